@@ -1,44 +1,63 @@
-import time, os, sys, zmq
+import time, os, sys, zmq, json, uuid
 
 NITRO_REQUEST_HELP = 0x0600C065
 NITRO_AFFIRM_HELP = 0x0600C066
 NITRO_HERE_IS_ASSIGNMENT = 0x0600C064
-NITRO_TERMINATE_REQUEST = 0x0600C06C
+NITRO_1ASSIGNMENT_COMPLETE = 0x0600C06A
+NITRO_ACCEPT_ASSIGNMENT = 0x0600C070
+NITRO_TERMINATE_REQUEST = 0x0600C06D
+NITRO_NEED_ASSIGNMENT = 0x0600C068
+SLOTS = 8
+
+TOPIC = "domain.nitro.coordinate"
+
+def msg(code, text=None):
+  body = {"code": "0x%08X" % code}
+  if text is not None:
+    body["message"] = text
+  return json.dumps({"body": body})
 
 def main():
+  host = sys.argv[1] if len(sys.argv) > 1 else "localhost"
   context = zmq.Context()
-  socket = context.socket(zmq.REP)
-  socket.bind("tcp://*:36000")
-  print("Listening on port 36000...");
-  start_time = None
-  end_time = None
+  subscriber = context.socket(zmq.SUB)
+  subscriber.setsockopt(zmq.SUBSCRIBE, TOPIC)
+  subscriber.connect("tcp://%s:47001" % host)
+  dealer = context.socket(zmq.DEALER)
+  dealer.setsockopt(zmq.IDENTITY, str(uuid.uuid4()))
+  dealer.connect("tcp://%s:47002" % host)
+  print("Waiting for coordinator on %s..." % host)
+
+  # Wait until the coordinator asks for help, then answer on the dispatch
+  # channel.
+  while True:
+    root = json.loads(subscriber.recv()[len(TOPIC):])
+    if eval(root["body"]["code"]) == NITRO_REQUEST_HELP:
+      break
+  print("\nGot enroll request. Responded with AFFIRM. Here we go...\n")
+  dealer.send(msg(NITRO_AFFIRM_HELP))
+  # The coordinator only sends work when asked.
+  dealer.send(msg(NITRO_NEED_ASSIGNMENT, str(SLOTS)))
+  start_time = os.times()[4]
   assignment_count = 0
-  while not end_time:
-    msg = socket.recv()
-    i = msg.find('0x')
-    j = msg.find('"', i)
-    code = eval(msg[i:j])
-    if code == NITRO_REQUEST_HELP:
-       print("\nGot enroll request. Responded with AFFIRM. Here we go...\n")
-       socket.send('{"body":{"code":"0x%08X"}}' % NITRO_AFFIRM_HELP)
-       start_time = os.times()[4]
-    elif code == NITRO_HERE_IS_ASSIGNMENT:
-       i = msg.find('"fake')
-       j = msg.find('"', i + 1)
-       cmdline = msg[i+1:j]
-       assignment_count += 1
-       if (assignment_count % 80 == 0) or (assignment_count == 1000):
-         print("\nGot assignment: %s" % cmdline)
-       else:
-         sys.stdout.write('.')
-       socket.send("ACK")
+  task_count = 0
+  while True:
+    root = json.loads(dealer.recv())
+    code = eval(root["body"]["code"])
+    if code == NITRO_HERE_IS_ASSIGNMENT:
+      asgn = root["body"]["assignment"]
+      assignment_count += 1
+      task_count += len(asgn["tasks"])
+      sys.stdout.write('.')
+      dealer.send(msg(NITRO_ACCEPT_ASSIGNMENT, asgn["id"]))
+      dealer.send(msg(NITRO_1ASSIGNMENT_COMPLETE, asgn["id"]))
+      dealer.send(msg(NITRO_NEED_ASSIGNMENT, str(SLOTS)))
     elif code == NITRO_TERMINATE_REQUEST:
-       end_time = os.times()[4]
-       print("\nBatch ended. %d launch requests. Elapsed time: %.2f secs.\n" % (assignment_count, end_time - start_time))
-       socket.send("ACK")
+      end_time = os.times()[4]
+      print("\nBatch ended. %d assignments, %d tasks. Elapsed time: %.2f secs.\n" % (assignment_count, task_count, end_time - start_time))
+      break
     else:
-      print(msg)
-      socket.send("ACK")
+      print(root)
 
 if __name__ == '__main__':
   main()
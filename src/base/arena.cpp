@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "base/arena.h"
+
+struct arena::data_t {
+	struct chunk_t {
+		std::unique_ptr<char[]> mem;
+		size_t size;
+	};
+	std::vector<chunk_t> chunks;
+	size_t chunk_size;
+	// Where the next allocation can start, and where the current chunk ends.
+	char * next;
+	char * end;
+
+	data_t(size_t chunk_size) : chunk_size(chunk_size), next(0), end(0) {
+	}
+
+	void add_chunk(size_t size) {
+		chunk_t c;
+		c.mem.reset(new char[size]);
+		c.size = size;
+		next = c.mem.get();
+		end = next + size;
+		chunks.push_back(std::move(c));
+	}
+
+	char * align(size_t alignment) const {
+		auto n = reinterpret_cast<uintptr_t>(next);
+		n = (n + alignment - 1) & ~(alignment - 1);
+		return reinterpret_cast<char *>(n);
+	}
+};
+
+arena::arena(size_t chunk_size) : data(new data_t(chunk_size)) {
+}
+
+arena::~arena() {
+	delete data;
+}
+
+void arena::reserve(size_t bytes) {
+	if (data->next && static_cast<size_t>(data->end - data->next) >= bytes) {
+		return;
+	}
+	data->add_chunk(bytes);
+}
+
+void * arena::allocate(size_t bytes, size_t alignment) {
+	char * p = data->next ? data->align(alignment) : nullptr;
+	if (!p || p + bytes > data->end) {
+		data->add_chunk(std::max(data->chunk_size, bytes + alignment));
+		p = data->align(alignment);
+	}
+	data->next = p + bytes;
+	return p;
+}
+
+char * arena::copy(char const * begin, char const * end) {
+	size_t len = end - begin;
+	auto p = static_cast<char *>(allocate(len + 1, 1));
+	memcpy(p, begin, len);
+	p[len] = 0;
+	return p;
+}
+
+bool arena::owns(void const * p) const {
+	auto c = static_cast<char const *>(p);
+	for (auto & chunk : data->chunks) {
+		if (c >= chunk.mem.get() && c < chunk.mem.get() + chunk.size) {
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t arena::get_chunk_count() const {
+	return data->chunks.size();
+}
@@ -0,0 +1,56 @@
+#ifndef _BASE_ARENA_H_
+#define _BASE_ARENA_H_
+
+#include <stddef.h>
+
+/**
+ * A bump allocator for lots of small objects that all die together.
+ *
+ * Memory comes from a short list of large chunks; nothing is freed until the
+ * arena itself is destroyed. Destructors of objects placed in an arena are
+ * not called automatically; whoever placement-news an object here must also
+ * destroy it.
+ *
+ * @note This class is NOT threadsafe.
+ */
+class arena {
+	struct data_t;
+	data_t * data;
+
+public:
+	/**
+	 * @param chunk_size
+	 *     How much to allocate at a time, when nothing has been reserved.
+	 *     Requests bigger than this get a chunk of their own.
+	 */
+	arena(size_t chunk_size = 16 * 1024);
+	virtual ~arena();
+
+	/**
+	 * Guarantee that the next @param bytes of allocations come from a single
+	 * chunk, allocating it now if necessary. Callers that know how much they
+	 * need (including any padding for alignment) can use this to avoid all
+	 * but one allocation.
+	 */
+	void reserve(size_t bytes);
+
+	void * allocate(size_t bytes, size_t alignment = alignof(long double));
+
+	/**
+	 * Copy the text between @param begin and @param end into the arena, and
+	 * null-terminate it.
+	 */
+	char * copy(char const * begin, char const * end);
+
+	/**
+	 * Does @param p point into memory that this arena handed out?
+	 */
+	bool owns(void const * p) const;
+
+	/**
+	 * How many chunks have we allocated? Primarily for testing.
+	 */
+	size_t get_chunk_count() const;
+};
+
+#endif // sentry
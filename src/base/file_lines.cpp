@@ -1,16 +1,25 @@
 #include <algorithm>
 #include <cstdint>
 #include <stdexcept>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using std::min;
 using std::max;
 
 #include "base/interp.h"
 #include "base/error.h"
 #include "base/event_codes.h"
+#include "base/dbc.h"
 #include "base/file_lines.h"
+#include "base/line_index.h"
+#include "base/line_scan.h"
 
 using namespace base::event_codes;
 
@@ -41,6 +50,14 @@ const size_t MIN_GULP_SIZE = 64 * 1024;
 // having to use massive amounts of RAM and do lots of I/O.
 const size_t TESTING_GULP_SIZE = 40;
 
+/**
+ * In mmap mode, how much of the file do we map at once? Batch files can be
+ * tens of GB; mapping them whole would work on 64-bit, but would tie up
+ * address space (and page tables) we may want for other batches. Since the
+ * kernel reads ahead for us, bigger windows don't buy much.
+ */
+const size_t MAX_MAP_WINDOW = 256 * 1024 * 1024;
+
 static char * last_line_break(char * p, char const * begin);
 static bool data_seems_binary(char const * begin, char const * end);
 
@@ -59,10 +76,31 @@ struct file_lines::data_t {
 	size_t buf_filled_count;
 	size_t gulp_count;
 	size_t line_num;
+	// The length of the line the buffered next() last returned, so
+	// next(size_t &) needn't take its strlen.
+	size_t line_length;
 	bool ltrim;
 	bool rtrim;
 
-	data_t(char const * _fname, bool ltrim, bool rtrim, size_t gulp_size) :
+	// State for mmap mode. The window covers [map_offset, map_offset +
+	// map_len) in the file; pos is the file offset of the next unread byte.
+	int fd;
+	char const * map_base;
+	uint64_t map_offset;
+	size_t map_len;
+	size_t window_size;
+	uint64_t pos;
+	// Where set_range() told us to stop (or flen), and what range of lines
+	// that is.
+	uint64_t limit;
+	size_t first_line;
+	size_t range_line_count;
+	// next() promises null-terminated lines, which we can't write into a
+	// read-only mapping; so in mmap mode, next() copies here.
+	std::string line_copy;
+
+	data_t(char const * _fname, bool ltrim, bool rtrim, size_t gulp_size,
+			bool map_file) :
 		fname(_fname), f(NULL),	flen(0), foffset(0),
 		gulp_size(gulp_size ?
 				(gulp_size == TESTING_GULP_SIZE ?
@@ -70,8 +108,14 @@ struct file_lines::data_t {
 						max(MIN_GULP_SIZE, min(MAX_GULP_SIZE, gulp_size))) :
 				MAX_GULP_SIZE),
 		buf(NULL), buf_offset(0), buf_filled_count(0), gulp_count(0),
-		line_num(0), ltrim(ltrim), rtrim(rtrim) {
+		line_num(0), line_length(0), ltrim(ltrim), rtrim(rtrim), fd(-1), map_base(NULL),
+		map_offset(0), map_len(0), window_size(0), pos(0), limit(0),
+		first_line(0), range_line_count(0) {
 
+		if (map_file) {
+			open_mapped(gulp_size);
+			return;
+		}
 		f = fopen(_fname, "r");
 		if (f) {
 			fseek(f, 0, SEEK_END);
@@ -101,6 +145,118 @@ struct file_lines::data_t {
 			delete[] buf;
 			buf = NULL;
 		}
+		unmap();
+		if (fd != -1) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	bool is_mapped() const {
+		return fd != -1;
+	}
+
+	void open_mapped(size_t requested_window) {
+		fd = open(fname.c_str(), O_RDONLY);
+		if (fd == -1) {
+			throw ERROR_EVENT(E_INPUT_FILE_1PATH_UNREADABLE, fname);
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			cleanup();
+			throw ERROR_EVENT(E_INPUT_FILE_1PATH_EMPTY, fname);
+		}
+		flen = st.st_size;
+		limit = flen;
+		// Windows have to start on a page boundary, and must be able to hold
+		// a line that starts anywhere in their first page.
+		size_t page = sysconf(_SC_PAGESIZE);
+		window_size = requested_window ? requested_window : MAX_MAP_WINDOW;
+		window_size = min(MAX_MAP_WINDOW, max(2 * page, window_size));
+		window_size -= window_size % page;
+		map_window(0);
+		if (data_seems_binary(map_base, map_base + min(static_cast<uint64_t>(
+				map_len), static_cast<uint64_t>(100)))) {
+			cleanup();
+			throw ERROR_EVENT(E_1FILE_BAD_SEEMS_BINARY, fname);
+		}
+	}
+
+	void unmap() {
+		if (map_base) {
+			munmap(const_cast<char *>(map_base), map_len);
+			map_base = NULL;
+			map_len = 0;
+		}
+	}
+
+	/**
+	 * Map the window that starts on the page containing file offset
+	 * @param offset.
+	 */
+	void map_window(uint64_t offset) {
+		unmap();
+		size_t page = sysconf(_SC_PAGESIZE);
+		map_offset = offset - (offset % page);
+		map_len = static_cast<size_t>(min(static_cast<uint64_t>(window_size),
+				flen - map_offset));
+		void * p = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_offset);
+		if (p == MAP_FAILED) {
+			int err = errno;
+			cleanup();
+			throw ERROR_EVENT(err);
+		}
+		madvise(p, map_len, MADV_SEQUENTIAL);
+		map_base = static_cast<char const *>(p);
+	}
+
+	/**
+	 * mmap-mode implementation of next(size_t &).
+	 */
+	char const * next_mapped(size_t & length) {
+		while (pos < limit) {
+			char const * window_end = map_base + map_len;
+			char const * start = map_base + (pos - map_offset);
+			char const * end = find_line_break(start, window_end);
+			bool at_eof = (map_offset + map_len == flen);
+			// We need to see the byte after a CR, to know whether it's part
+			// of a CR+LF.
+			if (!at_eof && (end == window_end || (*end == '\r'
+					&& end + 1 == window_end))) {
+				uint64_t page = sysconf(_SC_PAGESIZE);
+				if (pos - map_offset < page) {
+					// Line started at the top of the window, and still
+					// didn't fit.
+					uint64_t bytes = end - start;
+					cleanup();
+					throw ERROR_EVENT(E_1FILE_BAD_HUGE_LINE_2BYTES, fname,
+							bytes);
+				}
+				map_window(pos);
+				continue;
+			}
+			auto next_pos = pos + (end - start);
+			if (end < window_end) {
+				next_pos += (*end == '\r' && end + 1 < window_end
+						&& end[1] == '\n') ? 2 : 1;
+			}
+			pos = next_pos;
+			if (rtrim) {
+				end = skip_space_backward(start, end);
+			}
+			if (ltrim) {
+				start = skip_space(start, end);
+			}
+			++line_num;
+			length = end - start;
+			return start;
+		}
+		// The end of a range isn't the end of the file; the next range may
+		// well be in this window.
+		if (limit == flen) {
+			unmap();
+		}
+		return NULL;
 	}
 
 	/**
@@ -212,34 +368,42 @@ inline char * start_of_next_line(char * buf) {
 	}
 }
 
-inline void rtrim_line(const char * start, char * end) {
+inline char * rtrim_line(char * start, char * end) {
 	// end points to null terminator or to line break char when we enter.
-	// When we finish, we want it to point to a place where we can write
-	// a null byte.
-	do {
-		--end;
-	} while (end >= start && isspace(*end));
-	// It's possible for end to be before start when we get here, if end
-	// equaled start at the top of our loop. But underflow is harmless
-	// because we're going to write one byte *after* end. That's guaranteed
-	// to be a safe place--either because it was the original terminating
-	// null, a line break char, or a trailing whitespace char that we can
-	// clobber.
-	*++end = 0;
+	// When we finish, it points to the null we've written after the last
+	// non-whitespace char.
+	end = const_cast<char *>(skip_space_backward(start, end));
+	*end = 0;
+	return end;
 }
 
 size_t file_lines::get_current_line_num() const {
 	return data->line_num;
 }
 
-inline char * ltrim(char * txt) {
-	while (isspace(*txt)) {
-		++txt;
+inline char * ltrim(char * txt, char const * end) {
+	return const_cast<char *>(skip_space(txt, end));
+}
+
+char const * file_lines::next(size_t & length) {
+	if (data->is_mapped()) {
+		return data->next_mapped(length);
 	}
-	return txt;
+	auto line = next();
+	length = line ? data->line_length : 0;
+	return line;
 }
 
 char const * file_lines::next() {
+	if (data->is_mapped()) {
+		size_t length;
+		auto line = data->next_mapped(length);
+		if (!line) {
+			return NULL;
+		}
+		data->line_copy.assign(line, length);
+		return data->line_copy.c_str();
+	}
 	if (data->buf) {
 
 		auto end_of_current_gulp = data->buf + data->buf_filled_count;
@@ -252,10 +416,9 @@ char const * file_lines::next() {
 
 		while (true) {
 			if (start && start < end_of_current_gulp) {
-				auto end = strpbrk(start, "\n\r");
-				if (end == NULL) {
-					end = strchr(start, 0);
-				}
+				// Our gulp is null-terminated, so this always finds something.
+				auto end = const_cast<char *>(find_line_break(start,
+						end_of_current_gulp));
 
 				// Handle windows-style CR+LF.
 				auto double_break = false;
@@ -270,18 +433,18 @@ char const * file_lines::next() {
 				// because it's necessary, but because it's more efficient than
 				// trimming after we return the string.
 				*end = 0;
+				auto end_of_line = double_break ? end - 1 : end;
 				if (data->rtrim) {
-					rtrim_line(start, end);
+					end_of_line = rtrim_line(start, end_of_line);
 				} else {
-					if (double_break) {
-						end[-1] = 0;
-					}
+					*end_of_line = 0;
 				}
 				if (data->ltrim) {
-					start = ltrim(start);
+					start = ltrim(start, end_of_line);
 				}
 
 				data->buf_offset = end - data->buf;
+				data->line_length = end_of_line - start;
 				++data->line_num;
 				return start;
 
@@ -298,6 +461,13 @@ char const * file_lines::next() {
 }
 
 double file_lines::ratio_complete() const {
+	if (data->range_line_count) {
+		return (data->line_num + 1 - data->first_line) /
+				static_cast<double>(data->range_line_count);
+	}
+	if (data->is_mapped()) {
+		return data->pos / static_cast<double>(data->flen);
+	}
 	if (data->flen == 0 || data->buf == NULL) {
 		return 1.0;
 	}
@@ -305,10 +475,37 @@ double file_lines::ratio_complete() const {
 			static_cast<double>(data->flen);
 }
 
+uint64_t file_lines::get_offset() const {
+	return data->pos;
+}
+
+void file_lines::set_range(line_index const & idx, size_t first_line,
+		size_t last_line) {
+	PRECONDITION(data->is_mapped());
+	PRECONDITION(idx.get_file_size() == data->flen);
+	PRECONDITION(first_line >= 1 && first_line <= last_line + 1
+			&& last_line <= idx.get_line_count());
+	// A range that picks up where we left off needs no lookup; we're
+	// already just past the line before it.
+	if (first_line != data->line_num + 1) {
+		data->pos = idx.get_offset(first_line);
+	}
+	data->limit = idx.get_offset(last_line + 1);
+	data->line_num = first_line - 1;
+	data->first_line = first_line;
+	data->range_line_count = last_line + 1 - first_line;
+	if (data->pos < data->map_offset
+			|| data->pos >= data->map_offset + data->map_len) {
+		if (data->pos < data->limit) {
+			data->map_window(data->pos);
+		}
+	}
+}
+
 file_lines::file_lines(char const * fname, bool ltrim, bool rtrim,
-		size_t gulp_size) : data(0) {
+		size_t gulp_size, bool map_file) : data(0) {
 	if (fname && *fname) {
-		data = new data_t(fname, ltrim, rtrim, gulp_size);
+		data = new data_t(fname, ltrim, rtrim, gulp_size, map_file);
 	} else {
 		throw ERROR_EVENT(E_BAD_FNAME_NULL_OR_EMPTY);
 	}
@@ -319,26 +516,14 @@ file_lines::~file_lines() {
 }
 
 bool data_seems_binary(char const * begin, char const * end) {
-	for (char const * p = begin; p < end; ++p) {
-		char c = *p;
-		if (c == 127) return true;
-		if (c < ' ') {
-			if (c != '\t' && c != '\n' && c != '\r') {
-				return true;
-			}
-		}
-	}
-	return false;
+	return has_binary_bytes(begin, end);
 }
 
+/**
+ * Search backward from @param p, inclusive, for a line break. Returns begin if
+ * none is found after it.
+ */
 char * last_line_break(char * p, char const * begin) {
-	do {
-		char c = *p;
-		if ((c == '\n') || (c == '\r')) {
-			return p;
-		}
-	} while (--p > begin);
-	return p;
+	auto found = find_last_line_break(begin + 1, p + 1);
+	return found ? const_cast<char *>(found) : const_cast<char *>(begin);
 }
-
-
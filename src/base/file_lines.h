@@ -1,8 +1,11 @@
 #ifndef _BASE_FILE_LINES_H_
 #define _BASE_FILE_LINES_H_
 
+#include <cstdint>
 #include <stddef.h>
 
+class line_index;
+
 /**
  * Iterate over all lines in a text file in a way that's transparent to
  * file buffering issues.
@@ -41,10 +44,14 @@ public:
 	 *     will be adjusted to something reasonable. Ordinary callers should
 	 *     ignore. Note that gulp_size is also the maximum size of an
 	 *     individual line; lines that exceed gulp_size will trigger an
-	 *     exception.
+	 *     exception. In mmap mode, this is the size of the window we map.
+	 * @param map_file
+	 *     Instead of reading the file into a buffer, mmap it (in sliding
+	 *     windows, for large files). Lines returned by next(size_t &) then
+	 *     point straight into the mapping, and nothing is copied.
 	 */
 	file_lines(char const * fname, bool ltrim=false, bool rtrim=false,
-			size_t gulp_size=0);
+			size_t gulp_size=0, bool map_file=false);
 
 	virtual ~file_lines();
 
@@ -65,6 +72,14 @@ public:
 	 */
 	char const * next();
 
+	/**
+	 * Like next(), but the line is NOT necessarily null-terminated; its
+	 * length is returned in @param length. In mmap mode, this is the
+	 * zero-copy way to read a file. The line remains valid until the next
+	 * call to either flavor of next().
+	 */
+	char const * next(size_t & length);
+
 	/**
 	 * Return the 1-based line number that was most recently returned. Before
 	 * any lines have been read, returns 0. After file has been exhausted,
@@ -74,8 +89,28 @@ public:
 
 	/**
 	 * How much of the file have we consumed? Ratio is in the range [0..1].
+	 * After set_range(), this is exact in lines; otherwise it's measured in
+	 * bytes.
 	 */
 	double ratio_complete() const;
+
+	/**
+	 * In mmap mode, the file offset of the next unread byte -- just past the
+	 * line break of the line most recently returned. Primarily for building
+	 * a line_index.
+	 */
+	uint64_t get_offset() const;
+
+	/**
+	 * Read only lines [@param first_line, @param last_line] (1-based,
+	 * inclusive), jumping straight to the first one. This is how we resume a
+	 * batch partway through, or let several threads read one file in
+	 * parallel. Requires mmap mode. Ranges that fall within the part of the
+	 * file we have mapped (in particular, a range that begins where the last
+	 * one ended) are read without remapping.
+	 */
+	void set_range(line_index const & idx, size_t first_line,
+			size_t last_line);
 };
 
 #endif // sentry
@@ -1,41 +1,83 @@
-#include <mutex>
-#include <time.h>
+#include <random>
 #include <string.h>
-#include <stdlib.h>
+#include <ctype.h>
 
 #include "base/guid.h"
 #include "base/dbc.h"
 
+namespace {
+
 /**
- * Depending on the value of RAND_MAX, rand_r may generate 16- or 32-bit
- * numbers. Normalize to something we can count on.
+ * Each thread gets its own generator, seeded from the OS, so generating a
+ * guid is a couple of multiplies rather than a trip through a mutex.
  */
-inline uint16_t rand16(unsigned int * state) {
-	// TODO: convert to use std::mt19937 instead. It's faster, cleaner, and
-	// more random than rand_r.
-	return static_cast<uint16_t>(rand_r(state));
+std::mt19937_64 & get_thread_rng() {
+	thread_local std::mt19937_64 rng([] {
+		std::random_device rd;
+		std::seed_seq seq { rd(), rd(), rd(), rd() };
+		return std::mt19937_64(seq);
+	}());
+	return rng;
 }
 
-void generate_guid(char * buf, size_t buflen) {
+char const HEX_DIGITS[] = "0123456789abcdef";
+
+inline int hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c = static_cast<char>(tolower(c));
+	return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+} // end anonymous namespace
+
+guid_t generate_binary_guid() {
+	auto & rng = get_thread_rng();
+	uint64_t halves[2] = { rng(), rng() };
+	guid_t g;
+	memcpy(g.bytes, halves, sizeof(g.bytes));
+	// Version 4 (random) in the high nibble of byte 6, and the RFC 4122
+	// variant (10xx) in the high bits of byte 8.
+	g.bytes[6] = (g.bytes[6] & 0x0f) | 0x40;
+	g.bytes[8] = (g.bytes[8] & 0x3f) | 0x80;
+	return g;
+}
+
+void guid_t::format(char * buf, size_t buflen) const {
 	PRECONDITION(buflen >= GUID_BUF_LEN);
-	static std::mutex my_mutex;
-	std::lock_guard<std::mutex> lock(my_mutex);
-	static unsigned int state = 0;
-	if (state == 0) {
-		state = time(0);
+	auto p = buf;
+	for (unsigned i = 0; i < sizeof(bytes); ++i) {
+		if (i == 4 || i == 6 || i == 8 || i == 10) {
+			*p++ = '-';
+		}
+		*p++ = HEX_DIGITS[bytes[i] >> 4];
+		*p++ = HEX_DIGITS[bytes[i] & 0x0f];
 	}
-	sprintf(buf, "%04x%04x-%04x-%04x-%04x-%04x%04x%04x",
-		    rand16(&state), rand16(&state),        // Generates a 32-bit Hex number
-		    rand16(&state),                       // Generates a 16-bit Hex number
-		    ((rand16(&state) & 0x0fff) | 0x4000), // Generates a 16-bit Hex number of the form 4xxx (4 indicates the UUID version)
-		    rand16(&state) % 0x3fff + 0x8000,     // Generates a 16-bit Hex number in the range [0x8000, 0xbfff]
-		    rand16(&state), rand16(&state), rand16(&state));
+	*p = 0;
 }
 
-std::string generate_guid() {
+std::string guid_t::str() const {
 	char buf[GUID_BUF_LEN];
-	generate_guid(buf, sizeof(buf));
-	return buf;
+	format(buf, sizeof(buf));
+	return std::string(buf, GUID_BUF_LEN - 1);
+}
+
+bool guid_t::operator ==(guid_t const & other) const {
+	return memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+}
+
+bool guid_t::operator <(guid_t const & other) const {
+	return memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+}
+
+void generate_guid(char * buf, size_t buflen) {
+	PRECONDITION(buflen >= GUID_BUF_LEN);
+	generate_binary_guid().format(buf, buflen);
+}
+
+std::string generate_guid() {
+	return generate_binary_guid().str();
 }
 
 inline bool is_valid_guid_noise(char c) {
@@ -46,9 +88,42 @@ inline bool is_valid_guid_noise(char c) {
 // is irrelevant if we're comparing text as guids.
 const size_t MAX_COMPARE_COUNT = (GUID_BUF_LEN - 1) * 2;
 
+bool parse_guid(char const * txt, guid_t & into) {
+	if (!txt) {
+		return false;
+	}
+	unsigned nibbles = 0;
+	for (auto p = txt; *p && nibbles < sizeof(into.bytes) * 2; ++p) {
+		int n = hex_value(*p);
+		if (n < 0) {
+			if (!is_valid_guid_noise(*p)) {
+				return false;
+			}
+			continue;
+		}
+		if (nibbles % 2 == 0) {
+			into.bytes[nibbles / 2] = static_cast<uint8_t>(n << 4);
+		} else {
+			into.bytes[nibbles / 2] |= static_cast<uint8_t>(n);
+		}
+		++nibbles;
+	}
+	return nibbles == sizeof(into.bytes) * 2;
+}
+
+int compare_guids(guid_t const & a, guid_t const & b) {
+	int n = memcmp(a.bytes, b.bytes, sizeof(a.bytes));
+	return n < 0 ? -1 : (n > 0 ? 1 : 0);
+}
+
 int compare_guids(char const * a, char const * b) {
 	if (a) {
 		if (b) {
+			// Usually we're matching a guid against one we formatted
+			// ourselves, so an exact match is worth checking first.
+			if (a == b || strcmp(a, b) == 0) {
+				return 0;
+			}
 			auto pa = a;
 			auto pb = b;
 			size_t char_cnt = 0;
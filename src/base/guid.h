@@ -2,6 +2,7 @@
 #define _BASE_GUID_H_
 
 #include <stddef.h> // for size_t
+#include <cstdint>
 #include <string>
 
 /**
@@ -13,6 +14,44 @@
 
 const size_t GUID_BUF_LEN = 37;
 
+/**
+ * A guid in its 16-byte binary form. This is what we generate, compare, and
+ * put on the wire; the 36-character text form is only produced when someone
+ * asks for it.
+ */
+struct guid_t {
+	uint8_t bytes[16];
+
+	/**
+	 * Write the text form to a buffer, with null termination.
+	 *
+	 * @param buflen Cannot be less than GUID_BUF_LEN.
+	 */
+	void format(char * buf, size_t buflen) const;
+	std::string str() const;
+
+	bool operator ==(guid_t const & other) const;
+	bool operator !=(guid_t const & other) const { return !(*this == other); }
+	bool operator <(guid_t const & other) const;
+};
+
+static_assert(sizeof(guid_t) == 16, "guid_t must be unpadded.");
+
+/**
+ * Generate an RFC 4122-compliant (version 4) guid in binary form.
+ *
+ * Each thread has its own generator, so this never blocks.
+ */
+guid_t generate_binary_guid();
+
+/**
+ * Parse the text form of a guid, tolerating case, punctuation and whitespace
+ * the same way compare_guids() does.
+ *
+ * @return false if @param txt doesn't hold 32 hex digits.
+ */
+bool parse_guid(char const * txt, guid_t & into);
+
 /**
  * Generate an RFC 4122-compliant guid and write it to a buffer, with null
  * termination.
@@ -37,5 +76,6 @@ std::string generate_guid();
  * is why this function is more than just strcmp.
  */
 int compare_guids(char const * a, char const * b);
+int compare_guids(guid_t const & a, guid_t const & b);
 
 #endif // sentry
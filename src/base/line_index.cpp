@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/dbc.h"
+#include "base/error.h"
+#include "base/event_codes.h"
+#include "base/file_lines.h"
+#include "base/line_index.h"
+#include "base/xlog.h"
+
+using std::string;
+using std::vector;
+
+using namespace base::event_codes;
+
+/**
+ * How many lines between absolute offsets? This bounds the work of a lookup,
+ * and costs 16 bytes per stride in the sidecar.
+ */
+const uint32_t CHECKPOINT_STRIDE = 256;
+
+const uint32_t SIDECAR_VERSION = 1;
+
+namespace {
+
+/**
+ * The sidecar is this header, then header.line_count / stride + 1
+ * checkpoints, then header.delta_bytes of varint line lengths. Everything is
+ * in host byte order; an index is only ever read where it was written.
+ */
+struct header_t {
+	char magic[4];
+	uint32_t version;
+	uint64_t file_size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t line_count;
+	uint64_t delta_bytes;
+	uint32_t stride;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(header_t) == 56, "header_t must be unpadded.");
+
+char const SIDECAR_MAGIC[4] = { 'N', 'L', 'I', 'X' };
+
+struct checkpoint_t {
+	// File offset of line (n * stride) + 1...
+	uint64_t offset;
+	// ...and where its length is in the delta array.
+	uint64_t delta_pos;
+};
+
+inline void append_varint(vector<uint8_t> & out, uint64_t n) {
+	while (n >= 0x80) {
+		out.push_back(static_cast<uint8_t>(n) | 0x80);
+		n >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(n));
+}
+
+inline uint64_t read_varint(uint8_t const * & p) {
+	uint64_t n = 0;
+	for (int shift = 0; ; shift += 7) {
+		uint8_t b = *p++;
+		n |= static_cast<uint64_t>(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return n;
+		}
+	}
+}
+
+} // end anonymous namespace
+
+struct line_index::data_t {
+	header_t header;
+	// Either we built the index, and these own it...
+	vector<checkpoint_t> owned_checkpoints;
+	vector<uint8_t> owned_deltas;
+	// ...or we mapped a sidecar, and these describe the mapping.
+	void * map_base;
+	size_t map_len;
+	// Whichever is true, these are what we search.
+	checkpoint_t const * checkpoints;
+	uint8_t const * deltas;
+
+	data_t() : map_base(NULL), map_len(0), checkpoints(NULL), deltas(NULL) {
+		memset(&header, 0, sizeof(header));
+	}
+
+	~data_t() {
+		if (map_base) {
+			munmap(map_base, map_len);
+		}
+	}
+
+	size_t get_checkpoint_count() const {
+		return header.line_count / header.stride + 1;
+	}
+
+	bool load(string const & sidecar, header_t const & expected) {
+		int fd = open(sidecar.c_str(), O_RDONLY);
+		if (fd == -1) {
+			return false;
+		}
+		struct stat st;
+		bool ok = fstat(fd, &st) == 0
+				&& static_cast<size_t>(st.st_size) >= sizeof(header_t);
+		if (ok) {
+			map_len = st.st_size;
+			map_base = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map_base == MAP_FAILED) {
+				map_base = NULL;
+				ok = false;
+			}
+		}
+		close(fd);
+		if (!ok) {
+			return false;
+		}
+		memcpy(&header, map_base, sizeof(header));
+		ok = memcmp(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) == 0
+				&& header.version == SIDECAR_VERSION
+				&& header.file_size == expected.file_size
+				&& header.mtime_sec == expected.mtime_sec
+				&& header.mtime_nsec == expected.mtime_nsec
+				&& header.stride > 0
+				&& map_len == sizeof(header) + header.delta_bytes
+						+ get_checkpoint_count() * sizeof(checkpoint_t);
+		if (!ok) {
+			munmap(map_base, map_len);
+			map_base = NULL;
+			return false;
+		}
+		auto p = static_cast<char const *>(map_base) + sizeof(header);
+		checkpoints = reinterpret_cast<checkpoint_t const *>(p);
+		deltas = reinterpret_cast<uint8_t const *>(
+				p + get_checkpoint_count() * sizeof(checkpoint_t));
+		madvise(map_base, map_len, MADV_RANDOM);
+		return true;
+	}
+
+	void build(char const * fname, line_visitor const & visit) {
+		header.stride = CHECKPOINT_STRIDE;
+		file_lines fl(fname, false, false, 0, true);
+		uint64_t line_start = 0;
+		size_t len;
+		while (auto line = fl.next(len)) {
+			if (header.line_count % header.stride == 0) {
+				checkpoint_t cp = { line_start, owned_deltas.size() };
+				owned_checkpoints.push_back(cp);
+			}
+			++header.line_count;
+			if (visit) {
+				visit(header.line_count, line, len);
+			}
+			auto next_start = fl.get_offset();
+			append_varint(owned_deltas, next_start - line_start);
+			line_start = next_start;
+		}
+		// A final checkpoint, if needed, makes get_offset(line_count + 1)
+		// work like any other lookup.
+		if (header.line_count % header.stride == 0) {
+			checkpoint_t cp = { line_start, owned_deltas.size() };
+			owned_checkpoints.push_back(cp);
+		}
+		header.delta_bytes = owned_deltas.size();
+		checkpoints = &owned_checkpoints[0];
+		deltas = owned_deltas.empty() ? NULL : &owned_deltas[0];
+	}
+
+	void save(string const & sidecar) const {
+		auto tmp = sidecar + ".tmp";
+		FILE * f = fopen(tmp.c_str(), "w");
+		bool ok = f != NULL;
+		if (ok) {
+			ok = fwrite(&header, sizeof(header), 1, f) == 1
+					&& fwrite(checkpoints, sizeof(checkpoint_t),
+						get_checkpoint_count(), f) == get_checkpoint_count()
+					&& fwrite(deltas, 1, header.delta_bytes, f)
+						== header.delta_bytes;
+			ok = (fclose(f) == 0) && ok;
+			ok = ok && rename(tmp.c_str(), sidecar.c_str()) == 0;
+		}
+		if (!ok) {
+			int err = errno;
+			unlink(tmp.c_str());
+			xlog("Unable to save line index \"%1\": %2", sidecar,
+					ERROR_EVENT(err).what());
+		}
+	}
+};
+
+line_index::line_index(char const * fname, bool save_sidecar,
+		line_visitor const & visit) : data(new data_t) {
+	try {
+		if (!fname || !*fname) {
+			throw ERROR_EVENT(E_BAD_FNAME_NULL_OR_EMPTY);
+		}
+		struct stat st;
+		if (stat(fname, &st) != 0) {
+			throw ERROR_EVENT(E_INPUT_FILE_1PATH_UNREADABLE, fname);
+		}
+		header_t expected;
+		memset(&expected, 0, sizeof(expected));
+		memcpy(expected.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+		expected.version = SIDECAR_VERSION;
+		expected.file_size = st.st_size;
+		expected.mtime_sec = st.st_mtim.tv_sec;
+		expected.mtime_nsec = st.st_mtim.tv_nsec;
+
+		auto sidecar = get_sidecar_path(fname);
+		if (!data->load(sidecar, expected)) {
+			data->header = expected;
+			data->build(fname, visit);
+			if (save_sidecar) {
+				data->save(sidecar);
+			}
+		}
+	} catch (...) {
+		delete data;
+		throw;
+	}
+}
+
+line_index::~line_index() {
+	delete data;
+}
+
+string line_index::get_sidecar_path(char const * fname) {
+	return string(fname) + ".idx";
+}
+
+bool line_index::was_loaded() const {
+	return data->map_base != NULL;
+}
+
+size_t line_index::get_line_count() const {
+	return data->header.line_count;
+}
+
+uint64_t line_index::get_file_size() const {
+	return data->header.file_size;
+}
+
+uint64_t line_index::get_offset(size_t line_num) const {
+	PRECONDITION(line_num >= 1 && line_num <= get_line_count() + 1);
+	size_t n = line_num - 1;
+	auto & cp = data->checkpoints[n / data->header.stride];
+	uint64_t offset = cp.offset;
+	auto p = data->deltas + cp.delta_pos;
+	for (size_t i = n % data->header.stride; i > 0; --i) {
+		offset += read_varint(p);
+	}
+	return offset;
+}
+
+vector<line_index::range_t> line_index::split(unsigned count) const {
+	vector<range_t> ranges;
+	size_t lines = get_line_count();
+	count = std::max(1u, static_cast<unsigned>(
+			std::min<size_t>(count, lines)));
+	size_t first = 1;
+	for (unsigned i = 0; i < count && first <= lines; ++i) {
+		// Spread the remainder over the first few ranges.
+		size_t n = lines / count + (i < lines % count ? 1 : 0);
+		ranges.push_back(range_t(first, first + n - 1));
+		first += n;
+	}
+	return ranges;
+}
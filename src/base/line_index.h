@@ -0,0 +1,81 @@
+#ifndef _BASE_LINE_INDEX_H_
+#define _BASE_LINE_INDEX_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Where does each line of a text file begin?
+ *
+ * Building an index takes one pass over the file; a caller that needs to
+ * look at every line anyway can do so during that pass, with a
+ * line_visitor, so the file is read only once. The result is saved in a
+ * sidecar file (batch.txt.idx, next to batch.txt), and later instances reuse
+ * it as long as the text file's size and mtime haven't changed. So a 40 GB
+ * batch is scanned once, and thereafter any line can be found without
+ * reading what comes before it.
+ *
+ * Line numbers are 1-based, and agree with file_lines::get_current_line_num():
+ * CR, LF, CR+LF, and null each end a line, and blank lines count.
+ *
+ * The sidecar stores each line's length as a varint (1 byte for lines shorter
+ * than 128 bytes), plus an absolute offset every few hundred lines; finding
+ * a line decodes at most one stride of lengths.
+ *
+ * @note Instances are immutable after construction, and thus threadsafe.
+ */
+class line_index {
+	struct data_t;
+	data_t * data;
+
+public:
+	typedef std::pair<size_t, size_t> range_t;
+
+	/**
+	 * Called with each line's 1-based number, text, and length.
+	 */
+	typedef std::function<void (size_t line_num, char const * line,
+			size_t length)> line_visitor;
+
+	/**
+	 * Load the index for @param fname from its sidecar, or build it (and try
+	 * to save the sidecar) if the sidecar is missing or stale. Failure to
+	 * save is logged but otherwise ignored; the index still works.
+	 *
+	 * If we build the index, we show each line to @param visit as we go. If
+	 * we load it (see was_loaded()), @param visit is never called.
+	 *
+	 * @throws error_event under the same conditions as file_lines.
+	 */
+	line_index(char const * fname, bool save_sidecar = true,
+			line_visitor const & visit = nullptr);
+	virtual ~line_index();
+
+	static std::string get_sidecar_path(char const * fname);
+
+	/**
+	 * Did we load from a sidecar (true), or scan the file (false)?
+	 */
+	bool was_loaded() const;
+
+	size_t get_line_count() const;
+	uint64_t get_file_size() const;
+
+	/**
+	 * @return the file offset where 1-based @param line_num begins. As a
+	 *     convenience, get_offset(get_line_count() + 1) is the file size.
+	 */
+	uint64_t get_offset(size_t line_num) const;
+
+	/**
+	 * Divide the file into at most @param count ranges of consecutive lines
+	 * (first, last; 1-based and inclusive) of nearly equal line count, so
+	 * separate threads can read them in parallel.
+	 */
+	std::vector<range_t> split(unsigned count) const;
+};
+
+#endif // sentry
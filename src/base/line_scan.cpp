@@ -0,0 +1,254 @@
+#if defined(__x86_64__) || defined(__i386__)
+#define LINE_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#include <string.h>
+
+#include "base/line_scan.h"
+
+// Scalar kernels. These define the semantics; the vector versions must agree
+// with them byte for byte. Note that char is signed here, so bytes with the
+// high bit set are "less than space" -- which is how file_lines has always
+// judged binary data.
+
+static inline bool is_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool is_binary(char c) {
+	return c == 127 || (c < ' ' && c != '\t' && c != '\n' && c != '\r');
+}
+
+// A byte loop is less than half as fast as libc, whose memchr is vectorized
+// for every CPU it runs on; so the scalar kernels that cover the whole line
+// are built on memchr. LF ends nearly every line, and CR and null are only
+// sought before it.
+
+static inline char const * find_byte(char const * p, char const * end,
+		char c) {
+	auto found = static_cast<char const *>(memchr(p, c, end - p));
+	return found ? found : end;
+}
+
+static char const * scalar_find_line_break(char const * p, char const * end) {
+	end = find_byte(p, end, '\n');
+	end = find_byte(p, end, '\r');
+	return find_byte(p, end, 0);
+}
+
+static char const * scalar_find_last_line_break(char const * begin,
+		char const * p) {
+	auto lf = static_cast<char const *>(memrchr(begin, '\n', p - begin));
+	auto after = lf ? lf + 1 : begin;
+	auto cr = static_cast<char const *>(memrchr(after, '\r', p - after));
+	return cr ? cr : lf;
+}
+
+static char const * scalar_skip_space(char const * p, char const * end) {
+	while (p < end && is_space(*p)) {
+		++p;
+	}
+	return p;
+}
+
+static char const * scalar_skip_space_backward(char const * begin,
+		char const * p) {
+	while (p > begin && is_space(p[-1])) {
+		--p;
+	}
+	return p;
+}
+
+static bool scalar_has_binary_bytes(char const * p, char const * end) {
+	for (; p < end; ++p) {
+		if (is_binary(*p)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef LINE_SCAN_X86
+
+// Each *_mask function returns one bit per byte of its vector, set where the
+// byte is of interest. The loops then only need ctz to find a position.
+
+static inline unsigned sse2_line_break_mask(__m128i v) {
+	auto m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	return _mm_movemask_epi8(m);
+}
+
+static inline unsigned sse2_binary_mask(__m128i v) {
+	auto ok = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+					_mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+	auto m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(127)),
+			_mm_andnot_si128(ok, _mm_cmplt_epi8(v, _mm_set1_epi8(' '))));
+	return _mm_movemask_epi8(m);
+}
+
+static inline __m128i sse2_load(char const * p) {
+	return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+}
+
+static char const * sse2_find_line_break(char const * p, char const * end) {
+	for (; end - p >= 16; p += 16) {
+		auto v = sse2_load(p);
+		unsigned m = sse2_line_break_mask(v)
+				| _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		if (m) {
+			return p + __builtin_ctz(m);
+		}
+	}
+	return scalar_find_line_break(p, end);
+}
+
+static bool sse2_has_binary_bytes(char const * p, char const * end) {
+	for (; end - p >= 16; p += 16) {
+		if (sse2_binary_mask(sse2_load(p))) {
+			return true;
+		}
+	}
+	return scalar_has_binary_bytes(p, end);
+}
+
+// The AVX2 kernels are compiled for AVX2 regardless of -march, so we can ship
+// one binary; they're only called after we've checked the CPU.
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline unsigned avx2_binary_mask(__m256i v) {
+	auto ok = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+					_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+	auto m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(127)),
+			_mm256_andnot_si256(ok,
+					_mm256_cmpgt_epi8(_mm256_set1_epi8(' '), v)));
+	return _mm256_movemask_epi8(m);
+}
+
+AVX2 static inline __m256i avx2_load(char const * p) {
+	return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+}
+
+AVX2 static bool avx2_has_binary_bytes(char const * p, char const * end) {
+	for (; end - p >= 32; p += 32) {
+		if (avx2_binary_mask(avx2_load(p))) {
+			return true;
+		}
+	}
+	return sse2_has_binary_bytes(p, end);
+}
+
+#undef AVX2
+
+#endif // LINE_SCAN_X86
+
+namespace {
+
+struct kernels_t {
+	scan_isa isa;
+	char const * (* find_line_break)(char const *, char const *);
+	char const * (* find_last_line_break)(char const *, char const *);
+	char const * (* skip_space)(char const *, char const *);
+	char const * (* skip_space_backward)(char const *, char const *);
+	bool (* has_binary_bytes)(char const *, char const *);
+};
+
+// Only the kernels that beat the scalar ones in line_scan_test's benchmark
+// have vector versions. For short lines, finding the break with SSE2 is faster
+// than three calls to memchr, but AVX2 is no faster again; trimming a few
+// spaces, or finding the one last break in a buffer, doesn't take long enough
+// for vectors to help.
+const kernels_t all_kernels[] = {
+	{ scan_scalar, scalar_find_line_break, scalar_find_last_line_break,
+			scalar_skip_space, scalar_skip_space_backward,
+			scalar_has_binary_bytes },
+#ifdef LINE_SCAN_X86
+	{ scan_sse2, sse2_find_line_break, scalar_find_last_line_break,
+			scalar_skip_space, scalar_skip_space_backward,
+			sse2_has_binary_bytes },
+	{ scan_avx2, sse2_find_line_break, scalar_find_last_line_break,
+			scalar_skip_space, scalar_skip_space_backward,
+			avx2_has_binary_bytes },
+#endif
+};
+
+bool cpu_supports(scan_isa isa) {
+	switch (isa) {
+	case scan_scalar:
+		return true;
+#ifdef LINE_SCAN_X86
+	case scan_sse2:
+		// Every x86_64 CPU has SSE2.
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	case scan_avx2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+kernels_t const * pick_best_kernels() {
+	for (int i = sizeof(all_kernels) / sizeof(all_kernels[0]) - 1; i > 0;
+			--i) {
+		if (cpu_supports(all_kernels[i].isa)) {
+			return &all_kernels[i];
+		}
+	}
+	return &all_kernels[0];
+}
+
+kernels_t const * & active_kernels() {
+	static kernels_t const * active = pick_best_kernels();
+	return active;
+}
+
+} // end anonymous namespace
+
+scan_isa get_scan_isa() {
+	return active_kernels()->isa;
+}
+
+bool set_scan_isa(scan_isa isa) {
+	for (auto & k : all_kernels) {
+		if (k.isa == isa && cpu_supports(isa)) {
+			active_kernels() = &k;
+			return true;
+		}
+	}
+	return false;
+}
+
+char const * get_scan_isa_name(scan_isa isa) {
+	switch (isa) {
+	case scan_scalar: return "scalar";
+	case scan_sse2: return "sse2";
+	case scan_avx2: return "avx2";
+	default: return "unknown";
+	}
+}
+
+char const * find_line_break(char const * begin, char const * end) {
+	return active_kernels()->find_line_break(begin, end);
+}
+
+char const * find_last_line_break(char const * begin, char const * end) {
+	return active_kernels()->find_last_line_break(begin, end);
+}
+
+char const * skip_space(char const * begin, char const * end) {
+	return active_kernels()->skip_space(begin, end);
+}
+
+char const * skip_space_backward(char const * begin, char const * end) {
+	return active_kernels()->skip_space_backward(begin, end);
+}
+
+bool has_binary_bytes(char const * begin, char const * end) {
+	return active_kernels()->has_binary_bytes(begin, end);
+}
@@ -0,0 +1,70 @@
+#ifndef _BASE_LINE_SCAN_H_
+#define _BASE_LINE_SCAN_H_
+
+#include <stddef.h>
+
+/**
+ * Byte-scanning primitives for splitting and trimming lines of text. These are
+ * the inner loops of file_lines, and on a multi-GB batch file they run over
+ * every byte; so they use libc's memchr, and on x86, where it's faster still,
+ * they examine 16 (SSE2) or 32 (AVX2) bytes at a time. The best
+ * implementation the CPU supports is chosen the first time any of them is
+ * called.
+ *
+ * All functions take a half-open range [begin, end), and never read outside
+ * it. Whitespace means what isspace() means in the C locale.
+ */
+
+enum scan_isa {
+	scan_scalar,
+	scan_sse2,
+	scan_avx2
+};
+
+/**
+ * Which implementation is in use?
+ */
+scan_isa get_scan_isa();
+
+/**
+ * Switch implementations. Primarily for testing and benchmarks; this is not
+ * threadsafe with respect to concurrent scanning.
+ *
+ * @return false (and change nothing) if the CPU can't run @param isa.
+ */
+bool set_scan_isa(scan_isa isa);
+
+char const * get_scan_isa_name(scan_isa isa);
+
+/**
+ * Find the first CR, LF, or null in a range.
+ *
+ * @return position of the break, or end if there is none.
+ */
+char const * find_line_break(char const * begin, char const * end);
+
+/**
+ * Find the last CR or LF in a range.
+ *
+ * @return position of the break, or NULL if there is none.
+ */
+char const * find_last_line_break(char const * begin, char const * end);
+
+/**
+ * @return first non-whitespace char in a range, or end.
+ */
+char const * skip_space(char const * begin, char const * end);
+
+/**
+ * @return the position just past the last non-whitespace char in a range, or
+ *     begin if the range is all whitespace.
+ */
+char const * skip_space_backward(char const * begin, char const * end);
+
+/**
+ * Does a range contain control chars other than tab, CR, and LF? Bytes with
+ * the high bit set count as binary, too.
+ */
+bool has_binary_bytes(char const * begin, char const * end);
+
+#endif // sentry
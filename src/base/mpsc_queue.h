@@ -0,0 +1,78 @@
+#ifndef _BASE_MPSC_QUEUE_H_
+#define _BASE_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+/**
+ * An unbounded queue that any number of threads can push to, and one thread
+ * pops from, without locks.
+ *
+ * A push is one allocation and one atomic exchange, so producers never wait
+ * on each other or on the consumer. Items are moved in and out; nothing is
+ * copied.
+ *
+ * This is the intrusive queue described by Dmitry Vyukov. A pop can briefly
+ * see the queue as empty while a push is half done (between its exchange
+ * and its link); the item shows up on a later pop.
+ *
+ * @note Only one thread may call pop() (or empty()) at a time.
+ */
+template <typename T>
+class mpsc_queue {
+	struct node_t {
+		std::atomic<node_t *> next;
+		T item;
+
+		node_t() : next(nullptr), item() {}
+		explicit node_t(T && item) : next(nullptr), item(std::move(item)) {}
+	};
+
+	// Producers swap themselves in at the head; the consumer follows next
+	// links from the tail, which is always a spent (or dummy) node.
+	std::atomic<node_t *> head;
+	node_t * tail;
+
+	mpsc_queue(mpsc_queue const &);
+	mpsc_queue & operator =(mpsc_queue const &);
+
+public:
+	mpsc_queue() : head(new node_t), tail(head.load()) {
+	}
+
+	~mpsc_queue() {
+		T discard;
+		while (pop(discard)) {
+		}
+		delete tail;
+	}
+
+	/**
+	 * Safe to call from any thread.
+	 */
+	void push(T && item) {
+		auto n = new node_t(std::move(item));
+		auto prev = head.exchange(n, std::memory_order_acq_rel);
+		prev->next.store(n, std::memory_order_release);
+	}
+
+	/**
+	 * @return false if there was nothing to pop.
+	 */
+	bool pop(T & into) {
+		auto next = tail->next.load(std::memory_order_acquire);
+		if (!next) {
+			return false;
+		}
+		into = std::move(next->item);
+		delete tail;
+		tail = next;
+		return true;
+	}
+
+	bool empty() const {
+		return tail->next.load(std::memory_order_acquire) == nullptr;
+	}
+};
+
+#endif // sentry
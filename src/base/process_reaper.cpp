@@ -0,0 +1,329 @@
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "base/error.h"
+#include "base/process_reaper.h"
+#include "base/xlog.h"
+
+using std::string;
+using std::vector;
+using std::mutex;
+using std::lock_guard;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+extern char ** environ;
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+/**
+ * When pidfds aren't available, how often do we check on children?
+ */
+const int POLL_INTERVAL_MILLIS = 5;
+
+/**
+ * If a cmdline contains any of these, it needs a shell to interpret it.
+ */
+static char const * const SHELL_CHARS = "|&;<>()$`\\\"'*?[#~\n";
+
+struct process_reaper::data_t {
+	struct child_t {
+		int pidfd;
+		steady_clock::time_point started;
+		exit_callback on_exit;
+	};
+	typedef std::map<pid_t, child_t> childmap_t;
+
+	int epoll_fd;
+	// Written to wake the reaper thread, when we're shutting down or when a
+	// child without a pidfd needs polling.
+	int wake_fd;
+	bool have_pidfds;
+	std::atomic<bool> stopping;
+	childmap_t children;
+	mutable mutex children_mutex;
+	std::thread reaper_thread;
+
+	data_t() :
+			epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+			wake_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), have_pidfds(true),
+			stopping(false) {
+		if (epoll_fd < 0 || wake_fd < 0) {
+			throw ERROR_EVENT(errno);
+		}
+		struct epoll_event ev = { EPOLLIN, { 0 } };
+		ev.data.u64 = 0;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+	}
+
+	~data_t() {
+		close(wake_fd);
+		close(epoll_fd);
+	}
+
+	void wake() {
+		uint64_t one = 1;
+		if (write(wake_fd, &one, sizeof(one)) < 0) {
+			xlog("Unable to wake process reaper: %1", ERROR_EVENT(errno).what());
+		}
+	}
+
+	/**
+	 * Try to reap a single child. If it has exited, report it and forget it.
+	 *
+	 * @return true if the child was reaped.
+	 */
+	bool try_reap(pid_t pid) {
+		int status = 0;
+		struct rusage usage;
+		pid_t rc = wait4(pid, &status, WNOHANG, &usage);
+		if (rc == 0 || (rc < 0 && errno == EINTR)) {
+			return false;
+		}
+		child_t child;
+		{
+			lock_guard<mutex> lock(children_mutex);
+			auto i = children.find(pid);
+			if (i == children.end()) {
+				return true;
+			}
+			child = i->second;
+			children.erase(i);
+		}
+		if (child.pidfd >= 0) {
+			// Closing the fd also removes it from our epoll set.
+			close(child.pidfd);
+		}
+		process_exit_info info;
+		info.pid = pid;
+		if (rc < 0) {
+			// Somebody else reaped our child (e.g., an errant waitpid(-1)).
+			// We know it's gone, but nothing more.
+			xlog("Lost exit status of child %1: %2", pid,
+					ERROR_EVENT(errno).what());
+			info.status = W_EXITCODE(127, 0);
+			memset(&usage, 0, sizeof(usage));
+		} else {
+			info.status = status;
+		}
+		info.usage = usage;
+		info.wall_seconds = duration<double>(
+				steady_clock::now() - child.started).count();
+		if (child.on_exit) {
+			child.on_exit(info);
+		}
+		return true;
+	}
+
+	/**
+	 * Reap any children that we can't watch with a pidfd.
+	 */
+	void poll_children() {
+		vector<pid_t> pids;
+		{
+			lock_guard<mutex> lock(children_mutex);
+			for (auto & c : children) {
+				if (c.second.pidfd < 0) {
+					pids.push_back(c.first);
+				}
+			}
+		}
+		for (auto pid : pids) {
+			try_reap(pid);
+		}
+	}
+
+	bool has_unwatched_children() const {
+		lock_guard<mutex> lock(children_mutex);
+		for (auto & c : children) {
+			if (c.second.pidfd < 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool is_idle() const {
+		lock_guard<mutex> lock(children_mutex);
+		return children.empty();
+	}
+};
+
+process_reaper::process_reaper() : data(new data_t) {
+	data->reaper_thread = std::thread(&process_reaper::reaper_thread_main,
+			this);
+}
+
+process_reaper::~process_reaper() {
+	data->stopping = true;
+	data->wake();
+	data->reaper_thread.join();
+	delete data;
+}
+
+void process_reaper::reaper_thread_main() {
+	const int MAX_EVENTS = 64;
+	struct epoll_event events[MAX_EVENTS];
+	while (!(data->stopping && data->is_idle())) {
+		int timeout = data->has_unwatched_children() ? POLL_INTERVAL_MILLIS
+				: -1;
+		int n = epoll_wait(data->epoll_fd, events, MAX_EVENTS, timeout);
+		if (n < 0) {
+			if (errno != EINTR) {
+				xlog("Process reaper can't wait: %1", ERROR_EVENT(errno).what());
+				std::this_thread::sleep_for(std::chrono::milliseconds(
+						POLL_INTERVAL_MILLIS));
+			}
+			continue;
+		}
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.u64 == 0) {
+				uint64_t ignored;
+				while (read(data->wake_fd, &ignored, sizeof(ignored)) > 0) {
+				}
+			} else {
+				data->try_reap(static_cast<pid_t>(events[i].data.u64));
+			}
+		}
+		data->poll_children();
+	}
+}
+
+/**
+ * Split a cmdline that has no shell syntax into argv-style words.
+ *
+ * @return false if the cmdline needs a shell after all.
+ */
+static bool split_simple_cmdline(char const * cmdline, vector<string> & words) {
+	if (strpbrk(cmdline, SHELL_CHARS)) {
+		return false;
+	}
+	for (auto p = cmdline; *p;) {
+		while (*p && isspace(*p)) {
+			++p;
+		}
+		auto end = p;
+		while (*end && !isspace(*end)) {
+			++end;
+		}
+		if (end > p) {
+			words.push_back(string(p, end));
+		}
+		p = end;
+	}
+	// A leading VAR=value is an assignment only a shell understands.
+	return !words.empty() && words[0].find('=') == string::npos;
+}
+
+pid_t process_reaper::spawn(char const * cmdline,
+		exit_callback const & on_exit) {
+
+	vector<string> words;
+	if (!split_simple_cmdline(cmdline, words)) {
+		words.clear();
+		words.push_back("/bin/sh");
+		words.push_back("-c");
+		words.push_back(cmdline);
+	}
+	vector<char *> argv;
+	for (auto & w : words) {
+		argv.push_back(const_cast<char *>(w.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+			O_WRONLY, 0);
+	// Each child leads a process group of its own, so signal() reaches
+	// whatever a shell started on its behalf.
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+
+	data_t::child_t child;
+	child.started = steady_clock::now();
+	child.on_exit = on_exit;
+	child.pidfd = -1;
+
+	pid_t pid;
+	int rc;
+	{
+		// Hold the lock across the spawn so the reaper can't see the child
+		// exit before we've recorded it.
+		lock_guard<mutex> lock(data->children_mutex);
+		rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(),
+				environ);
+		if (rc == 0) {
+			if (data->have_pidfds) {
+				child.pidfd = syscall(SYS_pidfd_open, pid, 0);
+				if (child.pidfd < 0) {
+					data->have_pidfds = false;
+					xlog("pidfd_open unavailable (%1); polling for child exits.",
+							ERROR_EVENT(errno).what());
+				}
+			}
+			if (child.pidfd >= 0) {
+				struct epoll_event ev = { EPOLLIN, { 0 } };
+				ev.data.u64 = static_cast<uint64_t>(pid);
+				epoll_ctl(data->epoll_fd, EPOLL_CTL_ADD, child.pidfd, &ev);
+			}
+			data->children[pid] = child;
+		}
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (rc) {
+		throw ERROR_EVENT(rc);
+	}
+	if (child.pidfd < 0) {
+		// The reaper may be blocked indefinitely; make it start polling.
+		data->wake();
+	}
+	return pid;
+}
+
+bool process_reaper::signal(pid_t pid, int sig) {
+	lock_guard<mutex> lock(data->children_mutex);
+	auto i = data->children.find(pid);
+	if (i == data->children.end()) {
+		return false;
+	}
+	// A child can be reaped just before we take it off our list, and its
+	// pid reused. Its pidfd can't be; the reaper closes that only after
+	// taking the child off the list, under this lock. So we make sure the
+	// child is still ours before we signal its process group (whose id is
+	// its pid).
+	if (i->second.pidfd >= 0 && syscall(SYS_pidfd_send_signal,
+			i->second.pidfd, 0, nullptr, 0) != 0) {
+		return false;
+	}
+	return kill(-pid, sig) == 0;
+}
+
+unsigned process_reaper::get_running_count() const {
+	lock_guard<mutex> lock(data->children_mutex);
+	return data->children.size();
+}
@@ -0,0 +1,81 @@
+#ifndef _BASE_PROCESS_REAPER_H_
+#define _BASE_PROCESS_REAPER_H_
+
+#include <functional>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/**
+ * What we learned about a child process when it exited.
+ */
+struct process_exit_info {
+	pid_t pid;
+	/** Raw status from wait4(); use WIFEXITED() and friends to decode. */
+	int status;
+	/** How long the child ran, measured from just before it was spawned. */
+	double wall_seconds;
+	/** CPU time, max RSS, etc., as reported by wait4(). */
+	struct rusage usage;
+};
+
+/**
+ * Start child processes and notice when they exit, without dedicating a
+ * thread to each one.
+ *
+ * Children are started with posix_spawn(). A single background thread
+ * watches all of them; on Linux 5.3 or later it waits for their pidfds in an
+ * epoll loop, and on older kernels it falls back to polling every few
+ * milliseconds. Either way, children are reaped with wait4(), so their exit
+ * status and resource usage are collected directly.
+ *
+ * @note This class is threadsafe. Exit callbacks run on the reaper's thread,
+ *     so they should be quick, and they must not destroy the reaper.
+ */
+class process_reaper {
+	struct data_t;
+	data_t * data;
+
+	void reaper_thread_main();
+
+public:
+	typedef std::function<void (process_exit_info const &)> exit_callback;
+
+	process_reaper();
+
+	/**
+	 * Blocks until every child we started has exited and been reported.
+	 */
+	virtual ~process_reaper();
+
+	/**
+	 * Run @param cmdline as a child process, and call @param on_exit once it
+	 * has been reaped. The child's stdout is discarded; stdin and stderr are
+	 * inherited.
+	 *
+	 * Simple command lines are exec'ed directly. A command line that uses
+	 * quoting, redirection, or other shell syntax is run by /bin/sh -c.
+	 * Either way, the child leads a new process group.
+	 *
+	 * @return the child's pid. Throws if the child can't be started.
+	 */
+	pid_t spawn(char const * cmdline, exit_callback const & on_exit);
+
+	/**
+	 * Send @param sig to a child we started, and to everything in its
+	 * process group (such as the commands a shell started for it), unless
+	 * the child has already been reaped (so its pid may belong to someone
+	 * else by now).
+	 *
+	 * @return false if @param pid isn't a child we're still waiting for.
+	 */
+	bool signal(pid_t pid, int sig = SIGTERM);
+
+	/**
+	 * How many children have we started that haven't been reported yet?
+	 */
+	unsigned get_running_count() const;
+};
+
+#endif // sentry
@@ -0,0 +1,160 @@
+#ifndef _BASE_TIMING_WHEEL_H_
+#define _BASE_TIMING_WHEEL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+/**
+ * Deadlines for many keys, where deadlines are mostly pushed back rather
+ * than reached -- like a failure detector, where every sign of life from a
+ * peer renews its lease.
+ *
+ * Keys are parked in a ring of slots, one slot per tick. Renewing a key's
+ * deadline doesn't move it; when the wheel reaches the slot it's parked in,
+ * a key whose deadline has passed expires, and any other key is parked
+ * again, in the slot for its current deadline. So a renewal costs a map
+ * update, and turning the wheel costs in proportion to the keys it passes,
+ * not to how many keys there are.
+ *
+ * Deadlines are honored to within a tick; a key never expires early.
+ *
+ * @note Not threadsafe.
+ */
+template <typename KEY>
+class timing_wheel {
+public:
+	typedef std::chrono::steady_clock clock;
+	typedef clock::time_point time_point;
+
+private:
+	struct entry_t {
+		time_point deadline;
+		// The tick of the slot we're parked in, and which parking this is;
+		// slots may hold stale copies of a key that has since moved.
+		uint64_t tick;
+		uint64_t seq;
+	};
+	typedef std::pair<KEY, uint64_t> parked_t;
+
+	std::chrono::milliseconds tick_length;
+	time_point origin;
+	// The last tick whose slot we've processed.
+	uint64_t current;
+	uint64_t next_seq;
+	std::map<KEY, entry_t> entries;
+	std::vector<std::vector<parked_t>> slots;
+
+	timing_wheel(timing_wheel const &);
+	timing_wheel & operator =(timing_wheel const &);
+
+	uint64_t get_tick(time_point t) const {
+		if (t <= origin) {
+			return 0;
+		}
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				t - origin).count() / tick_length.count();
+	}
+
+	void park(KEY const & key, entry_t & entry) {
+		// Whatever part of its tick a deadline falls in, it has passed by
+		// the start of the next one.
+		entry.tick = std::max(get_tick(entry.deadline) + 1, current + 1);
+		entry.seq = next_seq++;
+		slots[entry.tick % slots.size()].push_back(
+				parked_t(key, entry.seq));
+	}
+
+	void process_slot(uint64_t tick, time_point now,
+			std::vector<KEY> & expired) {
+		std::vector<parked_t> slot;
+		slot.swap(slots[tick % slots.size()]);
+		for (auto & p : slot) {
+			auto e = entries.find(p.first);
+			if (e == entries.end() || e->second.seq != p.second) {
+				continue;
+			}
+			if (e->second.tick > tick) {
+				// Parked for a later trip around the wheel.
+				slots[tick % slots.size()].push_back(p);
+			} else if (e->second.deadline <= now) {
+				expired.push_back(p.first);
+				entries.erase(e);
+			} else {
+				park(p.first, e->second);
+			}
+		}
+	}
+
+public:
+	/**
+	 * @param tick_length is how precisely we honor deadlines; a deadline of
+	 * up to @param slot_count ticks away is reached in one trip around the
+	 * wheel.
+	 */
+	timing_wheel(std::chrono::milliseconds tick_length, unsigned slot_count,
+			time_point now = clock::now()) :
+			tick_length(std::max(tick_length, std::chrono::milliseconds(1))),
+			origin(now), current(0), next_seq(0),
+			slots(std::max(slot_count, 1u)) {
+	}
+
+	/**
+	 * Set the deadline for @param key, adding it if it's new.
+	 */
+	void schedule(KEY const & key, time_point deadline) {
+		auto e = entries.find(key);
+		if (e == entries.end()) {
+			entry_t entry;
+			entry.deadline = deadline;
+			park(key, entries.insert(std::make_pair(key, entry))
+					.first->second);
+		} else {
+			bool sooner = deadline < e->second.deadline;
+			e->second.deadline = deadline;
+			// A later deadline is noticed when we reach the slot; only an
+			// earlier one has to move.
+			if (sooner) {
+				park(key, e->second);
+			}
+		}
+	}
+
+	/**
+	 * Forget @param key without expiring it.
+	 */
+	void cancel(KEY const & key) {
+		entries.erase(key);
+	}
+
+	bool contains(KEY const & key) const {
+		return entries.find(key) != entries.end();
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	/**
+	 * Turn the wheel to @param now, forgetting every key whose deadline has
+	 * passed and appending it to @param expired.
+	 */
+	void advance(time_point now, std::vector<KEY> & expired) {
+		auto target = get_tick(now);
+		if (target <= current) {
+			return;
+		}
+		// If we're more than a trip behind, one trip catches us up.
+		auto first = std::max(current + 1,
+				target >= slots.size() ? target - slots.size() + 1 : 1);
+		for (auto tick = first; tick <= target; ++tick) {
+			current = tick;
+			process_slot(tick, now, expired);
+		}
+	}
+};
+
+#endif // sentry
@@ -1,10 +1,19 @@
+#include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <unordered_map>
 
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base/arena.h"
 #include "base/dbc.h"
 #include "base/guid.h"
 
 #include "domain/assignment.h"
 #include "domain/event_codes.h"
+#include "domain/msg.h"
 
 #include "json/json.h"
 
@@ -15,24 +24,200 @@ using namespace nitro::event_codes;
 
 namespace nitro {
 
+/**
+ * Marks the end of an intrusive list.
+ */
+const uint32_t NO_SLOT = UINT32_MAX;
+
+struct assignment::data_t {
+
+	/**
+	 * One task, plus its links in the list for its current status.
+	 */
+	struct slot_t {
+		// Placement-allocated in our arena.
+		task * t;
+		task_status status;
+		uint32_t prev;
+		uint32_t next;
+	};
+
+	struct list_t {
+		uint32_t head;
+		uint32_t tail;
+	};
+
+	// Holds the tasks and their cmdlines.
+	arena storage;
+	// Slots are never removed, so a slot's index is stable.
+	std::vector<slot_t> slots;
+	list_t lists[3];
+	std::atomic<unsigned> counts[3];
+
+	// Ids are normally consecutive, starting anywhere; then a task's slot is
+	// just (id - first_id). If ids ever stray from that pattern, we fall back
+	// to a hash index for the whole assignment.
+	task::id_type first_id;
+	std::unordered_map<task::id_type, uint32_t> sparse_index;
+
+	// Ids that entered each state since the last progress report, and a
+	// total we use to cap them.
+	std::vector<task::id_type> changes[3];
+	size_t change_count;
+	Json::Value::UInt report_seq;
+	unsigned reports_since_full;
+	bool full_report_due;
+
+	mutable std::mutex mutex;
+
+	data_t() : first_id(0), change_count(0), report_seq(0),
+			reports_since_full(0), full_report_due(true) {
+		for (int i = ts_ready; i <= ts_complete; ++i) {
+			lists[i].head = lists[i].tail = NO_SLOT;
+			counts[i] = 0;
+		}
+	}
+
+	~data_t() {
+		for (auto & s : slots) {
+			s.t->~task();
+		}
+	}
+
+	uint32_t find(task::id_type tid) const {
+		if (sparse_index.empty()) {
+			if (tid >= first_id && tid - first_id < slots.size()) {
+				return static_cast<uint32_t>(tid - first_id);
+			}
+			return NO_SLOT;
+		}
+		auto i = sparse_index.find(tid);
+		return i == sparse_index.end() ? NO_SLOT : i->second;
+	}
+
+	void link(uint32_t n, task_status status) {
+		slot_t & s = slots[n];
+		list_t & list = lists[status];
+		s.status = status;
+		s.prev = list.tail;
+		s.next = NO_SLOT;
+		if (list.tail == NO_SLOT) {
+			list.head = n;
+		} else {
+			slots[list.tail].next = n;
+		}
+		list.tail = n;
+		++counts[status];
+		note_change(s.t->get_id(), status);
+	}
+
+	void note_change(task::id_type tid, task_status status) {
+		if (full_report_due) {
+			return;
+		}
+		// Once the journal is bigger than the assignment, a snapshot is
+		// cheaper than a delta.
+		if (++change_count > slots.size()) {
+			clear_changes();
+			full_report_due = true;
+			return;
+		}
+		changes[status].push_back(tid);
+	}
+
+	void clear_changes() {
+		for (auto & c : changes) {
+			std::vector<task::id_type>().swap(c);
+		}
+		change_count = 0;
+	}
+
+	void unlink(uint32_t n) {
+		slot_t & s = slots[n];
+		list_t & list = lists[s.status];
+		if (s.prev == NO_SLOT) {
+			list.head = s.next;
+		} else {
+			slots[s.prev].next = s.next;
+		}
+		if (s.next == NO_SLOT) {
+			list.tail = s.prev;
+		} else {
+			slots[s.next].prev = s.prev;
+		}
+		--counts[s.status];
+	}
+
+	void move(uint32_t n, task_status status) {
+		unlink(n);
+		link(n, status);
+	}
+
+	task * add(task * t) {
+		auto tid = t->get_id();
+		uint32_t n = slots.size();
+		if (slots.empty()) {
+			first_id = tid;
+		} else if (sparse_index.empty() && tid != first_id + n) {
+			sparse_index.reserve(n + 1);
+			for (uint32_t i = 0; i < n; ++i) {
+				sparse_index[first_id + i] = i;
+			}
+		}
+		if (!sparse_index.empty()) {
+			PRECONDITION(sparse_index.find(tid) == sparse_index.end());
+			sparse_index[tid] = n;
+		}
+		slot_t s;
+		s.t = t;
+		slots.push_back(s);
+		link(n, ts_ready);
+		return t;
+	}
+
+	task * add(task::id_type tid, char const * cmdline,
+			char const * end_of_cmdline, assignment * asgn) {
+		auto t = task::make_in(storage, cmdline, end_of_cmdline, asgn, tid);
+		return t ? add(t) : nullptr;
+	}
+
+	bool is_complete() const {
+		return counts[ts_ready] == 0 && counts[ts_active] == 0;
+	}
+};
+
 assignment::assignment(char const * id) :
-		id(id && *id ? id : generate_guid().c_str()) {
+		data(new data_t), id(id && *id ? id : generate_guid().c_str()) {
 }
 
 assignment::assignment(char const * id, char const * lines) :
-		id(id) {
+		data(new data_t), id(id) {
 	fill_from_lines(lines);
 }
 
+assignment::~assignment() {
+	delete data;
+}
+
 void assignment::fill_from_lines(char const * lines) {
 	if (lines) {
 		// Technically, it should be unnecessary to lock here, because
 		// this function is only called in a constructor. However, I've
 		// added the lock because I don't want the function to get moved
 		// into a more general callability, only to have thread safety break.
-		lock_guard<std::mutex> lock(mutex);
+		lock_guard<std::mutex> lock(data->mutex);
+
+		// Copy all the lines into our arena at once, and then split them in
+		// place; each task's cmdline points into this one buffer.
+		auto len = strlen(lines);
+		size_t line_count = std::count(lines, lines + len, '\n') + 1;
+		data->slots.reserve(line_count);
+		data->storage.reserve(len + 1 + alignof(long double)
+				+ line_count * task::get_max_object_size());
+		char * buf = data->storage.copy(lines, lines + len);
+
 		task::id_type n = 0;
-		for (auto p = lines; *p;) {
+		for (auto p = buf; *p;) {
 			while (isspace(*p)) {
 				++p;
 			}
@@ -43,88 +228,77 @@ void assignment::fill_from_lines(char const * lines) {
 			if (!end) {
 				end = strchr(p, 0);
 			}
+			auto next = end;
 			do {
 				--end;
 			} while (end >= p && isspace(*end));
 			++end;
 			if (end > p) {
-				_ready_task(++n, p, end);
+				// Terminate the line where it stands. If that overwrites a
+				// line break, resume just past it.
+				if (*end) {
+					*end = 0;
+					if (next == end) {
+						++next;
+					}
+				}
+				data->add(++n, p, end, this);
 			}
-			p = end;
+			p = next;
 		}
 	}
 }
 
+void assignment::reserve(size_t task_count, size_t cmdline_bytes) {
+	lock_guard<std::mutex> lock(data->mutex);
+	data->slots.reserve(data->slots.size() + task_count);
+	data->storage.reserve(cmdline_bytes + task_count
+			* (1 + task::get_max_object_size() + alignof(long double)));
+}
+
 char const * assignment::get_id() const {
 	return id.c_str();
 }
 
 task * assignment::ready_task(task::id_type tid, char const * cmdline,
 		char const * end_of_cmdline) {
-	lock_guard<std::mutex> lock(mutex);
-	return _ready_task(tid, cmdline, end_of_cmdline);
+	lock_guard<std::mutex> lock(data->mutex);
+	return data->add(tid, cmdline, end_of_cmdline, this);
 }
 
-task * assignment::_ready_task(task::id_type tid, char const * cmdline,
-		char const * end_of_cmdline) {
-	auto t = task::make(cmdline, end_of_cmdline, this, tid).release();
-	if (t) {
-		lists[task_status::ts_ready].push_back(task::handle(t));
-	}
-	return t;
+task const * assignment::get_task(task::id_type tid) const {
+	lock_guard<std::mutex> lock(data->mutex);
+	auto n = data->find(tid);
+	return n == NO_SLOT ? nullptr : data->slots[n].t;
 }
 
 char const * assignment::activate_task(task::id_type tid) {
-	lock_guard<std::mutex> lock(mutex);
-	char const * cmdline = nullptr;
-	// Although this loop looks moderately expensive, it should, in practice,
-	// be virtually instantaneous, because we are always going to activate
-	// the first item in the ready list.
-	tasklist_t & rlist = lists[ts_ready];
-	for (tasklist_t::iterator i = rlist.begin(); i != rlist.end(); ++i) {
-		task::handle & thandle = *i;
-		if (thandle->get_id() == tid) {
-			cmdline = thandle->get_cmdline();
-			tasklist_t & alist = lists[ts_active];
-			alist.push_back(task::handle(thandle.release()));
-			rlist.erase(i);
-			break;
-		}
+	lock_guard<std::mutex> lock(data->mutex);
+	auto n = data->find(tid);
+	if (n == NO_SLOT || data->slots[n].status != ts_ready) {
+		return nullptr;
 	}
-	return cmdline;
+	data->move(n, ts_active);
+	return data->slots[n].t->get_cmdline();
 }
 
-bool assignment::complete_task(task::id_type tid) {
-	lock_guard<std::mutex> lock(mutex);
-	// Although this loop looks moderately expensive, it should, in practice,
-	// be cheap, because we are always going to have only a handful of active
-	// items.
-	tasklist_t & alist = lists[ts_active];
-	for (tasklist_t::iterator i = alist.begin(); i != alist.end(); ++i) {
-		task::handle & thandle = *i;
-		if (thandle->get_id() == tid) {
-			tasklist_t & clist = lists[ts_complete];
-			clist.push_back(task::handle(thandle.release()));
-			alist.erase(i);
-			break;
-		}
+bool assignment::complete_task(task::id_type tid, int exit_code) {
+	lock_guard<std::mutex> lock(data->mutex);
+	auto n = data->find(tid);
+	if (n != NO_SLOT && data->slots[n].status != ts_complete) {
+		data->slots[n].t->set_exit_code(exit_code);
+		data->move(n, ts_complete);
 	}
-	return _is_complete();
-}
-
-bool assignment::_is_complete() const {
-	return lists[ts_ready].empty() && lists[ts_active].empty();
+	return data->is_complete();
 }
 
 bool assignment::is_complete() const {
-	lock_guard<std::mutex> lock(mutex);
-	return _is_complete();
+	return data->is_complete();
 }
 
 unsigned assignment::get_counts(unsigned * complete, unsigned * active,
-		unsigned * ready) {
-	lock_guard<std::mutex> lock(mutex);
-	#define READ_AND_SET(x) unsigned _##x = lists[ts_##x].size(); if (x) *x = _##x
+		unsigned * ready) const {
+	#define READ_AND_SET(x) unsigned _##x = data->counts[ts_##x]; if (x) *x = _##x
 	READ_AND_SET(ready);
 	READ_AND_SET(active);
 	READ_AND_SET(complete);
@@ -132,63 +306,191 @@ unsigned assignment::get_counts(unsigned * complete, unsigned * active,
 	return _ready + _active + _complete;
 }
 
-string assignment::get_request_msg() const {
-	lock_guard<std::mutex> lock(mutex);
-	Json::Value root;
-	root["messageId"] = generate_guid();
-	root["senderId"] = "nitro@localhost"; // TODO: fix
-	Json::Value body;
-	body["code"] = events::get_std_id_repr(NITRO_HERE_IS_ASSIGNMENT);
-	Json::Value tasks;
-	tasklist_t const & rlist = lists[task_status::ts_ready];
-	for (tasklist_t::const_iterator i = rlist.cbegin(); i != rlist.cend();
-			++i) {
-		auto key = interp("%1", (*i)->get_id());
-		tasks[key] = (*i)->get_cmdline();
+assignment::taskrefs_t assignment::get_tasks_by_status(task_status status,
+		size_t max_count) const {
+	PRECONDITION(status >= ts_ready && status <= ts_complete);
+	taskrefs_t refs;
+	lock_guard<std::mutex> lock(data->mutex);
+	refs.reserve(std::min<size_t>(max_count, data->counts[status]));
+	for (auto n = data->lists[status].head; n != NO_SLOT
+			&& refs.size() < max_count; n = data->slots[n].next) {
+		refs.push_back(data->slots[n].t);
 	}
-	body["tasks"] = tasks;
-	root["body"] = body;
-	Json::StyledWriter writer;
-	return writer.write(root);
+	return refs;
+}
+
+string assignment::get_request_msg(wire_format fmt,
+		char const * sender_id) const {
+	lock_guard<std::mutex> lock(data->mutex);
+	if (fmt == wf_binary) {
+		wire_writer writer(NITRO_HERE_IS_ASSIGNMENT, sender_id);
+		writer.add_string(wfld_assignment_id, id);
+		writer.begin_tasks();
+		for (auto n = data->lists[ts_ready].head; n != NO_SLOT;
+				n = data->slots[n].next) {
+			task const & t = *data->slots[n].t;
+			auto cmdline = t.get_cmdline();
+			writer.add_task(t.get_id(), cmdline, strlen(cmdline));
+		}
+		return writer.finish();
+	}
+	string txt;
+	txt.reserve(JSON_MSG_ENVELOPE_SIZE + data->counts[ts_ready] * 64);
+	Json::BufferWriter writer(txt);
+	begin_json_msg(writer, NITRO_HERE_IS_ASSIGNMENT);
+	writer.key("assignment").startObject();
+	writer.key("id").stringValue(id);
+	// Tasks are an array rather than an object keyed by id, so the worker
+	// sees them in the order we prioritized them.
+	writer.key("tasks").startArray();
+	for (auto n = data->lists[ts_ready].head; n != NO_SLOT;
+			n = data->slots[n].next) {
+		task const & t = *data->slots[n].t;
+		writer.startObject();
+		writer.key("id").stringValue(std::to_string(t.get_id()));
+		writer.key("cmdline").stringValue(t.get_cmdline());
+		writer.endObject();
+	}
+	writer.endArray().endObject();
+	writer.endObject().endObject();
+	return txt;
 }
 
 string assignment::get_status_msg() const {
-	lock_guard<std::mutex> lock(mutex);
-	Json::Value root;
-	char guid[GUID_BUF_LEN];
-	generate_guid(guid, sizeof(guid));
-	root["messageId"] = guid;
-	root["senderId"] = "nitro@localhost"; // TODO: fix
-	root["body"]["code"] = events::get_std_id_repr(
-			NITRO_ASSIGNMENT_PROGRESS_REPORT);
-	Json::Value status;
-	int counts[3];
-	Json::Value pending(Json::arrayValue);
-	Json::Value done(Json::arrayValue);
+	lock_guard<std::mutex> lock(data->mutex);
+	string txt;
+	txt.reserve(JSON_MSG_ENVELOPE_SIZE + data->slots.size() * 8);
+	Json::BufferWriter writer(txt);
+	begin_json_msg(writer, NITRO_ASSIGNMENT_PROGRESS_REPORT);
+	writer.key("status").startObject();
 	for (task_status stat = task_status::ts_ready;
 			stat <= task_status::ts_complete; ++stat) {
-		counts[stat] = 0;
-		Json::Value items(Json::arrayValue);
-		tasklist_t const & tlist = lists[stat];
-		for (tasklist_t::const_iterator i = tlist.cbegin(); i != tlist.cend();
-				++i) {
-			auto idstr = interp("%1", (*i)->get_id());
-			items[counts[stat]++] = idstr;
-		}
-		auto name = get_status_name(stat);
-		auto count_key = interp("%1_count", name);
-		status[name] = items;
-		status[count_key] = counts[stat];
-	}
-	root["body"]["status"] = status;
-	Json::StyledWriter writer;
-	return writer.write(root);
-}
-
-assignment::tasklist_t const & assignment::get_list_by_status(
-		task_status ts) const {
-	PRECONDITION(ts >= ts_ready && ts <= ts_complete);
-	return lists[ts];
+		string name = get_status_name(stat);
+		writer.key(name).startArray();
+		for (auto n = data->lists[stat].head; n != NO_SLOT;
+				n = data->slots[n].next) {
+			writer.stringValue(std::to_string(data->slots[n].t->get_id()));
+		}
+		writer.endArray();
+		writer.key(name + "_count").numberValue(
+				static_cast<Json::UInt>(data->counts[stat]));
+	}
+	writer.endObject();
+	writer.endObject().endObject();
+	return txt;
+}
+
+string assignment::get_progress_msg() {
+	lock_guard<std::mutex> lock(data->mutex);
+	++data->reports_since_full;
+	bool full = data->full_report_due
+			|| data->reports_since_full >= FULL_REPORT_INTERVAL;
+	if (!full && data->change_count == 0) {
+		return string();
+	}
+	string txt;
+	txt.reserve(JSON_MSG_ENVELOPE_SIZE + 256);
+	Json::BufferWriter writer(txt);
+	begin_json_msg(writer, NITRO_ASSIGNMENT_PROGRESS_REPORT);
+	writer.key("status").startObject();
+	writer.key("assignment").stringValue(id);
+	writer.key("seq").numberValue(++data->report_seq);
+	writer.key("full").boolValue(full);
+	std::vector<task::id_type> ids;
+	for (task_status stat = task_status::ts_ready;
+			stat <= task_status::ts_complete; ++stat) {
+		if (full) {
+			ids.clear();
+			ids.reserve(data->counts[stat]);
+			for (auto n = data->lists[stat].head; n != NO_SLOT;
+					n = data->slots[n].next) {
+				ids.push_back(data->slots[n].t->get_id());
+			}
+		} else {
+			ids.swap(data->changes[stat]);
+		}
+		string name = get_status_name(stat);
+		writer.key(name).stringValue(encode_id_ranges(std::move(ids)));
+		writer.key(name + "_count").numberValue(
+				static_cast<Json::UInt>(data->counts[stat]));
+		ids.clear();
+	}
+	writer.endObject();
+	writer.endObject().endObject();
+	data->clear_changes();
+	if (full) {
+		data->full_report_due = false;
+		data->reports_since_full = 0;
+	}
+	return txt;
+}
+
+string encode_id_ranges(std::vector<task::id_type> ids) {
+	std::sort(ids.begin(), ids.end());
+	string txt;
+	for (size_t i = 0; i < ids.size();) {
+		auto first = ids[i], last = first;
+		while (++i < ids.size() && ids[i] <= last + 1) {
+			last = ids[i];
+		}
+		if (!txt.empty()) {
+			txt += ',';
+		}
+		txt += std::to_string(first);
+		if (last != first) {
+			txt += '-';
+			txt += std::to_string(last);
+		}
+	}
+	return txt;
+}
+
+const size_t MAX_DECODED_TASK_IDS = 1000000;
+
+bool decode_id_ranges(char const * txt, std::vector<task::id_type> & ids,
+		size_t max_count) {
+	if (!txt) {
+		return false;
+	}
+	size_t count = 0;
+	for (auto p = txt; *p;) {
+		if (!isdigit(*p)) {
+			return false;
+		}
+		char * end;
+		task::id_type first = strtoull(p, &end, 10), last = first;
+		if (*end == '-') {
+			p = end + 1;
+			if (!isdigit(*p)) {
+				return false;
+			}
+			last = strtoull(p, &end, 10);
+			if (last < first) {
+				return false;
+			}
+		}
+		// Check the width before expanding; a hostile range could otherwise
+		// exhaust memory.
+		if (last - first >= max_count - count) {
+			return false;
+		}
+		count += last - first + 1;
+		for (auto id = first; ; ++id) {
+			ids.push_back(id);
+			if (id == last) {
+				break;
+			}
+		}
+		p = end;
+		if (*p == ',') {
+			if (!*++p) {
+				return false;
+			}
+		} else if (*p) {
+			return false;
+		}
+	}
+	return true;
 }
 
 } // end namespace nitro
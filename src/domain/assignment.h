@@ -1,11 +1,12 @@
 #ifndef _DOMAIN_ASSIGNMENT_H_
 #define _DOMAIN_ASSIGNMENT_H_
 
-#include <list>
-#include <mutex>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include "domain/task.h"
+#include "domain/wire.h"
 
 namespace nitro {
 
@@ -13,6 +14,12 @@ namespace nitro {
  * The unit of delegated work -- typically a few dozen or a few hundred
  * individual commands.
  *
+ * Tasks and their cmdlines are allocated together in a per-assignment arena.
+ * Tasks are indexed in a contiguous slab, by task id, and are threaded onto
+ * intrusive ready/active/complete lists; changing a task's state is O(1), no
+ * matter how big the assignment is. Per-state counts are kept atomically, so
+ * they can be read without locking.
+ *
  * Assignments are thread-safe; you can interact with them from multiple
  * threads in parallel.
  */
@@ -30,6 +37,8 @@ public:
 	 */
 	assignment(char const * id, char const * lines);
 
+	~assignment();
+
 	char const * get_id() const;
 
 	/**
@@ -40,59 +49,121 @@ public:
 
 	/**
 	 * Count how many tasks are in each state. NULL can be passed for any
-	 * parameters that are uninteresting.
+	 * parameters that are uninteresting. Does not lock.
 	 *
 	 * @return total count
 	 */
 	unsigned get_counts(unsigned * complete=nullptr,
-			unsigned * active = nullptr, unsigned * ready=nullptr);
+			unsigned * active = nullptr, unsigned * ready=nullptr) const;
 
 	/**
-	 * Return a json string suitable for transmitting to a worker to request
-	 * that an assignment be accepted.
+	 * Return a message suitable for transmitting to a worker to request
+	 * that an assignment be accepted -- json by default, or a binary frame
+	 * for workers that have negotiated one.
 	 */
-	std::string get_request_msg() const;
+	std::string get_request_msg(wire_format fmt = wf_json,
+			char const * sender_id = nullptr) const;
 
 	/**
 	 * Return a json string suitable for reporting how far along we are
-	 * in processing an assignment.
+	 * in processing an assignment. This is a full dump of every task id;
+	 * see get_progress_msg() for what we publish periodically.
 	 */
 	std::string get_status_msg() const;
 
 	/**
-	 * Add a task that's ready for execution.
+	 * Return a compact json progress report, or an empty string if nothing
+	 * has changed since the last one and no snapshot is due.
+	 *
+	 * A report carries a sequence number, absolute per-state counts, and the
+	 * ids (as ranges; see encode_id_ranges()) of tasks that entered each
+	 * state since the previous report. Apply the ready, active, and complete
+	 * lists in that order. Every FULL_REPORT_INTERVAL reports, or if the
+	 * changes pile up, the report is instead a full snapshot ("full": true)
+	 * listing every task's state, so a listener that missed a report (pub/sub
+	 * drops messages) can resynchronize.
+	 */
+	std::string get_progress_msg();
+
+	/**
+	 * Add a task that's ready for execution. Ids are normally consecutive
+	 * (that's fastest), but needn't be. Adding a task with an id that's
+	 * already in use is a precondition violation.
 	 */
 	task * ready_task(task::id_type tid, char const * cmdline,
 			char const * end_of_cmdline=nullptr);
 
+	/**
+	 * Prepare to add @param task_count tasks whose cmdlines total
+	 * @param cmdline_bytes, so that adding them needs no further allocation.
+	 */
+	void reserve(size_t task_count, size_t cmdline_bytes);
+
+	/**
+	 * @return the task with id @param tid, or null if there isn't one.
+	 */
+	task const * get_task(task::id_type tid) const;
+
 	/**
 	 * Mark a task active and return its cmdline so we can launch it.
 	 */
 	char const * activate_task(task::id_type tid);
 
 	/**
-	 * Mark a task as complete; return true if entire assignment is complete.
+	 * Mark a task as complete, and record its @param exit_code. The task is
+	 * normally active, but may still be ready (e.g., when a coordinator hears
+	 * about tasks it never ran itself). Return true if entire assignment is
+	 * complete.
 	 */
-	bool complete_task(task::id_type tid);
+	bool complete_task(task::id_type tid, int exit_code = 0);
 
-	typedef std::list<task::handle> tasklist_t;
-	tasklist_t const & get_list_by_status(task_status status) const;
+	/**
+	 * Get up to @param max_count tasks that have a given status, in the order
+	 * they reached it. The tasks belong to the assignment; the pointers stay
+	 * valid for its lifetime.
+	 */
+	typedef std::vector<task const *> taskrefs_t;
+	taskrefs_t get_tasks_by_status(task_status status,
+			size_t max_count = SIZE_MAX) const;
 
 	typedef std::unique_ptr<assignment> handle;
 
 private:
-	void fill_from_lines(char const * lines);
+	struct data_t;
+	data_t * data;
 
-	task * _ready_task(task::id_type tid, char const * cmdline,
-			char const * end_of_cmdline);
-
-	bool _is_complete() const;
+	void fill_from_lines(char const * lines);
 
 	std::string id;
-	tasklist_t lists[3];
-	mutable std::mutex mutex;
 };
 
+/**
+ * How many progress reports, at most, between full snapshots.
+ */
+const unsigned FULL_REPORT_INTERVAL = 12;
+
+/**
+ * Render task ids as sorted, comma-separated ranges: { 7, 1, 2, 3, 5 }
+ * becomes "1-3,5,7". Duplicates are dropped.
+ */
+std::string encode_id_ranges(std::vector<task::id_type> ids);
+
+/**
+ * How many ids decode_id_ranges() will produce, unless told otherwise.
+ */
+extern const size_t MAX_DECODED_TASK_IDS;
+
+/**
+ * Reverse encode_id_ranges(), appending to @param ids. A range can name any
+ * number of ids, so a caller that knows how many tasks there can be (such as
+ * an assignment's task count) should pass that as @param max_count.
+ *
+ * @return false if @param txt is malformed, or names more than @param
+ *     max_count ids.
+ */
+bool decode_id_ranges(char const * txt, std::vector<task::id_type> & ids,
+		size_t max_count = MAX_DECODED_TASK_IDS);
+
 } // end namespace nitro
 
 #endif // sentry
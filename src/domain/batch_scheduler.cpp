@@ -0,0 +1,709 @@
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <pwd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/dbc.h"
+#include "base/error.h"
+#include "base/event_codes.h"
+#include "base/file_lines.h"
+#include "base/interp.h"
+#include "base/line_index.h"
+#include "base/xlog.h"
+
+#include "domain/batch_scheduler.h"
+#include "domain/task.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+using namespace base::event_codes;
+
+namespace nitro {
+
+static char const * const POLICY_NAMES[] = {
+	"fifo", "batch", "weighted", "user"
+};
+
+fair_share_policy parse_fair_share_policy(char const * name) {
+	for (int i = fs_fifo; i <= fs_user; ++i) {
+		if (name && strcmp(name, POLICY_NAMES[i]) == 0) {
+			return static_cast<fair_share_policy>(i);
+		}
+	}
+	return fs_batch;
+}
+
+char const * get_fair_share_policy_name(fair_share_policy policy) {
+	return POLICY_NAMES[policy];
+}
+
+const size_t MAX_RUNS_PER_BATCH = 4096;
+
+/**
+ * Consecutive tasks of a batch that sort alike, and any lines between them
+ * that aren't tasks -- or, if mixed, the rest of a batch that had too many
+ * runs, keyed by its highest priority and longest walltime.
+ */
+struct run_t {
+	size_t first_line;
+	size_t last_line;
+	double walltime;
+	int priority;
+	bool mixed;
+	// How many tasks, and how much estimated work, the run holds and hasn't
+	// handed out yet.
+	size_t count;
+	double work;
+};
+
+/**
+ * Collects a batch's runs, in file order, as its lines are parsed. Once a
+ * batch has MAX_RUNS_PER_BATCH runs, the last one absorbs every line after
+ * it, and is served in file order.
+ */
+struct run_builder {
+	std::vector<run_t> runs;
+	size_t lines;
+	double work;
+	// Lines that aren't tasks (blank lines, comments, and the like). Runs
+	// span them, but they aren't counted, and next() passes over them.
+	size_t skipped;
+
+	run_builder() : lines(0), work(0), skipped(0) {
+	}
+
+	/**
+	 * Parse line @param line_num, and add it if it's a task.
+	 */
+	void parse(size_t line_num, char const * line, size_t len) {
+		int priority;
+		double walltime;
+		if (task::estimate(line, line + len, priority, walltime)) {
+			add(line_num, priority, walltime);
+		} else {
+			++skipped;
+		}
+	}
+
+	void add(size_t line_num, int priority, double walltime) {
+		++lines;
+		work += walltime;
+		run_t run = { line_num, line_num, walltime, priority, false, 1,
+				walltime };
+		push(run);
+	}
+
+	/**
+	 * Add the runs @param other collected, for the lines right after ours.
+	 */
+	void append(run_builder const & other) {
+		lines += other.lines;
+		work += other.work;
+		skipped += other.skipped;
+		for (auto & run : other.runs) {
+			push(run);
+		}
+	}
+
+private:
+	void push(run_t const & run) {
+		if (runs.empty()) {
+			runs.push_back(run);
+			return;
+		}
+		auto & last = runs.back();
+		if (!last.mixed && !run.mixed && last.priority == run.priority
+				&& last.walltime == run.walltime) {
+			last.last_line = run.last_line;
+			last.count += run.count;
+			last.work += run.work;
+		} else if (last.mixed || runs.size() >= MAX_RUNS_PER_BATCH) {
+			last.mixed = true;
+			last.last_line = run.last_line;
+			last.priority = std::max(last.priority, run.priority);
+			last.walltime = std::max(last.walltime, run.walltime);
+			last.count += run.count;
+			last.work += run.work;
+		} else {
+			runs.push_back(run);
+		}
+	}
+};
+
+/**
+ * Orders a batch's runs for a max-heap: the run that should go first is the
+ * greatest.
+ */
+struct run_order {
+	bool operator ()(run_t const & a, run_t const & b) const {
+		if (a.priority != b.priority) {
+			return a.priority < b.priority;
+		}
+		if (a.walltime != b.walltime) {
+			return a.walltime < b.walltime;
+		}
+		return a.first_line > b.first_line;
+	}
+};
+
+typedef std::priority_queue<run_t, std::vector<run_t>, run_order> run_heap_t;
+
+struct batch_t {
+	string path;
+	// Who owns the file, for fs_user.
+	string user;
+	double weight;
+	std::unique_ptr<line_index> index;
+	// Opened the first time we read from the batch.
+	std::unique_ptr<file_lines> lines;
+	// Runs we haven't started; and the one we're reading, if reading.
+	run_heap_t runs;
+	// Where each run in runs begins.
+	std::set<size_t> unstarted;
+	run_t current;
+	bool reading;
+	size_t lines_left;
+	double work_left;
+	// Estimated work handed out, divided by the batch's share.
+	double pass;
+	unsigned id;
+
+	batch_t() : weight(1), reading(false), lines_left(0), work_left(0),
+			pass(0), id(0) {
+	}
+
+	int get_priority() const {
+		return reading ? current.priority : runs.top().priority;
+	}
+};
+
+typedef std::unique_ptr<batch_t> batch_handle;
+
+/**
+ * What we know about which lines of a batch have run. This outlives the
+ * batch_t, since lines run long after they're handed out.
+ */
+struct progress_t {
+	string path;
+	// Lines handed out that haven't run yet.
+	std::set<size_t> running;
+	// Just past the batch's last line.
+	size_t end_line;
+	// The first line of what we dropped because the file changed; end_line
+	// if nothing.
+	size_t lost;
+	// The resume line we last reported (at first, where the batch began), and
+	// whether lines have run since.
+	size_t reported;
+	bool moved;
+};
+
+/**
+ * Where a batch stands in line: highest priority first, then least charged,
+ * then oldest.
+ */
+struct batch_key {
+	int priority;
+	double pass;
+	unsigned id;
+
+	bool operator <(batch_key const & other) const {
+		if (priority != other.priority) {
+			return priority > other.priority;
+		}
+		if (pass != other.pass) {
+			return pass < other.pass;
+		}
+		return id < other.id;
+	}
+};
+
+static string get_owner_name(uid_t uid) {
+	struct passwd pw;
+	struct passwd * found = nullptr;
+	char buf[1024];
+	if (getpwuid_r(uid, &pw, buf, sizeof(buf), &found) == 0 && found) {
+		return found->pw_name;
+	}
+	return interp("%1", uid);
+}
+
+/**
+ * How many threads may scan one batch whose index we already have, and how
+ * many lines each must have to be worth starting.
+ */
+const unsigned MAX_SCAN_THREADS = 8;
+const size_t MIN_LINES_PER_SCAN_THREAD = 100000;
+
+static void scan_range(char const * path, line_index const & index,
+		line_index::range_t range, run_builder & builder) {
+	file_lines scan(path, false, false, 0, true);
+	scan.set_range(index, range.first, range.second);
+	size_t len;
+	for (auto line = scan.next(len); line; line = scan.next(len)) {
+		builder.parse(scan.get_current_line_num(), line, len);
+	}
+}
+
+/**
+ * Parse lines @param first_line to the end into @param builder, splitting
+ * the work among threads if there's enough of it.
+ */
+static void scan_in_parallel(char const * path, line_index const & index,
+		size_t first_line, run_builder & builder) {
+	auto last_line = index.get_line_count();
+	if (first_line > last_line) {
+		return;
+	}
+	auto remaining = last_line + 1 - first_line;
+	size_t threads = std::min(MAX_SCAN_THREADS,
+			std::max(1u, std::thread::hardware_concurrency()));
+	threads = std::min(threads,
+			std::max<size_t>(1, remaining / MIN_LINES_PER_SCAN_THREAD));
+	if (threads == 1) {
+		scan_range(path, index, line_index::range_t(first_line, last_line),
+				builder);
+		return;
+	}
+	// split() divides the whole file, so ask for enough pieces that what's
+	// left of it comes out in about as many as we have threads.
+	auto pieces = (threads * last_line + remaining - 1) / remaining;
+	std::vector<line_index::range_t> ranges;
+	for (auto r : index.split(static_cast<unsigned>(pieces))) {
+		if (r.second >= first_line) {
+			r.first = std::max(r.first, first_line);
+			ranges.push_back(r);
+		}
+	}
+	std::vector<run_builder> parts(ranges.size());
+	std::vector<std::exception_ptr> errors(ranges.size());
+	std::vector<std::thread> scanners;
+	for (size_t i = 0; i < ranges.size(); ++i) {
+		scanners.push_back(std::thread([&, i] {
+			try {
+				scan_range(path, index, ranges[i], parts[i]);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		}));
+	}
+	for (auto & t : scanners) {
+		t.join();
+	}
+	for (size_t i = 0; i < parts.size(); ++i) {
+		if (errors[i]) {
+			std::rethrow_exception(errors[i]);
+		}
+		builder.append(parts[i]);
+	}
+}
+
+/**
+ * Index a batch: parse every line once, and group them into runs. This is
+ * the slow part of adding a batch, and it touches nothing shared, so it can
+ * run on any thread.
+ */
+static batch_handle ingest(char const * path, size_t first_line,
+		double weight) {
+	PRECONDITION(path && *path);
+	PRECONDITION(first_line >= 1);
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		throw ERROR_EVENT(E_INPUT_FILE_1PATH_UNREADABLE, path);
+	}
+	batch_handle b(new batch_t);
+	b->path = path;
+	b->user = get_owner_name(st.st_uid);
+	b->weight = weight > 0 ? weight : 1.0;
+	// An empty batch is finished before it starts.
+	if (st.st_size == 0) {
+		return b;
+	}
+
+	// Building the index reads every line, so we parse them as it goes.
+	run_builder builder;
+	auto visit = [&](size_t line_num, char const * line, size_t len) {
+		if (line_num >= first_line) {
+			builder.parse(line_num, line, len);
+		}
+	};
+	b->index.reset(new line_index(path, true, visit));
+	if (b->index->was_loaded()) {
+		// The index came from its sidecar, so we still have to read the
+		// lines. With nothing else to read, we can do it in parallel.
+		scan_in_parallel(path, *b->index, first_line, builder);
+	}
+	if (builder.skipped) {
+		xlog("Skipping %1 lines of batch \"%2\" that aren't tasks.",
+				builder.skipped, path);
+	}
+	b->lines_left = builder.lines;
+	b->work_left = builder.work;
+	for (auto & run : builder.runs) {
+		b->unstarted.insert(run.first_line);
+	}
+	b->runs = run_heap_t(run_order(), std::move(builder.runs));
+	return b;
+}
+
+struct batch_scheduler::data_t {
+	fair_share_policy policy;
+	std::map<unsigned, batch_handle> batches;
+	std::set<batch_key> order;
+	// How many active batches each user has, for fs_user.
+	std::map<string, unsigned> user_batch_counts;
+	unsigned next_id;
+	// The pass of the batch we served most recently; new batches start here.
+	double vtime;
+	size_t lines_left;
+	double work_left;
+	// Keyed like batches, but kept until every line has run.
+	std::map<unsigned, progress_t> progress;
+
+	// Shared with reader threads.
+	mutex ready_mutex;
+	std::vector<batch_handle> ready;
+	std::map<std::thread::id, std::thread> readers;
+	std::vector<std::thread::id> finished_readers;
+	unsigned ingesting;
+
+	data_t(fair_share_policy policy) : policy(policy), next_id(0), vtime(0),
+			lines_left(0), work_left(0), ingesting(0) {
+	}
+
+	~data_t() {
+		for (auto & r : readers) {
+			r.second.join();
+		}
+	}
+
+	batch_key get_key(batch_t const & b) const {
+		batch_key key = { b.get_priority(), policy == fs_fifo ? 0 : b.pass,
+				b.id };
+		return key;
+	}
+
+	double get_share(batch_t const & b) const {
+		switch (policy) {
+		case fs_weighted:
+			return b.weight;
+		case fs_user:
+			return 1.0 / user_batch_counts.find(b.user)->second;
+		default:
+			return 1.0;
+		}
+	}
+
+	void adopt(batch_handle && b) {
+		if (b->lines_left == 0) {
+			return;
+		}
+		b->id = next_id++;
+		b->pass = vtime;
+		lines_left += b->lines_left;
+		work_left += b->work_left;
+		++user_batch_counts[b->user];
+		order.insert(get_key(*b));
+		auto end_line = b->index->get_line_count() + 1;
+		progress_t p = { b->path, std::set<size_t>(), end_line, end_line,
+				*b->unstarted.begin(), false };
+		progress[b->id] = std::move(p);
+		batches[b->id] = std::move(b);
+	}
+
+	/**
+	 * The lowest line of batch @param id that hasn't run.
+	 */
+	size_t get_resume_line(unsigned id, progress_t const & p) const {
+		auto line = std::min(p.end_line, p.lost);
+		if (!p.running.empty()) {
+			line = std::min(line, *p.running.begin());
+		}
+		auto b = batches.find(id);
+		if (b != batches.end()) {
+			if (b->second->reading) {
+				line = std::min(line,
+						b->second->lines->get_current_line_num() + 1);
+			}
+			if (!b->second->unstarted.empty()) {
+				line = std::min(line, *b->second->unstarted.begin());
+			}
+		}
+		return line;
+	}
+
+	/**
+	 * Note that lines of @param b from @param first_line on may never run.
+	 */
+	void lose(batch_t const & b, size_t first_line) {
+		auto & p = progress[b.id];
+		p.lost = std::min(p.lost, first_line);
+		p.moved = true;
+	}
+
+	/**
+	 * Take @param lines tasks and @param work seconds off what @param b,
+	 * and we, have left to hand out.
+	 */
+	void charge(batch_t & b, size_t lines, double work) {
+		b.lines_left -= lines;
+		b.work_left -= work;
+		lines_left -= lines;
+		work_left -= work;
+	}
+
+	/**
+	 * Let go of a batch, and of whatever it still had to hand out.
+	 */
+	void retire(unsigned id) {
+		auto b = batches.find(id);
+		charge(*b->second, b->second->lines_left, b->second->work_left);
+		auto u = user_batch_counts.find(b->second->user);
+		if (--u->second == 0) {
+			user_batch_counts.erase(u);
+		}
+		batches.erase(b);
+	}
+
+	/**
+	 * Take in whatever the reader threads have finished.
+	 */
+	void adopt_ready() {
+		std::vector<batch_handle> batches;
+		std::vector<std::thread> done;
+		{
+			lock_guard<mutex> lock(ready_mutex);
+			if (ready.empty() && finished_readers.empty()) {
+				return;
+			}
+			batches.swap(ready);
+			for (auto id : finished_readers) {
+				auto r = readers.find(id);
+				done.push_back(std::move(r->second));
+				readers.erase(r);
+			}
+			finished_readers.clear();
+		}
+		for (auto & t : done) {
+			t.join();
+		}
+		for (auto & b : batches) {
+			adopt(std::move(b));
+		}
+	}
+
+	void read_batch(string path, size_t first_line, double weight,
+			std::function<void ()> on_indexed) {
+		batch_handle b;
+		try {
+			b = ingest(path.c_str(), first_line, weight);
+		} catch (std::exception const & e) {
+			xlog("Unable to read batch \"%1\": %2", path, e.what());
+		}
+		{
+			lock_guard<mutex> lock(ready_mutex);
+			if (b) {
+				ready.push_back(std::move(b));
+			}
+			--ingesting;
+			finished_readers.push_back(std::this_thread::get_id());
+		}
+		if (on_indexed) {
+			on_indexed();
+		}
+	}
+};
+
+batch_scheduler::batch_scheduler(fair_share_policy policy) :
+		data(new data_t(policy)) {
+}
+
+batch_scheduler::~batch_scheduler() {
+	delete data;
+}
+
+fair_share_policy batch_scheduler::get_policy() const {
+	return data->policy;
+}
+
+size_t batch_scheduler::add_batch(char const * path, size_t first_line,
+		double weight) {
+	auto b = ingest(path, first_line, weight);
+	auto added = b->lines_left;
+	data->adopt(std::move(b));
+	return added;
+}
+
+void batch_scheduler::submit(string const & path, size_t first_line,
+		double weight, std::function<void ()> const & on_indexed) {
+	lock_guard<mutex> lock(data->ready_mutex);
+	++data->ingesting;
+	std::thread reader(&data_t::read_batch, data, path, first_line, weight,
+			on_indexed);
+	auto id = reader.get_id();
+	data->readers[id] = std::move(reader);
+}
+
+bool batch_scheduler::is_ingesting() const {
+	lock_guard<mutex> lock(data->ready_mutex);
+	return data->ingesting > 0;
+}
+
+bool batch_scheduler::next(pending_task & into) {
+	data->adopt_ready();
+	while (!data->order.empty()) {
+		auto first = data->order.begin();
+		auto & b = *data->batches[first->id];
+		if (!b.reading) {
+			b.current = b.runs.top();
+			b.runs.pop();
+			b.unstarted.erase(b.current.first_line);
+			// Our index is only good for the file we indexed, and reading
+			// a mapping past the end of a file that shrank would crash us.
+			// We check once a run, not once a line.
+			struct stat st;
+			if (stat(b.path.c_str(), &st) != 0
+					|| uint64_t(st.st_size) != b.index->get_file_size()) {
+				xlog("Batch \"%1\" has changed since it was added;"
+						" dropping the %2 tasks we hadn't handed out.",
+						b.path, b.lines_left);
+				data->lose(b, b.unstarted.empty() ? b.current.first_line
+						: std::min(b.current.first_line, *b.unstarted.begin()));
+				data->order.erase(first);
+				data->retire(b.id);
+				continue;
+			}
+			if (!b.lines) {
+				b.lines.reset(new file_lines(b.path.c_str(), false, false, 0,
+						true));
+			}
+			b.lines->set_range(*b.index, b.current.first_line,
+					b.current.last_line);
+			b.reading = true;
+		}
+		size_t len;
+		auto line = b.lines->next(len);
+		while (line && !task::is_task(line, line + len)) {
+			line = b.lines->next(len);
+		}
+		if (!line || b.lines->get_current_line_num() == b.current.last_line) {
+			b.reading = false;
+		}
+		data->order.erase(first);
+		if (line) {
+			into.cmdline.assign(line, len);
+			into.batch = b.id;
+			into.line = b.lines->get_current_line_num();
+			data->progress[b.id].running.insert(into.line);
+			if (b.current.mixed) {
+				// Lines in a mixed run differ; look at each as it goes out.
+				task::estimate(line, line + len, into.priority,
+						into.walltime);
+			} else {
+				into.priority = b.current.priority;
+				into.walltime = b.current.walltime;
+			}
+			// A line that became a task after we indexed it goes out
+			// uncounted.
+			if (b.current.count) {
+				--b.current.count;
+				b.current.work -= into.walltime;
+				data->charge(b, 1, into.walltime);
+			}
+			// Charge the batch for what it got. Under fs_fifo, pass isn't
+			// part of the key, so this changes nothing.
+			data->vtime = b.pass;
+			b.pass += into.walltime / data->get_share(b);
+		}
+		// If the run is over before all its tasks went out, the file has
+		// changed under us, and the tasks we counted are gone.
+		if (!b.reading && b.current.count) {
+			xlog("Lines %1-%2 of batch \"%3\" no longer hold the tasks they"
+					" did when it was added; dropping %4 of them.",
+					b.current.first_line, b.current.last_line, b.path,
+					b.current.count);
+			data->charge(b, b.current.count, b.current.work);
+			data->lose(b, b.current.first_line);
+			b.current.count = 0;
+		}
+		// Let go of a finished batch right away, not on the next call.
+		if (b.lines_left == 0 || (!b.reading && b.runs.empty())) {
+			data->retire(b.id);
+		} else {
+			data->order.insert(data->get_key(b));
+		}
+		if (line) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool batch_scheduler::empty() const {
+	data->adopt_ready();
+	return data->lines_left == 0;
+}
+
+size_t batch_scheduler::get_lines_left() const {
+	data->adopt_ready();
+	return data->lines_left;
+}
+
+double batch_scheduler::get_work_left() const {
+	data->adopt_ready();
+	return data->work_left;
+}
+
+size_t batch_scheduler::get_batch_count() const {
+	data->adopt_ready();
+	return data->batches.size();
+}
+
+void batch_scheduler::complete(unsigned batch, size_t line) {
+	auto p = data->progress.find(batch);
+	if (p != data->progress.end() && p->second.running.erase(line)) {
+		p->second.moved = true;
+	}
+}
+
+std::vector<resume_point> batch_scheduler::get_progress() {
+	std::vector<resume_point> points;
+	for (auto p = data->progress.begin(); p != data->progress.end();) {
+		auto & prog = p->second;
+		if (!prog.moved) {
+			++p;
+			continue;
+		}
+		prog.moved = false;
+		auto line = data->get_resume_line(p->first, prog);
+		// Nothing more will run once the batch is retired and its last
+		// lines are back.
+		bool over = prog.running.empty() && !data->batches.count(p->first);
+		bool finished = over && line == prog.end_line;
+		if (line != prog.reported || over) {
+			resume_point point = { prog.path, line, finished };
+			points.push_back(point);
+			prog.reported = line;
+		}
+		if (over) {
+			p = data->progress.erase(p);
+		} else {
+			++p;
+		}
+	}
+	return points;
+}
+
+} // end namespace nitro
@@ -0,0 +1,168 @@
+#ifndef _DOMAIN_BATCH_SCHEDULER_H_
+#define _DOMAIN_BATCH_SCHEDULER_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace nitro {
+
+/**
+ * The most runs of like lines we keep for one batch.
+ */
+extern const size_t MAX_RUNS_PER_BATCH;
+
+/**
+ * A line waiting to be handed out, with what we learned about it when its
+ * batch was ingested.
+ */
+struct pending_task {
+	std::string cmdline;
+	int priority;
+	double walltime;
+	// Where it came from, for batch_scheduler::complete().
+	unsigned batch;
+	size_t line;
+};
+
+/**
+ * Where to pick up a batch if we have to start over: every line before
+ * @param line has run. A finished batch's line is past its end.
+ */
+struct resume_point {
+	std::string path;
+	size_t line;
+	bool finished;
+};
+
+/**
+ * How batches with work of the same priority share the workers.
+ */
+enum fair_share_policy {
+	// Finish each batch before starting on the next.
+	fs_fifo,
+	// Every batch gets an equal share.
+	fs_batch,
+	// Each batch gets a share proportional to the weight it was added with.
+	fs_weighted,
+	// Every user (the owner of a batch file) gets an equal share, split
+	// evenly among that user's batches.
+	fs_user,
+};
+
+/**
+ * @return the policy named @param name (fifo, batch, weighted or user), or
+ *     fs_batch if the name is unrecognized.
+ */
+fair_share_policy parse_fair_share_policy(char const * name);
+char const * get_fair_share_policy_name(fair_share_policy);
+
+/**
+ * Decide which line, of all the batches we're working on, to hand out next.
+ *
+ * Each line is parsed once, when its batch is added, for its qsub priority
+ * (-p) and its estimated walltime. The highest priority always goes first.
+ * Among batches with work at that priority, the fair share policy picks one,
+ * by charging each batch the estimated walltime of every line it's given
+ * (divided by its weight) and choosing the batch that has been charged
+ * least; a batch added late starts even with the others rather than
+ * catching up. Within a batch, the longest lines go first (the LPT
+ * heuristic, since whoever asks for work is whoever ran out), and then
+ * lines go in file order.
+ *
+ * Batches are never loaded into memory. The index keeps runs of consecutive
+ * lines that sort alike -- typically a handful per batch -- and the text is
+ * read from a mapping of the file when a line is handed out. A batch whose
+ * lines alternate would have a run per line, so runs are capped at
+ * MAX_RUNS_PER_BATCH; the rest of such a batch goes in file order, at the
+ * highest priority and longest walltime among its lines. A batch's
+ * resources are released as soon as its last line is gone. Batch files
+ * shouldn't change once added; if one does, the tasks it no longer holds
+ * where we indexed them are logged and dropped.
+ *
+ * @note Apart from submit(), which is threadsafe, use a batch_scheduler from
+ *     only one thread.
+ */
+class batch_scheduler {
+	struct data_t;
+	data_t * data;
+
+	batch_scheduler(batch_scheduler const &);
+	batch_scheduler & operator =(batch_scheduler const &);
+
+public:
+	batch_scheduler(fair_share_policy policy = fs_batch);
+	virtual ~batch_scheduler();
+
+	fair_share_policy get_policy() const;
+
+	/**
+	 * Index the batch at @param path, from 1-based @param first_line to the
+	 * end, and make its lines available to next(). This scans the whole
+	 * file once. Lines that aren't tasks (such as blank lines) are logged
+	 * and left out. Under fs_weighted, the batch's share is proportional to
+	 * @param weight.
+	 *
+	 * @return how many tasks we added.
+	 *
+	 * @throws error_event if the file can't be read.
+	 */
+	size_t add_batch(char const * path, size_t first_line = 1,
+			double weight = 1.0);
+
+	/**
+	 * Like add_batch(), but index the batch on a reader thread of its own,
+	 * so a huge batch doesn't hold up the others. Its lines become available
+	 * once it's indexed, at which point we call @param on_indexed (from the
+	 * reader thread). Errors are logged.
+	 */
+	void submit(std::string const & path, size_t first_line = 1,
+			double weight = 1.0,
+			std::function<void ()> const & on_indexed = nullptr);
+
+	/**
+	 * Are any submitted batches still being indexed?
+	 */
+	bool is_ingesting() const;
+
+	/**
+	 * Take the line that should run next.
+	 *
+	 * @return false if no lines are available.
+	 */
+	bool next(pending_task & into);
+
+	/**
+	 * Are there no lines available? More may arrive if is_ingesting().
+	 */
+	bool empty() const;
+
+	/**
+	 * How many lines, and how many estimated walltime seconds of work, are
+	 * available but not yet handed out?
+	 */
+	size_t get_lines_left() const;
+	double get_work_left() const;
+
+	/**
+	 * How many batches still have lines to hand out?
+	 */
+	size_t get_batch_count() const;
+
+	/**
+	 * Note that a line next() handed out has run, so starting over needn't
+	 * repeat it. @param batch and @param line are as next() gave them.
+	 */
+	void complete(unsigned batch, size_t line);
+
+	/**
+	 * Where to resume each batch that lines have run from since the last
+	 * call. A finished batch is reported once, and then forgotten.
+	 */
+	std::vector<resume_point> get_progress();
+};
+
+} // end namespace nitro
+
+#endif // sentry
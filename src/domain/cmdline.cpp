@@ -17,7 +17,7 @@ using namespace nitro::event_codes;
 namespace nitro {
 
 char const * cmdline::get_valid_flags() const {
-	return "--help|-h|--follow|-f";
+	return "--help|-h|--follow|-f|--simulate|-s|--linger|-l";
 }
 
 /**
@@ -30,8 +30,9 @@ char const * cmdline::get_valid_flags() const {
  * For the time being, this is as far as I got.
  */
 char const * cmdline::get_valid_options() const {
-	return "--rrport|-r|--psport|-p|--workfor|-w|--exechost|-e"
-			"|--interface|-i|--linger|-l";
+	return "--rrport|-r|--psport|-p|--dpport|-d|--workfor|-w|--exechost|-e"
+			"|--interface|-i|--inflight|-n|--startline|-L"
+			"|--wire|-W|--fairshare|-F|--keepalive|-k";
 }
 
 char const * cmdline::get_default_program_name() const {
@@ -62,6 +63,7 @@ void cmdline::parse(int argc, char const ** argv) {
 	cmdline_base::parse(argc, argv);
 	auto n = validate_port("--rrport");
 	validate_port("--psport", n);
+	validate_port("--dpport", n);
 }
 
 cmdline::cmdline(int argc, char const ** argv) {
@@ -80,7 +82,8 @@ std::string cmdline::get_help() const {
 		}
 		e += err.what();
 	}
-	return interp(
+	// interp() takes at most nine args; the rest of the options follow.
+	auto help = interp(
 		"%1{errors}\n%2{progname} -- run batches of similar jobs at high speed\n"
 		"\n"
 		"  Syntax: %2{progname} [flags] [options] [batch file(s)]\n"
@@ -88,17 +91,30 @@ std::string cmdline::get_help() const {
 		"    Flags:\n"
 		"      --help or -h       -- Display this screen.\n"
 		"      --linger or -l     -- Wait for terminate message before exiting.\n"
+		"      --simulate or -s   -- Coordinate imaginary workers (demo mode).\n"
 		"\n"
 		"    Options:\n"
 		"      --workfor or -w    -- Take work from coordinator on specified host.\n"
 		"                            (Precludes batch files on cmdline.)\n"
 		"      --rrport or -r     -- Request/reply on this port (%3 is default).\n"
 		"      --psport or -p     -- Publish/subscribe on this port (%4 is default).\n"
+		"      --dpport or -d     -- Dispatch assignments on this port (%6 is default).\n"
         "      --interface or -i  -- NIC for multicast messages (%5{iface} is default).\n"
-		"\n",
+		"      --inflight or -n   -- Hold this many assignments at once (%7 is default).\n"
+		"      --startline or -L  -- Begin the first batch at this line (to resume;\n"
+		"                            the log says which line).\n"
+		"      --wire or -W       -- Dispatch messages as json or binary (%8 is default).\n"
+		"      --fairshare or -F  -- Share workers among batches by fifo, batch,\n"
+		"                            weighted or user (%9 is default).\n",
 		e, get_program_name(), DEFAULT_REQREP_PORT, DEFAULT_PUBSUB_PORT,
-		DEFAULT_MULTICAST_INTERFACE
+		DEFAULT_MULTICAST_INTERFACE, DEFAULT_DISPATCH_PORT,
+		DEFAULT_ASSIGNMENTS_IN_FLIGHT, DEFAULT_WIRE_FORMAT, DEFAULT_FAIR_SHARE
 		);
+	return help + interp(
+		"      --keepalive or -k  -- Give up on a silent worker after this many ms\n"
+		"                            (%1 is default).\n"
+		"\n",
+		DEFAULT_KEEPALIVE);
 }
 
 } // end namespace nitro
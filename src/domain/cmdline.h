@@ -7,9 +7,13 @@ namespace nitro {
 
 const int DEFAULT_REQREP_PORT = 47000;
 const int DEFAULT_PUBSUB_PORT = 47001;
+const int DEFAULT_DISPATCH_PORT = 47002;
+const int DEFAULT_ASSIGNMENTS_IN_FLIGHT = 2;
 const char * const DEFAULT_MULTICAST_INTERFACE = "eth0";
 const int DEFAULT_REPORTER_PORT = 35000;
 const int DEFAULT_KEEPALIVE = 5000;
+const char * const DEFAULT_WIRE_FORMAT = "binary";
+const char * const DEFAULT_FAIR_SHARE = "batch";
 
 /**
  * Parses nitro cmdline and provides logic to react.
@@ -0,0 +1,107 @@
+#include <string.h>
+#include <sys/wait.h>
+
+#include "base/process_reaper.h"
+
+#include "domain/completion_record.h"
+
+using std::string;
+using std::vector;
+
+namespace nitro {
+
+/**
+ * A batch is: this 4-byte magic, a uint32_t record count, a uint32_t length
+ * of the assignment id, the id itself, and then the records.
+ */
+static char const BATCH_MAGIC[4] = { '\0', 'N', 'C', 'R' };
+const size_t BATCH_HEADER_SIZE = sizeof(BATCH_MAGIC) + 2 * sizeof(uint32_t);
+
+static uint64_t to_micros(struct timeval const & tv) {
+	return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+completion_record completion_record::from_exit(task::id_type tid,
+		process_exit_info const & info) {
+	completion_record rec;
+	rec.task_id = tid;
+	if (WIFEXITED(info.status)) {
+		rec.exit_code = WEXITSTATUS(info.status);
+	} else if (WIFSIGNALED(info.status)) {
+		rec.exit_code = 128 + WTERMSIG(info.status);
+	} else {
+		rec.exit_code = -1;
+	}
+	// Linux reports ru_maxrss in kilobytes.
+	rec.max_rss_kb = static_cast<uint32_t>(info.usage.ru_maxrss);
+	rec.wall_micros = static_cast<uint64_t>(info.wall_seconds * 1000000);
+	rec.user_micros = to_micros(info.usage.ru_utime);
+	rec.sys_micros = to_micros(info.usage.ru_stime);
+	return rec;
+}
+
+completion_record completion_record::from_code(task::id_type tid,
+		int exit_code) {
+	completion_record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.task_id = tid;
+	rec.exit_code = exit_code;
+	return rec;
+}
+
+string encode_completion_batch(char const * assignment_id,
+		completion_record const * records, size_t count) {
+	uint32_t n = count;
+	uint32_t id_len = strlen(assignment_id);
+	string msg;
+	msg.reserve(BATCH_HEADER_SIZE + id_len + count * sizeof(*records));
+	msg.append(BATCH_MAGIC, sizeof(BATCH_MAGIC));
+	msg.append(reinterpret_cast<char const *>(&n), sizeof(n));
+	msg.append(reinterpret_cast<char const *>(&id_len), sizeof(id_len));
+	msg.append(assignment_id, id_len);
+	msg.append(reinterpret_cast<char const *>(records),
+			count * sizeof(*records));
+	return msg;
+}
+
+bool is_completion_batch(string const & msg) {
+	return msg.size() >= BATCH_HEADER_SIZE
+			&& memcmp(msg.data(), BATCH_MAGIC, sizeof(BATCH_MAGIC)) == 0;
+}
+
+bool decode_completion_batch(string const & msg, string & assignment_id,
+		vector<completion_record> & records) {
+	size_t offset = 0;
+	return decode_completion_batch(msg, offset, assignment_id, records)
+			&& offset == msg.size();
+}
+
+bool decode_completion_batch(string const & msg, size_t & offset,
+		string & assignment_id, vector<completion_record> & records) {
+	if (offset > msg.size() || msg.size() - offset < BATCH_HEADER_SIZE
+			|| memcmp(msg.data() + offset, BATCH_MAGIC,
+					sizeof(BATCH_MAGIC)) != 0) {
+		return false;
+	}
+	auto p = msg.data() + offset + sizeof(BATCH_MAGIC);
+	uint32_t n, id_len;
+	memcpy(&n, p, sizeof(n));
+	p += sizeof(n);
+	memcpy(&id_len, p, sizeof(id_len));
+	p += sizeof(id_len);
+	auto batch_size = BATCH_HEADER_SIZE + id_len
+			+ static_cast<size_t>(n) * sizeof(completion_record);
+	if (msg.size() - offset < batch_size) {
+		return false;
+	}
+	assignment_id.assign(p, id_len);
+	p += id_len;
+	records.resize(n);
+	if (n) {
+		memcpy(&records[0], p, n * sizeof(completion_record));
+	}
+	offset += batch_size;
+	return true;
+}
+
+} // end namespace nitro
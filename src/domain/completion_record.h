@@ -0,0 +1,78 @@
+#ifndef _DOMAIN_COMPLETION_RECORD_H_
+#define _DOMAIN_COMPLETION_RECORD_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "domain/task.h"
+
+struct process_exit_info;
+
+namespace nitro {
+
+/**
+ * What a worker tells the coordinator about one finished task. Records are a
+ * fixed 40 bytes, with no padding, so a batch of them is just an array.
+ *
+ * Fields are in host byte order; we assume a cluster doesn't mix
+ * endianness.
+ */
+struct completion_record {
+	uint64_t task_id;
+	/** Exit code, or 128 + signal number if the task was killed (as in sh). */
+	int32_t exit_code;
+	uint32_t max_rss_kb;
+	uint64_t wall_micros;
+	uint64_t user_micros;
+	uint64_t sys_micros;
+
+	/**
+	 * Describe a task that ran as a child process.
+	 */
+	static completion_record from_exit(task::id_type tid,
+			process_exit_info const & info);
+
+	/**
+	 * Describe a task about which we know only its outcome (e.g., one that
+	 * we couldn't start, or one that was simulated).
+	 */
+	static completion_record from_code(task::id_type tid, int exit_code);
+};
+
+static_assert(sizeof(completion_record) == 40,
+		"completion_record must be fixed-size and unpadded.");
+
+/**
+ * Pack records for tasks in a single assignment into one message. Batches
+ * begin with a NUL byte, so they can't be mistaken for json.
+ */
+std::string encode_completion_batch(char const * assignment_id,
+		completion_record const * records, size_t count);
+
+/**
+ * Does @param msg look like the output of encode_completion_batch()?
+ */
+bool is_completion_batch(std::string const & msg);
+
+/**
+ * Unpack a batch.
+ *
+ * @return false if the batch is truncated or otherwise malformed.
+ */
+bool decode_completion_batch(std::string const & msg,
+		std::string & assignment_id, std::vector<completion_record> & records);
+
+/**
+ * Unpack the batch that starts at @param offset, and advance @param offset
+ * past it. Batches sent as the parts of one message arrive concatenated;
+ * decode them in turn until @param offset reaches the end.
+ *
+ * @return false if there is no well-formed batch at @param offset.
+ */
+bool decode_completion_batch(std::string const & msg, size_t & offset,
+		std::string & assignment_id, std::vector<completion_record> & records);
+
+} // end namespace nitro
+
+#endif // sentry
@@ -1,10 +1,16 @@
 #include <algorithm>
+#include <chrono>
+#include <deque>
 #include <map>
 #include <mutex>
 #include <queue>
+#include <random>
+#include <set>
 #include <vector>
 #include <thread>
 
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -12,20 +18,27 @@
 #include "base/file_lines.h"
 #include "base/guid.h"
 #include "base/strutil.h"
+#include "base/timing_wheel.h"
 #include "base/xlog.h"
 
 #include "domain/assignment.h"
+#include "domain/batch_scheduler.h"
 #include "domain/cmdline.h"
+#include "domain/completion_record.h"
 #include "domain/coord_engine.h"
 #include "domain/event_codes.h"
+#include "domain/event_loop.h"
 #include "domain/msg.h"
+#include "domain/wire.h"
 #include "domain/zmq_helpers.h"
 
 #include "json/json.h"
 
 #include "zeromq/include/zmq.h"
 
+using std::chrono::high_resolution_clock;
 using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
 using std::map;
 using std::mutex;
@@ -37,26 +50,311 @@ using namespace nitro::event_codes;
 
 namespace nitro {
 
+const unsigned MAX_ASSIGNMENT_SIZE = 1000;
+const double TARGET_SECONDS_PER_ASSIGNMENT = 10.0;
+const unsigned MIN_RUNTIME_SAMPLES = 20;
+const double STRAGGLER_FACTOR = 2.0;
+const double MIN_STRAGGLER_SECONDS = 1.0;
+
 typedef map<string, assignment::handle> asgn_map_t;
+typedef high_resolution_clock::time_point time_point_t;
+
+// The batch and line each task of an assignment came from, by task id - 1.
+typedef std::vector<std::pair<unsigned, size_t>> origins_t;
+
+/**
+ * Remember when we sent an assignment, and how much work we thought it held,
+ * so we can measure how fast its worker gets through it.
+ */
+struct dispatch_t {
+	time_point_t sent;
+	// When we last heard that one of its tasks finished (or when we sent
+	// it, if we haven't).
+	time_point_t progressed;
+	double work;
+};
+
+/**
+ * How long tasks really run, as a multiple of their estimated walltime. We
+ * keep a window of recent samples, and sort out percentiles only when
+ * asked.
+ */
+struct runtime_stats {
+	static const size_t WINDOW = 1000;
+	std::vector<double> samples;
+	size_t next;
+	double p95;
+	bool p95_stale;
+
+	runtime_stats() : next(0), p95(0), p95_stale(false) {
+	}
+
+	void add(double ratio) {
+		if (samples.size() < WINDOW) {
+			samples.push_back(ratio);
+		} else {
+			samples[next] = ratio;
+			next = (next + 1) % WINDOW;
+		}
+		p95_stale = true;
+	}
+
+	size_t size() const {
+		return samples.size();
+	}
+
+	double get_p95() {
+		if (p95_stale && !samples.empty()) {
+			auto sorted = samples;
+			auto nth = sorted.begin() + (sorted.size() - 1) * 95 / 100;
+			std::nth_element(sorted.begin(), nth, sorted.end());
+			p95 = *nth;
+			p95_stale = false;
+		}
+		return p95;
+	}
+};
+
+// A task, by the id of its assignment and its id within that assignment.
+typedef std::pair<string, task::id_type> task_key;
+
+/**
+ * The other copy of a task that we're running twice, and the worker that's
+ * running it.
+ */
+struct twin_t {
+	task_key key;
+	string worker;
+};
+
+/**
+ * What we know about a worker that has enrolled over the dispatch channel.
+ */
+struct worker_t {
+	// Assignments we've sent that the worker hasn't yet completed.
+	map<string, dispatch_t> outstanding;
+	unsigned completed_count;
+	unsigned failed_task_count;
+	// How many tasks the worker runs at once, as it told us in its last
+	// request for work.
+	unsigned slots;
+	// Set when the worker has asked for work and we haven't yet answered.
+	bool needs_work;
+	time_point_t requested;
+	time_point_t last_completion;
+	// Estimated walltime seconds of work the worker finishes per second;
+	// 0 until we've seen it complete something.
+	double throughput;
+	// How we send it messages, as negotiated when it enrolled.
+	wire_format format;
+	// When it last sent us anything at all.
+	steady_clock::time_point last_heard;
+
+	worker_t() : completed_count(0), failed_task_count(0), slots(1),
+			needs_work(false),
+			throughput(0), format(wf_json) {
+	}
+
+	void record_completion(dispatch_t const & d, time_point_t now) {
+		// If the worker was already busy when we sent this assignment, it
+		// couldn't start on it until it finished the previous one.
+		auto start = std::max(d.sent, last_completion);
+		double elapsed = std::chrono::duration<double>(now - start).count();
+		if (elapsed > 0) {
+			double sample = d.work / elapsed;
+			throughput = throughput > 0 ? 0.7 * throughput + 0.3 * sample
+					: sample;
+		}
+		last_completion = now;
+		++completed_count;
+	}
+};
+
+// Keyed by the identity of the worker's dealer socket.
+typedef map<string, worker_t> worker_map_t;
+
+// How many ticks make up the keepalive period on our liveness wheel, and
+// how many slots the wheel has.
+const unsigned LIVENESS_TICKS_PER_KEEPALIVE = 10;
+const unsigned LIVENESS_SLOTS = 64;
 
 struct coord_engine::data_t {
 
-	std::unique_ptr<file_lines> current_batch_file;
+	// Every batch we've started on; lines come out highest priority first,
+	// shared fairly among batches.
+	batch_scheduler scheduler;
+	// Batches from the command line that we haven't given the scheduler yet.
+	queue<string> batches;
+	// Where to begin the first batch; only it can be resumed partway
+	// through.
+	size_t start_line;
 	stringlist_t hostlist;
 	asgn_map_t assignments;
+	// Keyed like assignments, for those we made from batches.
+	map<string, origins_t> origins;
 	mutex asgn_mutex;
-	queue<string> batches;
-	void * requester;
-	stringlist_t workers;
+	void * dispatcher;
+	worker_map_t workers;
 	bool simulate_workers;
+	uint64_t completed_task_count;
+	uint64_t failed_task_count;
+	// The best format we'll agree to on the dispatch channel.
+	wire_format wire;
+	// Set when someone asks us, over the responder, to stop.
+	bool terminate_requested;
+	runtime_stats runtimes;
+	// Tasks we've copied to a second worker, each mapped to its twin.
+	map<task_key, twin_t> twins;
+	// Tasks that lost the race to their twins; we ignore their results.
+	std::set<task_key> cancelled;
+	uint64_t speculated_task_count;
+	// How long a worker may be silent before we give up on it, and the
+	// wheel that tells us when one has been.
+	milliseconds keepalive;
+	timing_wheel<string> liveness;
+	// Unfinished tasks taken back from workers we gave up on. They go out
+	// again before anything else.
+	std::deque<pending_task> reclaimed;
+	// Workers we gave up on. If one turns out to be alive after all, we
+	// tell it to stop; its work has gone elsewhere.
+	std::set<string> lost_workers;
+	uint64_t reclaimed_task_count;
 
-	data_t() :
-			requester(0), simulate_workers(false) {
+	data_t(fair_share_policy policy, milliseconds keepalive) :
+			scheduler(policy),
+			start_line(1), dispatcher(0), simulate_workers(false),
+			completed_task_count(0),
+			failed_task_count(0), wire(wf_json), terminate_requested(false),
+			speculated_task_count(0), keepalive(keepalive),
+			liveness(keepalive / LIVENESS_TICKS_PER_KEEPALIVE, LIVENESS_SLOTS),
+			reclaimed_task_count(0) {
 	}
+
+	void ingest_batches();
+	void submit_batches(event_loop & loop);
+	bool has_work() const;
+	void note_task_ran(string const & aid, task::id_type tid);
+	void forget(asgn_map_t::iterator a);
+	void log_progress();
 };
 
+/**
+ * Hand every batch we haven't yet indexed to the scheduler.
+ */
+void coord_engine::data_t::ingest_batches() {
+	while (!batches.empty()) {
+		auto path = batches.front().c_str();
+		if (start_line > 1) {
+			xlog("Resuming batch \"%1\" at line %2.", path, start_line);
+		}
+		scheduler.add_batch(path, start_line);
+		start_line = 1;
+		batches.pop();
+	}
+}
+
+/**
+ * Like ingest_batches(), but index each batch on a reader thread, so we can
+ * start handing out lines from small batches while big ones are still being
+ * read. Each reader wakes @param loop when its batch is ready.
+ */
+void coord_engine::data_t::submit_batches(event_loop & loop) {
+	while (!batches.empty()) {
+		auto const & path = batches.front();
+		if (start_line > 1) {
+			xlog("Resuming batch \"%1\" at line %2.", path, start_line);
+		}
+		scheduler.submit(path, start_line, 1.0, [&loop] { loop.wake(); });
+		start_line = 1;
+		batches.pop();
+	}
+}
+
+/**
+ * Do we have lines to hand out, or are we about to?
+ */
+bool coord_engine::data_t::has_work() const {
+	return !reclaimed.empty() || !batches.empty() || !scheduler.empty()
+			|| scheduler.is_ingesting();
+}
+
+/**
+ * Tell the scheduler that a task from one of our batches has run. Call with
+ * asgn_mutex held.
+ */
+void coord_engine::data_t::note_task_ran(string const & aid,
+		task::id_type tid) {
+	auto o = origins.find(aid);
+	if (o != origins.end() && tid >= 1 && tid <= o->second.size()) {
+		auto & origin = o->second[tid - 1];
+		scheduler.complete(origin.first, origin.second);
+	}
+}
+
+/**
+ * Stop tracking an assignment. Call with asgn_mutex held.
+ */
+void coord_engine::data_t::forget(asgn_map_t::iterator a) {
+	origins.erase(a->first);
+	assignments.erase(a);
+}
+
+/**
+ * Log where each batch that has made progress could be resumed, so that if
+ * we're stopped, a rerun needn't start over.
+ */
+void coord_engine::data_t::log_progress() {
+	for (auto & point : scheduler.get_progress()) {
+		if (point.finished) {
+			xlog("Every line of batch \"%1\" has run.", point.path);
+		} else {
+			xlog("Lines of batch \"%1\" before %2 have run; to resume it,"
+					" put it first and add --startline %2.", point.path,
+					point.line);
+		}
+	}
+}
+
+/**
+ * Give a task we're sending out again the origin of its first copy, task
+ * @param tid of assignment @param aid. Call with asgn_mutex held.
+ */
+static void set_origin(pending_task & pt, map<string, origins_t> const & all,
+		string const & aid, task::id_type tid) {
+	auto o = all.find(aid);
+	if (o != all.end() && tid >= 1 && tid <= o->second.size()) {
+		pt.batch = o->second[tid - 1].first;
+		pt.line = o->second[tid - 1].second;
+	} else {
+		// No batch has this id, so complete() will ignore it.
+		pt.batch = UINT_MAX;
+		pt.line = 0;
+	}
+}
+
+/**
+ * Split the text of a NITRO_BATCH_SUBMITTED message, which is the path of
+ * the batch, optionally preceded by "weight=N ".
+ */
+static void parse_submission(string const & message, string & path,
+		double & weight) {
+	static const string WEIGHT_PREFIX = "weight=";
+	weight = 1.0;
+	path = message;
+	if (message.compare(0, WEIGHT_PREFIX.size(), WEIGHT_PREFIX) == 0) {
+		auto space = message.find(' ');
+		if (space != string::npos) {
+			weight = strtod(message.c_str() + WEIGHT_PREFIX.size(), nullptr);
+			path = message.substr(space + 1);
+		}
+	}
+}
+
 coord_engine::coord_engine(cmdline const & cmdline) :
-		engine(cmdline), data(new data_t) {
+		engine(cmdline), data(new data_t(parse_fair_share_policy(
+				cmdline.get_option("--fairshare", DEFAULT_FAIR_SHARE)),
+				milliseconds(std::max(1, cmdline.get_option_as_int(
+						"--keepalive", DEFAULT_KEEPALIVE))))) {
 
 	init_hosts(cmdline);
 	bind_after_ctor("c");
@@ -64,6 +362,16 @@ coord_engine::coord_engine(cmdline const & cmdline) :
 	for (auto batch: batches) {
 		data->batches.push(batch);
 	}
+	data->simulate_workers = cmdline.has_flag("--simulate");
+	data->wire = parse_wire_format(cmdline.get_option("--wire",
+			DEFAULT_WIRE_FORMAT));
+	data->start_line = std::max(1, cmdline.get_option_as_int("--startline", 1));
+
+	auto dispatch_port = cmdline.get_option_as_int("--dpport",
+			DEFAULT_DISPATCH_PORT);
+	data->dispatcher = zmq_socket(ctx, ZMQ_ROUTER);
+	zmq_bind_and_log(data->dispatcher,
+			interp(TCP_BIND_ENDPOINT_PATTERN, dispatch_port).c_str());
 
 #if 0
 	// bind socket for remote connections
@@ -79,16 +387,14 @@ coord_engine::coord_engine(cmdline const & cmdline) :
 }
 
 coord_engine::~coord_engine() {
+	zmq_close_now(data->dispatcher);
 	delete data;
 }
 
-void coord_engine::add_assignment(assignment * ) {
-#if 0
+void coord_engine::add_assignment(assignment * asgn) {
 	if (!asgn) return;
 	lock_guard<mutex> lock(data->asgn_mutex);
-	assignment::handle x(asgn);
-	data->assignments.insert({asgn->get_id(), x});
-#endif
+	data->assignments[asgn->get_id()] = assignment::handle(asgn);
 }
 
 bool coord_engine::get_simulate_workers() const {
@@ -99,170 +405,534 @@ void coord_engine::set_simulate_workers(bool value) {
 	data->simulate_workers = value;
 }
 
+unsigned coord_engine::get_worker_count() const {
+	return data->workers.size();
+}
+
+uint64_t coord_engine::get_completed_task_count() const {
+	return data->completed_task_count;
+}
+
+uint64_t coord_engine::get_failed_task_count() const {
+	return data->failed_task_count;
+}
+
+uint64_t coord_engine::get_speculated_task_count() const {
+	return data->speculated_task_count;
+}
+
+uint64_t coord_engine::get_reclaimed_task_count() const {
+	return data->reclaimed_task_count;
+}
+
 void coord_engine::enroll_workers_multi(int eid) {
-	static const string cfm_port = "50000";
+	// Subscribers filter on topic, so the topic has to lead the frame.
+	auto msg = interp("%1%2", COORDINATION_TOPIC, serialize_msg(eid));
+	send_full_msg(publisher, std::move(msg));
+}
 
-	if (get_simulate_workers()) {
-		return;
+void coord_engine::handle_dispatch_msg(string const & identity, int code,
+		string const & message) {
+	switch (code) {
+	case NITRO_AFFIRM_HELP:
+		if (data->workers.find(identity) == data->workers.end()) {
+			// A worker's affirmation names the formats it can read besides
+			// json. We accept by sending binary; it follows our lead.
+			worker_t wk;
+			if (data->wire == wf_binary
+					&& message == get_wire_format_name(wf_binary)) {
+				wk.format = wf_binary;
+			}
+			data->workers[identity] = wk;
+			xlog("Worker %1 enrolled; speaking %2.", identity,
+					get_wire_format_name(wk.format));
+		}
+		break;
+	case NITRO_NEED_ASSIGNMENT:
+		{
+			auto w = data->workers.find(identity);
+			if (w != data->workers.end()) {
+				auto slots = atoi(message.c_str());
+				w->second.slots = std::max(1, slots);
+				w->second.needs_work = true;
+				w->second.requested = high_resolution_clock::now();
+			}
+		}
+		break;
+	case NITRO_ACCEPT_ASSIGNMENT:
+	case NITRO_PING_RESPONSE:
+		// Hearing from the worker at all is what matters.
+		break;
+	case NITRO_1ASSIGNMENT_COMPLETE:
+		{
+			auto const & aid = message;
+			auto w = data->workers.find(identity);
+			if (w != data->workers.end()) {
+				auto d = w->second.outstanding.find(aid);
+				if (d != w->second.outstanding.end()) {
+					w->second.record_completion(d->second,
+							high_resolution_clock::now());
+					w->second.outstanding.erase(d);
+				}
+			}
+			// Normally we forgot the assignment when its last record
+			// arrived; this is for workers that don't send records.
+			lock_guard<mutex> lock(data->asgn_mutex);
+			auto a = data->assignments.find(aid);
+			if (a != data->assignments.end()) {
+				auto o = data->origins.find(aid);
+				if (o != data->origins.end()) {
+					for (size_t i = 0; i < o->second.size(); ++i) {
+						data->note_task_ran(aid, i + 1);
+					}
+				}
+				data->forget(a);
+			}
+		}
+		break;
+	default:
+		xlog("Unexpected message %1 (%2) from worker %3.",
+				events::get_std_id_repr(code), events::catalog().get_msg(code),
+				identity);
 	}
+}
 
-	// Clear workers list
-	data->workers.clear();
-
-	string json_msg = serialize_msg(eid, cfm_port);
-	zmq_msg_t msg, msg_copy;
-
-	// Create 2 copy of message
-	auto topic_len = strlen(COORDINATION_TOPIC);
-	auto total_len = json_msg.size() + topic_len;
-	zmq_msg_init_size(&msg, total_len);
-	zmq_msg_init_size(&msg_copy, total_len);
-	memcpy(zmq_msg_data(&msg), COORDINATION_TOPIC, topic_len);
-	memcpy((char *) zmq_msg_data(&msg) + topic_len, json_msg.c_str(),
-			json_msg.size());
-	zmq_msg_copy(&msg_copy, &msg);
-
-	// Send messages
-	int rc = zmq_sendmsg(publisher, &msg, 0);
-	xlog("message sending: %1", rc);
-
-	// Wait for the workers responses
-	void *cfm = zmq_socket(ctx, ZMQ_PULL);
-	if (cfm) {
-		string endpoint = interp("tcp://*:", cfm_port);
-		zmq_bind(cfm, endpoint.c_str());
-
-		zmq_pollitem_t items[1];
-		items[0].socket = cfm;
-		items[0].events = ZMQ_POLLIN;
-
-		// Stop wating workers if no connection for 5 sec
-		xlog("waiting confirmations from workers...");
-		while ((rc = zmq_poll(items, sizeof(items) / sizeof(items[0]), 5000))
-				> 0) {
-			for (unsigned i = 0; i < sizeof(items) / sizeof(items[0]);
-					i++) {
-				if (items[i].revents & ZMQ_POLLIN) {
-					Json::Value root;
-					string json = receive_full_msg(items[i].socket);
-
-					if (deserialize_msg(json, root)) {
-						data->workers.push_back(
-								root["body"]["message"].asCString());
-						xlog("Got response from worker: %1",
-								root["body"]["message"].asCString());
-					}
+void coord_engine::handle_completion_batch(string const & identity,
+		string const & batch) {
+	string aid;
+	std::vector<completion_record> records;
+	auto w = data->workers.find(identity);
+	auto now = high_resolution_clock::now();
+	// A worker may send batches for several assignments in one message.
+	for (size_t offset = 0; offset < batch.size();) {
+		if (!decode_completion_batch(batch, offset, aid, records)) {
+			xlog("Discarded malformed completion records from worker %1.",
+					identity);
+			return;
+		}
+		if (w != data->workers.end()) {
+			auto d = w->second.outstanding.find(aid);
+			if (d != w->second.outstanding.end()) {
+				d->second.progressed = now;
+			}
+		}
+		lock_guard<mutex> lock(data->asgn_mutex);
+		auto a = data->assignments.find(aid);
+		for (auto & rec : records) {
+			task_key key(aid, rec.task_id);
+			if (data->cancelled.erase(key)) {
+				// Its twin finished first, and has been counted.
+				continue;
+			}
+			if (a != data->assignments.end()) {
+				auto t = a->second->get_task(rec.task_id);
+				if (t && t->get_walltime_seconds() > 0) {
+					data->runtimes.add(rec.wall_micros / 1e6
+							/ t->get_walltime_seconds());
 				}
+				a->second->complete_task(rec.task_id, rec.exit_code);
 			}
+			data->note_task_ran(aid, rec.task_id);
+			settle_twins(key, rec.exit_code);
+			++data->completed_task_count;
+			if (rec.exit_code != 0) {
+				++data->failed_task_count;
+				if (w != data->workers.end()) {
+					++w->second.failed_task_count;
+				}
+				xlog(events::catalog().get_msg(
+						NITRO_1TASK_IN_2ASSIGNMENT_ON_3WORKER_FAILED_4CODE),
+						rec.task_id, aid, identity, rec.exit_code);
+			}
+		}
+		// Once every task is accounted for, whether by this worker or by
+		// twins elsewhere, the assignment is done.
+		if (a != data->assignments.end() && a->second->is_complete()) {
+			data->forget(a);
 		}
+	}
+}
 
-		zmq_close_now(cfm);
-		xlog("... done waiting confirmations from workers");
+void coord_engine::settle_twins(task_key const & key, int exit_code) {
+	auto t = data->twins.find(key);
+	if (t == data->twins.end()) {
+		return;
+	}
+	auto twin = t->second;
+	data->twins.erase(t);
+	data->twins.erase(twin.key);
 
-		// TODO: connect directly to missed workerks
+	// The first copy to finish speaks for both.
+	auto a = data->assignments.find(twin.key.first);
+	if (a != data->assignments.end()) {
+		if (a->second->complete_task(twin.key.second, exit_code)) {
+			data->forget(a);
+		}
+	}
+	data->cancelled.insert(twin.key);
+	auto w = data->workers.find(twin.worker);
+	if (w != data->workers.end()) {
+		send_routed_msg(data->dispatcher, twin.worker, serialize_msg(
+				w->second.format, get_id(), NITRO_CANCEL_1TASK_IN_2ASSIGNMENT,
+				interp("%1 %2", twin.key.second, twin.key.first)));
 	}
 }
 
-#define tryz(expr) rc = expr; if (rc) throw ERROR_EVENT(errno)
+void coord_engine::hear_from(string const & identity) {
+	auto w = data->workers.find(identity);
+	if (w != data->workers.end()) {
+		auto now = steady_clock::now();
+		w->second.last_heard = now;
+		data->liveness.schedule(identity, now + data->keepalive);
+	}
+}
 
-void coord_engine::enroll_workers(int eid) {
-	if (get_simulate_workers()) {
-		return;
+void coord_engine::check_workers() {
+	auto now = steady_clock::now();
+	std::vector<string> silent;
+	data->liveness.advance(now, silent);
+	for (auto & identity : silent) {
+		give_up_on_worker(identity);
 	}
-#if 1
-	if (data->hostlist.empty()) {
-		data->hostlist.push_back("localhost:36000");
+	// Any message counts as a heartbeat, so we only ping workers that have
+	// been quiet; a worker busy with long tasks may have nothing to say.
+	for (auto & w : data->workers) {
+		if (now - w.second.last_heard >= data->keepalive / 3) {
+			send_routed_msg(data->dispatcher, w.first, serialize_msg(
+					w.second.format, get_id(), NITRO_PING_REQUEST));
+		}
 	}
-#endif
-	if (!data->hostlist.empty()) {
-		try {
-			for (auto host : data->hostlist) {
-				data->requester = zmq_socket(ctx, ZMQ_REQ);
-				auto endpoint = interp("tcp://%1", host);
-				zmq_connect_and_log(data->requester, endpoint.c_str());
-				auto msg = serialize_msg(eid);
-				send_full_msg(data->requester, msg);
-				auto response = receive_full_msg(data->requester);
-				// TODO: check response
-				xlog("Enrolled %1.", endpoint);
-				zmq_close(data->requester);
+}
+
+void coord_engine::give_up_on_worker(string const & identity) {
+	auto w = data->workers.find(identity);
+	if (w == data->workers.end()) {
+		return;
+	}
+	size_t count = 0;
+	{
+		lock_guard<mutex> lock(data->asgn_mutex);
+		for (auto & o : w->second.outstanding) {
+			auto a = data->assignments.find(o.first);
+			if (a == data->assignments.end()) {
+				continue;
 			}
-		} catch (error_event const & e) {
-			zmq_close(data->requester);
-			throw;
+			for (auto t : a->second->get_tasks_by_status(ts_ready)) {
+				auto twin = data->twins.find(task_key(o.first, t->get_id()));
+				if (twin != data->twins.end()) {
+					// The other copy carries on alone.
+					data->twins.erase(twin->second.key);
+					data->twins.erase(twin);
+					continue;
+				}
+				pending_task pt;
+				pt.cmdline = t->get_cmdline();
+				pt.priority = t->get_priority();
+				pt.walltime = t->get_walltime_seconds();
+				set_origin(pt, data->origins, o.first, t->get_id());
+				data->reclaimed.push_back(std::move(pt));
+				++count;
+			}
+			data->forget(a);
 		}
 	}
+	xlog("Worker %1 has been silent for %2 ms; reassigning its %3 unfinished"
+			" tasks.", identity, data->keepalive.count(), count);
+	data->reclaimed_task_count += count;
+	data->lost_workers.insert(identity);
+	data->workers.erase(w);
 }
 
-coord_engine::assignment_t coord_engine::next_assignment() {
-	const auto MAX_SIZE = 1000;
-	assignment_t new_a;
-	while (true) {
-		if (!data->current_batch_file) {
-			if (data->batches.empty()) {
-				return new_a;
+void coord_engine::receive_dispatch_msgs() {
+	// Drain whatever backlog we have; the event loop only tells us that
+	// something arrived.
+	while (event_loop::has_input(data->dispatcher)) {
+		string identity;
+		auto txt = receive_routed_msg(data->dispatcher, identity);
+		if (data->lost_workers.count(identity)) {
+			send_routed_msg(data->dispatcher, identity, serialize_msg(
+					wf_json, get_id(), NITRO_TERMINATE_REQUEST));
+			continue;
+		}
+		if (is_completion_batch(txt)) {
+			handle_completion_batch(identity, txt);
+		} else if (is_wire_msg(txt)) {
+			wire_reader wire;
+			if (wire.parse(txt)) {
+				string message;
+				wire.get_string(wfld_message, message);
+				handle_dispatch_msg(identity, wire.get_code(), message);
 			} else {
-				auto fl = new file_lines(data->batches.front().c_str());
-				data->current_batch_file = std::unique_ptr < file_lines > (fl);
-				data->batches.pop();
+				xlog("Discarded malformed message from worker %1.", identity);
+			}
+		} else {
+			msg_view view;
+			if (!txt.empty() && decode_msg(txt.data(), txt.data() + txt.size(),
+					view)) {
+				handle_dispatch_msg(identity, view.code, view.message.str());
 			}
 		}
-		while (true) {
-			auto line = data->current_batch_file->next();
-			if (line) {
-				if (!new_a) {
-					new_a = assignment_t(new stringlist_t);
-				}
-				new_a->push_back(line);
-				if (new_a->size() >= MAX_SIZE) {
-					return new_a;
-				}
+		hear_from(identity);
+	}
+}
+
+void coord_engine::receive_submissions() {
+	while (event_loop::has_input(responder)) {
+		auto txt = receive_full_msg(responder);
+		msg_view view;
+		string reply;
+		if (txt.empty() || !decode_msg(txt.data(), txt.data() + txt.size(),
+				view)) {
+			reply = serialize_msg(NITRO_DENY_HELP_1REASON, "malformed message");
+		} else if (view.code == NITRO_BATCH_SUBMITTED) {
+			string path;
+			double weight;
+			parse_submission(view.message.str(), path, weight);
+			// Reading happens later, on another thread; catch the obvious
+			// mistakes while we can still tell the submitter.
+			if (path.empty() || access(path.c_str(), R_OK) != 0) {
+				reply = serialize_msg(NITRO_DENY_HELP_1REASON,
+						interp("can't read batch \"%1\"", path));
 			} else {
-				data->current_batch_file.reset();
+				xlog("Batch \"%1\" submitted.", path);
+				auto & loop = get_event_loop();
+				data->scheduler.submit(path, 1, weight, [&loop] { loop.wake(); });
+				reply = serialize_msg(NITRO_BATCH_SUBMITTED, path);
 			}
+		} else if (view.code == NITRO_TERMINATE_REQUEST) {
+			data->terminate_requested = true;
+			reply = serialize_msg(NITRO_TERMINATE_REQUEST);
+		} else {
+			reply = serialize_msg(NITRO_DENY_HELP_1REASON,
+					interp("unexpected message %1",
+							events::get_std_id_repr(view.code)));
 		}
+		// A REP socket won't receive again until we've replied.
+		send_full_msg(responder, std::move(reply));
 	}
 }
 
-void coord_engine::prioritize(assignment_t & asgn) {
-	struct priority_func {
-		int operator ()(string const & a, string const & b) {
-			// Here we could parse strings a and b and see if userprio was set,
-			// and generate a sort key for each. In the long run, we probably
-			// want to change the assignment_t datatype so it's not a list of
-			// strings, but rather a list of parsed data that already has
-			// sort key calculated.
-			return a.size() - b.size();
+coord_engine::assignment_t coord_engine::next_assignment(unsigned max_lines,
+		double max_work, unsigned min_lines) {
+	data->ingest_batches();
+	assignment_t new_a;
+	double work = 0;
+	pending_task pt;
+	auto next = [this](pending_task & pt) {
+		if (data->reclaimed.empty()) {
+			return data->scheduler.next(pt);
 		}
+		pt = std::move(data->reclaimed.front());
+		data->reclaimed.pop_front();
+		return true;
 	};
-	std::sort((*asgn).begin(), (*asgn).end(), priority_func());
+	while (next(pt)) {
+		if (!new_a) {
+			new_a = assignment_t(new tasklist_t);
+		}
+		work += pt.walltime;
+		new_a->push_back(std::move(pt));
+		auto n = new_a->size();
+		if (n >= max_lines || (max_work > 0 && work >= max_work
+				&& n >= min_lines)) {
+			break;
+		}
+	}
+	return new_a;
 }
 
-void coord_engine::distribute(assignment_t & asgn) {
-	if (get_simulate_workers()) {
-		return;
+void coord_engine::prioritize(assignment_t & asgn) {
+	// Workers start tasks in the order we send them, so the same rule that
+	// packs assignments applies inside each one.
+	std::stable_sort(asgn->begin(), asgn->end(),
+			[](pending_task const & a, pending_task const & b) {
+				return a.priority != b.priority ? a.priority > b.priority
+						: a.walltime > b.walltime;
+			});
+}
+
+string coord_engine::distribute(assignment_t & asgn,
+		string const & worker_id) {
+	PRECONDITION(asgn);
+	auto w = data->workers.find(worker_id);
+	PRECONDITION(w != data->workers.end());
+	auto a = new assignment(nullptr);
+	task::id_type n = 0;
+	dispatch_t d;
+	d.work = 0;
+	origins_t origins;
+	origins.reserve(asgn->size());
+	for (auto & pt : *asgn) {
+		// The scheduler only hands out tasks, so this shouldn't happen; but
+		// if it does, the line can't run, and mustn't leave a gap in ids.
+		if (!a->ready_task(n + 1, pt.cmdline.c_str())) {
+			xlog("Dropped \"%1\"; it isn't a task.", pt.cmdline);
+			continue;
+		}
+		++n;
+		d.work += pt.walltime;
+		origins.push_back(std::make_pair(pt.batch, pt.line));
 	}
-	auto host = data->hostlist.begin();
-	for (auto cmd : *asgn) {
-		auto endpoint = interp("tcp://%1", *host);
-		void * requester = 0;
-		try {
-			requester = zmq_socket(ctx, ZMQ_REQ);
-			int rc;
-			tryz(zmq_connect(requester, endpoint.c_str()));
-			auto msg = serialize_msg(NITRO_HERE_IS_ASSIGNMENT, cmd);
-			send_full_msg(requester, msg);
-			// Process ACK
-			receive_full_msg(requester);
-			++host;
-			if (host == data->hostlist.end()) {
-				host = data->hostlist.begin();
+	send_routed_msg(data->dispatcher, worker_id,
+			a->get_request_msg(w->second.format, get_id()));
+	d.sent = high_resolution_clock::now();
+	d.progressed = d.sent;
+	string aid = a->get_id();
+	w->second.outstanding[aid] = d;
+	w->second.needs_work = false;
+	add_assignment(a);
+	{
+		lock_guard<mutex> lock(data->asgn_mutex);
+		data->origins[aid].swap(origins);
+	}
+	asgn.reset();
+	return aid;
+}
+
+bool coord_engine::speculate(string const & worker_id) {
+	auto & stats = data->runtimes;
+	if (stats.size() < MIN_RUNTIME_SAMPLES) {
+		return false;
+	}
+	auto p95 = stats.get_p95();
+	auto now = high_resolution_clock::now();
+	auto slots = data->workers[worker_id].slots;
+
+	assignment_t copies;
+	std::vector<twin_t> originals;
+	auto full = [&] { return copies && copies->size() >= slots; };
+	{
+		lock_guard<mutex> lock(data->asgn_mutex);
+		for (auto w = data->workers.begin(); w != data->workers.end()
+				&& !full(); ++w) {
+			if (w->first == worker_id) {
+				continue;
+			}
+			// A worker starts its assignments' tasks in the order we sent
+			// them, and may hold more than one at a time. A task has
+			// surely started only if, counting from the worker's oldest
+			// assignment, it falls within the worker's slots. Every task
+			// that has started has been running at least since the worker
+			// last finished anything.
+			typedef std::pair<dispatch_t const *, asgn_map_t::iterator> held_t;
+			std::vector<held_t> held;
+			auto latest = w->second.last_completion;
+			for (auto & o : w->second.outstanding) {
+				auto a = data->assignments.find(o.first);
+				if (a != data->assignments.end()) {
+					held.push_back(std::make_pair(&o.second, a));
+				}
+				latest = std::max(latest, o.second.progressed);
+			}
+			std::sort(held.begin(), held.end(),
+					[](held_t const & x, held_t const & y) {
+				return x.first->sent < y.first->sent;
+			});
+			auto elapsed = std::chrono::duration<double>(now - latest).count();
+			unsigned unfinished = 0;
+			for (auto h = held.begin(); h != held.end() && !full(); ++h) {
+				auto & a = h->second;
+				unsigned complete;
+				unfinished += a->second->get_counts(&complete) - complete;
+				if (unfinished > w->second.slots) {
+					break;
+				}
+				for (auto t : a->second->get_tasks_by_status(ts_ready)) {
+					task_key key(a->first, t->get_id());
+					auto limit = std::max(MIN_STRAGGLER_SECONDS,
+							STRAGGLER_FACTOR * p95 * t->get_walltime_seconds());
+					if (elapsed <= limit || data->twins.count(key)) {
+						continue;
+					}
+					if (!copies) {
+						copies = assignment_t(new tasklist_t);
+					}
+					pending_task pt;
+					pt.cmdline = t->get_cmdline();
+					pt.priority = t->get_priority();
+					pt.walltime = t->get_walltime_seconds();
+					set_origin(pt, data->origins, a->first, t->get_id());
+					copies->push_back(std::move(pt));
+					twin_t original = { key, w->first };
+					originals.push_back(original);
+					if (full()) {
+						break;
+					}
+				}
+			}
+		}
+	}
+	if (!copies) {
+		return false;
+	}
+
+	auto aid = distribute(copies, worker_id);
+	xlog("Rerunning %1 straggling tasks on worker %2.", originals.size(),
+			worker_id);
+	for (size_t i = 0; i < originals.size(); ++i) {
+		// distribute() numbers tasks from 1, in order.
+		twin_t copy = { task_key(aid, i + 1), worker_id };
+		data->twins[originals[i].key] = copy;
+		data->twins[copy.key] = originals[i];
+	}
+	data->speculated_task_count += originals.size();
+	return true;
+}
+
+/**
+ * Find the worker that has been waiting longest for work, and send it an
+ * assignment sized to how fast it's been going.
+ *
+ * @return false if no worker is waiting, or if we have no more work.
+ */
+bool coord_engine::answer_work_request() {
+	auto w = data->workers.end();
+	for (auto i = data->workers.begin(); i != data->workers.end(); ++i) {
+		if (i->second.needs_work && (w == data->workers.end()
+				|| i->second.requested < w->second.requested)) {
+			w = i;
+		}
+	}
+	if (w == data->workers.end()) {
+		return false;
+	}
+
+	worker_t const & wk = w->second;
+	unsigned max_lines = MAX_ASSIGNMENT_SIZE;
+	double max_work = 0;
+	if (wk.throughput > 0) {
+		max_work = wk.throughput * TARGET_SECONDS_PER_ASSIGNMENT;
+	} else {
+		// Until we've measured a worker, give it a small probe: enough to
+		// fill its slots a couple of times.
+		max_lines = std::min(max_lines, wk.slots * 2);
+	}
+
+	// Near the end of our work, shrink assignments so what remains is spread
+	// across all workers rather than stranded on one.
+	auto & sched = data->scheduler;
+	if (!sched.empty() && data->batches.empty() && !sched.is_ingesting()) {
+		auto shares = 2 * data->workers.size();
+		unsigned share = static_cast<unsigned>(sched.get_lines_left() / shares);
+		max_lines = std::min(max_lines, std::max(share, wk.slots));
+		if (max_work > 0 && sched.get_work_left() > 0) {
+			max_work = std::min(max_work, sched.get_work_left() / shares);
+		}
+	}
+
+	auto asgn = next_assignment(max_lines, max_work, wk.slots);
+	if (!asgn) {
+		// Out of fresh work. Whoever's idle can race the stragglers.
+		for (auto & i : data->workers) {
+			if (i.second.needs_work && speculate(i.first)) {
+				return true;
 			}
-			zmq_close(requester);
-		} catch (error_event const & e) {
-			zmq_close(requester);
 		}
+		return false;
 	}
+	prioritize(asgn);
+	distribute(asgn, w->first);
+	return true;
 }
 
 void coord_engine::progress_reporter() {
@@ -308,10 +978,7 @@ void sim_thread_main(assignment * asgn, mutex * mtx, unsigned * count_completed,
 	}
 }
 
-int coord_engine::do_run() {
-
-#define SIMULATE 1
-#if SIMULATE
+int coord_engine::simulate() {
 
 	if (data->batches.empty()) {
 		xlog("No batch files specified on command line.");
@@ -370,39 +1037,81 @@ int coord_engine::do_run() {
 		xlog("Batch complete.\n");
 	}
 
+	return 0;
+}
+
+int coord_engine::do_run() {
+
+	if (get_simulate_workers()) {
+		return simulate();
+	}
 
-#else
 	report_progress = true;
 	std::thread t1(&coord_engine::progress_reporter, this);
 
-	// This is totally the wrong way to do dispatch of assignments. I'm
-	// completely abusing zmq by short-circuiting its own fair share routing
-	// and by creating and destroying sockets right and left. I've only done
-	// it this way to get some logic running that I can improve incrementally.
+	// Keep asking for help for as long as we have work to hand out. PUB/SUB
+	// drops anything published before a subscriber connects, so a single
+	// broadcast would miss workers that start after we do.
+	const auto ENROLL_INTERVAL = milliseconds(1000);
+	event_loop & loop = get_event_loop();
+	loop.add_socket(data->dispatcher);
+	loop.add_socket(responder);
+	// The timer also paces our heartbeats, so a short keepalive makes it
+	// tick faster.
+	loop.set_timer(std::max(milliseconds(1),
+			std::min(ENROLL_INTERVAL, data->keepalive / 3)));
 
-	enroll_workers_multi(NITRO_REQUEST_HELP);
-	enroll_workers(NITRO_REQUEST_HELP);
+	// All our batches are read at once, each on its own thread, so a giant
+	// batch doesn't keep workers from the small ones queued behind it.
+	data->submit_batches(loop);
 
-	while (true) {
-		auto assignment = next_assignment();
-		if (!assignment) {
+	// Nothing changes except when a worker talks to us, a batch is submitted
+	// or finishes indexing, or it's time to enroll again; sleep until one of
+	// those happens.
+	while (!data->terminate_requested) {
+		while (answer_work_request()) {
+		}
+		auto more_work = data->has_work() || !data->assignments.empty();
+
+		// If we're lingering, more batches may be submitted; wait for them
+		// until we're told to stop.
+		if (!more_work && !get_linger()) {
 			break;
 		}
-		prioritize(assignment);
-		// who's not busy?
-		distribute(assignment);
+
+		// Each tick, we also look again for stragglers (when we next try to
+		// answer a work request).
+		auto woke_for = loop.wait();
+		if (woke_for & event_loop::el_timer) {
+			// Until the last assignment is done, keep enrolling; a worker
+			// that joins late can still take reclaimed work, or race a
+			// straggler.
+			if (more_work) {
+				enroll_workers_multi(NITRO_REQUEST_HELP);
+			}
+			check_workers();
+			data->log_progress();
+		}
+		if (woke_for & event_loop::el_input) {
+			receive_dispatch_msgs();
+			receive_submissions();
+		}
 	}
 
-	enroll_workers(NITRO_TERMINATE_REQUEST);
-	std::this_thread::sleep_for(milliseconds(100));
-	int linger = 0;
-	zmq_setsockopt(data->requester, ZMQ_LINGER, &linger, sizeof(linger));
-	zmq_close(data->requester);
+	for (auto & w : data->workers) {
+		send_routed_msg(data->dispatcher, w.first, serialize_msg(
+				w.second.format, get_id(), NITRO_TERMINATE_REQUEST));
+	}
+	// Give our goodbyes a chance to be delivered before the socket closes.
+	int linger = 1000;
+	zmq_setsockopt(data->dispatcher, ZMQ_LINGER, &linger, sizeof(linger));
+	zmq_close(data->dispatcher);
+	data->dispatcher = 0;
+	data->log_progress();
 	xlog("Completed all batches.");
 
 	report_progress = false;
 	t1.join();
-#endif
 
 	return 0;
 }
@@ -1,13 +1,73 @@
 #ifndef _DOMAIN_COORD_ENGINE_H_
 #define _DOMAIN_COORD_ENGINE_H_
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "domain/batch_scheduler.h"
 #include "domain/engine.h"
 
+namespace Json {
+	class Value;
+}
+
 namespace nitro {
 
+/**
+ * The most lines we'll put in a single assignment, no matter how fast the
+ * worker that asked for it is.
+ */
+extern const unsigned MAX_ASSIGNMENT_SIZE;
+
+/**
+ * How many seconds of (estimated) work should an assignment hold? Once we've
+ * measured a worker's throughput, we size its assignments to match.
+ */
+extern const double TARGET_SECONDS_PER_ASSIGNMENT;
+
+/**
+ * When we've handed out all our work and a worker is idle, we copy any task
+ * that has run STRAGGLER_FACTOR times longer than the 95th percentile of
+ * tasks like it (scaled by its estimated walltime), and at least
+ * MIN_STRAGGLER_SECONDS, to the idle worker. We wait for MIN_RUNTIME_SAMPLES
+ * finished tasks before we trust the percentile.
+ */
+extern const unsigned MIN_RUNTIME_SAMPLES;
+extern const double STRAGGLER_FACTOR;
+extern const double MIN_STRAGGLER_SECONDS;
+
 /**
  * The engine used when the app is in "coordinator" mode, giving instructions to
  * workers.
+ *
+ * Workers talk to the coordinator over a single, long-lived ZMQ_ROUTER socket
+ * (the "dispatcher"). Each worker connects to it with a ZMQ_DEALER whose
+ * identity is the worker's engine id, so we can address assignments to a
+ * particular worker without opening a socket per command.
+ *
+ * Work is pulled, not pushed: a worker sends NITRO_NEED_ASSIGNMENT when it's
+ * running low, and we answer with an assignment sized to that worker's
+ * measured throughput.
+ *
+ * Batches can be added while we run, by sending NITRO_BATCH_SUBMITTED, with
+ * the batch's path (optionally preceded by "weight=N ") as its message, to
+ * our responder. We reply with NITRO_BATCH_SUBMITTED, or with
+ * NITRO_DENY_HELP_1REASON if we can't read the batch. A coordinator started
+ * with --linger keeps waiting for batches until it's sent
+ * NITRO_TERMINATE_REQUEST.
+ *
+ * An assignment is only done when all its tasks are, so one hung task can
+ * hold up the end of a batch. Once every line is handed out, we run
+ * stragglers a second time on idle workers, take whichever copy finishes
+ * first, and tell the other copy's worker to cancel it
+ * (NITRO_CANCEL_1TASK_IN_2ASSIGNMENT).
+ *
+ * Every message from a worker renews its lease. We ping (NITRO_PING_REQUEST)
+ * workers that have been quiet for a while, and a worker that stays silent
+ * for the --keepalive period is given up for lost: its unfinished tasks go
+ * out again ahead of everything else, and if it turns up later, we tell it
+ * to stop.
  */
 class coord_engine : public engine {
 public:
@@ -17,27 +77,127 @@ public:
 	virtual int do_run();
 
 	typedef std::vector<std::string> stringlist_t;
-	typedef std::unique_ptr<stringlist_t> assignment_t;
+
+	typedef std::vector<pending_task> tasklist_t;
+	typedef std::unique_ptr<tasklist_t> assignment_t;
 
 	stringlist_t const & get_hostlist() const;
 
-	assignment_t next_assignment();
+	/**
+	 * Take the next assignment from our batches, in the order our
+	 * batch_scheduler prefers. We stop adding lines when we reach
+	 * @param max_lines, or when the estimated walltime of the lines reaches
+	 * @param max_work seconds and we have at least @param min_lines. A
+	 * max_work <= 0 means only line counts matter.
+	 *
+	 * @return null if all batches are exhausted.
+	 */
+	assignment_t next_assignment(unsigned max_lines = MAX_ASSIGNMENT_SIZE,
+			double max_work = 0, unsigned min_lines = 1);
+
+	/**
+	 * Order the tasks in @param asgn the way its worker should start them.
+	 */
 	void prioritize(assignment_t & asgn);
-	void distribute(assignment_t & asgn);
-	void enroll_workers(int eid);
+
+	/**
+	 * Send an assignment to the worker whose dealer has the identity
+	 * @param worker_id. Ownership of the lines in @param asgn passes to the
+	 * worker, and asgn is reset.
+	 *
+	 * @return the id of the assignment we sent. Its tasks are numbered from
+	 *     1, in the order of @param asgn; a line that isn't a task is logged
+	 *     and left out, without using up a number.
+	 */
+	std::string distribute(assignment_t & asgn, std::string const & worker_id);
+
+	/**
+	 * Broadcast an event (normally NITRO_REQUEST_HELP) to all workers that
+	 * subscribe to us. Workers answer over the dispatch channel, not here;
+	 * see handle_dispatch_msg().
+	 */
 	void enroll_workers_multi(int eid);
 
 	bool get_simulate_workers() const;
 	void set_simulate_workers(bool value);
 
+	/**
+	 * Track an assignment that's been handed to a worker. The coord_engine
+	 * takes ownership.
+	 */
 	void add_assignment(assignment * asgn);
 
+	/**
+	 * How many workers have enrolled with us via the dispatch channel?
+	 */
+	unsigned get_worker_count() const;
+
+	/**
+	 * How many tasks have workers reported finishing, and how many of those
+	 * exited with a nonzero code?
+	 */
+	uint64_t get_completed_task_count() const;
+	uint64_t get_failed_task_count() const;
+
+	/**
+	 * How many tasks have we run a second copy of, because the first was
+	 * taking too long?
+	 */
+	uint64_t get_speculated_task_count() const;
+
+	/**
+	 * How many unfinished tasks have we taken back from workers that went
+	 * silent, to give to others?
+	 */
+	uint64_t get_reclaimed_task_count() const;
+
 private:
 	struct data_t;
 	data_t * data;
 
 	void init_hosts(cmdline const &);
 	void progress_reporter();
+	/**
+	 * React to a message from a worker. Whatever its format, the only parts
+	 * we need are its code and its message text.
+	 */
+	void handle_dispatch_msg(std::string const & identity, int code,
+			std::string const & message);
+	void handle_completion_batch(std::string const & identity,
+			std::string const & batch);
+	/**
+	 * Once one copy of a task we've run twice finishes, as identified by
+	 * assignment id and task id in @param key, complete the other with the
+	 * same @param exit_code and cancel it.
+	 */
+	void settle_twins(std::pair<std::string, uint64_t> const & key,
+			int exit_code);
+	/**
+	 * Copy straggling tasks from other workers to the idle worker whose
+	 * dealer has the identity @param worker_id.
+	 *
+	 * @return false if nothing looks stuck.
+	 */
+	bool speculate(std::string const & worker_id);
+	/**
+	 * Note that the worker whose dealer has the identity @param identity is
+	 * alive.
+	 */
+	void hear_from(std::string const & identity);
+	/**
+	 * Give up on workers that have been silent too long, and ping the ones
+	 * that are getting quiet.
+	 */
+	void check_workers();
+	void give_up_on_worker(std::string const & identity);
+	void receive_dispatch_msgs();
+	/**
+	 * Answer requests on the responder: batch submissions, and requests to
+	 * stop.
+	 */
+	void receive_submissions();
+	bool answer_work_request();
+	int simulate();
 	bool report_progress;
 	int reporter_port;
 };
@@ -12,15 +12,13 @@
 #include "domain/coord_engine.h"
 #include "domain/engine.h"
 #include "domain/event_codes.h"
+#include "domain/event_loop.h"
 #include "domain/msg.h"
 #include "domain/worker_engine.h"
 #include "domain/zmq_helpers.h"
 
 #include "zeromq/include/zmq.hpp"
 
-using std::mutex;
-using std::lock_guard;
-
 namespace nitro {
 
 const char * const COORDINATION_TOPIC = events::catalog().get_topic(
@@ -31,7 +29,7 @@ const unsigned MAX_HARDWARE_THREADS = std::max(4u, std::thread::hardware_concurr
 
 engine::engine(cmdline const & cmdline) :
 		ctx(_ctx), responder(sockets[ep_reqrep]), publisher(sockets[ep_pubsub]),
-		_ctx(0), id(), linger(false) {
+		_ctx(0), id(), loop(new event_loop), linger(false) {
 
 	auto reqrep_port = cmdline.get_option_as_int("--rrport", DEFAULT_REQREP_PORT);
 	auto pubsub_port = cmdline.get_option_as_int("--psport", DEFAULT_PUBSUB_PORT);
@@ -46,7 +44,8 @@ engine::engine(cmdline const & cmdline) :
 		linger = true;
 	}
 
-	id = generate_guid();
+	guid = generate_binary_guid();
+	id = guid.str();
 
     _ctx = zmq_ctx_new();
     sockets[ep_pubsub] = zmq_socket(_ctx, ZMQ_PUB);
@@ -82,6 +81,7 @@ engine::~engine() {
 	if (ctx) {
 		zmq_ctx_destroy(ctx);
 	}
+	delete loop;
 }
 
 void engine::bind_after_ctor(char const * style) {
@@ -104,22 +104,48 @@ char const * engine::get_id() const {
 	return id.c_str();
 }
 
+guid_t const & engine::get_guid() const {
+	return guid;
+}
+
 bool engine::get_linger() const {
 	return linger;
 }
 
-void engine::queue_for_send(void * socket, std::string const & msg) {
-	lock_guard<mutex> lock(send_queue_mutex);
-	send_queue.push({socket, msg});
+void engine::queue_for_send(void * socket, std::string && msg,
+		bool coalesce) {
+	send_queue.push(qmsg_t{socket, std::move(msg), coalesce});
+	loop->wake();
 }
 
-void engine::send_queued() {
-	lock_guard<mutex> lock(send_queue_mutex);
-	while (!send_queue.empty()) {
-		auto item = send_queue.front();
-		send_full_msg(item.first, item.second);
-		send_queue.pop();
+bool engine::send_queued() {
+	qmsg_t item;
+	void * run_socket = nullptr;
+	auto flush_run = [&]() {
+		if (send_run.size() == 1) {
+			send_full_msg(run_socket, std::move(send_run[0]));
+		} else if (!send_run.empty()) {
+			send_msg_parts(run_socket, send_run.data(), send_run.size());
+		}
+		send_run.clear();
+	};
+	for (unsigned i = 0; i < MAX_SEND_BATCH && send_queue.pop(item); ++i) {
+		if (!item.coalesce || item.socket != run_socket) {
+			flush_run();
+		}
+		if (item.coalesce) {
+			run_socket = item.socket;
+			send_run.push_back(std::move(item.msg));
+		} else {
+			send_full_msg(item.socket, std::move(item.msg));
+		}
 	}
+	flush_run();
+	return !send_queue.empty();
+}
+
+event_loop & engine::get_event_loop() const {
+	return *loop;
 }
 
 char const * engine::get_endpoint(int ep_pattern, int et_transport) const {
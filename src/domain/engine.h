@@ -2,10 +2,11 @@
 #define _NITRO_DOMAIN_ENGINE_H_
 
 #include <memory>
-#include <mutex>
-#include <queue>
 #include <string>
-#include <utility>
+#include <vector>
+
+#include "base/guid.h"
+#include "base/mpsc_queue.h"
 
 namespace zmq {
 	class context_t;
@@ -22,8 +23,15 @@ const char * const TCP_CONNECT_ENDPOINT_PATTERN = "tcp://%1:%2";
 
 extern const unsigned MAX_HARDWARE_THREADS;
 
+/**
+ * How many queued messages engine::send_queued() sends before it lets the
+ * poll loop look for input again.
+ */
+const unsigned MAX_SEND_BATCH = 64;
+
 class cmdline;
 class assignment;
+class event_loop;
 
 /**
  * Engines subscribe to this topic to hear messages that they need to handle
@@ -69,6 +77,11 @@ public:
 	 */
 	char const * get_id() const;
 
+	/**
+	 * The same id, in binary form.
+	 */
+	guid_t const & get_guid() const;
+
 	/**
 	 * Name the endpoint to use for interacting with this engine with the
 	 * specified pattern and transport.
@@ -118,20 +131,51 @@ protected:
 	// Derived classes should call this at the end of their constructor. We
 	// can't bind completely until we know what style of engine we are.
 	void bind_after_ctor(char const * style);
-	void queue_for_send(void * socket, std::string const & msg);
-	void send_queued();
+
+	/**
+	 * Hand @param msg to the poll loop's thread for sending, and wake the
+	 * loop. Safe to call from any thread; it never blocks.
+	 *
+	 * @param coalesce
+	 *     If true, @param msg delimits itself, and may travel as one part
+	 *     of a multipart message with others like it that are queued right
+	 *     after it for the same socket.
+	 */
+	void queue_for_send(void * socket, std::string && msg,
+			bool coalesce = false);
+
+	/**
+	 * Send up to MAX_SEND_BATCH queued messages, in order. Call only from
+	 * the poll loop's thread.
+	 *
+	 * @return true if more are still waiting.
+	 */
+	bool send_queued();
+
+	/**
+	 * The loop that our poll loop's thread waits in. Anything that gives it
+	 * work from another thread should wake() it.
+	 */
+	event_loop & get_event_loop() const;
 
 private:
 	int ports[2];
 
 	void * _ctx;
 	void * sockets[2];
+	guid_t guid;
 	std::string id;
 	std::string endpoints[2][3];
 
-	typedef std::pair<void *, std::string> qmsg_t;
-	std::queue<qmsg_t> send_queue;
-	std::mutex send_queue_mutex;
+	struct qmsg_t {
+		void * socket;
+		std::string msg;
+		bool coalesce;
+	};
+	event_loop * loop;
+	mpsc_queue<qmsg_t> send_queue;
+	// A run of coalescing messages, gathered by send_queued().
+	std::vector<std::string> send_run;
 	bool linger;
 };
 
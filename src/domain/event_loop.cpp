@@ -0,0 +1,138 @@
+#include <vector>
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "base/error.h"
+#include "base/xlog.h"
+
+#include "domain/event_loop.h"
+
+#include "zeromq/include/zmq.h"
+
+namespace nitro {
+
+struct event_loop::data_t {
+	void * poller;
+	int wake_fd;
+	int timer_fd;
+	// Room for one event per thing we watch, so a wait() sees them all.
+	std::vector<zmq_poller_event_t> events;
+
+	data_t() :
+			poller(zmq_poller_new()),
+			wake_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+			timer_fd(timerfd_create(CLOCK_MONOTONIC,
+					TFD_CLOEXEC | TFD_NONBLOCK)) {
+		if (!poller || wake_fd < 0 || timer_fd < 0) {
+			auto err = errno;
+			close_all();
+			throw ERROR_EVENT(err);
+		}
+		watch(wake_fd);
+		watch(timer_fd);
+	}
+
+	~data_t() {
+		close_all();
+	}
+
+	void close_all() {
+		for (int fd : { timer_fd, wake_fd }) {
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+		if (poller) {
+			zmq_poller_destroy(&poller);
+		}
+	}
+
+	void watch(int fd) {
+		if (zmq_poller_add_fd(poller, fd, nullptr, ZMQ_POLLIN) != 0) {
+			throw ERROR_EVENT(errno);
+		}
+		events.resize(events.size() + 1);
+	}
+
+	static void drain(int fd) {
+		uint64_t ignored;
+		while (read(fd, &ignored, sizeof(ignored)) > 0) {
+		}
+	}
+};
+
+event_loop::event_loop() : data(new data_t) {
+}
+
+event_loop::~event_loop() {
+	delete data;
+}
+
+void event_loop::add_socket(void * socket) {
+	if (zmq_poller_add(data->poller, socket, nullptr, ZMQ_POLLIN) != 0) {
+		throw ERROR_EVENT(errno);
+	}
+	data->events.resize(data->events.size() + 1);
+}
+
+void event_loop::set_timer(std::chrono::milliseconds interval) {
+	auto ms = interval.count();
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = ms / 1000;
+	spec.it_interval.tv_nsec = (ms % 1000) * 1000000;
+	// Any nonzero value arms the timer; this one means "now".
+	spec.it_value.tv_sec = 0;
+	spec.it_value.tv_nsec = ms ? 1 : 0;
+	if (timerfd_settime(data->timer_fd, 0, &spec, nullptr) != 0) {
+		throw ERROR_EVENT(errno);
+	}
+}
+
+void event_loop::wake() {
+	uint64_t one = 1;
+	if (write(data->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		xlog("Unable to wake event loop: %1", ERROR_EVENT(errno).what());
+	}
+}
+
+int event_loop::wait(int timeout_millis) {
+	// The poller asks every socket for ZMQ_EVENTS before it blocks, so input
+	// whose ZMQ_FD signal we've already consumed still counts.
+	auto & events = data->events;
+	int n = zmq_poller_wait_all(data->poller, &events[0], events.size(),
+			timeout_millis);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return 0;
+		}
+		throw ERROR_EVENT(errno);
+	}
+	int result = 0;
+	for (int i = 0; i < n; ++i) {
+		if (events[i].socket) {
+			result |= el_input;
+		} else if (events[i].fd == data->wake_fd) {
+			data_t::drain(data->wake_fd);
+			result |= el_wake;
+		} else if (events[i].fd == data->timer_fd) {
+			data_t::drain(data->timer_fd);
+			result |= el_timer;
+		}
+	}
+	return result;
+}
+
+bool event_loop::has_input(void * socket) {
+	int events = 0;
+	size_t events_size = sizeof(events);
+	if (zmq_getsockopt(socket, ZMQ_EVENTS, &events, &events_size) != 0) {
+		return false;
+	}
+	return (events & ZMQ_POLLIN) != 0;
+}
+
+} // end namespace nitro
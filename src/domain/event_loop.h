@@ -0,0 +1,78 @@
+#ifndef _DOMAIN_EVENT_LOOP_H_
+#define _DOMAIN_EVENT_LOOP_H_
+
+#include <chrono>
+
+namespace nitro {
+
+/**
+ * Let an engine's poll loop sleep until there's something to do: input on
+ * one of its zeromq sockets, a wake() from another thread, or its timer.
+ *
+ * Everything is registered once with a zmq_poller, which keeps an epoll set
+ * and each socket's ZMQ_FD; an eventfd carries wake()s and a timerfd the
+ * timer. Unlike zmq_poll(), waiting neither rebuilds the poll set nor
+ * allocates.
+ *
+ * A ZMQ_FD only says that a socket's state may have changed, and its signal
+ * can be consumed by any operation on the socket. The poller checks every
+ * socket's ZMQ_EVENTS before it blocks, and after it wakes; callers should
+ * keep reading a socket while has_input() says so.
+ *
+ * @note Apart from wake(), which is threadsafe, use an event_loop only from
+ *     the thread that owns its sockets.
+ */
+class event_loop {
+	struct data_t;
+	data_t * data;
+
+	event_loop(event_loop const &);
+	event_loop & operator =(event_loop const &);
+
+public:
+	/**
+	 * Bits returned by wait().
+	 */
+	enum {
+		el_input = 1,
+		el_wake = 2,
+		el_timer = 4,
+	};
+
+	event_loop();
+	virtual ~event_loop();
+
+	/**
+	 * Watch @param socket for input from now on.
+	 */
+	void add_socket(void * socket);
+
+	/**
+	 * Fire every @param interval, starting right away. A zero interval stops
+	 * the timer.
+	 */
+	void set_timer(std::chrono::milliseconds interval);
+
+	/**
+	 * Make the current wait(), or the next one, return at once. Safe to call
+	 * from any thread.
+	 */
+	void wake();
+
+	/**
+	 * Wait up to @param timeout_millis (-1 for as long as it takes, 0 to
+	 * just check) for something to happen.
+	 *
+	 * @return the el_* bits for what did, or 0 if we timed out.
+	 */
+	int wait(int timeout_millis = -1);
+
+	/**
+	 * Does @param socket have a message waiting?
+	 */
+	static bool has_input(void * socket);
+};
+
+} // end namespace nitro
+
+#endif // sentry
@@ -36,6 +36,11 @@ EVENT(NITRO_MSG_TOO_BIG_1SIZE, error, admin, 4,
 		" discarded.",
 		"")
 
+EVENT(NITRO_1TASK_IN_2ASSIGNMENT_ON_3WORKER_FAILED_4CODE, warning, user, 5,
+		"domain.nitro.status",
+		"Task %1 of assignment \"%2\" on worker %3 exited with code %4.",
+		"")
+
 EVENT(NITRO_HERE_IS_ASSIGNMENT, info, internal, 100,
 		"domain.nitro.coordinate",
 		"Here is an assignment of a few new commands to run.",
@@ -106,4 +111,9 @@ EVENT(NITRO_REJECT_ASSIGNMENT_1REASON, info, internal, 113,
 		"Assignment rejected. Reason: %1.",
 		"")
 
+EVENT(NITRO_CANCEL_1TASK_IN_2ASSIGNMENT, info, internal, 114,
+		"domain.nitro.coordinate",
+		"Task %1 in assignment \"%2\" is no longer needed; stop it.",
+		"")
+
 #undef EVENT
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "base/error.h"
@@ -14,27 +15,46 @@ using namespace nitro::event_codes;
 
 namespace nitro {
 
+void begin_json_msg(Json::BufferWriter & writer, int eid) {
+	char buf[GUID_BUF_LEN];
+	generate_guid(buf, sizeof(buf));
+	writer.startObject();
+	writer.key("messageId").stringValue(buf);
+	writer.key("senderId").stringValue("nitro@localhost"); // TODO: fix
+	writer.key("body").startObject();
+	events::get_std_id_repr(eid, buf, sizeof(buf));
+	writer.key("code").stringValue(buf);
+}
+
 std::string serialize_msg(int eid) {
-	Json::Value root;
-	char guid[GUID_BUF_LEN];
-	generate_guid(guid, sizeof(guid));
-	root["messageId"] = guid;
-	root["senderId"] = "nitro@localhost"; // TODO: fix
-	root["body"]["code"] = events::get_std_id_repr(eid);
-	Json::StyledWriter writer;
-	return writer.write(root);
-}
-
-std::string serialize_msg(int eid, std::string const & txt) {
-	Json::Value root;
-	char guid[GUID_BUF_LEN];
-	generate_guid(guid, sizeof(guid));
-	root["messageId"] = guid;
-	root["senderId"] = "nitro@localhost"; // TODO: fix
-	root["body"]["code"] = events::get_std_id_repr(eid);
-	root["body"]["message"] = txt;
-	Json::StyledWriter writer;
-	return writer.write(root);
+	std::string txt;
+	txt.reserve(JSON_MSG_ENVELOPE_SIZE);
+	Json::BufferWriter writer(txt);
+	begin_json_msg(writer, eid);
+	writer.endObject().endObject();
+	return txt;
+}
+
+std::string serialize_msg(int eid, std::string const & message) {
+	std::string txt;
+	txt.reserve(JSON_MSG_ENVELOPE_SIZE + message.size() + 16);
+	Json::BufferWriter writer(txt);
+	begin_json_msg(writer, eid);
+	writer.key("message").stringValue(message);
+	writer.endObject().endObject();
+	return txt;
+}
+
+std::string serialize_msg(wire_format fmt, char const * sender_id, int eid,
+		std::string const & txt) {
+	if (fmt == wf_json) {
+		return txt.empty() ? serialize_msg(eid) : serialize_msg(eid, txt);
+	}
+	wire_writer writer(eid, sender_id);
+	if (!txt.empty()) {
+		writer.add_string(wfld_message, txt);
+	}
+	return writer.finish();
 }
 
 bool deserialize_msg(std::string const & txt, Json::Value & into) {
@@ -42,38 +62,306 @@ bool deserialize_msg(std::string const & txt, Json::Value & into) {
 	return reader.parse(txt, into);
 }
 
-std::string receive_full_msg(void * socket) {
+bool deserialize_msg(char const * begin, char const * end,
+		Json::Value & into) {
+	Json::Reader reader;
+	return reader.parse(begin, end, into);
+}
+
+int get_msg_code(Json::Value const & msg) {
+	Json::Value const & code = msg["body"]["code"];
+	if (code.isString()) {
+		return static_cast<int>(strtoul(code.asCString(), nullptr, 0));
+	}
+	return code.isIntegral() ? code.asInt() : 0;
+}
+
+std::string json_text::str() const {
+	if (!escaped) {
+		return std::string(begin, end);
+	}
+	std::string decoded;
+	Json::SaxReader::decodeString(begin, end, decoded);
+	return decoded;
+}
+
+msg_view::msg_view() : code(0), has_tasks(false) {
+}
+
+void msg_view::clear() {
+	code = 0;
+	message = assignment_id = lines = json_text();
+	has_tasks = false;
+	tasks.clear();
+}
+
+namespace {
+
+/**
+ * Keys on the paths we decode. Everything else is k_other.
+ */
+enum msg_key {
+	k_other, k_root, k_body, k_code, k_message, k_assignment, k_id, k_tasks,
+	k_cmdline, k_lines, k_task
+};
+
+inline bool key_is(char const * begin, char const * end, char const * name,
+		size_t len) {
+	return static_cast<size_t>(end - begin) == len
+			&& memcmp(begin, name, len) == 0;
+}
+
+/**
+ * Numbers are views that may run to the very end of the buffer, so we can't
+ * hand them to strtoull().
+ */
+uint64_t parse_decimal(char const * begin, char const * end) {
+	uint64_t n = 0;
+	for (auto p = begin; p < end && *p >= '0' && *p <= '9'; ++p) {
+		n = n * 10 + (*p - '0');
+	}
+	return n;
+}
+
+msg_key classify_key(char const * begin, char const * end) {
+	#define TRY_KEY(name) \
+		if (key_is(begin, end, #name, sizeof(#name) - 1)) return k_##name
+	TRY_KEY(body);
+	TRY_KEY(code);
+	TRY_KEY(message);
+	TRY_KEY(assignment);
+	TRY_KEY(id);
+	TRY_KEY(tasks);
+	TRY_KEY(cmdline);
+	TRY_KEY(lines);
+	#undef TRY_KEY
+	return k_other;
+}
+
+/**
+ * Tracks where we are in the document -- which key each open container sits
+ * under -- and keeps values only at the handful of paths we care about:
+ *
+ *     body.code, body.message,
+ *     body.assignment.id, body.assignment.lines,
+ *     body.assignment.tasks[].id, body.assignment.tasks[].cmdline
+ */
+class msg_decoder : public Json::SaxHandler {
+	static const int MAX_TRACKED_DEPTH = 8;
+
+	msg_view & view;
+	msg_key path[MAX_TRACKED_DEPTH];
+	int depth;
+	msg_key current_key;
+
+	bool at(msg_key a, msg_key b) const {
+		return depth == 2 && path[1] == a && current_key == b;
+	}
+	bool at(msg_key a, msg_key b, msg_key c) const {
+		return depth == 3 && path[1] == a && path[2] == b && current_key == c;
+	}
+	bool in_task(msg_key key) const {
+		return depth == 5 && path[1] == k_body && path[2] == k_assignment
+				&& path[3] == k_tasks && path[4] == k_task
+				&& current_key == key;
+	}
+
+	bool push(msg_key key) {
+		if (depth < MAX_TRACKED_DEPTH) {
+			path[depth] = key;
+		}
+		++depth;
+		current_key = k_other;
+		return true;
+	}
+
+	bool pop() {
+		--depth;
+		current_key = k_other;
+		return true;
+	}
+
+public:
+	msg_decoder(msg_view & view) : view(view), depth(0),
+			current_key(k_root) {
+	}
+
+	virtual bool startObject() {
+		if (depth == 4 && path[3] == k_tasks && path[2] == k_assignment
+				&& path[1] == k_body) {
+			msg_view::task_t t;
+			t.id = 0;
+			view.tasks.push_back(t);
+			return push(k_task);
+		}
+		return push(current_key);
+	}
+
+	virtual bool endObject() {
+		return pop();
+	}
+
+	virtual bool startArray() {
+		if (at(k_body, k_assignment, k_tasks)) {
+			view.has_tasks = true;
+		}
+		return push(current_key);
+	}
+
+	virtual bool endArray() {
+		return pop();
+	}
+
+	virtual bool key(char const * begin, char const * end, bool escaped) {
+		current_key = escaped ? k_other : classify_key(begin, end);
+		return true;
+	}
+
+	virtual bool stringValue(char const * begin, char const * end,
+			bool escaped) {
+		json_text txt;
+		txt.begin = begin;
+		txt.end = end;
+		txt.escaped = escaped;
+		if (at(k_body, k_code)) {
+			// Codes travel as hex strings; see get_msg_code().
+			view.code = static_cast<int>(strtoul(begin, nullptr, 0));
+		} else if (at(k_body, k_message)) {
+			view.message = txt;
+		} else if (at(k_body, k_assignment, k_id)) {
+			view.assignment_id = txt;
+		} else if (at(k_body, k_assignment, k_lines)) {
+			view.lines = txt;
+		} else if (in_task(k_id)) {
+			view.tasks.back().id = strtoull(begin, nullptr, 10);
+		} else if (in_task(k_cmdline)) {
+			view.tasks.back().cmdline = txt;
+		}
+		return true;
+	}
+
+	virtual bool numberValue(char const * begin, char const * end) {
+		if (at(k_body, k_code)) {
+			view.code = static_cast<int>(parse_decimal(begin, end));
+		} else if (in_task(k_id)) {
+			view.tasks.back().id = parse_decimal(begin, end);
+		}
+		return true;
+	}
+};
+
+} // end anonymous namespace
+
+bool decode_msg(char const * begin, char const * end, msg_view & into) {
+	into.clear();
+	msg_decoder decoder(into);
+	Json::SaxReader reader;
+	return reader.parse(begin, end, decoder);
+}
+
+const size_t MAX_SIZE_WERE_WILLING_TO_RECEIVE = 1024 * 1024 * 8;
+
+msg_parts::msg_parts() : total(0) {
+}
+
+msg_parts::~msg_parts() {
+	clear();
+}
+
+void msg_parts::clear() {
+	for (auto & part : parts) {
+		zmq_msg_close(&part);
+	}
+	parts.clear();
+	gathered.clear();
+	total = 0;
+}
+
+bool msg_parts::empty() const {
+	return total == 0;
+}
+
+size_t msg_parts::size() const {
+	return total;
+}
+
+size_t msg_parts::get_part_count() const {
+	return parts.size();
+}
+
+char const * msg_parts::get_part_data(size_t i) const {
+	return static_cast<char const *>(zmq_msg_data(
+			const_cast<zmq_msg_t *>(&parts[i])));
+}
+
+size_t msg_parts::get_part_size(size_t i) const {
+	return zmq_msg_size(const_cast<zmq_msg_t *>(&parts[i]));
+}
+
+char const * msg_parts::data() {
+	if (parts.size() == 1) {
+		return get_part_data(0);
+	}
+	if (gathered.size() != total) {
+		gathered = str();
+	}
+	return gathered.c_str();
+}
+
+std::string msg_parts::str() const {
 	std::string full;
-	int64_t more = 1;
-	size_t more_size = sizeof more;
-	const size_t MAX_SIZE_WERE_WILLING_TO_RECEIVE = 1024 * 1024 * 8;
-	do {
-	    /* Create an empty ØMQ message to hold the message part */
-	    zmq_msg_t part;
-	    int rc = zmq_msg_init(&part);
-	    if (rc) return full;
-	    /* Block until a message is available to be received from socket */
-	    rc = zmq_msg_recv(&part, socket, 0);
-	    if (rc == -1) {
-	    	zmq_msg_close(&part);
-	    	return full;
-	    }
-	    auto part_size = zmq_msg_size(&part);
-	    auto new_size = full.size() + part_size;
-	    if (new_size > MAX_SIZE_WERE_WILLING_TO_RECEIVE) {
-	    	zmq_msg_close(&part);
-	    	throw ERROR_EVENT(NITRO_MSG_TOO_BIG_1SIZE, new_size);
-	    }
-	    auto data = reinterpret_cast<const char *>(zmq_msg_data(&part));
-	    full.append(data, part_size);
-	    /* Determine if more message parts are to follow */
-	    rc = zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &more_size);
-	    if (rc) more = false;
-	    zmq_msg_close(&part);
-	} while (more);
+	full.reserve(total);
+	for (size_t i = 0; i < parts.size(); ++i) {
+		full.append(get_part_data(i), get_part_size(i));
+	}
 	return full;
 }
 
+bool receive_msg_parts(void * socket, msg_parts & into) {
+	into.clear();
+	bool more = true;
+	while (more) {
+		into.parts.push_back(zmq_msg_t());
+		zmq_msg_t & part = into.parts.back();
+		int rc = zmq_msg_init(&part);
+		if (rc == 0) {
+			/* Block until a message is available to be received from socket */
+			rc = zmq_msg_recv(&part, socket, 0);
+			if (rc == -1) {
+				zmq_msg_close(&part);
+			}
+		}
+		if (rc == -1) {
+			into.parts.pop_back();
+			return !into.parts.empty();
+		}
+		into.total += zmq_msg_size(&part);
+		// Unlike ZMQ_RCVMORE, this doesn't cost a trip through the socket.
+		more = zmq_msg_more(&part);
+		if (into.total > MAX_SIZE_WERE_WILLING_TO_RECEIVE) {
+			auto size = into.total;
+			into.clear();
+			// Discard the rest of the message, so the next receive starts
+			// on a message of its own rather than on these leftovers.
+			while (more) {
+				zmq_msg_t rest;
+				zmq_msg_init(&rest);
+				more = zmq_msg_recv(&rest, socket, 0) != -1
+						&& zmq_msg_more(&rest);
+				zmq_msg_close(&rest);
+			}
+			throw ERROR_EVENT(NITRO_MSG_TOO_BIG_1SIZE, size);
+		}
+	}
+	return true;
+}
+
+std::string receive_full_msg(void * socket) {
+	msg_parts parts;
+	receive_msg_parts(socket, parts);
+	return parts.str();
+}
+
 void send_full_msg(void * socket, std::string const & txt) {
 	const size_t BYTES_PER_FRAME = 256 * 1024;
 	auto bytes_remaining = txt.size();
@@ -91,9 +379,97 @@ void send_full_msg(void * socket, std::string const & txt) {
 		auto data = zmq_msg_data(&msg);
 		memcpy(data, ptr, bytes_this_time);
 		ptr += bytes_this_time;
-		zmq_msg_send(&msg, socket, flags);
+		rc = zmq_msg_send(&msg, socket, flags);
 		zmq_msg_close(&msg);
+		if (rc == -1) {
+			throw ERROR_EVENT(zmq_errno());
+		}
 	} while (bytes_remaining > 0);
 }
 
+/**
+ * zeromq calls this (possibly on one of its own threads) when it's done with
+ * a buffer we gave it.
+ */
+static void free_sent_string(void *, void * hint) {
+	delete static_cast<std::string *>(hint);
+}
+
+static void send_moved_part(void * socket, std::string && txt, int flags) {
+	// The string object moves to the heap; its buffer doesn't move at all.
+	auto holder = new std::string(std::move(txt));
+	zmq_msg_t msg;
+	int rc = zmq_msg_init_data(&msg, &(*holder)[0], holder->size(),
+			free_sent_string, holder);
+	if (rc) {
+		delete holder;
+		throw ERROR_EVENT(errno);
+	}
+	rc = zmq_msg_send(&msg, socket, flags);
+	// If the send failed, this frees the buffer; if not, it's a no-op.
+	zmq_msg_close(&msg);
+	if (rc == -1) {
+		throw ERROR_EVENT(zmq_errno());
+	}
+}
+
+void send_full_msg(void * socket, std::string && txt) {
+	send_moved_part(socket, std::move(txt), 0);
+}
+
+void send_msg_parts(void * socket, std::string * parts, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		send_moved_part(socket, std::move(parts[i]),
+				i + 1 < count ? ZMQ_SNDMORE : 0);
+		parts[i].clear();
+	}
+}
+
+static void send_identity(void * socket, std::string const & identity) {
+	zmq_msg_t msg;
+	int rc = zmq_msg_init_size(&msg, identity.size());
+	if (rc) {
+		throw ERROR_EVENT(errno);
+	}
+	memcpy(zmq_msg_data(&msg), identity.c_str(), identity.size());
+	rc = zmq_msg_send(&msg, socket, ZMQ_SNDMORE);
+	zmq_msg_close(&msg);
+	// Without its identity frame, the body would go to the wrong peer (or
+	// nowhere), so we must not send it.
+	if (rc == -1) {
+		throw ERROR_EVENT(zmq_errno());
+	}
+}
+
+void send_routed_msg(void * socket, std::string const & identity,
+		std::string const & txt) {
+	send_identity(socket, identity);
+	send_full_msg(socket, txt);
+}
+
+void send_routed_msg(void * socket, std::string const & identity,
+		std::string && txt) {
+	send_identity(socket, identity);
+	send_full_msg(socket, std::move(txt));
+}
+
+std::string receive_routed_msg(void * socket, std::string & identity) {
+	identity.clear();
+	zmq_msg_t part;
+	int rc = zmq_msg_init(&part);
+	if (rc) return std::string();
+	rc = zmq_msg_recv(&part, socket, 0);
+	if (rc == -1) {
+		zmq_msg_close(&part);
+		return std::string();
+	}
+	identity.assign(reinterpret_cast<const char *>(zmq_msg_data(&part)),
+			zmq_msg_size(&part));
+	bool more = zmq_msg_more(&part);
+	zmq_msg_close(&part);
+	// A router always prepends the identity frame, so a message with nothing
+	// after it is malformed; treat it as empty.
+	return more ? receive_full_msg(socket) : std::string();
+}
+
 } // end namespace nitro
@@ -1,21 +1,199 @@
 #ifndef _DOMAIN_MSG_H_
 #define _DOMAIN_MSG_H_
 
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <vector>
+
+#include "domain/wire.h"
+
+#include "zeromq/include/zmq.h"
 
 namespace Json {
+	class BufferWriter;
 	class Value;
 }
 
 namespace nitro {
 
+/**
+ * Roughly how many bytes of a json message are envelope: ids, code, and
+ * punctuation. Add the size of the body's fields to reserve a buffer.
+ */
+const size_t JSON_MSG_ENVELOPE_SIZE = 128;
+
+/**
+ * Start a json message: the envelope, then the body up to and including its
+ * code. Add any other body fields, then close the body and the envelope with
+ * two endObject() calls.
+ */
+void begin_json_msg(Json::BufferWriter & writer, int eid);
+
 std::string serialize_msg(int eid);
 std::string serialize_msg(int eid, std::string const & txt);
+
+/**
+ * Serialize in whichever format our peer has negotiated. In binary, @param
+ * txt travels as the wfld_message field, and is omitted if empty.
+ */
+std::string serialize_msg(wire_format fmt, char const * sender_id, int eid,
+		std::string const & txt = std::string());
+
 bool deserialize_msg(std::string const & txt, Json::Value & into);
+bool deserialize_msg(char const * begin, char const * end, Json::Value & into);
+
+/**
+ * Extract the event code from a deserialized message. Codes travel as hex
+ * strings ("0x0600C064"), so Json::Value::asInt() can't read them directly.
+ *
+ * @return the code, or 0 if the message doesn't have one.
+ */
+int get_msg_code(Json::Value const & msg);
+
+/**
+ * A string inside a json message: still in the message's buffer, and still
+ * escaped if @c escaped is true.
+ */
+struct json_text {
+	char const * begin;
+	char const * end;
+	bool escaped;
+
+	json_text() : begin(nullptr), end(nullptr), escaped(false) {}
+	bool empty() const { return begin == end; }
+
+	/**
+	 * @return the text, unescaped.
+	 */
+	std::string str() const;
+};
+
+/**
+ * The parts of a json message that nitro acts on, decoded in a single
+ * streaming pass -- no Json::Value, no map nodes, and no string copies.
+ * Views refer into the message, which must outlive this object.
+ */
+struct msg_view {
+	struct task_t {
+		uint64_t id;
+		json_text cmdline;
+	};
+
+	int code;
+	json_text message;       // body.message
+	json_text assignment_id; // body.assignment.id
+	json_text lines;         // body.assignment.lines
+	bool has_tasks;          // body.assignment.tasks is an array
+	std::vector<task_t> tasks;
+
+	msg_view();
+	void clear();
+};
+
+/**
+ * Decode a json message into @param into, which is cleared first. Fields
+ * the message doesn't have are left empty; fields we don't know are
+ * skipped.
+ *
+ * @return false if the message isn't valid json.
+ */
+bool decode_msg(char const * begin, char const * end, msg_view & into);
+
+/**
+ * A message as it arrived: a gather list of zeromq parts, still in zeromq's
+ * buffers. Almost every message arrives as one part, and then data() is
+ * those bytes, uncopied. Parts are released when the object is destroyed.
+ */
+class msg_parts {
+	// A deque, because zeromq doesn't promise that a zmq_msg_t can be moved
+	// once it holds data.
+	std::deque<zmq_msg_t> parts;
+	size_t total;
+	std::string gathered;
 
+	msg_parts(msg_parts const &); // not implemented
+	msg_parts & operator =(msg_parts const &); // not implemented
+
+	friend bool receive_msg_parts(void * socket, msg_parts & into);
+
+public:
+	msg_parts();
+	~msg_parts();
+
+	void clear();
+	bool empty() const;
+
+	/**
+	 * Total bytes, across all parts.
+	 */
+	size_t size() const;
+
+	size_t get_part_count() const;
+	char const * get_part_data(size_t i) const;
+	size_t get_part_size(size_t i) const;
+
+	/**
+	 * All bytes of the message, contiguously. Only a multipart message
+	 * needs to be gathered (once) into a buffer of our own.
+	 */
+	char const * data();
+
+	std::string str() const;
+};
+
+/**
+ * Receive all the parts of the next message on @param socket, without
+ * concatenating them.
+ *
+ * @return false if nothing could be received.
+ */
+bool receive_msg_parts(void * socket, msg_parts & into);
+
+/**
+ * Send a copy of @param msg, in frames of modest size.
+ *
+ * @throws error_event (with zeromq's errno) if a frame can't be sent.
+ */
 void send_full_msg(void * socket, std::string const & msg);
+
+/**
+ * Send @param msg without copying it: zeromq takes the buffer, and frees it
+ * when it's done. Use this (by passing a temporary, or std::move()) for
+ * anything big.
+ */
+void send_full_msg(void * socket, std::string && msg);
+
+/**
+ * Send @param count strings as the parts of a single multipart message,
+ * without copying them (as with send_full_msg(socket, std::move(msg))). The
+ * strings are left empty. A receiver that doesn't ask for parts sees their
+ * concatenation, so this suits parts that delimit themselves.
+ */
+void send_msg_parts(void * socket, std::string * parts, size_t count);
+
 std::string receive_full_msg(void * socket);
 
+/**
+ * Send a message through a ZMQ_ROUTER socket to the peer whose identity is
+ * @param identity. If the peer is unknown, zeromq silently drops the message
+ * (unless the socket sets ZMQ_ROUTER_MANDATORY).
+ *
+ * @throws error_event if zeromq refuses the identity frame or the message;
+ *     as with the send_full_msg() flavors.
+ */
+void send_routed_msg(void * socket, std::string const & identity,
+		std::string const & msg);
+void send_routed_msg(void * socket, std::string const & identity,
+		std::string && msg);
+
+/**
+ * Receive a message on a ZMQ_ROUTER socket. The identity of the peer that
+ * sent it is written to @param identity; the return value is the message
+ * itself, exactly as the peer passed it to send_full_msg().
+ */
+std::string receive_routed_msg(void * socket, std::string & identity);
+
 }
 
 #endif // sentry
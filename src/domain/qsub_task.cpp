@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,34 +12,71 @@ using namespace nitro::event_codes;
 
 namespace nitro {
 
+const int MIN_PRIORITY = -1024;
+const int MAX_PRIORITY = 1023;
+
 qsub_task::qsub_task(char const * cmdline, char const * end_of_cmdline,
-		assignment * asgn, uint64_t id) :
-	task(cmdline, end_of_cmdline, asgn, id) {
+		assignment * asgn, uint64_t id, arena * storage) :
+	task(cmdline, end_of_cmdline, asgn, id, storage) {
+	auto x = get_cmdline();
+	auto end = strchr(x, 0);
+	priority = find_priority(x, end);
+	walltime = find_walltime(x, end);
 }
 
-int qsub_task::get_priority() const {
-	char const * p = strstr(get_cmdline(), " -p");
-	if (p && p[2] == ' ') {
-		char * end;
-		auto val = strtol(p + 3, &end, 10);
-		if (val >= -1024 && val <= 1023) {
-			return val;
+int find_priority(char const * cmdline, char const * end_of_cmdline) {
+	for (auto p = cmdline; p + 3 < end_of_cmdline; ++p) {
+		if (!isspace(p[0]) || p[1] != '-' || p[2] != 'p' || !isspace(p[3])) {
+			continue;
+		}
+		auto v = p + 4;
+		while (v < end_of_cmdline && isspace(*v)) {
+			++v;
+		}
+		// Parse by hand; the cmdline may not be null-terminated.
+		bool negative = v < end_of_cmdline && *v == '-';
+		if (negative || (v < end_of_cmdline && *v == '+')) {
+			++v;
+		}
+		auto digits = v;
+		long val = 0;
+		while (v < end_of_cmdline && isdigit(*v) && val <= 1024) {
+			val = val * 10 + (*v++ - '0');
+		}
+		if (v > digits && (v == end_of_cmdline || isspace(*v))) {
+			if (negative) {
+				val = -val;
+			}
+			if (val >= MIN_PRIORITY && val <= MAX_PRIORITY) {
+				return static_cast<int>(val);
+			}
 		}
+		break;
 	}
-	return 0;
+	return DEFAULT_PRIORITY;
+}
+
+int qsub_task::get_priority() const {
+	return priority;
 }
 
 double walltime_to_seconds(char const * walltime) {
-	double value = 0.0;
 	char const * end = strchr(walltime, ' ');
 	if (!end) {
 		end = strchr(walltime, 0);
 	}
+	return walltime_to_seconds(walltime, end);
+}
+
+double walltime_to_seconds(char const * walltime, char const * end) {
+	double value = 0.0;
 	char buf[128];
-	if (static_cast<size_t>(end - walltime) < sizeof(buf) - 1) {
-		strncpy(buf, walltime, end - walltime);
-		buf[end - walltime] = 0;
+	if (static_cast<size_t>(end - walltime) >= sizeof(buf)) {
+		throw ERROR_EVENT(NITRO_BAD_WALLTIME_1VALUE,
+				std::string(walltime, end));
 	}
+	strncpy(buf, walltime, end - walltime);
+	buf[end - walltime] = 0;
 	int multiplier = 1;
 	while (true) {
 		auto p = strchr(buf, 0);
@@ -70,9 +108,68 @@ double walltime_to_seconds(char const * walltime) {
 	return value;
 }
 
+/**
+ * Find the value of the walltime resource in a qsub cmdline. It can have an
+ * -l of its own, or share one with other comma-separated resources:
+ *
+ *     qsub -l walltime=4:00:00 job.sh
+ *     qsub -l nodes=1:ppn=4,walltime=30:00 job.sh
+ *
+ * @return the start of the value, with its end in @param value_end, or null
+ *     if the cmdline doesn't ask for a walltime.
+ */
+static char const * find_walltime_value(char const * cmdline,
+		char const * end_of_cmdline, char const *& value_end) {
+	static char const RESOURCE[] = "walltime=";
+	const size_t RESOURCE_LEN = sizeof(RESOURCE) - 1;
+	for (auto p = cmdline; p + 3 < end_of_cmdline; ++p) {
+		if (!isspace(p[0]) || p[1] != '-' || p[2] != 'l' || !isspace(p[3])) {
+			continue;
+		}
+		auto r = p + 4;
+		while (r < end_of_cmdline && isspace(*r)) {
+			++r;
+		}
+		auto end_of_list = r;
+		while (end_of_list < end_of_cmdline && !isspace(*end_of_list)) {
+			++end_of_list;
+		}
+		while (r < end_of_list) {
+			auto end_of_resource = static_cast<char const *>(memchr(r, ',',
+					end_of_list - r));
+			if (!end_of_resource) {
+				end_of_resource = end_of_list;
+			}
+			if (static_cast<size_t>(end_of_resource - r) > RESOURCE_LEN
+					&& strncmp(r, RESOURCE, RESOURCE_LEN) == 0) {
+				value_end = end_of_resource;
+				return r + RESOURCE_LEN;
+			}
+			r = end_of_resource + 1;
+		}
+		p = end_of_list - 1;
+	}
+	return nullptr;
+}
+
+double find_walltime(char const * cmdline, char const * end_of_cmdline) {
+	char const * value_end;
+	auto value = find_walltime_value(cmdline, end_of_cmdline, value_end);
+	if (value) {
+		try {
+			auto seconds = walltime_to_seconds(value, value_end);
+			if (seconds >= 0) {
+				return seconds;
+			}
+		} catch (error_event const &) {
+			// get_validation_errors() is where we complain about this.
+		}
+	}
+	return DEFAULT_WALLTIME_SECONDS;
+}
+
 double qsub_task::get_walltime_seconds() const {
-	// TODO: Look for -l walltime=value
-	return 1;
+	return walltime;
 }
 
 void qsub_task::get_validation_errors(std::string & errors) const {
@@ -84,12 +181,13 @@ void qsub_task::get_validation_errors(std::string & errors) const {
 		if (!flag) {
 			break;
 		}
+		x = flag + 2;
 		// TODO: get more robust; this is just quick and dirty
 		if (flag == dashF) {
 			if (flag[3] == ' ' && flag[4] == '"') {
 				x = strchr(flag + 5, '"');
 			}
-		} else if (strchr(BAD_FLAGS, flag[2])) {
+		} else if (flag[2] && strchr(BAD_FLAGS, flag[2])) {
 			errors += "The -";
 			errors += flag[2];
 			errors += " flag is not supported. ";
@@ -101,6 +199,19 @@ void qsub_task::get_validation_errors(std::string & errors) const {
 			}
 		}
 	}
+	char const * value_end;
+	auto cmdline = get_cmdline();
+	auto value = find_walltime_value(cmdline, strchr(cmdline, 0), value_end);
+	if (value) {
+		try {
+			if (walltime_to_seconds(value, value_end) < 0) {
+				errors += "A walltime can't be negative. ";
+			}
+		} catch (error_event const & e) {
+			errors += e.what();
+			errors += " ";
+		}
+	}
 }
 
 char const * qsub_task::get_task_style() const {
@@ -12,15 +12,35 @@ namespace nitro {
 class qsub_task: public task {
 public:
 	qsub_task(char const * cmdline, char const * end_of_cmdline,
-			assignment * asgn, uint64_t id);
+			assignment * asgn, uint64_t id, arena * storage);
 
 	virtual ~qsub_task() {}
 	virtual int get_priority() const;
 	virtual double get_walltime_seconds() const;
 	virtual void get_validation_errors(std::string &) const;
 	virtual char const * get_task_style() const;
+
+private:
+	// Parsed from the cmdline when the task is built, so that readers on
+	// other threads never write them.
+	int priority;
+	double walltime;
 };
 
+/**
+ * The range qsub allows for -p.
+ */
+extern const int MIN_PRIORITY;
+extern const int MAX_PRIORITY;
+
+/**
+ * Find the priority a qsub cmdline asks for with -p.
+ *
+ * @return the priority, or DEFAULT_PRIORITY if the cmdline doesn't say, or
+ *     says something outside [MIN_PRIORITY, MAX_PRIORITY].
+ */
+int find_priority(char const * cmdline, char const * end_of_cmdline);
+
 /**
  * Convert a walltime to raw seconds. Possible input formats include:
  *
@@ -34,6 +54,20 @@ public:
  */
 double walltime_to_seconds(char const * walltime);
 
+/**
+ * Like walltime_to_seconds(char const *), but the value ends at @param end.
+ */
+double walltime_to_seconds(char const * walltime, char const * end);
+
+/**
+ * Find the walltime a qsub cmdline asks for with -l walltime=..., whether
+ * it has an -l of its own or shares one with other resources.
+ *
+ * @return seconds, or DEFAULT_WALLTIME_SECONDS if the cmdline doesn't say,
+ *     or says something we can't parse.
+ */
+double find_walltime(char const * cmdline, char const * end_of_cmdline);
+
 } // end namespace nitro
 
 #endif // sentry
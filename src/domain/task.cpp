@@ -1,15 +1,38 @@
+#include <new>
+
+#include <ctype.h>
 #include <string.h>
 
+#include "base/arena.h"
+
 #include "domain/task.h"
 #define _PROPERLY_INCLUDED
 #include "domain/qsub_task.h"
 
 namespace nitro {
 
+const int DEFAULT_PRIORITY = 0;
+const double DEFAULT_WALLTIME_SECONDS = 1.0;
+
 task::task(char const * cmdline, char const * end_of_cmdline,
-		assignment * asgn, task::id_type id) :
-	cmdline(cmdline, end_of_cmdline ? end_of_cmdline : strchr(cmdline, 0)),
-	asgn(asgn), id(id), exit_code(0) {
+		assignment * asgn, task::id_type id, arena * storage) :
+	cmdline(nullptr), asgn(asgn), id(id), exit_code(0) {
+	if (!end_of_cmdline) {
+		end_of_cmdline = strchr(cmdline, 0);
+	}
+	if (storage) {
+		if (*end_of_cmdline == 0 && storage->owns(cmdline)) {
+			this->cmdline = cmdline;
+		} else {
+			this->cmdline = storage->copy(cmdline, end_of_cmdline);
+		}
+	} else {
+		size_t len = end_of_cmdline - cmdline;
+		owned_cmdline.reset(new char[len + 1]);
+		memcpy(owned_cmdline.get(), cmdline, len);
+		owned_cmdline[len] = 0;
+		this->cmdline = owned_cmdline.get();
+	}
 }
 
 int task::get_exit_code() const {
@@ -51,7 +74,7 @@ task::id_type task::get_id() const {
 }
 
 char const * task::get_cmdline() const {
-	return cmdline.c_str();
+	return cmdline;
 }
 
 task::handle task::make(char const * cmdline, assignment * asgn,
@@ -59,22 +82,67 @@ task::handle task::make(char const * cmdline, assignment * asgn,
 	return task::make(cmdline, nullptr, asgn, id);
 }
 
-task::handle task::make(char const * cmdline, char const * end_of_cmdline,
-		assignment * asgn, task::id_type id) {
+/**
+ * Skip leading whitespace, and decide which type of task (if any) the cmdline
+ * describes.
+ *
+ * @return null if we don't recognize the cmdline.
+ */
+static char const * recognize_task_style(char const *& cmdline,
+		char const *& end_of_cmdline) {
 	if (cmdline) {
 		if (!end_of_cmdline) {
 			end_of_cmdline = strchr(cmdline, 0);
 		}
-		while (isspace(*cmdline) && cmdline < end_of_cmdline) {
+		while (cmdline < end_of_cmdline && isspace(*cmdline)) {
 			++cmdline;
 		}
-		if (*cmdline && cmdline < end_of_cmdline) {
+		if (end_of_cmdline - cmdline >= 4) {
 			if (strncmp(cmdline, "qsub", 4) == 0) {
-				return handle(new qsub_task(cmdline, end_of_cmdline, asgn, id));
+				return "qsub";
 			}
 		}
 	}
+	return nullptr;
+}
+
+task::handle task::make(char const * cmdline, char const * end_of_cmdline,
+		assignment * asgn, task::id_type id) {
+	if (recognize_task_style(cmdline, end_of_cmdline)) {
+		return handle(new qsub_task(cmdline, end_of_cmdline, asgn, id,
+				nullptr));
+	}
 	return handle(nullptr);
 }
 
+task * task::make_in(arena & storage, char const * cmdline,
+		char const * end_of_cmdline, assignment * asgn, task::id_type id) {
+	if (recognize_task_style(cmdline, end_of_cmdline)) {
+		void * mem = storage.allocate(sizeof(qsub_task), alignof(qsub_task));
+		return new (mem) qsub_task(cmdline, end_of_cmdline, asgn, id,
+				&storage);
+	}
+	return nullptr;
+}
+
+size_t task::get_max_object_size() {
+	return sizeof(qsub_task);
+}
+
+bool task::is_task(char const * cmdline, char const * end_of_cmdline) {
+	return recognize_task_style(cmdline, end_of_cmdline) != nullptr;
+}
+
+bool task::estimate(char const * cmdline, char const * end_of_cmdline,
+		int & priority, double & walltime) {
+	if (recognize_task_style(cmdline, end_of_cmdline)) {
+		priority = find_priority(cmdline, end_of_cmdline);
+		walltime = find_walltime(cmdline, end_of_cmdline);
+		return true;
+	}
+	priority = DEFAULT_PRIORITY;
+	walltime = DEFAULT_WALLTIME_SECONDS;
+	return false;
+}
+
 } // end namespace nitro
@@ -5,10 +5,18 @@
 #include <memory>
 #include <cstdint>
 
+class arena;
+
 namespace nitro {
 
 class assignment;
 
+/**
+ * What we assume about a task whose cmdline doesn't tell us.
+ */
+extern const int DEFAULT_PRIORITY;
+extern const double DEFAULT_WALLTIME_SECONDS;
+
 class task {
 
 public:
@@ -44,12 +52,51 @@ public:
 	static handle make(char const * cmdline, char const * end_of_cmdline,
 			assignment * asgn, id_type id);
 
+	/**
+	 * Like make(), but build the task in @param storage instead of on the
+	 * heap. If the cmdline is already null-terminated inside the arena, the
+	 * task uses it in place; otherwise it's copied there. The caller must
+	 * call the task's destructor (but not delete it) before the arena dies.
+	 *
+	 * @return null if no task type understands the cmdline.
+	 */
+	static task * make_in(arena & storage, char const * cmdline,
+			char const * end_of_cmdline, assignment * asgn, id_type id);
+
+	/**
+	 * How many bytes of arena does make_in() use per task, not counting the
+	 * cmdline?
+	 */
+	static size_t get_max_object_size();
+
+	/**
+	 * Would make() build a task from @param cmdline? Blank lines, comments
+	 * and commands we don't understand aren't tasks.
+	 */
+	static bool is_task(char const * cmdline, char const * end_of_cmdline);
+
+	/**
+	 * What would get_priority() and get_walltime_seconds() say about the
+	 * task a cmdline describes? This reads the cmdline without building the
+	 * task, so it can be used on lines that aren't null-terminated.
+	 *
+	 * @return false (and defaults) if the cmdline isn't a task.
+	 */
+	static bool estimate(char const * cmdline, char const * end_of_cmdline,
+			int & priority, double & walltime);
+
 protected:
+	/**
+	 * @param storage
+	 *     If null, the task keeps its own copy of the cmdline; otherwise, it
+	 *     refers to text in the arena.
+	 */
 	task(char const * cmdline, char const * end_of_cmdline, assignment * asgn,
-			id_type id);
+			id_type id, arena * storage);
 
 private:
-	std::string cmdline;
+	char const * cmdline;
+	std::unique_ptr<char[]> owned_cmdline;
 	assignment * asgn;
 	uint64_t id;
 	int exit_code;
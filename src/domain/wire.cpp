@@ -0,0 +1,279 @@
+#include <algorithm>
+
+#include <string.h>
+
+#include "base/dbc.h"
+
+#include "domain/wire.h"
+
+using std::string;
+
+namespace nitro {
+
+/**
+ * A frame begins with these 3 bytes and a version byte. The leading null
+ * keeps frames from being mistaken for json, and "NB" keeps them from being
+ * mistaken for completion batches ("\0NCR").
+ */
+static char const WIRE_MAGIC[3] = { '\0', 'N', 'B' };
+
+const size_t MSG_ID_SIZE = sizeof(guid_t);
+
+// magic, version, code, message id, sender id length.
+const size_t FIXED_HEADER_SIZE = sizeof(WIRE_MAGIC) + 1 + sizeof(uint32_t)
+		+ MSG_ID_SIZE + 1;
+
+// tag, type, length.
+const size_t FIELD_HEADER_SIZE = 2 + sizeof(uint32_t);
+
+enum field_type {
+	ft_string = 1,
+	ft_tasks = 2
+};
+
+const uint32_t NO_TASKS = UINT32_MAX;
+
+// id, cmdline length.
+const size_t TASK_HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+
+template <typename T>
+inline void append_pod(string & buf, T value) {
+	buf.append(reinterpret_cast<char const *>(&value), sizeof(value));
+}
+
+template <typename T>
+inline T read_pod(char const * p) {
+	T value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+template <typename T>
+inline void patch_pod(string & buf, size_t pos, T value) {
+	memcpy(&buf[pos], &value, sizeof(value));
+}
+
+char const * get_wire_format_name(wire_format fmt) {
+	return fmt == wf_binary ? "binary" : "json";
+}
+
+wire_format parse_wire_format(char const * name) {
+	return name && strcmp(name, "binary") == 0 ? wf_binary : wf_json;
+}
+
+wire_writer::wire_writer(int code, char const * sender_id) :
+		tasks_count_pos(0), tasks_len_pos(0), task_count(NO_TASKS) {
+	size_t sender_len = sender_id ? std::min<size_t>(strlen(sender_id), 255)
+			: 0;
+	buf.reserve(256);
+	buf.append(WIRE_MAGIC, sizeof(WIRE_MAGIC));
+	buf.push_back(static_cast<char>(WIRE_VERSION));
+	append_pod(buf, static_cast<uint32_t>(code));
+	auto msg_id = generate_binary_guid();
+	buf.append(reinterpret_cast<char const *>(msg_id.bytes), MSG_ID_SIZE);
+	buf.push_back(static_cast<char>(sender_len));
+	buf.append(sender_id ? sender_id : "", sender_len);
+	field_count_pos = buf.size();
+	append_pod(buf, static_cast<uint16_t>(0));
+}
+
+void wire_writer::close_tasks() {
+	if (task_count != NO_TASKS) {
+		patch_pod(buf, tasks_count_pos, task_count);
+		patch_pod(buf, tasks_len_pos, static_cast<uint32_t>(
+				buf.size() - tasks_count_pos));
+		task_count = NO_TASKS;
+	}
+}
+
+void wire_writer::begin_field(wire_field field, uint8_t type, uint32_t len) {
+	close_tasks();
+	uint16_t n = read_pod<uint16_t>(&buf[field_count_pos]);
+	patch_pod(buf, field_count_pos, static_cast<uint16_t>(n + 1));
+	buf.push_back(static_cast<char>(field));
+	buf.push_back(static_cast<char>(type));
+	append_pod(buf, len);
+}
+
+void wire_writer::add_string(wire_field field, char const * value,
+		size_t len) {
+	begin_field(field, ft_string, len);
+	buf.append(value, len);
+}
+
+void wire_writer::begin_tasks(size_t cmdline_bytes_hint) {
+	begin_field(wfld_tasks, ft_tasks, 0);
+	tasks_len_pos = buf.size() - sizeof(uint32_t);
+	tasks_count_pos = buf.size();
+	task_count = 0;
+	append_pod(buf, task_count);
+	if (cmdline_bytes_hint) {
+		buf.reserve(buf.size() + cmdline_bytes_hint);
+	}
+}
+
+void wire_writer::add_task(uint64_t id, char const * cmdline, size_t len) {
+	PRECONDITION(task_count != NO_TASKS);
+	append_pod(buf, id);
+	append_pod(buf, static_cast<uint32_t>(len));
+	buf.append(cmdline, len);
+	++task_count;
+}
+
+string const & wire_writer::finish() {
+	close_tasks();
+	return buf;
+}
+
+bool is_wire_msg(char const * msg, size_t len) {
+	return len >= FIXED_HEADER_SIZE
+			&& memcmp(msg, WIRE_MAGIC, sizeof(WIRE_MAGIC)) == 0;
+}
+
+bool is_wire_msg(string const & msg) {
+	return is_wire_msg(msg.data(), msg.size());
+}
+
+wire_reader::wire_reader() : begin(0), end(0), code(0), fields(0),
+		field_count(0) {
+	memset(msg_id.bytes, 0, sizeof(msg_id.bytes));
+}
+
+bool wire_reader::parse(string const & msg) {
+	return parse(msg.data(), msg.size());
+}
+
+bool wire_reader::parse(char const * msg, size_t len) {
+	if (!is_wire_msg(msg, len)
+			|| static_cast<uint8_t>(msg[sizeof(WIRE_MAGIC)]) != WIRE_VERSION) {
+		return false;
+	}
+	begin = msg;
+	end = begin + len;
+	auto p = begin + sizeof(WIRE_MAGIC) + 1;
+	code = static_cast<int>(read_pod<uint32_t>(p));
+	p += sizeof(uint32_t);
+	memcpy(msg_id.bytes, p, MSG_ID_SIZE);
+	p += MSG_ID_SIZE;
+	size_t sender_len = static_cast<uint8_t>(*p++);
+	if (static_cast<size_t>(end - p) < sender_len + sizeof(uint16_t)) {
+		return false;
+	}
+	sender_id.assign(p, sender_len);
+	p += sender_len;
+	field_count = read_pod<uint16_t>(p);
+	p += sizeof(uint16_t);
+	fields = p;
+	for (unsigned i = 0; i < field_count; ++i) {
+		if (static_cast<size_t>(end - p) < FIELD_HEADER_SIZE) {
+			return false;
+		}
+		uint8_t type = p[1];
+		uint32_t len = read_pod<uint32_t>(p + 2);
+		p += FIELD_HEADER_SIZE;
+		if (static_cast<size_t>(end - p) < len) {
+			return false;
+		}
+		if (type == ft_tasks) {
+			// Every task must fit inside the field.
+			auto q = p, field_end = p + len;
+			if (len < sizeof(uint32_t)) {
+				return false;
+			}
+			uint32_t n = read_pod<uint32_t>(q);
+			q += sizeof(uint32_t);
+			for (uint32_t t = 0; t < n; ++t) {
+				if (static_cast<size_t>(field_end - q) < TASK_HEADER_SIZE) {
+					return false;
+				}
+				uint32_t cmd_len = read_pod<uint32_t>(q + sizeof(uint64_t));
+				q += TASK_HEADER_SIZE;
+				if (static_cast<size_t>(field_end - q) < cmd_len) {
+					return false;
+				}
+				q += cmd_len;
+			}
+			if (q != field_end) {
+				return false;
+			}
+		}
+		p += len;
+	}
+	return true;
+}
+
+int wire_reader::get_code() const {
+	return code;
+}
+
+guid_t const & wire_reader::get_msg_id() const {
+	return msg_id;
+}
+
+string const & wire_reader::get_sender_id() const {
+	return sender_id;
+}
+
+bool wire_reader::find(wire_field field, uint8_t type, char const *& value,
+		uint32_t & len) const {
+	auto p = fields;
+	for (unsigned i = 0; i < field_count; ++i) {
+		len = read_pod<uint32_t>(p + 2);
+		if (static_cast<uint8_t>(p[0]) == field
+				&& static_cast<uint8_t>(p[1]) == type) {
+			value = p + FIELD_HEADER_SIZE;
+			return true;
+		}
+		p += FIELD_HEADER_SIZE + len;
+	}
+	return false;
+}
+
+bool wire_reader::get_string(wire_field field, string & value) const {
+	char const * p;
+	uint32_t len;
+	if (!find(field, ft_string, p, len)) {
+		return false;
+	}
+	value.assign(p, len);
+	return true;
+}
+
+bool wire_reader::next_task(char const *& cursor, uint64_t & id,
+		char const *& cmdline, size_t & len) const {
+	char const * p;
+	uint32_t field_len;
+	if (!find(wfld_tasks, ft_tasks, p, field_len)) {
+		return false;
+	}
+	if (!cursor) {
+		cursor = p + sizeof(uint32_t);
+	}
+	if (cursor >= p + field_len) {
+		return false;
+	}
+	id = read_pod<uint64_t>(cursor);
+	len = read_pod<uint32_t>(cursor + sizeof(uint64_t));
+	cmdline = cursor + TASK_HEADER_SIZE;
+	cursor = cmdline + len;
+	return true;
+}
+
+size_t wire_reader::get_task_count(size_t * cmdline_bytes) const {
+	char const * p;
+	uint32_t field_len;
+	if (!find(wfld_tasks, ft_tasks, p, field_len)) {
+		if (cmdline_bytes) {
+			*cmdline_bytes = 0;
+		}
+		return 0;
+	}
+	uint32_t n = read_pod<uint32_t>(p);
+	if (cmdline_bytes) {
+		// Everything in the field that isn't the count or a task header.
+		*cmdline_bytes = field_len - sizeof(uint32_t) - n * TASK_HEADER_SIZE;
+	}
+	return n;
+}
+
+} // end namespace nitro
@@ -0,0 +1,152 @@
+#ifndef _DOMAIN_WIRE_H_
+#define _DOMAIN_WIRE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "base/guid.h"
+
+namespace nitro {
+
+/**
+ * How messages between a coordinator and its workers are encoded.
+ *
+ * Everything starts out as json, which is what our python tools (and older
+ * nitros) speak. A worker that can read binary says so when it affirms its
+ * willingness to help; a coordinator that agrees answers in binary, and from
+ * then on, each side uses binary with the other. Broadcasts stay json.
+ */
+enum wire_format {
+	wf_json,
+	wf_binary
+};
+
+/**
+ * @return "json" or "binary".
+ */
+char const * get_wire_format_name(wire_format fmt);
+
+/**
+ * @return wf_binary or wf_json (the default) for a name like the ones above.
+ */
+wire_format parse_wire_format(char const * name);
+
+/**
+ * Current version of the binary framing. A reader rejects frames with a
+ * version it doesn't know.
+ */
+const uint8_t WIRE_VERSION = 1;
+
+/**
+ * Fields a binary message can carry. Each is tagged with its type and length,
+ * so a reader skips any it doesn't recognize.
+ */
+enum wire_field {
+	wfld_message = 1,
+	wfld_assignment_id = 2,
+	wfld_tasks = 3
+};
+
+/**
+ * Build a binary message. The frame is a fixed header (magic, version,
+ * numeric event code, the message id as a binary guid, and the sender id),
+ * followed by typed fields.
+ *
+ * All integers are in host byte order; we assume a cluster doesn't mix
+ * endianness.
+ */
+class wire_writer {
+	std::string buf;
+	size_t field_count_pos;
+	size_t tasks_count_pos;
+	size_t tasks_len_pos;
+	uint32_t task_count;
+
+	void begin_field(wire_field field, uint8_t type, uint32_t len);
+	void close_tasks();
+
+public:
+	wire_writer(int code, char const * sender_id);
+
+	void add_string(wire_field field, char const * value, size_t len);
+	void add_string(wire_field field, std::string const & value) {
+		add_string(field, value.c_str(), value.size());
+	}
+
+	/**
+	 * Tasks are a single field holding a list of (id, cmdline) pairs. Call
+	 * add_task() as many times as needed after begin_tasks(); the list ends
+	 * when another field is added or the message is finished.
+	 */
+	void begin_tasks(size_t cmdline_bytes_hint = 0);
+	void add_task(uint64_t id, char const * cmdline, size_t len);
+
+	/**
+	 * @return the finished frame. The writer shouldn't be used afterward.
+	 */
+	std::string const & finish();
+};
+
+/**
+ * Read a binary message, without copying any of it. The reader refers into
+ * the buffer it parsed, which must outlive it.
+ */
+class wire_reader {
+	char const * begin;
+	char const * end;
+	int code;
+	guid_t msg_id;
+	std::string sender_id;
+	// Where the fields begin, and how many there are.
+	char const * fields;
+	uint16_t field_count;
+
+	bool find(wire_field field, uint8_t type, char const *& value,
+			uint32_t & len) const;
+
+public:
+	wire_reader();
+
+	/**
+	 * Validate a whole frame, including every field.
+	 *
+	 * @return false if it's not a binary message, is truncated, or has a
+	 *     version we don't understand.
+	 */
+	bool parse(std::string const & msg);
+	bool parse(char const * msg, size_t len);
+
+	int get_code() const;
+	guid_t const & get_msg_id() const;
+	std::string const & get_sender_id() const;
+
+	/**
+	 * @return false if the message has no such field.
+	 */
+	bool get_string(wire_field field, std::string & value) const;
+
+	/**
+	 * Walk the task list. Call with cursor = nullptr to start; each call
+	 * advances it.
+	 *
+	 * @return false when there are no more tasks.
+	 */
+	bool next_task(char const *& cursor, uint64_t & id, char const *& cmdline,
+			size_t & len) const;
+
+	/**
+	 * @return the number of tasks, and their total cmdline bytes.
+	 */
+	size_t get_task_count(size_t * cmdline_bytes = nullptr) const;
+};
+
+/**
+ * Does @param msg start like a binary frame? (Binary frames begin with a
+ * null byte, so they're never mistaken for json.)
+ */
+bool is_wire_msg(std::string const & msg);
+bool is_wire_msg(char const * msg, size_t len);
+
+} // end namespace nitro
+
+#endif // sentry
@@ -1,26 +1,33 @@
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <list>
 #include <map>
 #include <mutex>
 #include <thread>
+#include <vector>
 
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "base/dbc.h"
 #include "base/file_lines.h"
+#include "base/process_reaper.h"
 #include "base/strutil.h"
 #include "base/xlog.h"
 
 #include "domain/assignment.h"
 #include "domain/cmdline.h"
+#include "domain/completion_record.h"
+#include "domain/event_loop.h"
 #include "domain/worker_engine.h"
 #include "domain/event_codes.h"
 #include "domain/msg.h"
+#include "domain/wire.h"
 #include "domain/zmq_helpers.h"
 
-#include "json/json.h"
-
 #include "zeromq/include/zmq.h"
 
 using std::string;
@@ -31,33 +38,20 @@ using std::map;
 using std::atomic;
 using std::lock_guard;
 using std::chrono::milliseconds;
-using std::chrono::high_resolution_clock;
 
 using namespace nitro::event_codes;
 
 namespace nitro {
 
-void default_thread_main(worker_engine & we, char const * cmdline) {
-	worker_engine::notifier notifier(we);
-	FILE * f = popen(cmdline, "r");
-	if (f) {
-		char buf[1024];
-		while (fgets(buf, sizeof(buf), f) != NULL) {
-			;
-		}
-		pclose(f);
-	}
-}
-
-thread * default_launch_func(worker_engine & we, char const * cmdline) {
-	return new thread(default_thread_main, std::ref(we), cmdline);
-}
-
 struct thread_task_pair {
 	mutable thread * associated_thread;
 	task const * associated_task;
-	thread_task_pair(thread * th, task const * taskref) :
-			associated_thread(th), associated_task(taskref) {
+	// We may be running tasks from several assignments at once, so remember
+	// which one to credit when this thread exits.
+	assignment * associated_assignment;
+	thread_task_pair(thread * th, task const * taskref, assignment * asgn) :
+			associated_thread(th), associated_task(taskref),
+			associated_assignment(asgn) {
 	}
 	~thread_task_pair() {
 		delete associated_thread;
@@ -75,28 +69,59 @@ struct thread_task_pair {
 		}
 		associated_thread = rhs.associated_thread;
 		associated_task = rhs.associated_task;
+		associated_assignment = rhs.associated_assignment;
 		rhs.associated_thread = nullptr;
 		return *this;
 	}
 };
 
 typedef std::map<thread::id, thread_task_pair> threadmap_t;
-typedef std::queue<assignment::handle> asgn_queue_t;
+typedef std::deque<assignment::handle> asgn_queue_t;
+// Completion records we haven't sent yet, keyed by assignment id.
+typedef std::map<string, std::vector<completion_record>> record_map_t;
+// Child processes we're running, keyed by assignment id and task id.
+typedef std::map<std::pair<string, task::id_type>, pid_t> pid_map_t;
 
 struct worker_engine::data_t {
 	void * subscriber;
+	// Our half of the coordinator's dispatch channel. Assignments arrive
+	// here, and we report back on it.
+	void * dealer;
 	threadmap_t threadmap;
 	mutex tmap_mutex;
-	atomic<uint> active_thread_count;
+	atomic<uint> active_task_count;
 	asgn_queue_t asgn_queue;
 	mutex aqueue_mutex;
+	record_map_t pending_records;
+	mutex records_mutex;
+	pid_map_t running;
+	mutex running_mutex;
 	string workfor;
 	launch_func launcher;
+	unsigned desired_busy_threads;
+	unsigned max_assignments_in_flight;
 	bool enrolled;
+	// True once we've answered a coordinator's broadcast over the dispatch
+	// channel. From then on, only a terminate request lets us exit.
+	bool joined;
+	bool terminate_requested;
+	// True from the time we ask for work until the coordinator sends some.
+	bool awaiting_assignment;
+	// What we offer to speak on the dispatch channel, and what the
+	// coordinator has agreed to (it answers in binary if it accepts).
+	wire_format wire_offer;
+	wire_format wire;
+	// Starts and reaps real child processes, unless a launch_func has been
+	// supplied. Declared last so it's destroyed first; its dtor waits for
+	// our children, whose exit callbacks use everything above.
+	std::unique_ptr<process_reaper> reaper;
 
 	data_t() :
-			subscriber(0), threadmap(), active_thread_count(0), launcher(0),
-			enrolled(false) {
+			subscriber(0), dealer(0), threadmap(), active_task_count(0),
+			launcher(0), desired_busy_threads(MAX_HARDWARE_THREADS),
+			max_assignments_in_flight(DEFAULT_ASSIGNMENTS_IN_FLIGHT),
+			enrolled(false), joined(false), terminate_requested(false),
+			awaiting_assignment(false), wire_offer(wf_json), wire(wf_json) {
 	}
 };
 
@@ -106,6 +131,7 @@ worker_engine::notifier::~notifier() {
 
 void worker_engine::notify_thread_complete(thread::id tid) {
 	task::id_type task_id_to_complete = UINT64_MAX;
+	assignment * asgn = nullptr;
 	{
 		lock_guard<mutex> lock(data->tmap_mutex);
 		auto i = data->threadmap.find(tid);
@@ -114,28 +140,54 @@ void worker_engine::notify_thread_complete(thread::id tid) {
 			// in thread dtor, which recursively calls this method...
 			i->second.associated_thread->detach();
 			task_id_to_complete = i->second.associated_task->get_id();
+			asgn = i->second.associated_assignment;
 			// This causes the thread object to be destroyed, among other
 			// things.
 			data->threadmap.erase(i);
 		}
 	} // release lock on threadmap
 	if (task_id_to_complete != UINT64_MAX) {
-		--data->active_thread_count;
-		auto asgn = get_current_assignment();
-		if (asgn) {
-			bool all_complete = asgn->complete_task(task_id_to_complete);
-			if (all_complete) {
-				auto msg = serialize_msg(NITRO_1ASSIGNMENT_COMPLETE,
-						asgn->get_id());
-				queue_for_send(publisher, msg);
-				lock_guard<mutex> lock(data->aqueue_mutex);
-				data->asgn_queue.pop();
+		// Simulated tasks always succeed, and use no resources worth
+		// mentioning.
+		finish_task(asgn, completion_record::from_code(task_id_to_complete, 0));
+	} else {
+		xlog("Didn't find thread in map.");
+	}
+}
+
+void worker_engine::finish_task(assignment * asgn,
+		completion_record const & rec) {
+	--data->active_task_count;
+	bool all_complete = asgn->complete_task(rec.task_id, rec.exit_code);
+	{
+		lock_guard<mutex> lock(data->records_mutex);
+		data->pending_records[asgn->get_id()].push_back(rec);
+	}
+	if (all_complete) {
+		// The coordinator forgets an assignment once it's complete, so make
+		// sure the last of its records go out first.
+		send_completion_records(asgn->get_id());
+		queue_for_send(publisher, serialize_msg(NITRO_1ASSIGNMENT_COMPLETE,
+				asgn->get_id()));
+		if (data->joined) {
+			queue_for_send(data->dealer, make_msg(data->dealer,
+					NITRO_1ASSIGNMENT_COMPLETE, asgn->get_id()));
+		}
+		// Assignments don't necessarily finish in the order we got them.
+		lock_guard<mutex> lock(data->aqueue_mutex);
+		auto & q = data->asgn_queue;
+		for (auto i = q.begin(); i != q.end(); ++i) {
+			if (i->get() == asgn) {
+				q.erase(i);
+				break;
 			}
-		} else {
-			xlog("Got thread exit without current assignment. Huh?");
 		}
+		// Wake the poll loop while we still hold the lock; once it sees the
+		// queue empty, it may return, and the engine may be destroyed.
+		get_event_loop().wake();
 	} else {
-		xlog("Didn't find thread in map.");
+		// Wake the poll loop, so it refills this task's slot now.
+		get_event_loop().wake();
 	}
 }
 
@@ -150,6 +202,12 @@ worker_engine::worker_engine(cmdline const & cmdline) :
 				strlen(COORDINATION_TOPIC));
 		bind_after_ctor("w");
 
+		data->max_assignments_in_flight = std::max(1,
+				cmdline.get_option_as_int("--inflight",
+						DEFAULT_ASSIGNMENTS_IN_FLIGHT));
+		data->wire_offer = parse_wire_format(cmdline.get_option("--wire",
+				DEFAULT_WIRE_FORMAT));
+
 		auto wf = cmdline.get_option("--workfor", "");
 		auto proto = strstr(wf, "://");
 		if (proto) {
@@ -164,6 +222,19 @@ worker_engine::worker_engine(cmdline const & cmdline) :
 			auto endpoint = interp("tcp://%1", data->workfor);
 			zmq_connect_and_log(subscriber, endpoint.c_str());
 
+			// The coordinator's router knows us by our engine id.
+			auto dealer = zmq_socket(ctx, ZMQ_DEALER);
+			if (dealer) {
+				data->dealer = dealer;
+				zmq_setsockopt(dealer, ZMQ_IDENTITY, get_id(),
+						strlen(get_id()));
+				string host(data->workfor, 0, data->workfor.rfind(':'));
+				endpoint = interp(TCP_CONNECT_ENDPOINT_PATTERN, host,
+						cmdline.get_option_as_int("--dpport",
+								DEFAULT_DISPATCH_PORT));
+				zmq_connect_and_log(dealer, endpoint.c_str());
+			}
+
 #if 0
 			auto eth = cmdline.get_option("--interface",
 					DEFAULT_MULTICAST_INTERFACE);
@@ -180,6 +251,8 @@ const char * worker_engine::get_workfor() const {
 }
 
 worker_engine::~worker_engine() {
+	data->reaper.reset();
+	zmq_close_now(data->dealer);
 	zmq_close_now(data->subscriber);
 	delete data;
 }
@@ -189,51 +262,162 @@ worker_engine::launch_func worker_engine::get_launch_func() const {
 }
 
 void worker_engine::set_launch_func(launch_func value) {
-	data->launcher = value ? value : default_launch_func;
+	data->launcher = value;
 }
 
 assignment * worker_engine::get_current_assignment() const {
+	lock_guard<mutex> lock(data->aqueue_mutex);
 	return data->asgn_queue.empty() ? 0 : data->asgn_queue.front().get();
 }
 
+unsigned worker_engine::get_desired_busy_threads() const {
+	return data->desired_busy_threads;
+}
+
+void worker_engine::set_desired_busy_threads(unsigned value) {
+	PRECONDITION(value > 0);
+	data->desired_busy_threads = value;
+}
+
+unsigned worker_engine::get_max_assignments_in_flight() const {
+	return data->max_assignments_in_flight;
+}
+
+void worker_engine::set_max_assignments_in_flight(unsigned value) {
+	PRECONDITION(value > 0);
+	data->max_assignments_in_flight = value;
+}
+
+unsigned worker_engine::get_ready_count() const {
+	unsigned total = 0;
+	lock_guard<mutex> lock(data->aqueue_mutex);
+	for (auto & asgn : data->asgn_queue) {
+		unsigned ready;
+		asgn->get_counts(nullptr, nullptr, &ready);
+		total += ready;
+	}
+	return total;
+}
+
+void worker_engine::request_more_work() {
+	if (!data->joined || data->awaiting_assignment
+			|| data->terminate_requested) {
+		return;
+	}
+	// Count only the assignments that still have tasks to start; one whose
+	// tasks are all running is draining, and can't keep our slots busy.
+	// Asking as soon as we're below our limit, rather than when we run out,
+	// means the coordinator's answer arrives while we're still busy with
+	// what we have.
+	unsigned buffered = 0;
+	{
+		lock_guard<mutex> lock(data->aqueue_mutex);
+		for (auto & asgn : data->asgn_queue) {
+			unsigned ready;
+			asgn->get_counts(nullptr, nullptr, &ready);
+			if (ready) {
+				++buffered;
+			}
+		}
+	}
+	if (buffered < data->max_assignments_in_flight) {
+		data->awaiting_assignment = true;
+		send_full_msg(data->dealer, make_msg(data->dealer,
+				NITRO_NEED_ASSIGNMENT, interp("%1", data->desired_busy_threads)));
+	}
+}
+
 void worker_engine::start_more_tasks() {
-	// TODO: make desired_busy_threads a configurable member.
-	auto desired_busy_threads = MAX_HARDWARE_THREADS;
+	auto desired_busy_threads = data->desired_busy_threads;
 	static bool logged_thread_count = false;
 	if (!logged_thread_count) {
 		logged_thread_count = true;
 		xlog("worker_engine will try to keep %1 threads busy.",
 				desired_busy_threads);
 	}
-	auto atc = data->active_thread_count.load();
-	if (atc < desired_busy_threads) {
-		auto asgn = get_current_assignment();
-		if (asgn) {
-			assignment::tasklist_t const & readylist = asgn->get_list_by_status(
-					task_status::ts_ready);
-			std::list<task const *> to_start;
-			for (auto i = readylist.cbegin(); i != readylist.cend(); ++i) {
-				task const & t = **i;
-				to_start.push_back(&t);
-				if (++atc == desired_busy_threads) {
-					break;
-				}
+	auto atc = data->active_task_count.load();
+	if (atc >= desired_busy_threads) {
+		return;
+	}
+	// Fill slots from the oldest assignment first, then spill over into the
+	// ones we've prefetched. Once we let go of the queue, the assignments we
+	// picked are still safe to use: none of them can be retired while it
+	// has tasks we haven't started.
+	typedef std::pair<assignment *, task const *> pending_t;
+	std::list<pending_t> to_start;
+	{
+		lock_guard<mutex> lock(data->aqueue_mutex);
+		for (auto & handle : data->asgn_queue) {
+			assignment * asgn = handle.get();
+			for (auto t : asgn->get_tasks_by_status(ts_ready,
+					desired_busy_threads - atc)) {
+				to_start.push_back(pending_t(asgn, t));
+				++atc;
 			}
-			if (!to_start.empty()) {
-				lock_guard<mutex> lock(data->tmap_mutex);
-				for (auto i : to_start) {
-					auto cmdline = asgn->activate_task(i->get_id());
-					thread * launched = data->launcher(*this, cmdline);
-					thread_task_pair ttpair(launched, i);
-					data->threadmap.insert( { launched->get_id(), ttpair });
-				}
-				data->active_thread_count += to_start.size();
+			if (atc == desired_busy_threads) {
+				break;
 			}
 		}
 	}
+	if (to_start.empty()) {
+		return;
+	}
+	data->active_task_count += to_start.size();
+	if (data->launcher) {
+		lock_guard<mutex> lock(data->tmap_mutex);
+		for (auto & p : to_start) {
+			auto cmdline = p.first->activate_task(p.second->get_id());
+			thread * launched = data->launcher(*this, cmdline);
+			thread_task_pair ttpair(launched, p.second, p.first);
+			data->threadmap.insert( { launched->get_id(), ttpair });
+		}
+		return;
+	}
+	if (!data->reaper) {
+		data->reaper.reset(new process_reaper);
+	}
+	for (auto & p : to_start) {
+		auto asgn = p.first;
+		auto tid = p.second->get_id();
+		auto cmdline = asgn->activate_task(tid);
+		auto key = std::make_pair(string(asgn->get_id()), tid);
+		try {
+			// Remember the child's pid, in case we're asked to cancel it. Its
+			// exit callback waits for us to finish.
+			lock_guard<mutex> lock(data->running_mutex);
+			data->running[key] = data->reaper->spawn(cmdline,
+					[this, asgn, tid, key](process_exit_info const & info) {
+						{
+							lock_guard<mutex> lock(data->running_mutex);
+							data->running.erase(key);
+						}
+						finish_task(asgn, completion_record::from_exit(tid, info));
+					});
+		} catch (std::exception const & e) {
+			// Treat a task we couldn't start like one that failed at once,
+			// the way a shell reports a missing command; otherwise its
+			// assignment would never complete.
+			xlog("Unable to start \"%1\": %2", cmdline, e.what());
+			finish_task(asgn, completion_record::from_code(tid, 127));
+		}
+	}
 }
 
 void worker_engine::respond_to_help_request(void * socket) {
+	if (socket == data->subscriber) {
+		// A coordinator broadcasts this repeatedly until its work is handed
+		// out; answer over the dispatch channel, and only once.
+		if (data->dealer && !data->joined) {
+			data->joined = true;
+			data->enrolled = true;
+			// Affirming is also how we offer a faster format; the
+			// coordinator doesn't know yet what we speak, so this is json.
+			send_full_msg(data->dealer, serialize_msg(wf_json, get_id(),
+					NITRO_AFFIRM_HELP, data->wire_offer == wf_binary ?
+							get_wire_format_name(wf_binary) : ""));
+		}
+		return;
+	}
 	if (!data->enrolled) {
 		data->enrolled = true;
 		send_full_msg(socket, serialize_msg(NITRO_AFFIRM_HELP));
@@ -245,36 +429,166 @@ void worker_engine::respond_to_help_request(void * socket) {
 
 void worker_engine::accept_assignment(assignment * asgn) {
 	lock_guard<mutex> lock(data->aqueue_mutex);
-	data->asgn_queue.push(assignment::handle(asgn));
+	data->asgn_queue.push_back(assignment::handle(asgn));
 	// Normally, we say we're enrolled when we receive a message requesting
 	// help, and we affirm that we're available. But in testing, we may
 	// directly call this method without sending a message. In all cases,
 	// we must be enrolled by the time we accept an assignment, so this is a
 	// useful failsafe.
 	data->enrolled = true;
+	get_event_loop().wake();
+}
+
+string worker_engine::make_msg(void * socket, int eid,
+		string const & txt) const {
+	auto fmt = (socket == data->dealer) ? data->wire : wf_json;
+	return serialize_msg(fmt, get_id(), eid, txt);
 }
 
 void worker_engine::respond_to_assignment(void * socket,
-		Json::Value const & json) {
-	string txt;
+		wire_reader const & wire) {
+	string aid;
+	wire.get_string(wfld_assignment_id, aid);
+	assignment * asgn = nullptr;
 	if (data->enrolled) {
-		auto aid = json["body"]["assignment"]["id"];
-		auto lines = json["body"]["assignment"]["lines"];
-		assignment * asgn = new assignment(aid.asCString(), lines.asCString());
+		asgn = new assignment(aid.c_str());
+		size_t cmdline_bytes;
+		auto count = wire.get_task_count(&cmdline_bytes);
+		asgn->reserve(count, cmdline_bytes);
+		// Cmdlines are copied straight from the frame into the assignment's
+		// arena.
+		char const * cursor = nullptr;
+		uint64_t tid;
+		char const * cmdline;
+		size_t len;
+		while (wire.next_task(cursor, tid, cmdline, len)) {
+			asgn->ready_task(tid, cmdline, cmdline + len);
+		}
+	}
+	reply_to_assignment(socket, asgn, aid);
+}
+
+void worker_engine::reply_to_assignment(void * socket, assignment * asgn,
+		string const & aid) {
+	string txt;
+	if (asgn) {
 		accept_assignment(asgn);
-		txt = serialize_msg(NITRO_ACCEPT_ASSIGNMENT);
+		data->awaiting_assignment = false;
+		txt = make_msg(socket, NITRO_ACCEPT_ASSIGNMENT, aid);
 	} else {
-		txt = serialize_msg(NITRO_REJECT_ASSIGNMENT_1REASON,
+		txt = make_msg(socket, NITRO_REJECT_ASSIGNMENT_1REASON,
 				"not yet enrolled");
 	}
 	send_full_msg(socket, txt);
 }
 
+void worker_engine::respond_to_assignment(void * socket,
+		msg_view const & msg) {
+	string aid;
+	assignment * asgn = nullptr;
+	if (data->enrolled) {
+		aid = msg.assignment_id.str();
+		if (msg.has_tasks) {
+			asgn = new assignment(aid.c_str());
+			// Size the assignment's arena up front, so all the tasks and
+			// their cmdlines fit in a single allocation.
+			size_t cmdline_bytes = 0;
+			for (auto & t : msg.tasks) {
+				cmdline_bytes += t.cmdline.end - t.cmdline.begin;
+			}
+			asgn->reserve(msg.tasks.size(), cmdline_bytes);
+			// Most cmdlines need no unescaping, and go straight from the
+			// message into the assignment.
+			string unescaped;
+			for (auto & t : msg.tasks) {
+				if (t.cmdline.escaped) {
+					unescaped = t.cmdline.str();
+					asgn->ready_task(t.id, unescaped.c_str(),
+							unescaped.c_str() + unescaped.size());
+				} else {
+					asgn->ready_task(t.id, t.cmdline.begin, t.cmdline.end);
+				}
+			}
+		} else {
+			asgn = new assignment(aid.c_str(), msg.lines.str().c_str());
+		}
+	}
+	reply_to_assignment(socket, asgn, aid);
+}
+
+void worker_engine::cancel_task(string const & message) {
+	// The message is "<task id> <assignment id>".
+	char * end;
+	task::id_type tid = strtoull(message.c_str(), &end, 10);
+	if (end == message.c_str() || *end != ' ') {
+		xlog("Ignored malformed request to cancel \"%1\".", message);
+		return;
+	}
+	string aid(end + 1);
+	{
+		lock_guard<mutex> lock(data->running_mutex);
+		auto r = data->running.find(std::make_pair(aid, tid));
+		if (r != data->running.end()) {
+			// Its exit is reported like any other.
+			data->reaper->signal(r->second);
+			return;
+		}
+	}
+	// If the task hasn't started, it never will. One that's running on a
+	// thread from a launch_func can't be stopped; it will finish in its own
+	// time.
+	assignment * asgn = nullptr;
+	{
+		lock_guard<mutex> lock(data->aqueue_mutex);
+		for (auto & handle : data->asgn_queue) {
+			if (aid == handle->get_id()) {
+				asgn = handle.get();
+				break;
+			}
+		}
+	}
+	if (asgn && asgn->activate_task(tid)) {
+		++data->active_task_count;
+		finish_task(asgn, completion_record::from_code(tid, 128 + SIGTERM));
+	}
+}
+
+void worker_engine::send_completion_records(char const * assignment_id) {
+	record_map_t batches;
+	{
+		lock_guard<mutex> lock(data->records_mutex);
+		if (assignment_id) {
+			auto i = data->pending_records.find(assignment_id);
+			if (i == data->pending_records.end()) {
+				return;
+			}
+			batches[i->first].swap(i->second);
+			data->pending_records.erase(i);
+		} else {
+			batches.swap(data->pending_records);
+		}
+	}
+	// Only a coordinator we've joined wants these.
+	if (data->joined) {
+		for (auto & b : batches) {
+			// Batches delimit themselves, so those for several
+			// assignments can share one multipart message.
+			queue_for_send(data->dealer, encode_completion_batch(
+					b.first.c_str(), b.second.data(), b.second.size()),
+					true);
+		}
+	}
+}
+
 void worker_engine::report_status() {
-	auto asgn = get_current_assignment();
-	if (asgn) {
-		auto txt = asgn->get_status_msg();
-		queue_for_send(publisher, txt);
+	lock_guard<mutex> lock(data->aqueue_mutex);
+	if (!data->asgn_queue.empty()) {
+		for (auto & asgn : data->asgn_queue) {
+			auto msg = asgn->get_progress_msg();
+			if (!msg.empty()) {
+				queue_for_send(publisher, std::move(msg));
+			}
+		}
 	} else {
 		// TODO: REPORT IDLE
 	}
@@ -282,80 +596,127 @@ void worker_engine::report_status() {
 
 int worker_engine::do_run() {
 
-	const int ITEM_COUNT = 2;
-
+	// Only watch the dealer if we have one.
+	void * const sockets[] = { responder, data->subscriber, data->dealer };
+	const int SOCKET_COUNT = data->dealer ? 3 : 2;
+	auto topic_len = strlen(COORDINATION_TOPIC);
+
+	// Rather than ticking, we sleep until a socket has input, a task
+	// finishes (finish_task() wakes us, so its slot is refilled at once),
+	// or it's time for a status report.
+	event_loop & loop = get_event_loop();
+	for (int i = 0; i < SOCKET_COUNT; ++i) {
+		loop.add_socket(sockets[i]);
+	}
 	const auto REPORTING_INTERVAL = milliseconds(5000);
-	high_resolution_clock clock;
-	auto last_status_report = clock.now() - REPORTING_INTERVAL;
+	loop.set_timer(REPORTING_INTERVAL);
+
+	// Reused for every json message, so its task list keeps its capacity.
+	msg_view view;
+	msg_parts parts;
+
+	// Set when send_queued() leaves messages behind, so we don't wait
+	// before sending the rest.
+	bool send_backlog = false;
 
 	while (true) {
 
-		// Don't keep looping if we've completed our work.
-		if (data->enrolled && !get_linger() && !get_current_assignment()) {
-			break;
+		// Don't keep looping if we've completed our work. Once we've joined
+		// a coordinator, it decides when we're done.
+		if (!get_current_assignment()) {
+			if (data->terminate_requested) {
+				break;
+			}
+			if (data->enrolled && !get_linger() && !data->joined) {
+				break;
+			}
 		}
 
 		start_more_tasks();
+		request_more_work();
 
-		auto time_since_last_status_report = clock.now() - last_status_report;
-		if (time_since_last_status_report > REPORTING_INTERVAL) {
+		auto woke_for = loop.wait(send_backlog ? 0 : -1);
+		if (woke_for & event_loop::el_timer) {
 			report_status();
-			last_status_report = clock.now();
 		}
 
-		int delay = 25;
-		while (true) {
-
-			zmq_pollitem_t items[] = { { responder, 0, ZMQ_POLLIN, 0 }, {
-					data->subscriber, 0, ZMQ_POLLIN, 0 }, };
-
-			int rc = zmq_poll(items, ITEM_COUNT, delay);
-			if (rc < 1) {
-				break;
-			} else {
+		for (int i = 0; i < SOCKET_COUNT; ++i) {
+			void * socket = sockets[i];
 
-				for (int i = 0; i < ITEM_COUNT; ++i) {
+			// Drain each socket; its ZMQ_FD won't tell us again about
+			// messages that are already queued.
+			while (event_loop::has_input(socket)) {
 
-					if (items[i].revents == 0) {
-						continue;
-					}
+				// Read the message where zeromq put it; an assignment's
+				// cmdlines are copied only once, into its arena.
+				if (!receive_msg_parts(socket, parts) || parts.empty()) {
+					break;
+				}
+				auto txt = parts.data();
+				auto len = parts.size();
+
+				// Broadcasts are prefixed with their topic so subscribers
+				// can filter them.
+				if (socket == data->subscriber && len >= topic_len
+						&& memcmp(txt, COORDINATION_TOPIC, topic_len) == 0) {
+					txt += topic_len;
+					len -= topic_len;
+				}
 
-					auto txt = receive_full_msg(items[i].socket);
-					if (txt.empty()) {
-						continue;
+				#define IF_SOCKET_HANDLE(ok, block) \
+					if (ok) { block; } \
+					else { xlog("Can't handle msg on socket %1", i); } break
+
+				// A binary frame from our coordinator means it accepted
+				// our offer; answer it in kind from now on.
+				wire_reader wire;
+				bool binary = is_wire_msg(txt, len);
+				if (binary ? wire.parse(txt, len)
+						: decode_msg(txt, txt + len, view)) {
+					auto code = binary ? wire.get_code() : view.code;
+					if (binary && socket == data->dealer) {
+						data->wire = wf_binary;
 					}
-
-					void * socket = items[i].socket;
-
-					#define IF_SOCKET_N_HANDLE(num, block) \
-						if (i == num) { block; } \
-						else { xlog("Can't handle msg on socket %1", num); } break
-
-					Json::Value json;
-					if (deserialize_msg(txt, json)) {
-						auto code = json["body"]["code"].asInt();
-						switch (code) {
-						case NITRO_REQUEST_HELP:
-							IF_SOCKET_N_HANDLE(0,
-									respond_to_help_request(socket));
-						case NITRO_HERE_IS_ASSIGNMENT:
-							IF_SOCKET_N_HANDLE(0,
-									respond_to_assignment(socket, json));
-						default:
-							xlog("Unrecognized message %1 (%2)",
-									events::get_std_id_repr(code),
-									events::catalog().get_msg(code));
-						}
+					switch (code) {
+					case NITRO_REQUEST_HELP:
+						IF_SOCKET_HANDLE(socket != data->dealer,
+								respond_to_help_request(socket));
+					case NITRO_HERE_IS_ASSIGNMENT:
+						IF_SOCKET_HANDLE(socket != data->subscriber,
+								binary ? respond_to_assignment(socket, wire)
+										: respond_to_assignment(socket, view));
+					case NITRO_TERMINATE_REQUEST:
+						IF_SOCKET_HANDLE(socket == data->dealer,
+								data->terminate_requested = true);
+					case NITRO_CANCEL_1TASK_IN_2ASSIGNMENT:
+						IF_SOCKET_HANDLE(socket == data->dealer, {
+							string message;
+							if (binary) {
+								wire.get_string(wfld_message, message);
+							} else {
+								message = view.message.str();
+							}
+							cancel_task(message);
+						});
+					case NITRO_PING_REQUEST:
+						// Our coordinator hasn't heard from us in a while.
+						IF_SOCKET_HANDLE(socket == data->dealer,
+								queue_for_send(data->dealer, make_msg(
+										data->dealer, NITRO_PING_RESPONSE)));
+					default:
+						xlog("Unrecognized message %1 (%2)",
+								events::get_std_id_repr(code),
+								events::catalog().get_msg(code));
 					}
 				}
-				// On subsequent times through the loop, don't wait; only
-				// continue looping as long as we have a backlog of messages.
-				delay = 0;
 			}
 		}
 
-		// Dispatch any messages that we've decided to send.
-		send_queued();
+		// Dispatch any messages that we've decided to send. Records for
+		// tasks that finished since our last pass go out as one batch per
+		// assignment.
+		send_completion_records();
+		send_backlog = send_queued();
 	}
 
 	return 0;
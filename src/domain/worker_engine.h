@@ -5,13 +5,12 @@
 
 #include "domain/engine.h"
 
-namespace Json {
-	class Value;
-}
-
 namespace nitro {
 
 class assignment;
+struct completion_record;
+struct msg_view;
+class wire_reader;
 
 /**
  * The engine used when the app is in "worker" mode, waiting for instructions
@@ -37,15 +36,18 @@ public:
 	 */
 	const char * get_workfor() const;
 
-	typedef std::thread * (*launch_func)(worker_engine &, char const * cmdline);
-	launch_func get_launch_func() const;
 	/**
-	 * Allow launch behaviors to be simulated.
+	 * Normally, each task runs as a child process, started and reaped by a
+	 * single process_reaper. A launch_func replaces that with a thread per
+	 * task, so launch behaviors can be simulated. Pass null to go back to
+	 * real processes.
 	 */
+	typedef std::thread * (*launch_func)(worker_engine &, char const * cmdline);
+	launch_func get_launch_func() const;
 	void set_launch_func(launch_func value);
 
 	/**
-	 * All threads that this engine starts need to call this method on exit.
+	 * All threads started by a launch_func need to call this method on exit.
 	 * Use the notifier class to guarantee this.
 	 */
 	void notify_thread_complete(std::thread::id id);
@@ -55,6 +57,27 @@ public:
 		~notifier();
 	};
 
+	/**
+	 * How many tasks should we try to keep running at once? Defaults to
+	 * MAX_HARDWARE_THREADS.
+	 */
+	unsigned get_desired_busy_threads() const;
+	void set_desired_busy_threads(unsigned value);
+
+	/**
+	 * How many assignments with tasks still waiting to start may we hold at
+	 * once? While we're below this number, we ask the coordinator for more
+	 * work, so the next assignment is already here when the current one
+	 * runs dry. Defaults to --inflight, or DEFAULT_ASSIGNMENTS_IN_FLIGHT.
+	 */
+	unsigned get_max_assignments_in_flight() const;
+	void set_max_assignments_in_flight(unsigned value);
+
+	/**
+	 * How many tasks, across all assignments we hold, are waiting to start?
+	 */
+	unsigned get_ready_count() const;
+
 	/**
 	 * Should not be called by ordinary users. Public for testing.
 	 */
@@ -69,8 +92,34 @@ private:
 
 	void report_status();
 	void respond_to_help_request(void * socket);
-	void respond_to_assignment(void * socket, Json::Value const & json);
+	void respond_to_assignment(void * socket, msg_view const & msg);
+	void respond_to_assignment(void * socket, wire_reader const & wire);
+	/**
+	 * Take an assignment we've decoded, and tell whoever sent it. A null
+	 * @param asgn means we weren't in a position to accept it.
+	 */
+	void reply_to_assignment(void * socket, assignment * asgn,
+			std::string const & aid);
+	/**
+	 * Stop a task the coordinator no longer needs (because a copy of it
+	 * finished elsewhere), as described by the text of a
+	 * NITRO_CANCEL_1TASK_IN_2ASSIGNMENT message.
+	 */
+	void cancel_task(std::string const & message);
+	/**
+	 * Serialize a message for @param socket, in binary if that's what the
+	 * coordinator on the other end has agreed to.
+	 */
+	std::string make_msg(void * socket, int eid,
+			std::string const & txt = std::string()) const;
 	void start_more_tasks();
+	void finish_task(assignment * asgn, completion_record const & rec);
+	/**
+	 * Queue the completion records we've accumulated for the coordinator,
+	 * either for one assignment or (given null) for all of them.
+	 */
+	void send_completion_records(char const * assignment_id = nullptr);
+	void request_more_work();
 	assignment * get_current_assignment() const;
 
 	friend void zmq_poll_thread_main(worker_engine *);
@@ -0,0 +1,190 @@
+#ifndef CPPTL_JSON_ARENA_H_INCLUDED
+# define CPPTL_JSON_ARENA_H_INCLUDED
+
+# include "config.h"
+# include <cstddef>
+# include <new>
+
+namespace Json {
+
+   /** \brief Memory for the Values of one document, released all at once.
+    *
+    * While a ValueArenaScope for an arena is alive, Values built on that
+    * thread take their strings, member names, and object/array storage from
+    * the arena instead of the heap, and destroying them frees nothing. The
+    * arena's blocks are released together when the arena is destroyed, so it
+    * must outlive every Value built in its scope.
+    *
+    * Copying a Value made in an arena, outside any scope, produces an
+    * ordinary heap-backed Value that may outlive the arena.
+    *
+    * \code
+    * Json::ValueArena arena;
+    * Json::ValueArenaScope scope( arena );
+    * Json::Value root;
+    * root["body"]["code"] = "0x0600C064";
+    * return Json::FastWriter().write( root );
+    * \endcode
+    */
+   class JSON_API ValueArena
+   {
+   public:
+      enum { defaultBlockSize = 16 * 1024 };
+
+      explicit ValueArena( std::size_t blockSize = defaultBlockSize );
+      ~ValueArena();
+
+      /// Allocate \c size bytes, aligned for any Value member.
+      void *allocate( std::size_t size );
+
+      /// Copy \c length bytes of \c value, plus a null terminator.
+      char *duplicateString( const char *value, unsigned int length );
+
+      /// How much memory the arena has taken from the heap.
+      std::size_t bytesReserved() const;
+
+      /// The arena in scope on the calling thread, or 0 if there is none.
+      static ValueArena *current();
+
+   private:
+      friend class ValueArenaScope;
+
+      // The first block lives inside the arena itself, so small documents
+      // built in a stack-allocated arena never touch the heap.
+      enum { initialSize = 2048 };
+
+      struct Block
+      {
+         Block *next_;
+      };
+
+      ValueArena( const ValueArena & );
+      ValueArena &operator =( const ValueArena & );
+
+      char *cursor_;
+      char *limit_;
+      Block *blocks_;
+      std::size_t blockSize_;
+      std::size_t reserved_;
+      double initial_[initialSize / sizeof(double)];
+   };
+
+   /** \brief Make an arena current on this thread, for the life of the scope.
+    *
+    * Scopes nest; the previous arena (or none) is restored on destruction.
+    */
+   class JSON_API ValueArenaScope
+   {
+   public:
+      explicit ValueArenaScope( ValueArena &arena );
+      ~ValueArenaScope();
+
+   private:
+      ValueArenaScope( const ValueArenaScope & );
+      ValueArenaScope &operator =( const ValueArenaScope & );
+
+      ValueArena *previous_;
+   };
+
+   /** \brief Allocator for Value's containers.
+    *
+    * Captures the current arena when constructed; allocates from it if there
+    * was one, and from the heap otherwise. A container that is copied takes
+    * the arena current at the time of the copy, not its source's.
+    */
+   template <typename T>
+   class ValueArenaAllocator
+   {
+   public:
+      typedef T value_type;
+      typedef T *pointer;
+      typedef const T *const_pointer;
+      typedef T &reference;
+      typedef const T &const_reference;
+      typedef std::size_t size_type;
+      typedef std::ptrdiff_t difference_type;
+
+      template <typename U>
+      struct rebind
+      {
+         typedef ValueArenaAllocator<U> other;
+      };
+
+      ValueArenaAllocator()
+         : arena_( ValueArena::current() )
+      {
+      }
+
+      template <typename U>
+      ValueArenaAllocator( const ValueArenaAllocator<U> &other )
+         : arena_( other.arena() )
+      {
+      }
+
+      ValueArena *arena() const
+      {
+         return arena_;
+      }
+
+      pointer allocate( size_type n, const void * = 0 )
+      {
+         void *p = arena_ ? arena_->allocate( n * sizeof(T) )
+                          : ::operator new( n * sizeof(T) );
+         return static_cast<pointer>( p );
+      }
+
+      void deallocate( pointer p, size_type )
+      {
+         if ( !arena_ )
+            ::operator delete( p );
+      }
+
+      ValueArenaAllocator select_on_container_copy_construction() const
+      {
+         return ValueArenaAllocator();
+      }
+
+      void construct( pointer p, const T &value )
+      {
+         new ( p ) T( value );
+      }
+
+      void destroy( pointer p )
+      {
+         p->~T();
+      }
+
+      pointer address( reference x ) const
+      {
+         return &x;
+      }
+
+      const_pointer address( const_reference x ) const
+      {
+         return &x;
+      }
+
+      size_type max_size() const
+      {
+         return size_type( -1 ) / sizeof(T);
+      }
+
+      template <typename U>
+      bool operator ==( const ValueArenaAllocator<U> &other ) const
+      {
+         return arena_ == other.arena();
+      }
+
+      template <typename U>
+      bool operator !=( const ValueArenaAllocator<U> &other ) const
+      {
+         return arena_ != other.arena();
+      }
+
+   private:
+      ValueArena *arena_;
+   };
+
+} // namespace Json
+
+#endif // CPPTL_JSON_ARENA_H_INCLUDED
@@ -0,0 +1,81 @@
+#ifndef CPPTL_JSON_BUFFER_WRITER_H_INCLUDED
+# define CPPTL_JSON_BUFFER_WRITER_H_INCLUDED
+
+# include "config.h"
+# include "forwards.h"
+# include <string>
+
+namespace Json {
+
+   /** \brief Write a <a HREF="http://www.json.org">JSON</a> document
+    * straight into a string, one event at a time, without building a Value.
+    *
+    * The events mirror those of SaxHandler. Separators are inserted as
+    * needed; the output is compact, like FastWriter's (without its trailing
+    * newline). Nothing but the document itself is allocated, so the cost is
+    * proportional to the bytes written. Reserve the document beforehand, or
+    * reuse one that already has the capacity, to avoid regrowth.
+    *
+    * The caller is responsible for a well-formed sequence: a key before each
+    * member's value, and balanced starts and ends.
+    *
+    * \code
+    * std::string doc;
+    * doc.reserve( 256 );
+    * Json::BufferWriter writer( doc );
+    * writer.startObject();
+    * writer.key( "code" ).stringValue( "0x0600C064" );
+    * writer.key( "tasks" ).startArray().numberValue( 1 ).endArray();
+    * writer.endObject();
+    * \endcode
+    */
+   class JSON_API BufferWriter
+   {
+   public:
+      typedef long long Int64;
+      typedef unsigned long long UInt64;
+
+      /// Events are appended to \c document, which must outlive the writer.
+      explicit BufferWriter( std::string &document );
+
+      BufferWriter &startObject();
+      BufferWriter &endObject();
+      BufferWriter &startArray();
+      BufferWriter &endArray();
+
+      /// \c name is escaped as needed, like a string value.
+      BufferWriter &key( const char *name );
+      BufferWriter &key( const std::string &name );
+
+      BufferWriter &stringValue( const char *value );
+      BufferWriter &stringValue( const char *begin, const char *end );
+      BufferWriter &stringValue( const std::string &value );
+      BufferWriter &numberValue( Int value );
+      BufferWriter &numberValue( UInt value );
+      BufferWriter &numberValue( Int64 value );
+      BufferWriter &numberValue( UInt64 value );
+      /// Always written with a decimal point or an exponent, so that it
+      /// reads back as a real.
+      BufferWriter &numberValue( double value );
+      BufferWriter &boolValue( bool value );
+      BufferWriter &nullValue();
+
+      /// The document written so far.
+      const std::string &document() const;
+
+   private:
+      BufferWriter( const BufferWriter & );
+      BufferWriter &operator =( const BufferWriter & );
+
+      void separate();
+      void writeString( const char *begin, const char *end );
+      void writeUInt64( UInt64 value, bool isNegative );
+
+      std::string &document_;
+      // Containers open; at depth 0 a value needs no separator.
+      int depth_;
+   };
+
+} // namespace Json
+
+#endif // CPPTL_JSON_BUFFER_WRITER_H_INCLUDED
@@ -13,6 +13,11 @@
 /// (hash table & simple deque container with customizable allocator).
 /// THIS FEATURE IS STILL EXPERIMENTAL!
 //#  define JSON_VALUE_USE_INTERNAL_MAP 1
+/// If defined, objects and arrays are stored in an open-addressing hash map
+/// (see hash_map.h) instead of std::map. Lookups are O(1), and members iterate
+/// (and are written) in insertion order rather than sorted by name.
+/// Ignored if JSON_VALUE_USE_INTERNAL_MAP is defined.
+//#  define JSON_VALUE_USE_HASH_MAP 1
 /// Force usage of standard new/malloc based allocator instead of memory pool based allocator.
 /// The memory pools allocator used optimization (initializing Value and ValueInternalLink
 /// as if it was a POD) that may cause some validation tool to report errors.
@@ -0,0 +1,442 @@
+#ifndef CPPTL_JSON_HASH_MAP_H_INCLUDED
+# define CPPTL_JSON_HASH_MAP_H_INCLUDED
+
+# include <algorithm>
+# include <cstddef>
+# include <iterator>
+# include <new>
+# include <utility>
+# include <vector>
+
+namespace Json {
+
+   /** \brief Open-addressing hash map that iterates in insertion order.
+    *
+    * Used as Value's object/array storage when JSON_VALUE_USE_HASH_MAP is
+    * defined. It has the subset of the std::map interface that Value uses.
+    * Entries are allocated individually, so references to them stay valid
+    * until they are erased. Their positions are kept in a dense vector, and
+    * the hash index holds 32-bit positions with linear probing.
+    *
+    * Unlike std::map, iteration follows insertion order rather than key
+    * order, and an insertion may invalidate iterators (but not references).
+    */
+   template <typename Key, typename T, typename Hash, typename Allocator>
+   class OrderedHashMap
+   {
+   public:
+      typedef Key key_type;
+      typedef T mapped_type;
+      typedef std::pair<const Key, T> value_type;
+      typedef std::size_t size_type;
+      typedef Allocator allocator_type;
+
+   private:
+      struct Node
+      {
+         Node( const value_type &value, std::size_t hash )
+            : value_( value )
+            , hash_( hash )
+         {
+         }
+
+         value_type value_;
+         std::size_t hash_;
+      };
+
+      typedef typename Allocator::template rebind<Node>::other NodeAllocator;
+      typedef typename Allocator::template rebind<Node *>::other NodePtrAllocator;
+      typedef typename Allocator::template rebind<unsigned int>::other SlotAllocator;
+      typedef std::vector<Node *, NodePtrAllocator> Nodes;
+      typedef std::vector<unsigned int, SlotAllocator> Slots;
+
+      // A slot holds a position in nodes_, plus one, or one of these.
+      enum { emptySlot = 0u, deletedSlot = ~0u };
+
+      template <typename Ref, typename Ptr>
+      class IteratorTemplate
+      {
+      public:
+         typedef std::bidirectional_iterator_tag iterator_category;
+         typedef typename OrderedHashMap::value_type value_type;
+         typedef std::ptrdiff_t difference_type;
+         typedef Ptr pointer;
+         typedef Ref reference;
+
+         IteratorTemplate()
+            : nodes_( 0 )
+            , pos_( 0 )
+         {
+         }
+
+         IteratorTemplate( const Nodes *nodes, std::size_t pos )
+            : nodes_( nodes )
+            , pos_( pos )
+         {
+         }
+
+         // iterator converts to const_iterator.
+         template <typename R, typename P>
+         IteratorTemplate( const IteratorTemplate<R, P> &other )
+            : nodes_( other.nodes_ )
+            , pos_( other.pos_ )
+         {
+         }
+
+         reference operator *() const
+         {
+            return (*nodes_)[pos_]->value_;
+         }
+
+         pointer operator ->() const
+         {
+            return &(*nodes_)[pos_]->value_;
+         }
+
+         IteratorTemplate &operator ++()
+         {
+            do
+               ++pos_;
+            while ( pos_ < nodes_->size()  &&  !(*nodes_)[pos_] );
+            return *this;
+         }
+
+         IteratorTemplate &operator --()
+         {
+            do
+               --pos_;
+            while ( !(*nodes_)[pos_] );
+            return *this;
+         }
+
+         IteratorTemplate operator ++( int )
+         {
+            IteratorTemplate temp( *this );
+            ++*this;
+            return temp;
+         }
+
+         IteratorTemplate operator --( int )
+         {
+            IteratorTemplate temp( *this );
+            --*this;
+            return temp;
+         }
+
+         template <typename R, typename P>
+         bool operator ==( const IteratorTemplate<R, P> &other ) const
+         {
+            return pos_ == other.pos_  &&  nodes_ == other.nodes_;
+         }
+
+         template <typename R, typename P>
+         bool operator !=( const IteratorTemplate<R, P> &other ) const
+         {
+            return !( *this == other );
+         }
+
+      private:
+         template <typename R, typename P> friend class IteratorTemplate;
+         friend class OrderedHashMap;
+
+         const Nodes *nodes_;
+         std::size_t pos_;
+      };
+
+   public:
+      typedef IteratorTemplate<value_type &, value_type *> iterator;
+      typedef IteratorTemplate<const value_type &, const value_type *> const_iterator;
+
+      OrderedHashMap()
+         : allocator_()
+         , nodes_( NodePtrAllocator( allocator_ ) )
+         , slots_( SlotAllocator( allocator_ ) )
+         , size_( 0 )
+         , deleted_( 0 )
+      {
+      }
+
+      OrderedHashMap( const OrderedHashMap &other )
+         : allocator_( other.allocator_.select_on_container_copy_construction() )
+         , nodes_( NodePtrAllocator( allocator_ ) )
+         , slots_( SlotAllocator( allocator_ ) )
+         , size_( 0 )
+         , deleted_( 0 )
+      {
+         reserve( other.size_ );
+         for ( const_iterator it = other.begin(); it != other.end(); ++it )
+            insert( *it );
+      }
+
+      ~OrderedHashMap()
+      {
+         destroyNodes();
+      }
+
+      allocator_type get_allocator() const
+      {
+         return allocator_;
+      }
+
+      size_type size() const
+      {
+         return size_;
+      }
+
+      bool empty() const
+      {
+         return size_ == 0;
+      }
+
+      iterator begin()
+      {
+         return iterator( &nodes_, firstPosition() );
+      }
+
+      iterator end()
+      {
+         return iterator( &nodes_, nodes_.size() );
+      }
+
+      const_iterator begin() const
+      {
+         return const_iterator( &nodes_, firstPosition() );
+      }
+
+      const_iterator end() const
+      {
+         return const_iterator( &nodes_, nodes_.size() );
+      }
+
+      iterator find( const key_type &key )
+      {
+         std::size_t slot;
+         return iterator( &nodes_, findPosition( key, hasher_( key ), slot ) );
+      }
+
+      const_iterator find( const key_type &key ) const
+      {
+         std::size_t slot;
+         return const_iterator( &nodes_, findPosition( key, hasher_( key ), slot ) );
+      }
+
+      /// Same as find(); there is no order to be bound by. Lets Value's
+      /// lower_bound()/insert( hint ) idiom work unchanged.
+      iterator lower_bound( const key_type &key )
+      {
+         return find( key );
+      }
+
+      std::pair<iterator, bool> insert( const value_type &value )
+      {
+         std::size_t hash = hasher_( value.first );
+         std::size_t slot;
+         std::size_t pos = findPosition( value.first, hash, slot );
+         if ( pos != nodes_.size() )
+            return std::make_pair( iterator( &nodes_, pos ), false );
+         if ( ( size_ + deleted_ + 1 ) * 4 > slots_.size() * 3 )
+         {
+            // Rehash, which also drops deleted slots and the holes they left
+            // in nodes_. The nodes themselves don't move.
+            rehash( ( size_ + 1 ) * 2 );
+            findPosition( value.first, hash, slot );
+         }
+         NodeAllocator nodeAllocator( allocator_ );
+         Node *node = nodeAllocator.allocate( 1 );
+         try
+         {
+            new ( node ) Node( value, hash );
+         }
+         catch ( ... )
+         {
+            nodeAllocator.deallocate( node, 1 );
+            throw;
+         }
+         nodes_.push_back( node );
+         slots_[slot] = static_cast<unsigned int>( nodes_.size() );
+         ++size_;
+         return std::make_pair( iterator( &nodes_, nodes_.size() - 1 ), true );
+      }
+
+      iterator insert( iterator, const value_type &value )
+      {
+         return insert( value ).first;
+      }
+
+      void erase( iterator it )
+      {
+         Node *node = nodes_[it.pos_];
+         std::size_t mask = slots_.size() - 1;
+         std::size_t slot = node->hash_ & mask;
+         while ( slots_[slot] != it.pos_ + 1 )
+            slot = ( slot + 1 ) & mask;
+         slots_[slot] = deletedSlot;
+         ++deleted_;
+         destroyNode( node );
+         nodes_[it.pos_] = 0;
+         --size_;
+         // Dropping trailing holes keeps arrays, which shrink from the end,
+         // dense.
+         while ( !nodes_.empty()  &&  !nodes_.back() )
+            nodes_.pop_back();
+      }
+
+      size_type erase( const key_type &key )
+      {
+         iterator it = find( key );
+         if ( it == end() )
+            return 0;
+         erase( it );
+         return 1;
+      }
+
+      void clear()
+      {
+         destroyNodes();
+         nodes_.clear();
+         std::fill( slots_.begin(), slots_.end(), (unsigned int)emptySlot );
+         size_ = 0;
+         deleted_ = 0;
+      }
+
+      /// Same members with equal values, in any order.
+      bool operator ==( const OrderedHashMap &other ) const
+      {
+         if ( size_ != other.size_ )
+            return false;
+         for ( const_iterator it = begin(); it != end(); ++it )
+         {
+            const_iterator found = other.find( it->first );
+            if ( found == other.end()  ||  !( found->second == it->second ) )
+               return false;
+         }
+         return true;
+      }
+
+      /// Orders like std::map: lexicographically, by sorted key.
+      bool operator <( const OrderedHashMap &other ) const
+      {
+         std::vector<const value_type *> mine( sorted() );
+         std::vector<const value_type *> theirs( other.sorted() );
+         return std::lexicographical_compare( mine.begin(), mine.end(),
+                                              theirs.begin(), theirs.end(),
+                                              lessByPair );
+      }
+
+   private:
+      OrderedHashMap &operator =( const OrderedHashMap & );
+
+      std::size_t firstPosition() const
+      {
+         std::size_t pos = 0;
+         while ( pos < nodes_.size()  &&  !nodes_[pos] )
+            ++pos;
+         return pos;
+      }
+
+      /// Returns the position of \c key in nodes_, or nodes_.size() if
+      /// absent, in which case \c slot is where it would be inserted.
+      std::size_t findPosition( const key_type &key, std::size_t hash,
+                                std::size_t &slot ) const
+      {
+         if ( slots_.empty() )
+         {
+            slot = 0;
+            return nodes_.size();
+         }
+         std::size_t mask = slots_.size() - 1;
+         std::size_t firstDeleted = slots_.size();
+         for ( slot = hash & mask; ; slot = ( slot + 1 ) & mask )
+         {
+            unsigned int s = slots_[slot];
+            if ( s == emptySlot )
+               break;
+            if ( s == deletedSlot )
+            {
+               if ( firstDeleted == slots_.size() )
+                  firstDeleted = slot;
+               continue;
+            }
+            const Node *node = nodes_[s - 1];
+            if ( node->hash_ == hash  &&  node->value_.first == key )
+               return s - 1;
+         }
+         if ( firstDeleted != slots_.size() )
+            slot = firstDeleted;
+         return nodes_.size();
+      }
+
+      void reserve( std::size_t count )
+      {
+         if ( count * 4 > slots_.size() * 3 )
+            rehash( count );
+      }
+
+      void rehash( std::size_t count )
+      {
+         std::size_t capacity = 8;
+         while ( capacity * 3 < count * 4 )
+            capacity *= 2;
+         Nodes compacted( ( NodePtrAllocator( allocator_ ) ) );
+         compacted.reserve( capacity );
+         for ( std::size_t i = 0; i < nodes_.size(); ++i )
+            if ( nodes_[i] )
+               compacted.push_back( nodes_[i] );
+         nodes_.swap( compacted );
+         Slots slots( capacity, (unsigned int)emptySlot, SlotAllocator( allocator_ ) );
+         slots_.swap( slots );
+         deleted_ = 0;
+         std::size_t mask = capacity - 1;
+         for ( std::size_t i = 0; i < nodes_.size(); ++i )
+         {
+            std::size_t slot = nodes_[i]->hash_ & mask;
+            while ( slots_[slot] != emptySlot )
+               slot = ( slot + 1 ) & mask;
+            slots_[slot] = static_cast<unsigned int>( i + 1 );
+         }
+      }
+
+      void destroyNode( Node *node )
+      {
+         node->~Node();
+         NodeAllocator( allocator_ ).deallocate( node, 1 );
+      }
+
+      void destroyNodes()
+      {
+         for ( std::size_t i = 0; i < nodes_.size(); ++i )
+            if ( nodes_[i] )
+               destroyNode( nodes_[i] );
+      }
+
+      std::vector<const value_type *> sorted() const
+      {
+         std::vector<const value_type *> values;
+         values.reserve( size_ );
+         for ( const_iterator it = begin(); it != end(); ++it )
+            values.push_back( &*it );
+         std::sort( values.begin(), values.end(), lessByKey );
+         return values;
+      }
+
+      static bool lessByKey( const value_type *a, const value_type *b )
+      {
+         return a->first < b->first;
+      }
+
+      static bool lessByPair( const value_type *a, const value_type *b )
+      {
+         return *a < *b;
+      }
+
+      Allocator allocator_;
+      Hash hasher_;
+      Nodes nodes_;
+      Slots slots_;
+      std::size_t size_;
+      std::size_t deleted_;
+   };
+
+} // namespace Json
+
+#endif // CPPTL_JSON_HASH_MAP_H_INCLUDED
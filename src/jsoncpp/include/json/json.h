@@ -4,7 +4,9 @@
 # include "autolink.h"
 # include "value.h"
 # include "reader.h"
+# include "sax_reader.h"
 # include "writer.h"
+# include "buffer_writer.h"
 # include "features.h"
 
 #endif // JSON_JSON_H_INCLUDED
@@ -0,0 +1,86 @@
+#ifndef CPPTL_JSON_SAX_READER_H_INCLUDED
+# define CPPTL_JSON_SAX_READER_H_INCLUDED
+
+# include "config.h"
+# include <string>
+
+namespace Json {
+
+   /** \brief Receives the events of a SaxReader, in document order.
+    *
+    * Strings are passed as [begin, end) views into the document, without
+    * their quotes and still escaped; \c escaped says whether decoding is
+    * needed (see SaxReader::decodeString()). Numbers are passed as views of
+    * their text. Nothing is allocated on the handler's behalf.
+    *
+    * Each callback returns \c false to stop parsing. The defaults ignore the
+    * event and continue.
+    */
+   class JSON_API SaxHandler
+   {
+   public:
+      virtual ~SaxHandler();
+
+      virtual bool startObject();
+      virtual bool endObject();
+      virtual bool startArray();
+      virtual bool endArray();
+      virtual bool key( const char *begin, const char *end, bool escaped );
+      virtual bool stringValue( const char *begin, const char *end, bool escaped );
+      virtual bool numberValue( const char *begin, const char *end );
+      virtual bool boolValue( bool value );
+      virtual bool nullValue();
+   };
+
+   /** \brief Stream a <a HREF="http://www.json.org">JSON</a> document to a
+    * SaxHandler, without building a Value.
+    *
+    * Accepts what Reader accepts with Features::all(): comments are skipped,
+    * and the root may be any value.
+    */
+   class JSON_API SaxReader
+   {
+   public:
+      typedef char Char;
+      typedef const Char *Location;
+
+      /// Containers nested deeper than this are rejected.
+      enum { maxDepth = 256 };
+
+      SaxReader();
+
+      /** \brief Parse [beginDoc, endDoc), calling \c handler for each event.
+       * \return \c true if the whole document was valid and the handler never
+       *         stopped the parse.
+       */
+      bool parse( const char *beginDoc, const char *endDoc,
+                  SaxHandler &handler );
+
+      /// Where parsing stopped, if it failed.
+      Location getErrorLocation() const;
+
+      /** \brief Decode the escapes in a string view from a SaxHandler,
+       * appending the result to \c decoded.
+       * \return \c false if an escape is malformed.
+       */
+      static bool decodeString( const char *begin, const char *end,
+                                std::string &decoded );
+
+   private:
+      bool readValue( SaxHandler &handler, int depth );
+      bool readObject( SaxHandler &handler, int depth );
+      bool readArray( SaxHandler &handler, int depth );
+      bool readString( Location &begin, Location &end, bool &escaped );
+      bool readNumber( Location &begin, Location &end );
+      bool match( const char *pattern, int patternLength );
+      bool skipSpacesAndComments();
+
+      Location begin_;
+      Location end_;
+      Location current_;
+      Location error_;
+   };
+
+} // namespace Json
+
+#endif // CPPTL_JSON_SAX_READER_H_INCLUDED
@@ -2,10 +2,13 @@
 # define CPPTL_JSON_H_INCLUDED
 
 # include "forwards.h"
+# include "arena.h"
 # include <string>
 # include <vector>
 
-# ifndef JSON_USE_CPPTL_SMALLMAP
+# if defined(JSON_VALUE_USE_HASH_MAP)
+#  include "hash_map.h"
+# elif !defined(JSON_USE_CPPTL_SMALLMAP)
 #  include <map>
 # else
 #  include <cpptl/smallmap.h>
@@ -138,7 +141,10 @@ namespace Json {
          {
             noDuplication = 0,
             duplicate,
-            duplicateOnCopy
+            duplicateOnCopy,
+            /// Copied into a ValueArena: never freed, but duplicated on copy
+            /// like duplicateOnCopy.
+            inArena
          };
          CZString( int index );
          CZString( const char *cstr, DuplicationPolicy allocate );
@@ -152,13 +158,25 @@ namespace Json {
          bool isStaticString() const;
       private:
          void swap( CZString &other );
+         void duplicateName();
          const char *cstr_;
          int index_;
       };
 
+#  ifdef JSON_VALUE_USE_HASH_MAP
+      struct CZStringHash
+      {
+         std::size_t operator()( const CZString &key ) const;
+      };
+#  endif
+
    public:
-#  ifndef JSON_USE_CPPTL_SMALLMAP
-      typedef std::map<CZString, Value> ObjectValues;
+#  if defined(JSON_VALUE_USE_HASH_MAP)
+      typedef OrderedHashMap<CZString, Value, CZStringHash,
+                             ValueArenaAllocator<std::pair<const CZString, Value> > > ObjectValues;
+#  elif !defined(JSON_USE_CPPTL_SMALLMAP)
+      typedef std::map<CZString, Value, std::less<CZString>,
+                       ValueArenaAllocator<std::pair<const CZString, Value> > > ObjectValues;
 #  else
       typedef CppTL::SmallMap<CZString, Value> ObjectValues;
 #  endif // ifndef JSON_USE_CPPTL_SMALLMAP
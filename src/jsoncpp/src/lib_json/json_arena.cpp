@@ -0,0 +1,118 @@
+#include <json/arena.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace Json {
+
+// Everything the arena hands out is aligned like this, which suits Value,
+// its containers' nodes, and strings alike.
+static const std::size_t arenaAlignment = 2 * sizeof(double);
+
+static inline std::size_t
+alignUp( std::size_t n )
+{
+   return ( n + arenaAlignment - 1 ) & ~( arenaAlignment - 1 );
+}
+
+static ValueArena *&
+currentArena()
+{
+   static __thread ValueArena *arena = 0;
+   return arena;
+}
+
+
+// Implementation of class ValueArena
+// ////////////////////////////////
+
+ValueArena::ValueArena( std::size_t blockSize )
+   : cursor_( reinterpret_cast<char *>( initial_ ) )
+   , limit_( reinterpret_cast<char *>( initial_ ) + sizeof(initial_) )
+   , blocks_( 0 )
+   , blockSize_( blockSize < initialSize ? initialSize : blockSize )
+   , reserved_( 0 )
+{
+}
+
+
+ValueArena::~ValueArena()
+{
+   while ( blocks_ )
+   {
+      Block *next = blocks_->next_;
+      free( blocks_ );
+      blocks_ = next;
+   }
+}
+
+
+void *
+ValueArena::allocate( std::size_t size )
+{
+   size = alignUp( size ? size : 1 );
+   if ( std::size_t( limit_ - cursor_ ) < size )
+   {
+      // Big requests get a block of their own; otherwise start a new block
+      // and abandon what's left of the current one.
+      std::size_t header = alignUp( sizeof(Block) );
+      bool dedicated = size > blockSize_ / 4;
+      std::size_t blockSize = dedicated ? header + size : blockSize_;
+      Block *block = static_cast<Block *>( malloc( blockSize ) );
+      if ( !block )
+         throw std::bad_alloc();
+      block->next_ = blocks_;
+      blocks_ = block;
+      reserved_ += blockSize;
+      char *start = reinterpret_cast<char *>( block ) + header;
+      if ( dedicated )
+         return start;
+      cursor_ = start;
+      limit_ = reinterpret_cast<char *>( block ) + blockSize;
+   }
+   void *p = cursor_;
+   cursor_ += size;
+   return p;
+}
+
+
+char *
+ValueArena::duplicateString( const char *value, unsigned int length )
+{
+   char *newString = static_cast<char *>( allocate( length + 1 ) );
+   memcpy( newString, value, length );
+   newString[length] = 0;
+   return newString;
+}
+
+
+std::size_t
+ValueArena::bytesReserved() const
+{
+   return reserved_;
+}
+
+
+ValueArena *
+ValueArena::current()
+{
+   return currentArena();
+}
+
+
+// Implementation of class ValueArenaScope
+// ////////////////////////////////
+
+ValueArenaScope::ValueArenaScope( ValueArena &arena )
+   : previous_( currentArena() )
+{
+   currentArena() = &arena;
+}
+
+
+ValueArenaScope::~ValueArenaScope()
+{
+   currentArena() = previous_;
+}
+
+} // namespace Json
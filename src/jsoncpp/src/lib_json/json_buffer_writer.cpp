@@ -0,0 +1,271 @@
+#include <json/buffer_writer.h>
+#include <stdio.h>
+#include <string.h>
+
+#if _MSC_VER >= 1400 // VC++ 8.0
+#pragma warning( disable : 4996 )   // disable warning about sprintf being deprecated.
+#endif
+
+namespace Json {
+
+static const char hexDigits[] = "0123456789abcdef";
+
+// What a character turns into inside a string: 0 if it is written as is,
+// 'u' for a \u00XX escape, and otherwise the letter after the backslash.
+static char
+escapeFor( unsigned char ch )
+{
+   switch ( ch )
+   {
+   case '"': return '"';
+   case '\\': return '\\';
+   case '\b': return 'b';
+   case '\f': return 'f';
+   case '\n': return 'n';
+   case '\r': return 'r';
+   case '\t': return 't';
+   default:
+      return ch < 0x20 ? 'u' : 0;
+   }
+}
+
+
+// Implementation of class BufferWriter
+// ////////////////////////////////
+
+BufferWriter::BufferWriter( std::string &document )
+   : document_( document )
+   , depth_( 0 )
+{
+}
+
+
+BufferWriter &
+BufferWriter::startObject()
+{
+   separate();
+   document_ += '{';
+   ++depth_;
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::endObject()
+{
+   document_ += '}';
+   --depth_;
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::startArray()
+{
+   separate();
+   document_ += '[';
+   ++depth_;
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::endArray()
+{
+   document_ += ']';
+   --depth_;
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::key( const char *name )
+{
+   separate();
+   writeString( name, name + strlen( name ) );
+   document_ += ':';
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::key( const std::string &name )
+{
+   separate();
+   writeString( name.data(), name.data() + name.length() );
+   document_ += ':';
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::stringValue( const char *value )
+{
+   return stringValue( value, value + strlen( value ) );
+}
+
+
+BufferWriter &
+BufferWriter::stringValue( const char *begin, const char *end )
+{
+   separate();
+   writeString( begin, end );
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::stringValue( const std::string &value )
+{
+   return stringValue( value.data(), value.data() + value.length() );
+}
+
+
+BufferWriter &
+BufferWriter::numberValue( Int value )
+{
+   return numberValue( Int64( value ) );
+}
+
+
+BufferWriter &
+BufferWriter::numberValue( UInt value )
+{
+   return numberValue( UInt64( value ) );
+}
+
+
+BufferWriter &
+BufferWriter::numberValue( Int64 value )
+{
+   separate();
+   // Negate as unsigned, so the most negative value survives.
+   if ( value < 0 )
+      writeUInt64( UInt64( 0 ) - UInt64( value ), true );
+   else
+      writeUInt64( UInt64( value ), false );
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::numberValue( UInt64 value )
+{
+   separate();
+   writeUInt64( value, false );
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::numberValue( double value )
+{
+   separate();
+   char buffer[32];
+#if defined(_MSC_VER) && defined(__STDC_SECURE_LIB__)
+   int length = sprintf_s( buffer, sizeof(buffer), "%#.16g", value );
+#else
+   int length = snprintf( buffer, sizeof(buffer), "%#.16g", value );
+#endif
+   // %#g always gives a decimal point; drop the trailing zeroes after it,
+   // but keep one digit.
+   const char *dot = static_cast<const char *>( memchr( buffer, '.', length ) );
+   if ( dot  &&  !memchr( buffer, 'e', length ) )
+   {
+      const char *last = buffer + length - 1;
+      while ( last > dot + 1  &&  *last == '0' )
+         --last;
+      length = int( last - buffer + 1 );
+   }
+   document_.append( buffer, length );
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::boolValue( bool value )
+{
+   separate();
+   if ( value )
+      document_.append( "true", 4 );
+   else
+      document_.append( "false", 5 );
+   return *this;
+}
+
+
+BufferWriter &
+BufferWriter::nullValue()
+{
+   separate();
+   document_.append( "null", 4 );
+   return *this;
+}
+
+
+const std::string &
+BufferWriter::document() const
+{
+   return document_;
+}
+
+
+void
+BufferWriter::separate()
+{
+   // Right after an opening bracket or a key nothing is needed; after
+   // anything else, inside a container, we are starting the next element.
+   if ( depth_ == 0 )
+      return;
+   char last = document_[document_.length() - 1];
+   if ( last != '{'  &&  last != '['  &&  last != ':' )
+      document_ += ',';
+}
+
+
+void
+BufferWriter::writeString( const char *begin, const char *end )
+{
+   document_ += '"';
+   const char *run = begin;
+   for ( const char *current = begin; current != end; ++current )
+   {
+      char escape = escapeFor( static_cast<unsigned char>( *current ) );
+      if ( !escape )
+         continue;
+      // Copy the run of plain characters in one go, then the escape.
+      document_.append( run, current );
+      run = current + 1;
+      char buffer[6] = { '\\', escape, '0', '0', 0, 0 };
+      if ( escape == 'u' )
+      {
+         unsigned char ch = static_cast<unsigned char>( *current );
+         buffer[4] = hexDigits[ch >> 4];
+         buffer[5] = hexDigits[ch & 0xF];
+         document_.append( buffer, 6 );
+      }
+      else
+         document_.append( buffer, 2 );
+   }
+   document_.append( run, end );
+   document_ += '"';
+}
+
+
+void
+BufferWriter::writeUInt64( UInt64 value, bool isNegative )
+{
+   char buffer[24];
+   char *current = buffer + sizeof(buffer);
+   do
+   {
+      *--current = char( '0' + value % 10 );
+      value /= 10;
+   }
+   while ( value != 0 );
+   if ( isNegative )
+      *--current = '-';
+   document_.append( current, buffer + sizeof(buffer) );
+}
+
+} // namespace Json
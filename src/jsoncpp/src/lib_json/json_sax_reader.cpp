@@ -0,0 +1,416 @@
+#include <json/sax_reader.h>
+#include <cstring>
+
+namespace Json {
+
+// Implementation of class SaxHandler
+// ////////////////////////////////
+
+SaxHandler::~SaxHandler()
+{
+}
+
+
+bool
+SaxHandler::startObject()
+{
+   return true;
+}
+
+
+bool
+SaxHandler::endObject()
+{
+   return true;
+}
+
+
+bool
+SaxHandler::startArray()
+{
+   return true;
+}
+
+
+bool
+SaxHandler::endArray()
+{
+   return true;
+}
+
+
+bool
+SaxHandler::key( const char *, const char *, bool )
+{
+   return true;
+}
+
+
+bool
+SaxHandler::stringValue( const char *, const char *, bool )
+{
+   return true;
+}
+
+
+bool
+SaxHandler::numberValue( const char *, const char * )
+{
+   return true;
+}
+
+
+bool
+SaxHandler::boolValue( bool )
+{
+   return true;
+}
+
+
+bool
+SaxHandler::nullValue()
+{
+   return true;
+}
+
+
+// Implementation of class SaxReader
+// ////////////////////////////////
+
+SaxReader::SaxReader()
+   : begin_( 0 )
+   , end_( 0 )
+   , current_( 0 )
+   , error_( 0 )
+{
+}
+
+
+bool
+SaxReader::parse( const char *beginDoc, const char *endDoc,
+                  SaxHandler &handler )
+{
+   begin_ = beginDoc;
+   end_ = endDoc;
+   current_ = begin_;
+   error_ = 0;
+   if ( !readValue( handler, 0 ) )
+   {
+      if ( !error_ )
+         error_ = current_;
+      return false;
+   }
+   if ( !skipSpacesAndComments()  ||  current_ != end_ )
+   {
+      error_ = current_;
+      return false;
+   }
+   return true;
+}
+
+
+SaxReader::Location
+SaxReader::getErrorLocation() const
+{
+   return error_;
+}
+
+
+bool
+SaxReader::skipSpacesAndComments()
+{
+   while ( current_ != end_ )
+   {
+      Char c = *current_;
+      if ( c == ' '  ||  c == '\t'  ||  c == '\r'  ||  c == '\n' )
+         ++current_;
+      else if ( c == '/'  &&  end_ - current_ >= 2  &&  current_[1] == '*' )
+      {
+         Location close = current_ + 2;
+         while ( close + 1 < end_  &&  !( close[0] == '*'  &&  close[1] == '/' ) )
+            ++close;
+         if ( close + 1 >= end_ )
+            return false;
+         current_ = close + 2;
+      }
+      else if ( c == '/'  &&  end_ - current_ >= 2  &&  current_[1] == '/' )
+      {
+         while ( current_ != end_  &&  *current_ != '\n'  &&  *current_ != '\r' )
+            ++current_;
+      }
+      else
+         break;
+   }
+   return true;
+}
+
+
+bool
+SaxReader::match( const char *pattern, int patternLength )
+{
+   if ( end_ - current_ < patternLength
+        ||  memcmp( current_, pattern, patternLength ) != 0 )
+      return false;
+   current_ += patternLength;
+   return true;
+}
+
+
+bool
+SaxReader::readValue( SaxHandler &handler, int depth )
+{
+   if ( !skipSpacesAndComments()  ||  current_ == end_ )
+      return false;
+   Location begin, end;
+   bool escaped;
+   switch ( *current_ )
+   {
+   case '{':
+      return readObject( handler, depth + 1 );
+   case '[':
+      return readArray( handler, depth + 1 );
+   case '"':
+      return readString( begin, end, escaped )
+             &&  handler.stringValue( begin, end, escaped );
+   case 't':
+      return match( "true", 4 )  &&  handler.boolValue( true );
+   case 'f':
+      return match( "false", 5 )  &&  handler.boolValue( false );
+   case 'n':
+      return match( "null", 4 )  &&  handler.nullValue();
+   default:
+      return readNumber( begin, end )  &&  handler.numberValue( begin, end );
+   }
+}
+
+
+bool
+SaxReader::readObject( SaxHandler &handler, int depth )
+{
+   if ( depth > maxDepth  ||  !handler.startObject() )
+      return false;
+   ++current_;
+   if ( !skipSpacesAndComments() )
+      return false;
+   if ( current_ != end_  &&  *current_ == '}' )
+   {
+      ++current_;
+      return handler.endObject();
+   }
+   while ( true )
+   {
+      Location begin, end;
+      bool escaped;
+      if ( !skipSpacesAndComments()  ||  current_ == end_  ||  *current_ != '"'
+           ||  !readString( begin, end, escaped )
+           ||  !handler.key( begin, end, escaped ) )
+         return false;
+      if ( !skipSpacesAndComments()  ||  current_ == end_  ||  *current_ != ':' )
+         return false;
+      ++current_;
+      if ( !readValue( handler, depth ) )
+         return false;
+      if ( !skipSpacesAndComments()  ||  current_ == end_ )
+         return false;
+      Char c = *current_++;
+      if ( c == '}' )
+         return handler.endObject();
+      if ( c != ',' )
+      {
+         --current_;
+         return false;
+      }
+   }
+}
+
+
+bool
+SaxReader::readArray( SaxHandler &handler, int depth )
+{
+   if ( depth > maxDepth  ||  !handler.startArray() )
+      return false;
+   ++current_;
+   if ( !skipSpacesAndComments() )
+      return false;
+   if ( current_ != end_  &&  *current_ == ']' )
+   {
+      ++current_;
+      return handler.endArray();
+   }
+   while ( true )
+   {
+      if ( !readValue( handler, depth ) )
+         return false;
+      if ( !skipSpacesAndComments()  ||  current_ == end_ )
+         return false;
+      Char c = *current_++;
+      if ( c == ']' )
+         return handler.endArray();
+      if ( c != ',' )
+      {
+         --current_;
+         return false;
+      }
+   }
+}
+
+
+bool
+SaxReader::readString( Location &begin, Location &end, bool &escaped )
+{
+   // current_ is on the opening quote.
+   begin = ++current_;
+   escaped = false;
+   while ( current_ != end_ )
+   {
+      Char c = *current_;
+      if ( c == '"' )
+      {
+         end = current_++;
+         return true;
+      }
+      if ( c == '\\' )
+      {
+         escaped = true;
+         if ( ++current_ == end_ )
+            break;
+      }
+      ++current_;
+   }
+   return false;
+}
+
+
+bool
+SaxReader::readNumber( Location &begin, Location &end )
+{
+   begin = current_;
+   if ( current_ != end_  &&  *current_ == '-' )
+      ++current_;
+   Location digits = current_;
+   while ( current_ != end_ )
+   {
+      Char c = *current_;
+      if ( ( c >= '0'  &&  c <= '9' )  ||  c == '.'  ||  c == 'e'  ||  c == 'E'
+           ||  c == '+'  ||  c == '-' )
+         ++current_;
+      else
+         break;
+   }
+   end = current_;
+   if ( current_ == digits  ||  *digits < '0'  ||  *digits > '9' )
+   {
+      current_ = begin;
+      return false;
+   }
+   return true;
+}
+
+
+static void
+appendUTF8( std::string &out, unsigned int cp )
+{
+   if ( cp <= 0x7f )
+      out += static_cast<char>( cp );
+   else if ( cp <= 0x7FF )
+   {
+      out += static_cast<char>( 0xC0 | ( cp >> 6 ) );
+      out += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+   }
+   else if ( cp <= 0xFFFF )
+   {
+      out += static_cast<char>( 0xE0 | ( cp >> 12 ) );
+      out += static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+      out += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+   }
+   else
+   {
+      out += static_cast<char>( 0xF0 | ( cp >> 18 ) );
+      out += static_cast<char>( 0x80 | ( ( cp >> 12 ) & 0x3F ) );
+      out += static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+      out += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+   }
+}
+
+
+static bool
+readHex4( const char *&current, const char *end, unsigned int &value )
+{
+   if ( end - current < 4 )
+      return false;
+   value = 0;
+   for ( int i = 0; i < 4; ++i )
+   {
+      char c = *current++;
+      value *= 16;
+      if ( c >= '0'  &&  c <= '9' )
+         value += c - '0';
+      else if ( c >= 'a'  &&  c <= 'f' )
+         value += c - 'a' + 10;
+      else if ( c >= 'A'  &&  c <= 'F' )
+         value += c - 'A' + 10;
+      else
+         return false;
+   }
+   return true;
+}
+
+
+bool
+SaxReader::decodeString( const char *begin, const char *end,
+                         std::string &decoded )
+{
+   decoded.reserve( decoded.size() + ( end - begin ) );
+   const char *current = begin;
+   while ( current != end )
+   {
+      // Copy the run up to the next escape in one go.
+      const char *escape = static_cast<const char *>(
+         memchr( current, '\\', end - current ) );
+      if ( !escape )
+         escape = end;
+      decoded.append( current, escape );
+      current = escape;
+      if ( current == end )
+         break;
+      if ( ++current == end )
+         return false;
+      Char c = *current++;
+      switch ( c )
+      {
+      case '"': decoded += '"'; break;
+      case '/': decoded += '/'; break;
+      case '\\': decoded += '\\'; break;
+      case 'b': decoded += '\b'; break;
+      case 'f': decoded += '\f'; break;
+      case 'n': decoded += '\n'; break;
+      case 'r': decoded += '\r'; break;
+      case 't': decoded += '\t'; break;
+      case 'u':
+         {
+            unsigned int unicode;
+            if ( !readHex4( current, end, unicode ) )
+               return false;
+            if ( unicode >= 0xD800  &&  unicode <= 0xDBFF )
+            {
+               // A surrogate pair; the low half must follow.
+               unsigned int surrogatePair;
+               if ( end - current < 6  ||  current[0] != '\\'  ||  current[1] != 'u' )
+                  return false;
+               current += 2;
+               if ( !readHex4( current, end, surrogatePair ) )
+                  return false;
+               unicode = 0x10000 + ( ( unicode & 0x3FF ) << 10 )
+                         + ( surrogatePair & 0x3FF );
+            }
+            appendUTF8( decoded, unicode );
+         }
+         break;
+      default:
+         return false;
+      }
+   }
+   return true;
+}
+
+} // namespace Json
@@ -102,6 +102,25 @@ static ValueAllocator *&valueAllocator()
    return valueAllocator;
 }
 
+// While a ValueArenaScope is alive, strings come from its arena. Such strings
+// are never released individually, so \c allocated comes back false, as for
+// a StaticString.
+static inline char *
+duplicateStringValue( const char *value,
+                      unsigned int length,
+                      bool &allocated )
+{
+   ValueArena *arena = ValueArena::current();
+   allocated = arena == 0;
+   if ( arena )
+   {
+      if ( length == ValueAllocator::unknown )
+         length = (unsigned int)strlen( value );
+      return arena->duplicateString( value, length );
+   }
+   return valueAllocator()->duplicateStringValue( value, length );
+}
+
 static struct DummyValueAllocatorInitializer {
    DummyValueAllocatorInitializer() 
    {
@@ -178,19 +197,36 @@ Value::CZString::CZString( int index )
 }
 
 Value::CZString::CZString( const char *cstr, DuplicationPolicy allocate )
-   : cstr_( allocate == duplicate ? valueAllocator()->makeMemberName(cstr) 
-                                  : cstr )
+   : cstr_( cstr )
    , index_( allocate )
 {
+   if ( allocate == duplicate )
+      duplicateName();
 }
 
 Value::CZString::CZString( const CZString &other )
-: cstr_( other.index_ != noDuplication &&  other.cstr_ != 0
-                ?  valueAllocator()->makeMemberName( other.cstr_ )
-                : other.cstr_ )
+: cstr_( other.cstr_ )
    , index_( other.cstr_ ? (other.index_ == noDuplication ? noDuplication : duplicate)
                          : other.index_ )
 {
+   if ( cstr_  &&  index_ == duplicate )
+      duplicateName();
+}
+
+void 
+Value::CZString::duplicateName()
+{
+   ValueArena *arena = ValueArena::current();
+   if ( arena )
+   {
+      cstr_ = arena->duplicateString( cstr_, (unsigned int)strlen( cstr_ ) );
+      index_ = inArena;
+   }
+   else
+   {
+      cstr_ = valueAllocator()->makeMemberName( cstr_ );
+      index_ = duplicate;
+   }
 }
 
 Value::CZString::~CZString()
@@ -250,6 +286,46 @@ Value::CZString::isStaticString() const
    return index_ == noDuplication;
 }
 
+# ifdef JSON_VALUE_USE_HASH_MAP
+std::size_t 
+Value::CZStringHash::operator()( const CZString &key ) const
+{
+   // FNV-1a for names; indexes are mixed so consecutive ones spread out.
+   const char *name = key.c_str();
+   if ( !name )
+      return std::size_t( key.index() ) * 0x9E3779B97F4A7C15ull;
+   std::size_t hash = 14695981039346656037ull;
+   for ( ; *name; ++name )
+   {
+      hash ^= (unsigned char)*name;
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
+# endif
+
+// Object and array storage comes from the current arena, if any, as do the
+// container's nodes (see ValueArenaAllocator).
+static Value::ObjectValues *
+newObjectValues( const Value::ObjectValues *other )
+{
+   ValueArena *arena = ValueArena::current();
+   if ( !arena )
+      return other ? new Value::ObjectValues( *other ) : new Value::ObjectValues();
+   void *p = arena->allocate( sizeof(Value::ObjectValues) );
+   return other ? new ( p ) Value::ObjectValues( *other ) : new ( p ) Value::ObjectValues();
+}
+
+static void 
+deleteObjectValues( Value::ObjectValues *values )
+{
+   typedef Value::ObjectValues ObjectValues;
+   if ( values->get_allocator().arena() )
+      values->~ObjectValues();
+   else
+      delete values;
+}
+
 #endif // ifndef JSON_VALUE_USE_INTERNAL_MAP
 
 
@@ -290,7 +366,7 @@ Value::Value( ValueType type )
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      value_.map_ = new ObjectValues();
+      value_.map_ = newObjectValues( 0 );
       break;
 #else
    case arrayValue:
@@ -348,7 +424,9 @@ Value::Value( const char *value )
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( value );
+   bool allocated;
+   value_.string_ = duplicateStringValue( value, ValueAllocator::unknown, allocated );
+   allocated_ = allocated;
 }
 
 
@@ -361,8 +439,11 @@ Value::Value( const char *beginValue,
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( beginValue, 
-                                                            UInt(endValue - beginValue) );
+   bool allocated;
+   value_.string_ = duplicateStringValue( beginValue, 
+                                          UInt(endValue - beginValue),
+                                          allocated );
+   allocated_ = allocated;
 }
 
 
@@ -374,9 +455,11 @@ Value::Value( const std::string &value )
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( value.c_str(), 
-                                                            (unsigned int)value.length() );
-
+   bool allocated;
+   value_.string_ = duplicateStringValue( value.c_str(), 
+                                          (unsigned int)value.length(),
+                                          allocated );
+   allocated_ = allocated;
 }
 
 Value::Value( const StaticString &value )
@@ -400,7 +483,9 @@ Value::Value( const CppTL::ConstString &value )
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( value, value.length() );
+   bool allocated;
+   value_.string_ = duplicateStringValue( value, value.length(), allocated );
+   allocated_ = allocated;
 }
 # endif
 
@@ -434,8 +519,11 @@ Value::Value( const Value &other )
    case stringValue:
       if ( other.value_.string_ )
       {
-         value_.string_ = valueAllocator()->duplicateStringValue( other.value_.string_ );
-         allocated_ = true;
+         bool allocated;
+         value_.string_ = duplicateStringValue( other.value_.string_,
+                                                ValueAllocator::unknown,
+                                                allocated );
+         allocated_ = allocated;
       }
       else
          value_.string_ = 0;
@@ -443,7 +531,7 @@ Value::Value( const Value &other )
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      value_.map_ = new ObjectValues( *other.value_.map_ );
+      value_.map_ = newObjectValues( other.value_.map_ );
       break;
 #else
    case arrayValue:
@@ -486,7 +574,7 @@ Value::~Value()
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      delete value_.map_;
+      deleteObjectValues( value_.map_ );
       break;
 #else
    case arrayValue:
@@ -881,7 +969,11 @@ Value::size() const
    case booleanValue:
    case stringValue:
       return 0;
-#ifndef JSON_VALUE_USE_INTERNAL_MAP
+#if defined(JSON_VALUE_USE_HASH_MAP)
+   case arrayValue:  // arrays are kept dense; see operator[]( UInt )
+   case objectValue:
+      return Int( value_.map_->size() );
+#elif !defined(JSON_VALUE_USE_INTERNAL_MAP)
    case arrayValue:  // size of the array is highest index + 1
       if ( !value_.map_->empty() )
       {
@@ -978,6 +1070,12 @@ Value::operator[]( UInt index )
    if ( type_ == nullValue )
       *this = Value( arrayValue );
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
+# ifdef JSON_VALUE_USE_HASH_MAP
+   // Fill any gap with nulls, so that elements are inserted (and iterate) in
+   // index order, and size() is just the element count.
+   for ( UInt fill = UInt( value_.map_->size() ); fill < index; ++fill )
+      value_.map_->insert( ObjectValues::value_type( CZString( fill ), null ) );
+# endif
    CZString key( index );
    ObjectValues::iterator it = value_.map_->lower_bound( key );
    if ( it != value_.map_->end()  &&  (*it).first == key )
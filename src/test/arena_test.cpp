@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "base/arena.h"
+
+#include "gtest/gtest.h"
+
+TEST(arena_test, allocate_and_align) {
+	arena a(64);
+	auto c = static_cast<char *>(a.allocate(1, 1));
+	auto d = a.allocate(sizeof(double), alignof(double));
+	EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(d) % alignof(double));
+	EXPECT_NE(static_cast<void *>(c), d);
+	EXPECT_TRUE(a.owns(c));
+	EXPECT_TRUE(a.owns(d));
+	int local;
+	EXPECT_FALSE(a.owns(&local));
+	EXPECT_EQ(1u, a.get_chunk_count());
+
+	// Big requests get their own chunk.
+	a.allocate(1000);
+	EXPECT_EQ(2u, a.get_chunk_count());
+}
+
+TEST(arena_test, copy) {
+	arena a;
+	char const * txt = "hello world";
+	auto p = a.copy(txt, txt + 5);
+	EXPECT_STREQ("hello", p);
+	EXPECT_TRUE(a.owns(p));
+}
+
+TEST(arena_test, reserve) {
+	arena a(16);
+	a.reserve(1000);
+	EXPECT_EQ(1u, a.get_chunk_count());
+	for (int i = 0; i < 100; ++i) {
+		a.allocate(8, 8);
+	}
+	EXPECT_EQ(1u, a.get_chunk_count());
+	// Already have room; reserving again shouldn't allocate.
+	a.reserve(100);
+	EXPECT_EQ(1u, a.get_chunk_count());
+}
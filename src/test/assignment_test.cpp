@@ -6,6 +6,8 @@
 
 #include "gtest/gtest.h"
 
+#include "json/json.h"
+
 #include "test/test_util.h"
 
 using namespace base::event_codes;
@@ -25,6 +27,7 @@ TEST(assignment_test, get_request_msg) {
 	a.ready_task(2, "qsub task 2");
 	auto txt = a.get_request_msg();
 	expect_str_contains(txt, events::get_std_id_repr(NITRO_HERE_IS_ASSIGNMENT));
+	expect_str_contains(txt, "\"id\":\"test\"");
 	expect_str_contains(txt, "\"1\"");
 	expect_str_contains(txt, "\"qsub task 2\"");
 }
@@ -38,25 +41,172 @@ TEST(assignment_test, get_status_msg) {
 	auto txt = a.get_status_msg();
 	expect_str_contains(txt,
 			events::get_std_id_repr(NITRO_ASSIGNMENT_PROGRESS_REPORT));
-	expect_str_contains(txt, "complete_count\" : 0");
-	expect_str_contains(txt, "active_count\" : 0");
-	expect_str_contains(txt, "ready\" : [ \"1\", \"2\" ]");
+	expect_str_contains(txt, "complete_count\":0");
+	expect_str_contains(txt, "active_count\":0");
+	expect_str_contains(txt, "ready\":[\"1\",\"2\"]");
 
 	a.activate_task(1);
 	a.activate_task(2);
 	a.complete_task(2);
 	txt = a.get_status_msg();
-	expect_str_contains(txt, "ready_count\" : 0");
-	expect_str_contains(txt, "active_count\" : 1");
-	expect_str_contains(txt, "active\" : [ \"1\" ]");
-	expect_str_contains(txt, "complete_count\" : 1");
-	expect_str_contains(txt, "complete\" : [ \"2\" ]");
+	expect_str_contains(txt, "ready_count\":0");
+	expect_str_contains(txt, "active_count\":1");
+	expect_str_contains(txt, "active\":[\"1\"]");
+	expect_str_contains(txt, "complete_count\":1");
+	expect_str_contains(txt, "complete\":[\"2\"]");
+}
+
+namespace {
+
+Json::Value parse_progress(std::string const & txt) {
+	Json::Value root;
+	Json::Reader reader;
+	EXPECT_TRUE(reader.parse(txt, root)) << txt;
+	return root["body"]["status"];
+}
+
+} // end anonymous namespace
+
+TEST(assignment_test, progress_msg_sends_deltas_between_snapshots) {
+	assignment a("test");
+	for (task::id_type i = 1; i <= 100; ++i) {
+		a.ready_task(i, "qsub task");
+	}
+
+	// The first report is a snapshot.
+	auto status = parse_progress(a.get_progress_msg());
+	EXPECT_TRUE(status["full"].asBool());
+	EXPECT_EQ(1u, status["seq"].asUInt());
+	EXPECT_STREQ("test", status["assignment"].asCString());
+	EXPECT_STREQ("1-100", status["ready"].asCString());
+	EXPECT_STREQ("", status["complete"].asCString());
+	EXPECT_EQ(100u, status["ready_count"].asUInt());
+
+	// Nothing changed, so nothing to say.
+	EXPECT_EQ("", a.get_progress_msg());
+
+	for (task::id_type i = 1; i <= 10; ++i) {
+		a.activate_task(i);
+	}
+	a.complete_task(3);
+	a.complete_task(4);
+	a.complete_task(9);
+	auto txt = a.get_progress_msg();
+	status = parse_progress(txt);
+	EXPECT_FALSE(status["full"].asBool());
+	EXPECT_EQ(2u, status["seq"].asUInt());
+	EXPECT_STREQ("", status["ready"].asCString());
+	EXPECT_STREQ("1-10", status["active"].asCString());
+	EXPECT_STREQ("3-4,9", status["complete"].asCString());
+	EXPECT_EQ(90u, status["ready_count"].asUInt());
+	EXPECT_EQ(7u, status["active_count"].asUInt());
+	EXPECT_EQ(3u, status["complete_count"].asUInt());
+	// Far smaller than a dump of every id.
+	EXPECT_LT(txt.size(), a.get_status_msg().size() / 2);
+
+	// Periodically, we resend everything.
+	bool saw_full = false;
+	for (unsigned i = 0; i < FULL_REPORT_INTERVAL && !saw_full; ++i) {
+		a.complete_task(10 - i % 10);
+		txt = a.get_progress_msg();
+		if (!txt.empty()) {
+			status = parse_progress(txt);
+			saw_full = status["full"].asBool();
+		}
+	}
+	ASSERT_TRUE(saw_full);
+	std::vector<task::id_type> ids;
+	ASSERT_TRUE(decode_id_ranges(status["ready"].asCString(), ids));
+	EXPECT_EQ(90u, ids.size());
+	EXPECT_EQ(11u, ids.front());
+}
+
+TEST(assignment_test, progress_msg_falls_back_to_snapshot_when_busy) {
+	assignment a("test");
+	for (task::id_type i = 1; i <= 4; ++i) {
+		a.ready_task(i, "qsub task");
+	}
+	a.get_progress_msg();
+	// More transitions than tasks; a snapshot is cheaper than the journal.
+	for (task::id_type i = 1; i <= 4; ++i) {
+		a.activate_task(i);
+		a.complete_task(i);
+	}
+	auto status = parse_progress(a.get_progress_msg());
+	EXPECT_TRUE(status["full"].asBool());
+	EXPECT_STREQ("1-4", status["complete"].asCString());
+}
+
+TEST(assignment_test, id_ranges) {
+	EXPECT_EQ("", encode_id_ranges({}));
+	EXPECT_EQ("1-3,5,7", encode_id_ranges({ 7, 1, 2, 3, 5, 2 }));
+	std::vector<task::id_type> ids;
+	ASSERT_TRUE(decode_id_ranges("1-3,5,7", ids));
+	EXPECT_EQ((std::vector<task::id_type>{ 1, 2, 3, 5, 7 }), ids);
+	ids.clear();
+	EXPECT_TRUE(decode_id_ranges("", ids));
+	EXPECT_TRUE(ids.empty());
+	EXPECT_FALSE(decode_id_ranges("1-", ids));
+	EXPECT_FALSE(decode_id_ranges("3-1", ids));
+	EXPECT_FALSE(decode_id_ranges("1,,2", ids));
+	EXPECT_FALSE(decode_id_ranges("1,", ids));
+	EXPECT_FALSE(decode_id_ranges("x", ids));
+
+	// Ranges are checked for width before they're expanded.
+	ids.clear();
+	EXPECT_FALSE(decode_id_ranges("0-1000000000000", ids));
+	EXPECT_TRUE(ids.empty());
+	EXPECT_FALSE(decode_id_ranges("0-18446744073709551615", ids));
+	EXPECT_TRUE(decode_id_ranges("1-3,5", ids, 4));
+	ids.clear();
+	EXPECT_FALSE(decode_id_ranges("1-3,5-6", ids, 4));
+}
+
+TEST(assignment_test, complete_task_records_exit_code) {
+	assignment a("test");
+	a.ready_task(1, "qsub task 1");
+	a.ready_task(2, "qsub task 2");
+	a.activate_task(1);
+	EXPECT_FALSE(a.complete_task(1, 3));
+	// A task can be completed straight from the ready list.
+	EXPECT_TRUE(a.complete_task(2));
+	auto done = a.get_tasks_by_status(ts_complete);
+	ASSERT_EQ(2u, done.size());
+	EXPECT_EQ(3, done.front()->get_exit_code());
+	EXPECT_EQ(0, done.back()->get_exit_code());
+}
+
+TEST(assignment_test, sparse_ids) {
+	// Coordinators number tasks by line, so ids needn't start at 1 or be
+	// consecutive.
+	assignment a("test");
+	a.ready_task(1000, "qsub task 1000");
+	a.ready_task(1001, "qsub task 1001");
+	a.ready_task(7, "qsub task 7");
+	unsigned complete, active, ready;
+	EXPECT_EQ(3u, a.get_counts(&complete, &active, &ready));
+	EXPECT_EQ(3u, ready);
+
+	expect_str_contains(a.activate_task(7), "task 7");
+	EXPECT_EQ(nullptr, a.activate_task(7));
+	EXPECT_EQ(nullptr, a.activate_task(8));
+	EXPECT_FALSE(a.complete_task(1001));
+	a.get_counts(&complete, &active, &ready);
+	EXPECT_EQ(1u, complete);
+	EXPECT_EQ(1u, active);
+	EXPECT_EQ(1u, ready);
+
+	auto readylist = a.get_tasks_by_status(ts_ready);
+	ASSERT_EQ(1u, readylist.size());
+	EXPECT_EQ(1000u, readylist[0]->get_id());
+	EXPECT_FALSE(a.complete_task(7));
+	EXPECT_TRUE(a.complete_task(1000));
+	EXPECT_TRUE(a.is_complete());
 }
 
 TEST(assignment_test, fill_from_lines) {
 	assignment asgn("a1", "qsub line 1\nqsub line 2\nqsub line 3");
-	assignment::tasklist_t const & readylist = asgn.get_list_by_status(
-			ts_ready);
+	auto readylist = asgn.get_tasks_by_status(ts_ready);
 	EXPECT_EQ(3, readylist.size());
 	for (auto i = readylist.cbegin(); i != readylist.cend(); ++i) {
 		auto cmd = (*i)->get_cmdline();
@@ -64,3 +214,13 @@ TEST(assignment_test, fill_from_lines) {
 		EXPECT_TRUE(strchr(cmd, '\n') == 0);
 	}
 }
+
+TEST(assignment_test, fill_from_lines_trims_in_place) {
+	assignment asgn("a1", "qsub a  \r\nqsub b\n\n   qsub c\t");
+	auto readylist = asgn.get_tasks_by_status(ts_ready);
+	ASSERT_EQ(3u, readylist.size());
+	EXPECT_STREQ("qsub a", readylist[0]->get_cmdline());
+	EXPECT_STREQ("qsub b", readylist[1]->get_cmdline());
+	EXPECT_STREQ("qsub c", readylist[2]->get_cmdline());
+	EXPECT_EQ(3u, readylist[2]->get_id());
+}
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <string.h>
+#include <unistd.h>
+
+#include "base/line_index.h"
+
+#include "domain/batch_scheduler.h"
+
+#include "gtest/gtest.h"
+
+#include "test/test_util.h"
+
+using std::string;
+using std::vector;
+
+using namespace nitro;
+
+namespace {
+
+/**
+ * A batch file that deletes itself when it goes out of scope.
+ */
+struct temp_batch {
+	string path;
+	FileCleanup fc;
+
+	temp_batch(vector<string> const & lines) : path(make_temp_file()),
+			fc(path.c_str()) {
+		std::ofstream out(path.c_str());
+		for (auto & line : lines) {
+			out << line << "\n";
+		}
+	}
+};
+
+vector<string> drain(batch_scheduler & sched) {
+	vector<string> lines;
+	pending_task pt;
+	while (sched.next(pt)) {
+		lines.push_back(pt.cmdline);
+	}
+	return lines;
+}
+
+} // end anonymous namespace
+
+TEST(batch_scheduler_test, priority_then_walltime_then_order) {
+	temp_batch first({
+		"qsub a1",
+		"qsub -p 5 a2",
+		"qsub -l walltime=10 a3",
+		"qsub -p 5 -l walltime=10 a4",
+		"qsub a5",
+	});
+	temp_batch second({
+		"qsub -p 5 b1",
+		"qsub b2",
+		"qsub -p -3 -l walltime=1:00:00 b3",
+	});
+	// Finish one batch before starting the next, so the order depends only
+	// on the lines.
+	batch_scheduler sched(fs_fifo);
+	EXPECT_TRUE(sched.empty());
+	EXPECT_EQ(5u, sched.add_batch(first.path.c_str()));
+	EXPECT_EQ(3u, sched.add_batch(second.path.c_str()));
+	EXPECT_EQ(8u, sched.get_lines_left());
+	EXPECT_EQ(2u, sched.get_batch_count());
+	EXPECT_EQ(3600.0 + 2 * 10 + 5 * 1, sched.get_work_left());
+
+	vector<string> expected = {
+		"qsub -p 5 -l walltime=10 a4",
+		"qsub -p 5 a2",
+		"qsub -p 5 b1",
+		"qsub -l walltime=10 a3",
+		"qsub a1",
+		"qsub a5",
+		"qsub b2",
+		"qsub -p -3 -l walltime=1:00:00 b3",
+	};
+	EXPECT_EQ(expected, drain(sched));
+	EXPECT_TRUE(sched.empty());
+	EXPECT_EQ(0u, sched.get_batch_count());
+	EXPECT_EQ(0.0, sched.get_work_left());
+}
+
+TEST(batch_scheduler_test, new_batch_preempts_current_run) {
+	vector<string> lines;
+	for (int i = 1; i <= 6; ++i) {
+		lines.push_back("qsub task" + std::to_string(i));
+	}
+	temp_batch low(lines);
+	temp_batch high({ "qsub -p 1 urgent" });
+
+	batch_scheduler sched;
+	sched.add_batch(low.path.c_str(), 2);
+	pending_task pt;
+	ASSERT_TRUE(sched.next(pt));
+	EXPECT_EQ("qsub task2", pt.cmdline);
+	ASSERT_TRUE(sched.next(pt));
+	EXPECT_EQ("qsub task3", pt.cmdline);
+
+	sched.add_batch(high.path.c_str());
+	ASSERT_TRUE(sched.next(pt));
+	EXPECT_EQ("qsub -p 1 urgent", pt.cmdline);
+	EXPECT_EQ(1, pt.priority);
+	EXPECT_EQ(1u, sched.get_batch_count());
+
+	vector<string> expected = { "qsub task4", "qsub task5", "qsub task6" };
+	EXPECT_EQ(expected, drain(sched));
+}
+
+TEST(batch_scheduler_test, many_runs_stay_in_file_order) {
+	// Alternating walltimes make a run of every line.
+	vector<string> lines;
+	for (int i = 0; i < 2000; ++i) {
+		lines.push_back("qsub -l walltime=" + std::to_string(i % 2 ? 5 : 7)
+				+ " task" + std::to_string(i));
+	}
+	temp_batch batch(lines);
+	batch_scheduler sched;
+	sched.add_batch(batch.path.c_str());
+	auto out = drain(sched);
+	ASSERT_EQ(lines.size(), out.size());
+	for (int i = 0; i < 1000; ++i) {
+		EXPECT_EQ(lines[2 * i], out[i]);
+		EXPECT_EQ(lines[2 * i + 1], out[1000 + i]);
+	}
+}
+
+TEST(batch_scheduler_test, runs_are_capped) {
+	// Alternating walltimes would make a run of every line. Past the cap,
+	// the rest of the batch goes in file order, still with each line's own
+	// estimate.
+	vector<string> lines;
+	auto count = 3 * MAX_RUNS_PER_BATCH;
+	for (size_t i = 0; i < count; ++i) {
+		lines.push_back("qsub -l walltime=" + std::to_string(i % 2 ? 5 : 7)
+				+ " task" + std::to_string(i));
+	}
+	temp_batch batch(lines);
+	batch_scheduler sched;
+	sched.add_batch(batch.path.c_str());
+	EXPECT_EQ(count, sched.get_lines_left());
+
+	vector<string> out;
+	pending_task pt;
+	while (sched.next(pt)) {
+		auto i = std::stoul(pt.cmdline.substr(pt.cmdline.rfind("task") + 4));
+		EXPECT_EQ(i % 2 ? 5.0 : 7.0, pt.walltime);
+		out.push_back(pt.cmdline);
+	}
+	ASSERT_EQ(count, out.size());
+	EXPECT_EQ(0.0, sched.get_work_left());
+
+	// The long lines among the first runs go first, then the tail (which
+	// sorts with them, being later), then the short lines.
+	auto tail = std::find(out.begin(), out.end(),
+			lines[MAX_RUNS_PER_BATCH - 1]);
+	ASSERT_NE(out.end(), tail);
+	EXPECT_EQ(MAX_RUNS_PER_BATCH / 2, size_t(tail - out.begin()));
+	EXPECT_EQ(vector<string>(lines.begin() + MAX_RUNS_PER_BATCH - 1,
+			lines.end()), vector<string>(tail, tail + (count
+					- MAX_RUNS_PER_BATCH + 1)));
+}
+
+TEST(batch_scheduler_test, sidecar_scan_matches_first_pass) {
+	// Enough lines that a batch whose index comes from its sidecar is read
+	// by several threads; blocks of like lines make runs that cross their
+	// ranges.
+	vector<string> lines;
+	for (int i = 0; i < 400000; ++i) {
+		lines.push_back("qsub -p " + std::to_string(i / 1000 % 3)
+				+ " -l walltime=" + std::to_string(i / 7000 % 4 + 1)
+				+ " task" + std::to_string(i));
+	}
+	temp_batch batch(lines);
+	FileCleanup sidecar(line_index::get_sidecar_path(batch.path.c_str())
+			.c_str());
+
+	vector<string> built, loaded;
+	for (auto out : { &built, &loaded }) {
+		batch_scheduler sched(fs_fifo);
+		EXPECT_EQ(lines.size() - 12344,
+				sched.add_batch(batch.path.c_str(), 12345));
+		*out = drain(sched);
+	}
+	ASSERT_EQ(lines.size() - 12344, loaded.size());
+	EXPECT_TRUE(built == loaded);
+}
+
+static vector<string> numbered(char const * prefix, int count,
+		char const * options = "") {
+	vector<string> lines;
+	for (int i = 1; i <= count; ++i) {
+		lines.push_back(string("qsub ") + options + prefix
+				+ std::to_string(i));
+	}
+	return lines;
+}
+
+TEST(batch_scheduler_test, batches_share_equally) {
+	// A giant batch doesn't hold up the small ones submitted after it.
+	temp_batch giant(numbered("g", 100));
+	temp_batch small1(numbered("s", 2));
+	temp_batch small2(numbered("t", 2));
+	batch_scheduler sched;
+	EXPECT_EQ(fs_batch, sched.get_policy());
+	sched.add_batch(giant.path.c_str());
+	sched.add_batch(small1.path.c_str());
+	sched.add_batch(small2.path.c_str());
+
+	auto out = drain(sched);
+	ASSERT_EQ(104u, out.size());
+	vector<string> expected = {
+		"qsub g1", "qsub s1", "qsub t1",
+		"qsub g2", "qsub s2", "qsub t2",
+		"qsub g3", "qsub g4",
+	};
+	EXPECT_EQ(expected, vector<string>(out.begin(), out.begin() + 8));
+}
+
+TEST(batch_scheduler_test, shares_follow_walltime_and_weight) {
+	// Under fs_batch, a batch of long tasks is given fewer of them.
+	temp_batch slow(numbered("slow", 4, "-l walltime=3 "));
+	temp_batch fast(numbered("fast", 12));
+	{
+		batch_scheduler sched;
+		sched.add_batch(slow.path.c_str());
+		sched.add_batch(fast.path.c_str());
+		auto out = drain(sched);
+		vector<string> expected = {
+			"qsub -l walltime=3 slow1", "qsub fast1", "qsub fast2",
+			"qsub fast3", "qsub -l walltime=3 slow2", "qsub fast4",
+		};
+		EXPECT_EQ(expected, vector<string>(out.begin(), out.begin() + 6));
+	}
+	// Under fs_weighted, a batch with three times the weight gets three
+	// times the share.
+	{
+		batch_scheduler sched(fs_weighted);
+		sched.add_batch(fast.path.c_str(), 1, 1.0);
+		sched.add_batch(slow.path.c_str(), 1, 3.0);
+		auto out = drain(sched);
+		vector<string> expected = {
+			"qsub fast1", "qsub -l walltime=3 slow1", "qsub fast2",
+			"qsub -l walltime=3 slow2", "qsub fast3",
+		};
+		EXPECT_EQ(expected, vector<string>(out.begin(), out.begin() + 5));
+	}
+}
+
+TEST(batch_scheduler_test, priority_beats_fair_share) {
+	temp_batch normal(numbered("n", 3));
+	temp_batch urgent(numbered("u", 2, "-p 10 "));
+	batch_scheduler sched;
+	sched.add_batch(normal.path.c_str());
+	sched.add_batch(urgent.path.c_str());
+	vector<string> expected = {
+		"qsub -p 10 u1", "qsub -p 10 u2", "qsub n1", "qsub n2", "qsub n3",
+	};
+	EXPECT_EQ(expected, drain(sched));
+}
+
+TEST(batch_scheduler_test, empty_batch_adds_nothing) {
+	temp_batch empty({});
+	batch_scheduler sched;
+	EXPECT_EQ(0u, sched.add_batch(empty.path.c_str()));
+	EXPECT_TRUE(sched.empty());
+	EXPECT_EQ(0u, sched.get_batch_count());
+}
+
+TEST(batch_scheduler_test, lines_that_arent_tasks_are_skipped) {
+	temp_batch batch({
+		"# set up",
+		"",
+		"qsub a1",
+		"",
+		"qsub a2",
+		"echo not a task",
+		"qsub -p 5 a3",
+		"   ",
+		"qsub a4",
+	});
+	FileCleanup sidecar(line_index::get_sidecar_path(batch.path.c_str())
+			.c_str());
+	vector<string> expected = {
+		"qsub -p 5 a3", "qsub a1", "qsub a2", "qsub a4",
+	};
+	// Once as we build the index, and once with it loaded from its sidecar.
+	for (int i = 0; i < 2; ++i) {
+		batch_scheduler sched;
+		EXPECT_EQ(4u, sched.add_batch(batch.path.c_str()));
+		EXPECT_EQ(4u, sched.get_lines_left());
+		EXPECT_EQ(4.0, sched.get_work_left());
+		EXPECT_EQ(expected, drain(sched));
+		EXPECT_TRUE(sched.empty());
+	}
+}
+
+TEST(batch_scheduler_test, batch_that_changes_is_dropped) {
+	// Cut short after it's added: what's left of it is gone.
+	temp_batch cut(numbered("c", 10));
+	batch_scheduler sched;
+	EXPECT_EQ(10u, sched.add_batch(cut.path.c_str()));
+	ASSERT_EQ(0, truncate(cut.path.c_str(), 4 * strlen("qsub c1\n")));
+	EXPECT_TRUE(drain(sched).empty());
+	EXPECT_TRUE(sched.empty());
+	EXPECT_EQ(0u, sched.get_lines_left());
+	EXPECT_EQ(0.0, sched.get_work_left());
+	EXPECT_EQ(0u, sched.get_batch_count());
+	auto progress = sched.get_progress();
+	ASSERT_EQ(1u, progress.size());
+	EXPECT_EQ(1u, progress[0].line);
+	EXPECT_FALSE(progress[0].finished);
+
+	// Cut short between runs: what went out stays out.
+	temp_batch later({ "qsub -l walltime=2 l1", "qsub l2", "qsub l3" });
+	EXPECT_EQ(3u, sched.add_batch(later.path.c_str()));
+	pending_task pt;
+	ASSERT_TRUE(sched.next(pt));
+	EXPECT_EQ("qsub -l walltime=2 l1", pt.cmdline);
+	ASSERT_EQ(0, truncate(later.path.c_str(), pt.cmdline.size() + 1));
+	EXPECT_TRUE(drain(sched).empty());
+	EXPECT_TRUE(sched.empty());
+	EXPECT_EQ(0.0, sched.get_work_left());
+	// The batch isn't finished; it would resume where we dropped it.
+	sched.complete(pt.batch, pt.line);
+	progress = sched.get_progress();
+	ASSERT_EQ(1u, progress.size());
+	EXPECT_EQ(later.path, progress[0].path);
+	EXPECT_EQ(2u, progress[0].line);
+	EXPECT_FALSE(progress[0].finished);
+
+	// Rewritten in place: the lines that stopped being tasks are dropped,
+	// and the rest still go out.
+	temp_batch rewritten(numbered("r", 4));
+	EXPECT_EQ(4u, sched.add_batch(rewritten.path.c_str()));
+	{
+		std::fstream out(rewritten.path.c_str());
+		out.seekp(2 * strlen("qsub r1\n"));
+		out << "#sub r3\n#sub r4\n";
+	}
+	vector<string> expected = { "qsub r1", "qsub r2" };
+	EXPECT_EQ(expected, drain(sched));
+	EXPECT_TRUE(sched.empty());
+	EXPECT_EQ(0.0, sched.get_work_left());
+	EXPECT_EQ(0u, sched.get_batch_count());
+}
+
+TEST(batch_scheduler_test, progress_is_lowest_line_not_run) {
+	temp_batch batch({
+		"qsub task1",
+		"qsub -l walltime=1:00:00 task2",
+		"qsub task3",
+		"qsub task4",
+	});
+	batch_scheduler sched;
+	sched.add_batch(batch.path.c_str(), 1);
+	EXPECT_TRUE(sched.get_progress().empty());
+
+	// The long line goes first.
+	pending_task long2, pt1, pt3;
+	ASSERT_TRUE(sched.next(long2));
+	EXPECT_EQ(2u, long2.line);
+	ASSERT_TRUE(sched.next(pt1));
+	EXPECT_EQ(1u, pt1.line);
+	ASSERT_TRUE(sched.next(pt3));
+	EXPECT_EQ(3u, pt3.line);
+
+	// Line 1 has run, but 2 is still running.
+	sched.complete(pt1.batch, pt1.line);
+	sched.complete(pt3.batch, pt3.line);
+	auto progress = sched.get_progress();
+	ASSERT_EQ(1u, progress.size());
+	EXPECT_EQ(batch.path, progress[0].path);
+	EXPECT_EQ(2u, progress[0].line);
+	EXPECT_FALSE(progress[0].finished);
+	EXPECT_TRUE(sched.get_progress().empty());
+
+	// Now only line 4, which hasn't been handed out, is left.
+	sched.complete(long2.batch, long2.line);
+	progress = sched.get_progress();
+	ASSERT_EQ(1u, progress.size());
+	EXPECT_EQ(4u, progress[0].line);
+
+	pending_task pt4;
+	ASSERT_TRUE(sched.next(pt4));
+	EXPECT_EQ(4u, pt4.line);
+	EXPECT_TRUE(sched.get_progress().empty());
+	sched.complete(pt4.batch, pt4.line);
+	progress = sched.get_progress();
+	ASSERT_EQ(1u, progress.size());
+	EXPECT_EQ(5u, progress[0].line);
+	EXPECT_TRUE(progress[0].finished);
+
+	// A finished batch is reported once, and completing again is harmless.
+	sched.complete(pt4.batch, pt4.line);
+	EXPECT_TRUE(sched.get_progress().empty());
+}
+
+TEST(batch_scheduler_test, submit_indexes_on_reader_thread) {
+	temp_batch first(numbered("a", 3));
+	temp_batch second(numbered("b", 3));
+	std::mutex mtx;
+	std::condition_variable cv;
+	int indexed = 0;
+	auto on_indexed = [&] {
+		std::lock_guard<std::mutex> lock(mtx);
+		++indexed;
+		cv.notify_all();
+	};
+
+	batch_scheduler sched;
+	sched.submit(first.path, 2, 1.0, on_indexed);
+	sched.submit(second.path, 1, 1.0, on_indexed);
+	sched.submit("/no/such/batch", 1, 1.0, on_indexed);
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(10),
+				[&] { return indexed == 3; }));
+	}
+	EXPECT_EQ(5u, sched.get_lines_left());
+	EXPECT_EQ(2u, sched.get_batch_count());
+	EXPECT_FALSE(sched.is_ingesting());
+	EXPECT_EQ(5u, drain(sched).size());
+}
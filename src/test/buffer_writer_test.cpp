@@ -0,0 +1,78 @@
+#include <climits>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "json/json.h"
+
+using std::string;
+
+TEST(buffer_writer_test, separators) {
+	string doc;
+	Json::BufferWriter w(doc);
+	w.startObject();
+	w.key("a").startArray().numberValue(1).numberValue(-2).boolValue(true)
+			.boolValue(false).nullValue().endArray();
+	w.key("b").startObject().endObject();
+	w.key("c").startArray().endArray();
+	w.key("d").startArray().startObject().key("x").stringValue("y").endObject()
+			.startArray().endArray().endArray();
+	w.key(string("e")).stringValue(string("z"));
+	w.endObject();
+	EXPECT_EQ("{\"a\":[1,-2,true,false,null],\"b\":{},\"c\":[],"
+			"\"d\":[{\"x\":\"y\"},[]],\"e\":\"z\"}", doc);
+	EXPECT_EQ(&doc, &w.document());
+}
+
+TEST(buffer_writer_test, appends_to_existing_text) {
+	string doc = "prefix ";
+	Json::BufferWriter w(doc);
+	w.numberValue(7);
+	EXPECT_EQ("prefix 7", doc);
+}
+
+TEST(buffer_writer_test, numbers) {
+	string doc;
+	Json::BufferWriter w(doc);
+	w.startArray();
+	w.numberValue(INT_MIN).numberValue(UINT_MAX);
+	w.numberValue(LLONG_MIN).numberValue(ULLONG_MAX);
+	w.numberValue(0.25).numberValue(1.0).numberValue(-3e20);
+	w.endArray();
+	EXPECT_EQ("[-2147483648,4294967295,-9223372036854775808,"
+			"18446744073709551615,0.25,1.0,-3.000000000000000e+20]", doc);
+}
+
+TEST(buffer_writer_test, escapes) {
+	string doc;
+	Json::BufferWriter w(doc);
+	string s = "tab\there \"q\" \\ / \x01\x1f \xc3\xa9";
+	w.startObject().key("k\n").stringValue(s).endObject();
+	EXPECT_EQ("{\"k\\n\":\"tab\\there \\\"q\\\" \\\\ / \\u0001\\u001f \xc3\xa9\"}",
+			doc);
+	// An embedded null is written, not treated as the end.
+	doc.clear();
+	Json::BufferWriter w2(doc);
+	char const nul[] = "a\0b";
+	w2.stringValue(nul, nul + 3);
+	EXPECT_EQ("\"a\\u0000b\"", doc);
+}
+
+TEST(buffer_writer_test, reader_agrees) {
+	string doc;
+	Json::BufferWriter w(doc);
+	w.startObject();
+	w.key("s").stringValue("line1\nline2 \"quoted\" \\ /");
+	w.key("n").numberValue(-12);
+	w.key("d").numberValue(0.5);
+	w.key("a").startArray().boolValue(true).nullValue().endArray();
+	w.endObject();
+	Json::Value root;
+	ASSERT_TRUE(Json::Reader().parse(doc, root)) << doc;
+	EXPECT_EQ("line1\nline2 \"quoted\" \\ /", root["s"].asString());
+	EXPECT_EQ(-12, root["n"].asInt());
+	EXPECT_TRUE(root["d"].isDouble());
+	EXPECT_EQ(0.5, root["d"].asDouble());
+	EXPECT_TRUE(root["a"][0u].asBool());
+	EXPECT_TRUE(root["a"][1u].isNull());
+}
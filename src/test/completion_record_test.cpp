@@ -0,0 +1,88 @@
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "base/process_reaper.h"
+
+#include "domain/completion_record.h"
+
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+using namespace nitro;
+
+TEST(completion_record_test, from_exit) {
+	process_exit_info info;
+	memset(&info, 0, sizeof(info));
+	info.status = W_EXITCODE(2, 0);
+	info.wall_seconds = 1.5;
+	info.usage.ru_utime.tv_sec = 1;
+	info.usage.ru_utime.tv_usec = 250;
+	info.usage.ru_maxrss = 4096;
+	auto rec = completion_record::from_exit(7, info);
+	EXPECT_EQ(7u, rec.task_id);
+	EXPECT_EQ(2, rec.exit_code);
+	EXPECT_EQ(1500000u, rec.wall_micros);
+	EXPECT_EQ(1000250u, rec.user_micros);
+	EXPECT_EQ(0u, rec.sys_micros);
+	EXPECT_EQ(4096u, rec.max_rss_kb);
+
+	// Killed tasks are reported the way a shell would.
+	info.status = W_EXITCODE(0, SIGKILL);
+	EXPECT_EQ(128 + SIGKILL, completion_record::from_exit(7, info).exit_code);
+}
+
+TEST(completion_record_test, batch_round_trip) {
+	completion_record recs[] = {
+		completion_record::from_code(1, 0),
+		completion_record::from_code(2, 127),
+	};
+	recs[0].wall_micros = 123456789;
+	auto batch = encode_completion_batch("a1", recs, 2);
+	EXPECT_TRUE(is_completion_batch(batch));
+
+	string aid;
+	vector<completion_record> decoded;
+	ASSERT_TRUE(decode_completion_batch(batch, aid, decoded));
+	EXPECT_EQ("a1", aid);
+	ASSERT_EQ(2u, decoded.size());
+	EXPECT_EQ(0, memcmp(recs, decoded.data(), sizeof(recs)));
+}
+
+TEST(completion_record_test, malformed_batches) {
+	EXPECT_FALSE(is_completion_batch("{ \"body\" : {} }"));
+	auto rec = completion_record::from_code(1, 0);
+	auto batch = encode_completion_batch("a1", &rec, 1);
+	batch.resize(batch.size() - 1);
+	string aid;
+	vector<completion_record> decoded;
+	EXPECT_FALSE(decode_completion_batch(batch, aid, decoded));
+}
+
+TEST(completion_record_test, concatenated_batches) {
+	auto r1 = completion_record::from_code(1, 0);
+	completion_record r2[] = {
+		completion_record::from_code(2, 0),
+		completion_record::from_code(3, 1),
+	};
+	auto msg = encode_completion_batch("a1", &r1, 1)
+			+ encode_completion_batch("a2", r2, 2);
+	EXPECT_TRUE(is_completion_batch(msg));
+
+	// Whole, it isn't one batch; in turn, it's two.
+	string aid;
+	vector<completion_record> decoded;
+	EXPECT_FALSE(decode_completion_batch(msg, aid, decoded));
+	size_t offset = 0;
+	ASSERT_TRUE(decode_completion_batch(msg, offset, aid, decoded));
+	EXPECT_EQ("a1", aid);
+	EXPECT_EQ(1u, decoded.size());
+	ASSERT_TRUE(decode_completion_batch(msg, offset, aid, decoded));
+	EXPECT_EQ("a2", aid);
+	ASSERT_EQ(2u, decoded.size());
+	EXPECT_EQ(3u, decoded[1].task_id);
+	EXPECT_EQ(msg.size(), offset);
+	EXPECT_FALSE(decode_completion_batch(msg, offset, aid, decoded));
+}
@@ -1,19 +1,30 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <thread>
+#include <vector>
+
+#include <string.h>
 
 #include "base/countof.h"
 #include "base/xlog.h"
 
 #include "domain/assignment.h"
 #include "domain/cmdline.h"
+#include "domain/completion_record.h"
 #include "domain/coord_engine.h"
 #include "domain/event_codes.h"
 #include "domain/msg.h"
+#include "domain/worker_engine.h"
 #include "domain/zmq_helpers.h"
 
 #include "gtest/gtest.h"
 
+#include "test/test_util.h"
+
 #include "zeromq/include/zmq.h"
 
+using std::lock_guard;
 using std::thread;
 using std::string;
 
@@ -41,3 +52,560 @@ TEST(coord_engine_test, req_rep) {
 	ce.run();
 }
 #endif
+
+static std::atomic<unsigned> dispatched_task_count(0);
+static std::mutex dispatched_mutex;
+static std::vector<string> dispatched_cmdlines;
+
+static void count_only_thread_main(worker_engine & we, char const * cmdline) {
+	worker_engine::notifier notifier(we);
+	++dispatched_task_count;
+	lock_guard<std::mutex> lock(dispatched_mutex);
+	dispatched_cmdlines.push_back(cmdline);
+}
+
+static thread * count_only_launch_func(worker_engine & we, char const * cmdline) {
+	return new thread(count_only_thread_main, std::ref(we), cmdline);
+}
+
+static void reset_dispatch_counts() {
+	dispatched_task_count.store(0);
+	lock_guard<std::mutex> lock(dispatched_mutex);
+	dispatched_cmdlines.clear();
+}
+
+/**
+ * A batch file that deletes itself (and its sidecar) when it goes out of
+ * scope.
+ */
+struct temp_batch {
+	string path;
+	FileCleanup fc;
+
+	temp_batch(std::vector<string> const & lines) : path(make_temp_file()),
+			fc(path.c_str()) {
+		write(lines);
+	}
+
+	/**
+	 * A batch of @param count lines, each @param prefix followed by its
+	 * number, counting from 0.
+	 */
+	temp_batch(size_t count, char const * prefix = "qsub -l walltime=1 task") :
+			path(make_temp_file()), fc(path.c_str()) {
+		std::vector<string> lines;
+		for (size_t i = 0; i < count; ++i) {
+			lines.push_back(prefix + std::to_string(i));
+		}
+		write(lines);
+	}
+
+private:
+	void write(std::vector<string> const & lines) {
+		FILE * f = fopen(path.c_str(), "w");
+		for (auto & line : lines) {
+			fprintf(f, "%s\n", line.c_str());
+		}
+		fclose(f);
+	}
+};
+
+/**
+ * What happened when a coordinator ran a batch with one counting worker.
+ */
+struct dispatch_result {
+	int coord_exit_code;
+	int worker_exit_code;
+	unsigned worker_count;
+	uint64_t completed_task_count;
+	uint64_t failed_task_count;
+	// The cmdlines the worker was given, in the order it started them.
+	std::vector<string> dispatched;
+};
+
+/**
+ * Run a coordinator on @param batch, with one worker that only counts (and
+ * records) the tasks it's given, until the batch is done. The coordinator
+ * listens on @param port_base and the two ports after it; the worker, on the
+ * two after those. @param coord_options and @param worker_options are added
+ * to their command lines.
+ */
+static dispatch_result dispatch_and_count(temp_batch const & batch,
+		int port_base, std::vector<string> const & coord_options = {},
+		std::vector<string> const & worker_options = {}) {
+	auto port = [port_base](int i) { return std::to_string(port_base + i); };
+	std::vector<string> cargs = { "nitro", "--rrport", port(0), "--psport",
+			port(1), "--dpport", port(2) };
+	cargs.insert(cargs.end(), coord_options.begin(), coord_options.end());
+	cargs.push_back(batch.path);
+	std::vector<string> wargs = { "nitro", "--rrport", port(3), "--psport",
+			port(4), "--dpport", port(2), "--workfor",
+			"127.0.0.1:" + port(1) };
+	wargs.insert(wargs.end(), worker_options.begin(), worker_options.end());
+	auto argv = [](std::vector<string> const & args) {
+		std::vector<char const *> v;
+		for (auto & arg : args) {
+			v.push_back(arg.c_str());
+		}
+		return v;
+	};
+	auto cargv = argv(cargs);
+	auto wargv = argv(wargs);
+
+	coord_engine ce(cmdline(cargv.size(), cargv.data()));
+	worker_engine we(cmdline(wargv.size(), wargv.data()));
+	we.set_launch_func(count_only_launch_func);
+
+	reset_dispatch_counts();
+	dispatch_result result;
+	result.worker_exit_code = -1;
+	thread worker([&] { result.worker_exit_code = we.run(); });
+	result.coord_exit_code = ce.run();
+	worker.join();
+
+	result.worker_count = ce.get_worker_count();
+	result.completed_task_count = ce.get_completed_task_count();
+	result.failed_task_count = ce.get_failed_task_count();
+	lock_guard<std::mutex> lock(dispatched_mutex);
+	result.dispatched = dispatched_cmdlines;
+	return result;
+}
+
+TEST(coord_engine_test, dispatch_to_worker) {
+	const size_t TASK_COUNT = 300;
+	temp_batch batch(TASK_COUNT);
+	auto result = dispatch_and_count(batch, 52520);
+
+	EXPECT_EQ(0, result.coord_exit_code);
+	EXPECT_EQ(0, result.worker_exit_code);
+	EXPECT_EQ(1u, result.worker_count);
+	EXPECT_EQ(TASK_COUNT, result.dispatched.size());
+	// Every task should have been reported back in a completion record.
+	EXPECT_EQ(TASK_COUNT, result.completed_task_count);
+	EXPECT_EQ(0u, result.failed_task_count);
+}
+
+TEST(coord_engine_test, resume_at_start_line) {
+	const size_t TASK_COUNT = 300;
+	const size_t START_LINE = 101;
+	temp_batch batch(TASK_COUNT);
+	auto result = dispatch_and_count(batch, 52530,
+			{ "--startline", std::to_string(START_LINE) });
+
+	// Line n is task(n - 1); exactly the lines from START_LINE on ran.
+	std::vector<string> expected;
+	for (size_t i = START_LINE - 1; i < TASK_COUNT; ++i) {
+		expected.push_back("qsub -l walltime=1 task" + std::to_string(i));
+	}
+	auto ran = result.dispatched;
+	std::sort(ran.begin(), ran.end());
+	std::sort(expected.begin(), expected.end());
+	EXPECT_EQ(expected, ran);
+}
+
+TEST(coord_engine_test, dispatch_to_json_worker) {
+	const size_t TASK_COUNT = 50;
+	temp_batch batch(TASK_COUNT);
+	// A worker that doesn't offer binary (like our python tools) gets json.
+	auto result = dispatch_and_count(batch, 52540, {}, { "--wire", "json" });
+
+	EXPECT_EQ(TASK_COUNT, result.dispatched.size());
+	EXPECT_EQ(TASK_COUNT, result.completed_task_count);
+}
+
+TEST(coord_engine_test, longest_tasks_go_first) {
+	std::vector<string> lines;
+	for (int i = 1; i <= 10; ++i) {
+		auto n = std::to_string(i);
+		if (i == 9) {
+			lines.push_back("qsub -l nodes=1,walltime=4:00:00 long" + n);
+		} else if (i == 3 || i == 4) {
+			lines.push_back("qsub -l walltime=10:00 medium" + n);
+		} else {
+			lines.push_back("qsub task" + n);
+		}
+	}
+	temp_batch batch(lines);
+
+	char const * cargs[] = { "nitro", "--rrport", "52550", "--psport", "52551",
+			"--dpport", "52552", batch.path.c_str() };
+	coord_engine ce(cmdline(countof(cargs), cargs));
+
+	auto a = ce.next_assignment(2);
+	ASSERT_TRUE(a.get() != nullptr);
+	ASSERT_EQ(2u, a->size());
+	EXPECT_EQ("qsub -l nodes=1,walltime=4:00:00 long9", (*a)[0].cmdline);
+	EXPECT_EQ(14400.0, (*a)[0].walltime);
+	EXPECT_EQ("qsub -l walltime=10:00 medium3", (*a)[1].cmdline);
+
+	// Packing by work: the other medium task alone is worth more than 60
+	// seconds, but we still want two lines.
+	a = ce.next_assignment(100, 60, 2);
+	ASSERT_EQ(2u, a->size());
+	EXPECT_EQ("qsub -l walltime=10:00 medium4", (*a)[0].cmdline);
+	EXPECT_EQ("qsub task1", (*a)[1].cmdline);
+
+	// Equally long tasks keep their order in the file.
+	a = ce.next_assignment();
+	ASSERT_EQ(6u, a->size());
+	char const * expected[] = { "qsub task2", "qsub task5", "qsub task6",
+			"qsub task7", "qsub task8", "qsub task10" };
+	for (unsigned i = 0; i < countof(expected); ++i) {
+		EXPECT_EQ(expected[i], (*a)[i].cmdline);
+	}
+	EXPECT_FALSE(ce.next_assignment());
+}
+
+static string request(void * requester, string const & msg) {
+	send_full_msg(requester, msg);
+	return receive_full_msg(requester);
+}
+
+static int get_reply_code(string const & reply) {
+	msg_view view;
+	return decode_msg(reply.data(), reply.data() + reply.size(), view)
+			? view.code : 0;
+}
+
+static bool wait_for_dispatch_count(unsigned count) {
+	for (int i = 0; i < 1000 && dispatched_task_count.load() < count; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return dispatched_task_count.load() == count;
+}
+
+TEST(coord_engine_test, batches_submitted_while_running) {
+	temp_batch first(50, "qsub first");
+	temp_batch second(20, "qsub second");
+
+	// A lingering coordinator with nothing to do yet.
+	char const * cargs[] = { "nitro", "--rrport", "52560", "--psport", "52561",
+			"--dpport", "52562", "--linger" };
+	coord_engine ce(cmdline(countof(cargs), cargs));
+
+	char const * wargs[] = { "nitro", "--rrport", "52563", "--psport", "52564",
+			"--dpport", "52562", "--workfor", "127.0.0.1:52561" };
+	worker_engine we(cmdline(countof(wargs), wargs));
+	we.set_launch_func(count_only_launch_func);
+
+	reset_dispatch_counts();
+	int coord_exit_code = -1;
+	thread coord([&] { coord_exit_code = ce.run(); });
+	thread worker([&] { we.run(); });
+
+	void * requester = zmq_socket(ce.ctx, ZMQ_REQ);
+	zsocket_cleaner zclean(requester);
+	zmq_connect_and_log(requester, "tcp://127.0.0.1:52560");
+
+	EXPECT_EQ(NITRO_BATCH_SUBMITTED, get_reply_code(request(requester,
+			serialize_msg(NITRO_BATCH_SUBMITTED, first.path))));
+	EXPECT_TRUE(wait_for_dispatch_count(50));
+
+	EXPECT_EQ(NITRO_DENY_HELP_1REASON, get_reply_code(request(requester,
+			serialize_msg(NITRO_BATCH_SUBMITTED, "/no/such/batch"))));
+
+	EXPECT_EQ(NITRO_BATCH_SUBMITTED, get_reply_code(request(requester,
+			serialize_msg(NITRO_BATCH_SUBMITTED, "weight=2 " + second.path))));
+	EXPECT_TRUE(wait_for_dispatch_count(70));
+
+	EXPECT_EQ(NITRO_TERMINATE_REQUEST, get_reply_code(request(requester,
+			serialize_msg(NITRO_TERMINATE_REQUEST))));
+	coord.join();
+	worker.join();
+	EXPECT_EQ(0, coord_exit_code);
+	EXPECT_EQ(1u, ce.get_worker_count());
+}
+
+static std::atomic<bool> hang_released(false);
+static std::atomic<int> hang_count(0);
+
+/**
+ * Like count_only_thread_main, except that the first task to mention "hang"
+ * doesn't finish until we release it.
+ */
+static void hang_once_thread_main(worker_engine & we, char const * cmdline) {
+	worker_engine::notifier notifier(we);
+	++dispatched_task_count;
+	if (strstr(cmdline, "hang") && hang_count++ == 0) {
+		while (!hang_released.load()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+}
+
+static thread * hang_once_launch_func(worker_engine & we, char const * cmdline) {
+	return new thread(hang_once_thread_main, std::ref(we), cmdline);
+}
+
+TEST(coord_engine_test, stragglers_run_twice) {
+	const unsigned TASK_COUNT = 60;
+	std::vector<string> lines = { "qsub hang" };
+	for (unsigned i = 1; i < TASK_COUNT; ++i) {
+		lines.push_back("qsub task" + std::to_string(i));
+	}
+	temp_batch batch(lines);
+
+	char const * cargs[] = { "nitro", "--rrport", "52570", "--psport", "52571",
+			"--dpport", "52572", batch.path.c_str() };
+	coord_engine ce(cmdline(countof(cargs), cargs));
+
+	char const * wargs1[] = { "nitro", "--rrport", "52573", "--psport", "52574",
+			"--dpport", "52572", "--workfor", "127.0.0.1:52571" };
+	worker_engine we1(cmdline(countof(wargs1), wargs1));
+	we1.set_launch_func(hang_once_launch_func);
+	char const * wargs2[] = { "nitro", "--rrport", "52575", "--psport", "52576",
+			"--dpport", "52572", "--workfor", "127.0.0.1:52571" };
+	worker_engine we2(cmdline(countof(wargs2), wargs2));
+	we2.set_launch_func(hang_once_launch_func);
+
+	reset_dispatch_counts();
+	hang_released.store(false);
+	hang_count.store(0);
+	thread worker1([&] { we1.run(); });
+	thread worker2([&] { we2.run(); });
+	// We finish without waiting for the hung task; its copy stands in.
+	EXPECT_EQ(0, ce.run());
+	hang_released.store(true);
+	worker1.join();
+	worker2.join();
+
+	EXPECT_EQ(2u, ce.get_worker_count());
+	EXPECT_EQ(1u, ce.get_speculated_task_count());
+	EXPECT_EQ(TASK_COUNT + 1, dispatched_task_count.load());
+	EXPECT_EQ(TASK_COUNT, ce.get_completed_task_count());
+}
+
+/**
+ * A worker we script by hand, speaking the dispatch protocol directly, so we
+ * decide exactly what it asks for and when its tasks finish.
+ */
+struct fake_worker {
+	void * dealer;
+	string id;
+
+	struct assignment_t {
+		string id;
+		std::vector<uint64_t> task_ids;
+		std::vector<string> cmdlines;
+	};
+
+	fake_worker(coord_engine const & ce, char const * name,
+			char const * endpoint) : dealer(zmq_socket(ce.ctx, ZMQ_DEALER)),
+			id(name) {
+		zmq_setsockopt(dealer, ZMQ_IDENTITY, id.data(), id.size());
+		int timeout = 5000;
+		zmq_setsockopt(dealer, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+		zmq_connect_and_log(dealer, endpoint);
+		send(NITRO_AFFIRM_HELP, "");
+	}
+
+	~fake_worker() {
+		zmq_close(dealer);
+	}
+
+	void send(int eid, string const & txt) {
+		send_full_msg(dealer, serialize_msg(wf_json, id.c_str(), eid, txt));
+	}
+
+	/**
+	 * Ask for work, claiming @param slots, and wait for it to arrive.
+	 */
+	assignment_t request(unsigned slots) {
+		send(NITRO_NEED_ASSIGNMENT, std::to_string(slots));
+		assignment_t asgn;
+		msg_view view;
+		while (true) {
+			auto txt = receive_full_msg(dealer);
+			if (txt.empty()) {
+				ADD_FAILURE() << id << " was never given an assignment.";
+				break;
+			}
+			if (decode_msg(txt.data(), txt.data() + txt.size(), view)
+					&& view.code == NITRO_HERE_IS_ASSIGNMENT) {
+				asgn.id = view.assignment_id.str();
+				for (auto & t : view.tasks) {
+					asgn.task_ids.push_back(t.id);
+					asgn.cmdlines.push_back(t.cmdline.str());
+				}
+				break;
+			}
+		}
+		return asgn;
+	}
+
+	/**
+	 * Report every task in @param asgn done, each having run for @param
+	 * micros.
+	 */
+	void complete(assignment_t const & asgn, uint64_t micros = 100000) {
+		std::vector<completion_record> records;
+		for (auto tid : asgn.task_ids) {
+			records.push_back(completion_record::from_code(tid, 0));
+			records.back().wall_micros = micros;
+		}
+		send_full_msg(dealer, encode_completion_batch(asgn.id.c_str(),
+				records.data(), records.size()));
+	}
+
+	/**
+	 * Say that all of @param asgn is done, without records for its tasks.
+	 */
+	void finish(assignment_t const & asgn) {
+		send(NITRO_1ASSIGNMENT_COMPLETE, asgn.id);
+	}
+};
+
+TEST(coord_engine_test, assignments_sized_to_throughput) {
+	const size_t TASK_COUNT = 10000;
+	temp_batch batch(TASK_COUNT);
+
+	char const * cargs[] = { "nitro", "--rrport", "52600", "--psport", "52601",
+			"--dpport", "52602", batch.path.c_str() };
+	coord_engine ce(cmdline(countof(cargs), cargs));
+	int coord_exit_code = -1;
+	thread coord([&] { coord_exit_code = ce.run(); });
+
+	typedef std::chrono::steady_clock clock;
+	typedef std::chrono::duration<double> seconds;
+	const unsigned SLOTS = 4;
+	fake_worker w(ce, "sizer", "tcp://127.0.0.1:52602");
+	std::vector<fake_worker::assignment_t> held;
+
+	// Until we've measured a worker, it gets a probe that fills its slots
+	// twice.
+	auto asked = clock::now();
+	held.push_back(w.request(SLOTS));
+	auto received = clock::now();
+	EXPECT_EQ(2 * SLOTS, held.back().task_ids.size());
+	size_t left = TASK_COUNT - held.back().task_ids.size();
+
+	// Having seen how long it took, we send enough for
+	// TARGET_SECONDS_PER_ASSIGNMENT at that pace.
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	auto finished = clock::now();
+	w.finish(held.back());
+	held.push_back(w.request(SLOTS));
+	auto work = 2 * SLOTS * TARGET_SECONDS_PER_ASSIGNMENT;
+	auto most = work / seconds(finished - received).count() + 1;
+	auto least = work / seconds(clock::now() - asked).count();
+	auto sized = held.back().task_ids.size();
+	EXPECT_LE(least, sized);
+	EXPECT_GE(most, sized);
+	EXPECT_LT(2 * SLOTS, sized);
+	left -= sized;
+
+	// Near the end, an assignment takes no more than half of what's left
+	// (for our only worker, which gets two shares), down to a slot's worth
+	// each.
+	bool shrank = false;
+	while (left > 0) {
+		held.push_back(w.request(SLOTS));
+		auto n = held.back().task_ids.size();
+		ASSERT_LT(0u, n);
+		EXPECT_GE(std::max<size_t>(left / 2, SLOTS), n);
+		EXPECT_GE(sized, n);
+		shrank = shrank || n < sized;
+		left -= std::min(left, n);
+	}
+	EXPECT_TRUE(shrank);
+	EXPECT_GE(SLOTS, held.back().task_ids.size());
+
+	for (size_t i = 1; i < held.size(); ++i) {
+		w.finish(held[i]);
+	}
+	coord.join();
+	EXPECT_EQ(0, coord_exit_code);
+}
+
+TEST(coord_engine_test, queued_assignments_are_not_stragglers) {
+	const unsigned TASK_COUNT = 30;
+	temp_batch batch(TASK_COUNT);
+
+	char const * cargs[] = { "nitro", "--rrport", "52590", "--psport", "52591",
+			"--dpport", "52592", "--keepalive", "60000", batch.path.c_str() };
+	coord_engine ce(cmdline(countof(cargs), cargs));
+	int coord_exit_code = -1;
+	thread coord([&] { coord_exit_code = ce.run(); });
+
+	// A fast worker runs most of the batch, so we know how long tasks take.
+	fake_worker fast(ce, "fast", "tcp://127.0.0.1:52592");
+	auto first = fast.request(25);
+	EXPECT_EQ(25u, first.task_ids.size());
+	fast.complete(first);
+
+	// A worker with one slot takes two assignments of one task each; the
+	// second waits for the first to finish.
+	fake_worker busy(ce, "busy", "tcp://127.0.0.1:52592");
+	auto running = busy.request(1);
+	auto queued = busy.request(1);
+	ASSERT_EQ(1u, running.task_ids.size());
+	ASSERT_EQ(1u, queued.task_ids.size());
+
+	auto rest = fast.request(25);
+	EXPECT_EQ(3u, rest.task_ids.size());
+	fast.complete(rest);
+
+	// Long after either should have finished, only the task that's running
+	// is a straggler.
+	std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+	auto copies = fast.request(25);
+	ASSERT_EQ(1u, copies.cmdlines.size());
+	EXPECT_EQ(running.cmdlines[0], copies.cmdlines[0]);
+
+	// The copy wins; the queued task finishes after all.
+	fast.complete(copies);
+	busy.complete(queued);
+	coord.join();
+	EXPECT_EQ(0, coord_exit_code);
+	EXPECT_EQ(1u, ce.get_speculated_task_count());
+	EXPECT_EQ(TASK_COUNT, ce.get_completed_task_count());
+}
+
+TEST(coord_engine_test, silent_worker_loses_its_work) {
+	const unsigned TASK_COUNT = 100;
+	temp_batch batch(TASK_COUNT, "qsub task");
+
+	char const * cargs[] = { "nitro", "--rrport", "52580", "--psport", "52581",
+			"--dpport", "52582", "--keepalive", "500", batch.path.c_str() };
+	coord_engine ce(cmdline(countof(cargs), cargs));
+
+	reset_dispatch_counts();
+	int coord_exit_code = -1;
+	thread coord([&] { coord_exit_code = ce.run(); });
+
+	// A worker that takes an assignment and is never heard from again, as if
+	// its node had died.
+	void * ghost = zmq_socket(ce.ctx, ZMQ_DEALER);
+	zsocket_cleaner zclean(ghost);
+	zmq_setsockopt(ghost, ZMQ_IDENTITY, "ghost", 5);
+	int timeout = 5000;
+	zmq_setsockopt(ghost, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+	zmq_connect_and_log(ghost, "tcp://127.0.0.1:52582");
+	send_full_msg(ghost, serialize_msg(wf_json, "ghost", NITRO_AFFIRM_HELP,
+			""));
+	send_full_msg(ghost, serialize_msg(wf_json, "ghost", NITRO_NEED_ASSIGNMENT,
+			"4"));
+	int code = 0;
+	while (code != NITRO_HERE_IS_ASSIGNMENT) {
+		auto txt = receive_full_msg(ghost);
+		if (txt.empty()) {
+			ADD_FAILURE() << "The ghost was never given an assignment.";
+			break;
+		}
+		code = get_reply_code(txt);
+	}
+
+	char const * wargs[] = { "nitro", "--rrport", "52583", "--psport", "52584",
+			"--dpport", "52582", "--workfor", "127.0.0.1:52581" };
+	worker_engine we(cmdline(countof(wargs), wargs));
+	we.set_launch_func(count_only_launch_func);
+	thread worker([&] { we.run(); });
+	coord.join();
+	worker.join();
+
+	EXPECT_EQ(0, coord_exit_code);
+	EXPECT_EQ(1u, ce.get_worker_count());
+	EXPECT_LT(0u, ce.get_reclaimed_task_count());
+	EXPECT_EQ(TASK_COUNT, dispatched_task_count.load());
+	EXPECT_EQ(TASK_COUNT, ce.get_completed_task_count());
+}
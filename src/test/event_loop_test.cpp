@@ -0,0 +1,84 @@
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "domain/event_loop.h"
+#include "domain/msg.h"
+#include "domain/zmq_helpers.h"
+
+#include "gtest/gtest.h"
+
+#include "zeromq/include/zmq.h"
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using namespace nitro;
+
+TEST(event_loop_test, times_out) {
+	event_loop loop;
+	EXPECT_EQ(0, loop.wait(0));
+	auto start = steady_clock::now();
+	EXPECT_EQ(0, loop.wait(20));
+	EXPECT_LE(milliseconds(15), steady_clock::now() - start);
+}
+
+TEST(event_loop_test, wake_from_another_thread) {
+	event_loop loop;
+	std::thread waker([&loop]() {
+		std::this_thread::sleep_for(milliseconds(10));
+		loop.wake();
+	});
+	EXPECT_EQ(event_loop::el_wake, loop.wait(5000));
+	waker.join();
+	// Wakes don't accumulate.
+	loop.wake();
+	loop.wake();
+	EXPECT_EQ(event_loop::el_wake, loop.wait(0));
+	EXPECT_EQ(0, loop.wait(0));
+}
+
+TEST(event_loop_test, timer) {
+	event_loop loop;
+	loop.set_timer(milliseconds(10));
+	// The first tick is immediate.
+	EXPECT_EQ(event_loop::el_timer, loop.wait(1000));
+	EXPECT_EQ(event_loop::el_timer, loop.wait(1000));
+	loop.set_timer(milliseconds(0));
+	EXPECT_EQ(0, loop.wait(30));
+}
+
+TEST(event_loop_test, socket_input) {
+	void * ctx = zmq_ctx_new();
+	zctx_cleaner z1(ctx);
+	void * sender = zmq_socket(ctx, ZMQ_PUSH);
+	zsocket_cleaner z2(sender);
+	const char * const INPROC_ENDPOINT = "inproc://event_loop_socket_input";
+	zmq_bind_and_log(sender, INPROC_ENDPOINT);
+	void * receiver = zmq_socket(ctx, ZMQ_PULL);
+	zsocket_cleaner z3(receiver);
+	zmq_connect_and_log(receiver, INPROC_ENDPOINT);
+
+	event_loop loop;
+	loop.add_socket(receiver);
+	EXPECT_EQ(0, loop.wait(0));
+
+	std::thread sender_thread([sender]() {
+		std::this_thread::sleep_for(milliseconds(10));
+		send_full_msg(sender, std::string("one"));
+		send_full_msg(sender, std::string("two"));
+	});
+	EXPECT_TRUE(loop.wait(5000) & event_loop::el_input);
+	sender_thread.join();
+
+	// Once signalled, keep reading while there's input; a later wait()
+	// still sees anything we left behind.
+	ASSERT_TRUE(event_loop::has_input(receiver));
+	EXPECT_EQ("one", receive_full_msg(receiver));
+	while (!event_loop::has_input(receiver)) {
+		std::this_thread::yield();
+	}
+	EXPECT_EQ(event_loop::el_input, loop.wait(1000));
+	EXPECT_EQ("two", receive_full_msg(receiver));
+	EXPECT_FALSE(event_loop::has_input(receiver));
+	EXPECT_EQ(0, loop.wait(0));
+}
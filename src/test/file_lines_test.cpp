@@ -149,3 +149,96 @@ TEST(file_lines_test, line_spanning_gulp) {
 	line = fl.next();
 	EXPECT_STREQ(nullptr, line);
 }
+
+TEST(file_lines_test, mapped_text_file) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	std::ofstream out(temp_file.c_str());
+	out << "  abc  \n\n\r\n\tdef\r\nghi";
+	out.close();
+
+	file_lines fl(fc.fname.c_str(), true, true, 0, true);
+	size_t len;
+	auto line = fl.next(len);
+	EXPECT_EQ("abc", std::string(line, len));
+	line = fl.next(len);
+	EXPECT_EQ(static_cast<size_t>(0), len);
+	line = fl.next(len);
+	EXPECT_EQ(static_cast<size_t>(0), len);
+	// The null-terminated flavor works in mmap mode, too.
+	EXPECT_STREQ("def", fl.next());
+	line = fl.next(len);
+	EXPECT_EQ("ghi", std::string(line, len));
+	EXPECT_EQ(static_cast<size_t>(5), fl.get_current_line_num());
+	EXPECT_DOUBLE_EQ(1.0, fl.ratio_complete());
+	EXPECT_STREQ(NULL, fl.next(len));
+	EXPECT_STREQ(NULL, fl.next());
+}
+
+TEST(file_lines_test, mapped_empty_file) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	try {
+		file_lines fl(temp_file.c_str(), false, false, 0, true);
+		ADD_FAILURE() << "Expected error_event about empty file.";
+	} catch (error_event const & e) {
+		ASSERT_EQ(e.get_event_code(), E_INPUT_FILE_1PATH_EMPTY);
+	}
+}
+
+TEST(file_lines_test, mapped_binary_file) {
+	try {
+		file_lines fl("/bin/ls", false, false, 0, true);
+		ADD_FAILURE() << "Expected error_event about binary file.";
+	} catch (error_event const & e) {
+		ASSERT_EQ(e.get_event_code(), E_1FILE_BAD_SEEMS_BINARY);
+	}
+}
+
+TEST(file_lines_test, mapped_windows_match_buffered) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	std::ofstream out(temp_file.c_str());
+	// Enough lines of varying length, with a mix of line endings, that with
+	// the smallest window, lines and CR/LF pairs straddle window boundaries.
+	for (int i = 0; i < 5000; ++i) {
+		out << "qsub -N job" << i << " " << std::string(i % 37, 'x')
+				<< (i % 3 ? "\r\n" : "\n");
+	}
+	out.close();
+
+	file_lines buffered(fc.fname.c_str());
+	file_lines mapped(fc.fname.c_str(), false, false, TESTING_GULP_SIZE, true);
+	size_t count = 0;
+	while (true) {
+		auto expected = buffered.next();
+		size_t len;
+		auto line = mapped.next(len);
+		if (!expected) {
+			EXPECT_STREQ(NULL, line);
+			break;
+		}
+		ASSERT_TRUE(line != NULL);
+		ASSERT_EQ(std::string(expected), std::string(line, len));
+		++count;
+	}
+	EXPECT_EQ(static_cast<size_t>(5000), count);
+	EXPECT_EQ(count, mapped.get_current_line_num());
+}
+
+TEST(file_lines_test, mapped_line_bigger_than_window) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	std::ofstream out(temp_file.c_str());
+	out << "abc\n" << std::string(1024 * 1024, 'x') << "\nabc\n";
+	out.close();
+
+	file_lines fl(fc.fname.c_str(), false, false, TESTING_GULP_SIZE, true);
+	EXPECT_STREQ("abc", fl.next());
+	try {
+		fl.next();
+		ADD_FAILURE() << "Expected block to throw an error_event.";
+	} catch (error_event const & e) {
+		EXPECT_EQ(E_1FILE_BAD_HUGE_LINE_2BYTES, e.get_event_code());
+	}
+}
@@ -1,3 +1,7 @@
+#include <set>
+#include <thread>
+#include <vector>
+
 #include "base/guid.h"
 #include "base/error.h"
 
@@ -33,3 +37,55 @@ TEST(guid_test, compare) {
 	EXPECT_EQ(1, compare_guids(b, a_raw));
 	EXPECT_EQ(0, compare_guids(b, b_with_garbage));
 }
+
+TEST(guid_test, binary_round_trip) {
+	auto g = generate_binary_guid();
+	// Version 4, RFC 4122 variant.
+	EXPECT_EQ(0x40, g.bytes[6] & 0xf0);
+	EXPECT_EQ(0x80, g.bytes[8] & 0xc0);
+	auto txt = g.str();
+	ASSERT_EQ(GUID_BUF_LEN - 1, txt.size());
+	EXPECT_EQ('4', txt[14]);
+	guid_t parsed;
+	ASSERT_TRUE(parse_guid(txt.c_str(), parsed));
+	EXPECT_TRUE(parsed == g);
+	EXPECT_EQ(0, compare_guids(parsed, g));
+	EXPECT_FALSE(parse_guid("7d55c193-e82b", parsed));
+	EXPECT_FALSE(parse_guid("7d55c193-e82b-4076-aaed-2dc8bbc396fg", parsed));
+	ASSERT_TRUE(parse_guid("{7D55C193 E82B 4076 AAED 2DC8BBC396FF}", parsed));
+	EXPECT_EQ("7d55c193-e82b-4076-aaed-2dc8bbc396ff", parsed.str());
+}
+
+TEST(guid_test, binary_compare_agrees_with_text) {
+	guid_t a, b;
+	ASSERT_TRUE(parse_guid("7d55c193-e82b-4076-aaed-2dc8bbc396ff", a));
+	ASSERT_TRUE(parse_guid("be5fed47ddc14f3aad2d8a59eea59b73", b));
+	EXPECT_EQ(-1, compare_guids(a, b));
+	EXPECT_EQ(1, compare_guids(b, a));
+	EXPECT_TRUE(a < b);
+	EXPECT_TRUE(a != b);
+	EXPECT_EQ(compare_guids(a.str().c_str(), b.str().c_str()),
+			compare_guids(a, b));
+}
+
+TEST(guid_test, unique_across_threads) {
+	const int THREAD_COUNT = 4;
+	const int PER_THREAD = 2000;
+	std::vector<guid_t> made[THREAD_COUNT];
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREAD_COUNT; ++t) {
+		threads.push_back(std::thread([&made, t] {
+			for (int i = 0; i < PER_THREAD; ++i) {
+				made[t].push_back(generate_binary_guid());
+			}
+		}));
+	}
+	for (auto & th : threads) {
+		th.join();
+	}
+	std::set<guid_t> all;
+	for (auto & v : made) {
+		all.insert(v.begin(), v.end());
+	}
+	EXPECT_EQ(static_cast<size_t>(THREAD_COUNT * PER_THREAD), all.size());
+}
@@ -0,0 +1,198 @@
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/file_lines.h"
+#include "base/line_index.h"
+
+#include "gtest/gtest.h"
+
+#include "test/test_util.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+/**
+ * Write a batch with mixed line endings and blank lines, and return the
+ * lines as file_lines would see them.
+ */
+vector<string> write_batch(string const & fname, int line_count) {
+	vector<string> lines;
+	std::ofstream out(fname.c_str());
+	for (int i = 0; i < line_count; ++i) {
+		string line = i % 17 == 0 ? "" : "qsub task" + std::to_string(i)
+				+ string(i % 200, 'x');
+		out << line << (i % 5 == 0 ? "\r\n" : "\n");
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+} // end anonymous namespace
+
+TEST(line_index_test, offsets_and_sidecar) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	auto lines = write_batch(temp_file, 1000);
+	auto sidecar = line_index::get_sidecar_path(temp_file.c_str());
+
+	line_index built(temp_file.c_str());
+	EXPECT_FALSE(built.was_loaded());
+	ASSERT_EQ(lines.size(), built.get_line_count());
+	EXPECT_EQ(0, access(sidecar.c_str(), R_OK));
+
+	line_index loaded(temp_file.c_str());
+	EXPECT_TRUE(loaded.was_loaded());
+	ASSERT_EQ(lines.size(), loaded.get_line_count());
+
+	uint64_t offset = 0;
+	for (size_t i = 0; i < lines.size(); ++i) {
+		ASSERT_EQ(offset, built.get_offset(i + 1)) << i;
+		ASSERT_EQ(offset, loaded.get_offset(i + 1)) << i;
+		offset += lines[i].size() + (i % 5 == 0 ? 2 : 1);
+	}
+	struct stat st;
+	stat(temp_file.c_str(), &st);
+	EXPECT_EQ(static_cast<uint64_t>(st.st_size),
+			loaded.get_offset(lines.size() + 1));
+}
+
+TEST(line_index_test, stale_or_corrupt_sidecar_is_rebuilt) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	write_batch(temp_file, 300);
+	auto sidecar = line_index::get_sidecar_path(temp_file.c_str());
+	{
+		line_index idx(temp_file.c_str());
+	}
+
+	// Truncate the sidecar.
+	truncate(sidecar.c_str(), 60);
+	{
+		line_index idx(temp_file.c_str());
+		EXPECT_FALSE(idx.was_loaded());
+		EXPECT_EQ(300u, idx.get_line_count());
+	}
+
+	// Change the batch.
+	write_batch(temp_file, 400);
+	line_index idx(temp_file.c_str());
+	EXPECT_FALSE(idx.was_loaded());
+	EXPECT_EQ(400u, idx.get_line_count());
+}
+
+TEST(line_index_test, ranges_read_in_parallel) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	auto lines = write_batch(temp_file, 5000);
+	line_index idx(temp_file.c_str(), false);
+
+	auto ranges = idx.split(7);
+	ASSERT_EQ(7u, ranges.size());
+	EXPECT_EQ(1u, ranges.front().first);
+	EXPECT_EQ(lines.size(), ranges.back().second);
+
+	vector<vector<string>> results(ranges.size());
+	vector<std::thread> threads;
+	for (size_t i = 0; i < ranges.size(); ++i) {
+		threads.push_back(std::thread([&, i] {
+			file_lines fl(temp_file.c_str(), false, false, 0, true);
+			fl.set_range(idx, ranges[i].first, ranges[i].second);
+			size_t len;
+			while (auto line = fl.next(len)) {
+				results[i].push_back(string(line, len));
+			}
+		}));
+	}
+	for (auto & t : threads) {
+		t.join();
+	}
+
+	vector<string> combined;
+	for (size_t i = 0; i < ranges.size(); ++i) {
+		EXPECT_EQ(ranges[i].second - ranges[i].first + 1, results[i].size());
+		combined.insert(combined.end(), results[i].begin(), results[i].end());
+	}
+	EXPECT_EQ(lines, combined);
+}
+
+TEST(line_index_test, resume_with_exact_ratio) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	auto lines = write_batch(temp_file, 1000);
+	line_index idx(temp_file.c_str(), false);
+
+	file_lines fl(temp_file.c_str(), false, false, 0, true);
+	fl.set_range(idx, 751, 1000);
+	EXPECT_DOUBLE_EQ(0.0, fl.ratio_complete());
+	size_t len;
+	auto line = fl.next(len);
+	EXPECT_EQ(lines[750], string(line, len));
+	EXPECT_EQ(751u, fl.get_current_line_num());
+	for (int i = 0; i < 124; ++i) {
+		fl.next(len);
+	}
+	EXPECT_DOUBLE_EQ(0.5, fl.ratio_complete());
+	while (fl.next(len)) {
+	}
+	EXPECT_EQ(1000u, fl.get_current_line_num());
+	EXPECT_DOUBLE_EQ(1.0, fl.ratio_complete());
+}
+
+TEST(line_index_test, successive_ranges) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	auto lines = write_batch(temp_file, 1000);
+	line_index idx(temp_file.c_str(), false);
+
+	// Ranges that follow on, jump back, and jump ahead, read from one
+	// instance the way a scheduler serves runs.
+	file_lines fl(temp_file.c_str(), false, false, 0, true);
+	size_t const ranges[][2] = {
+		{ 10, 20 }, { 21, 21 }, { 22, 40 }, { 5, 9 }, { 41, 41 }, { 900, 1000 },
+	};
+	for (auto & r : ranges) {
+		fl.set_range(idx, r[0], r[1]);
+		vector<string> got;
+		size_t len;
+		while (auto line = fl.next(len)) {
+			got.push_back(string(line, len));
+		}
+		EXPECT_EQ(vector<string>(lines.begin() + r[0] - 1,
+				lines.begin() + r[1]), got);
+		EXPECT_EQ(r[1], fl.get_current_line_num());
+	}
+}
+
+TEST(line_index_test, visitor_sees_lines_while_building) {
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	auto sidecar = line_index::get_sidecar_path(temp_file.c_str());
+	FileCleanup fc2(sidecar.c_str());
+	auto lines = write_batch(temp_file, 600);
+
+	vector<string> seen;
+	size_t expected_num = 1;
+	auto visit = [&](size_t line_num, char const * line, size_t len) {
+		EXPECT_EQ(expected_num++, line_num);
+		seen.push_back(string(line, len));
+	};
+	{
+		line_index idx(temp_file.c_str(), true, visit);
+		EXPECT_FALSE(idx.was_loaded());
+	}
+	EXPECT_EQ(lines, seen);
+
+	// Loading from the sidecar reads nothing.
+	seen.clear();
+	line_index idx(temp_file.c_str(), true, visit);
+	EXPECT_TRUE(idx.was_loaded());
+	EXPECT_TRUE(seen.empty());
+}
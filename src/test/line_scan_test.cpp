@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <string.h>
+
+#include "base/file_lines.h"
+#include "base/line_scan.h"
+
+#include "gtest/gtest.h"
+
+#include "test/test_util.h"
+
+using std::string;
+
+namespace {
+
+/**
+ * Switch to an implementation for the life of the object, then switch back.
+ */
+struct isa_override {
+	scan_isa saved;
+	bool ok;
+	isa_override(scan_isa isa) : saved(get_scan_isa()), ok(set_scan_isa(isa)) {
+	}
+	~isa_override() {
+		set_scan_isa(saved);
+	}
+};
+
+scan_isa const all_isas[] = { scan_scalar, scan_sse2, scan_avx2 };
+
+/**
+ * Build text that exercises every byte class the kernels care about, with
+ * runs long enough to span several vectors.
+ */
+string make_noisy_text(std::mt19937 & rng, size_t len) {
+	static char const alphabet[] = "abc XYZ\t\n\r\v\f \x01\x7f\x80\xff";
+	string s;
+	s.reserve(len);
+	while (s.size() < len) {
+		char c = alphabet[rng() % (sizeof(alphabet) - 1)];
+		s.append(rng() % 40 + 1, c);
+	}
+	s.resize(len);
+	return s;
+}
+
+/**
+ * How file_lines read a trimmed line before the scan kernels: strpbrk() for
+ * the break, and isspace() a byte at a time to trim, over a null-terminated
+ * buffer refilled a megabyte at a time. This is the benchmark's baseline.
+ *
+ * @return how many lines there were.
+ */
+size_t count_lines_the_old_way(char const * fname) {
+	const size_t GULP = 1024 * 1024;
+	std::vector<char> buf(GULP + 1);
+	FILE * f = fopen(fname, "r");
+	size_t count = 0, kept = 0;
+	while (true) {
+		auto n = fread(&buf[kept], 1, GULP - kept, f);
+		if (n == 0 && kept == 0) {
+			break;
+		}
+		auto filled = kept + n;
+		buf[filled] = 0;
+		char * start = &buf[0];
+		char * stop = start + filled;
+		while (start < stop) {
+			auto end = strpbrk(start, "\n\r");
+			if (!end) {
+				if (n) {
+					// Finish this line after the next read.
+					break;
+				}
+				end = stop;
+			}
+			auto next = end + (*end == '\r' && end[1] == '\n' ? 2 : 1);
+			auto e = end;
+			while (e > start && isspace(e[-1])) {
+				--e;
+			}
+			*e = 0;
+			while (isspace(*start)) {
+				++start;
+			}
+			++count;
+			start = next;
+		}
+		kept = start < stop ? stop - start : 0;
+		memmove(&buf[0], start, kept);
+		if (n == 0) {
+			break;
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+} // end anonymous namespace
+
+TEST(line_scan_test, scalar_basics) {
+	isa_override o(scan_scalar);
+	string s = "  \tabc def\r\n";
+	auto b = s.data(), e = b + s.size();
+	EXPECT_EQ(b + 10, find_line_break(b, e));
+	EXPECT_EQ(b + 11, find_last_line_break(b, e));
+	EXPECT_EQ(b + 3, skip_space(b, e));
+	EXPECT_EQ(b + 10, skip_space_backward(b, e));
+	EXPECT_FALSE(has_binary_bytes(b, e));
+	EXPECT_EQ(e, find_line_break(b + 12, e));
+	EXPECT_EQ(nullptr, find_last_line_break(b, b + 10));
+	EXPECT_EQ(b, skip_space_backward(b, b + 3));
+	s[4] = 0;
+	EXPECT_EQ(b + 4, find_line_break(b, e));
+	EXPECT_TRUE(has_binary_bytes(b, e));
+}
+
+TEST(line_scan_test, vector_kernels_match_scalar) {
+	std::mt19937 rng(42);
+	for (auto isa : all_isas) {
+		if (isa == scan_scalar) {
+			continue;
+		}
+		isa_override probe(isa);
+		if (!probe.ok) {
+			// CPU can't run this one; nothing to compare.
+			continue;
+		}
+		SCOPED_TRACE(get_scan_isa_name(isa));
+		for (int trial = 0; trial < 500; ++trial) {
+			string s = make_noisy_text(rng, rng() % 200);
+			// Scan from unaligned starting points and to unaligned ends.
+			size_t lo = s.empty() ? 0 : rng() % (s.size() / 2 + 1);
+			auto b = s.data() + lo, e = s.data() + s.size();
+
+			set_scan_isa(scan_scalar);
+			auto brk = find_line_break(b, e);
+			auto last = find_last_line_break(b, e);
+			auto ls = skip_space(b, e);
+			auto rs = skip_space_backward(b, e);
+			auto bin = has_binary_bytes(b, e);
+
+			set_scan_isa(isa);
+			ASSERT_EQ(brk, find_line_break(b, e)) << trial;
+			ASSERT_EQ(last, find_last_line_break(b, e)) << trial;
+			ASSERT_EQ(ls, skip_space(b, e)) << trial;
+			ASSERT_EQ(rs, skip_space_backward(b, e)) << trial;
+			ASSERT_EQ(bin, has_binary_bytes(b, e)) << trial;
+		}
+	}
+}
+
+TEST(line_scan_test, best_isa_is_default) {
+	auto isa = get_scan_isa();
+	for (auto better : all_isas) {
+		if (better > isa) {
+			isa_override o(better);
+			EXPECT_FALSE(o.ok) << get_scan_isa_name(better);
+		}
+	}
+}
+
+/**
+ * Not a correctness test; run with --gtest_also_run_disabled_tests to compare
+ * lines/sec for each implementation, against the strpbrk/isspace scan they
+ * replaced, and then the time each kernel takes alone. NITRO_BENCH_MB sizes the batch file (default 256); use a few
+ * thousand to see multi-GB behavior, where the file no longer fits in the
+ * page cache.
+ */
+TEST(line_scan_test, DISABLED_benchmark) {
+	auto mb_env = getenv("NITRO_BENCH_MB");
+	size_t mb = mb_env ? strtoul(mb_env, NULL, 10) : 256;
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+	{
+		std::ofstream out(temp_file.c_str());
+		string line;
+		for (size_t bytes = 0, i = 0; bytes < mb * 1024 * 1024; ++i) {
+			line = "  qsub -l walltime=00:05:00 -N job" + std::to_string(i)
+					+ " /home/user/bin/analyze --input=/data/sample"
+					+ std::to_string(i % 997) + ".dat   \n";
+			out << line;
+			bytes += line.size();
+		}
+	}
+	auto report = [](char const * isa, char const * mode, size_t count,
+			std::chrono::steady_clock::time_point start) {
+		std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+		printf("%-6s %-8s %zu lines in %.3f s = %.0f lines/sec\n", isa, mode,
+				count, elapsed.count(), count / elapsed.count());
+	};
+	// Read the file once untimed, so each contender finds the page cache in
+	// the same state.
+	count_lines_the_old_way(temp_file.c_str());
+	auto start = std::chrono::steady_clock::now();
+	report("old", "buffered", count_lines_the_old_way(temp_file.c_str()),
+			start);
+	for (auto map_file : { false, true }) {
+		for (auto isa : all_isas) {
+			isa_override o(isa);
+			if (!o.ok) {
+				continue;
+			}
+			start = std::chrono::steady_clock::now();
+			file_lines fl(temp_file.c_str(), true, true, 0, map_file);
+			size_t count = 0, len;
+			while (fl.next(len)) {
+				++count;
+			}
+			report(get_scan_isa_name(isa), map_file ? "mmap" : "buffered",
+					count, start);
+		}
+	}
+
+	// Then each kernel alone, over (up to) the first 256MB in memory. The
+	// scalar kernels are mostly libc's memchr, so a vector kernel that
+	// doesn't beat them isn't worth having.
+	string text(std::min(mb, size_t(256)) * 1024 * 1024, 0);
+	{
+		std::ifstream in(temp_file.c_str());
+		in.read(&text[0], text.size());
+		text.resize(in.gcount());
+	}
+	auto begin = text.data(), end = begin + text.size();
+	std::vector<char const *> breaks;
+	for (auto p = begin; p < end; ++p) {
+		p = static_cast<char const *>(memchr(p, '\n', end - p));
+		if (!p) {
+			break;
+		}
+		breaks.push_back(p);
+	}
+	auto ns_per_line = [&](std::chrono::steady_clock::time_point start) {
+		std::chrono::duration<double, std::nano> elapsed =
+				std::chrono::steady_clock::now() - start;
+		return elapsed.count() / breaks.size();
+	};
+	for (auto isa : all_isas) {
+		isa_override o(isa);
+		if (!o.ok) {
+			continue;
+		}
+		size_t found = 0;
+		start = std::chrono::steady_clock::now();
+		for (auto p = begin; (p = find_line_break(p, end)) < end; ++p) {
+			++found;
+		}
+		auto find_ns = ns_per_line(start);
+		size_t trimmed = 0;
+		start = std::chrono::steady_clock::now();
+		auto line = begin;
+		for (auto brk : breaks) {
+			trimmed += skip_space(line, brk) - line;
+			trimmed += brk - skip_space_backward(line, brk);
+			line = brk + 1;
+		}
+		auto trim_ns = ns_per_line(start);
+		start = std::chrono::steady_clock::now();
+		bool binary = has_binary_bytes(begin, end);
+		auto binary_ns = ns_per_line(start);
+		printf("%-6s find_line_break %.1f ns/line, skip_space both ways "
+				"%.1f ns/line, has_binary_bytes %.1f ns/line\n",
+				get_scan_isa_name(isa), find_ns, trim_ns, binary_ns);
+		EXPECT_EQ(breaks.size(), found);
+		EXPECT_EQ(5 * breaks.size(), trimmed);
+		EXPECT_FALSE(binary);
+	}
+}
@@ -0,0 +1,64 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/mpsc_queue.h"
+
+#include "gtest/gtest.h"
+
+using std::string;
+
+TEST(mpsc_queue_test, fifo) {
+	mpsc_queue<string> q;
+	string s;
+	EXPECT_TRUE(q.empty());
+	EXPECT_FALSE(q.pop(s));
+	q.push("a");
+	q.push(string(100, 'b'));
+	EXPECT_FALSE(q.empty());
+	ASSERT_TRUE(q.pop(s));
+	EXPECT_EQ("a", s);
+	ASSERT_TRUE(q.pop(s));
+	EXPECT_EQ(100u, s.size());
+	EXPECT_FALSE(q.pop(s));
+	EXPECT_TRUE(q.empty());
+}
+
+TEST(mpsc_queue_test, destroyed_with_items) {
+	mpsc_queue<string> q;
+	q.push(string(1000, 'x'));
+	q.push(string(1000, 'y'));
+	// Nothing to check but that nothing leaks or crashes.
+}
+
+TEST(mpsc_queue_test, many_producers) {
+	const int PRODUCERS = 4;
+	const int PER_PRODUCER = 20000;
+	mpsc_queue<int> q;
+	std::vector<std::thread> producers;
+	for (int p = 0; p < PRODUCERS; ++p) {
+		producers.push_back(std::thread([&q, p]() {
+			for (int i = 0; i < PER_PRODUCER; ++i) {
+				q.push(p * PER_PRODUCER + i);
+			}
+		}));
+	}
+	// Consume while they produce; each producer's items stay in order.
+	std::vector<int> last(PRODUCERS, -1);
+	int count = 0;
+	while (count < PRODUCERS * PER_PRODUCER) {
+		int item;
+		if (!q.pop(item)) {
+			std::this_thread::yield();
+			continue;
+		}
+		int p = item / PER_PRODUCER;
+		EXPECT_LT(last[p], item);
+		last[p] = item;
+		++count;
+	}
+	for (auto & t : producers) {
+		t.join();
+	}
+	EXPECT_TRUE(q.empty());
+}
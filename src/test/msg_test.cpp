@@ -1,5 +1,7 @@
+#include "base/error.h"
 #include "base/guid.h"
 
+#include "domain/event_codes.h"
 #include "domain/msg.h"
 #include "domain/zmq_helpers.h"
 
@@ -13,6 +15,7 @@
 
 using std::string;
 using namespace nitro;
+using namespace nitro::event_codes;
 
 TEST(msg_test, serialize_msg) {
 	auto json = serialize_msg(0x20345096, "test \"msg");
@@ -45,6 +48,42 @@ TEST(msg_test, deserialize_msg) {
 	EXPECT_STREQ("2013-05-29 19:27:03.237+0800", root["body"]["eventDate"].asCString());
 }
 
+TEST(msg_test, decode_msg) {
+	string txt = serialize_msg(0x20394906, "Job \"123\" started.");
+	msg_view view;
+	ASSERT_TRUE(decode_msg(txt.data(), txt.data() + txt.size(), view));
+	EXPECT_EQ(0x20394906, view.code);
+	EXPECT_TRUE(view.message.escaped);
+	EXPECT_EQ("Job \"123\" started.", view.message.str());
+	EXPECT_TRUE(view.assignment_id.empty());
+	EXPECT_FALSE(view.has_tasks);
+
+	// Tasks, and fields we don't know (at depths we do know) are skipped.
+	txt = "{ \"messageId\": \"x\", \"body\": { \"code\": \"0x0600C064\","
+			" \"extra\": { \"code\": \"0x1\", \"id\": \"no\" },"
+			" \"assignment\": { \"id\": \"a1\", \"tasks\": ["
+			" { \"id\": \"7\", \"cmdline\": \"echo \\\"hi\\\"\" },"
+			" { \"cmdline\": \"ls\", \"id\": 8, \"junk\": [ { \"id\": 9 } ] }"
+			" ] } } }";
+	ASSERT_TRUE(decode_msg(txt.data(), txt.data() + txt.size(), view));
+	EXPECT_EQ(0x0600C064, view.code);
+	EXPECT_EQ("a1", view.assignment_id.str());
+	ASSERT_TRUE(view.has_tasks);
+	ASSERT_EQ(2u, view.tasks.size());
+	EXPECT_EQ(7u, view.tasks[0].id);
+	EXPECT_EQ("echo \"hi\"", view.tasks[0].cmdline.str());
+	EXPECT_EQ(8u, view.tasks[1].id);
+	EXPECT_EQ("ls", view.tasks[1].cmdline.str());
+	EXPECT_FALSE(view.tasks[1].cmdline.escaped);
+
+	// Reuse clears what was there.
+	txt = "{\"body\": {\"code\": 5}}";
+	ASSERT_TRUE(decode_msg(txt.data(), txt.data() + txt.size(), view));
+	EXPECT_EQ(5, view.code);
+	EXPECT_TRUE(view.tasks.empty());
+	EXPECT_FALSE(decode_msg(txt.data(), txt.data() + txt.size() - 1, view));
+}
+
 TEST(msg_test, send_and_receive_multipart) {
 
 	void * ctx = zmq_ctx_new();
@@ -68,3 +107,117 @@ TEST(msg_test, send_and_receive_multipart) {
 	auto received = receive_full_msg(receiver);
 	EXPECT_EQ(TEST_MSG_SIZE, received.size());
 }
+
+TEST(msg_test, zero_copy_send_and_gather) {
+	void * ctx = zmq_ctx_new();
+	zctx_cleaner z1(ctx);
+
+	void * sender = zmq_socket(ctx, ZMQ_PUSH);
+	zsocket_cleaner z2(sender);
+	const char * const INPROC_ENDPOINT = "inproc://zero_copy_send_and_gather";
+	zmq_bind_and_log(sender, INPROC_ENDPOINT);
+
+	void * receiver = zmq_socket(ctx, ZMQ_PULL);
+	zsocket_cleaner z3(receiver);
+	zmq_connect_and_log(receiver, INPROC_ENDPOINT);
+
+	// A moved string goes out as a single part, and arrives as one.
+	const size_t TEST_MSG_SIZE = 1024 * 512 + 5;
+	string big(TEST_MSG_SIZE, 'x');
+	big[0] = 'a';
+	send_full_msg(sender, std::move(big));
+	msg_parts parts;
+	ASSERT_TRUE(receive_msg_parts(receiver, parts));
+	EXPECT_EQ(1u, parts.get_part_count());
+	EXPECT_EQ(TEST_MSG_SIZE, parts.size());
+	EXPECT_EQ(parts.get_part_data(0), parts.data());
+	EXPECT_EQ('a', parts.data()[0]);
+
+	// A copied one is framed; the parts come back as a gather list, and
+	// data() joins them only on demand.
+	string framed(TEST_MSG_SIZE, 'y');
+	framed[TEST_MSG_SIZE - 1] = 'z';
+	send_full_msg(sender, framed);
+	ASSERT_TRUE(receive_msg_parts(receiver, parts));
+	EXPECT_EQ(3u, parts.get_part_count());
+	EXPECT_EQ(TEST_MSG_SIZE, parts.size());
+	EXPECT_EQ(framed, string(parts.data(), parts.size()));
+	EXPECT_EQ(framed, parts.str());
+}
+
+TEST(msg_test, oversized_msg_is_discarded) {
+	void * ctx = zmq_ctx_new();
+	zctx_cleaner z1(ctx);
+
+	void * sender = zmq_socket(ctx, ZMQ_PUSH);
+	zsocket_cleaner z2(sender);
+	const char * const INPROC_ENDPOINT = "inproc://oversized_msg_is_discarded";
+	zmq_bind_and_log(sender, INPROC_ENDPOINT);
+
+	void * receiver = zmq_socket(ctx, ZMQ_PULL);
+	zsocket_cleaner z3(receiver);
+	zmq_connect_and_log(receiver, INPROC_ENDPOINT);
+
+	// Framed, so the limit is crossed with parts still to come; none of
+	// them may be taken for the message that follows.
+	string too_big(9 * 1024 * 1024, 'x');
+	send_full_msg(sender, too_big);
+	send_full_msg(sender, "next");
+	msg_parts parts;
+	EXPECT_THROW_WITH_CODE(receive_msg_parts(receiver, parts),
+			NITRO_MSG_TOO_BIG_1SIZE);
+	EXPECT_TRUE(parts.empty());
+	ASSERT_TRUE(receive_msg_parts(receiver, parts));
+	EXPECT_EQ("next", parts.str());
+}
+
+TEST(msg_test, send_msg_parts) {
+	void * ctx = zmq_ctx_new();
+	zctx_cleaner z1(ctx);
+
+	void * sender = zmq_socket(ctx, ZMQ_PUSH);
+	zsocket_cleaner z2(sender);
+	const char * const INPROC_ENDPOINT = "inproc://send_msg_parts";
+	zmq_bind_and_log(sender, INPROC_ENDPOINT);
+
+	void * receiver = zmq_socket(ctx, ZMQ_PULL);
+	zsocket_cleaner z3(receiver);
+	zmq_connect_and_log(receiver, INPROC_ENDPOINT);
+
+	string parts[] = { "one", "", "three" };
+	send_msg_parts(sender, parts, 3);
+	EXPECT_TRUE(parts[0].empty());
+	EXPECT_TRUE(parts[2].empty());
+	msg_parts received;
+	ASSERT_TRUE(receive_msg_parts(receiver, received));
+	ASSERT_EQ(3u, received.get_part_count());
+	EXPECT_EQ(5u, received.get_part_size(2));
+	EXPECT_EQ("onethree", received.str());
+}
+
+TEST(msg_test, failed_sends_throw) {
+	void * ctx = zmq_ctx_new();
+	zctx_cleaner z1(ctx);
+
+	// A REQ socket can't send twice without a reply in between.
+	void * rep = zmq_socket(ctx, ZMQ_REP);
+	zsocket_cleaner z2(rep);
+	zmq_bind_and_log(rep, "inproc://failed_sends_throw");
+	void * req = zmq_socket(ctx, ZMQ_REQ);
+	zsocket_cleaner z3(req);
+	zmq_connect_and_log(req, "inproc://failed_sends_throw");
+	send_full_msg(req, string("first"));
+	EXPECT_THROW_WITH_CODE(send_full_msg(req, string("second")), EFSM);
+	EXPECT_THROW_WITH_CODE(send_full_msg(req, "third"), EFSM);
+
+	// A router that must route refuses an identity it doesn't know, and we
+	// don't go on to send the body.
+	void * router = zmq_socket(ctx, ZMQ_ROUTER);
+	zsocket_cleaner z4(router);
+	int mandatory = 1;
+	zmq_setsockopt(router, ZMQ_ROUTER_MANDATORY, &mandatory,
+			sizeof(mandatory));
+	zmq_bind_and_log(router, "inproc://failed_sends_throw_router");
+	EXPECT_THROW_WITH_CODE(send_routed_msg(router, "nobody", "hello"),
+			EHOSTUNREACH);
+}
@@ -0,0 +1,129 @@
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <errno.h>
+#include <sys/wait.h>
+
+#include "base/error.h"
+#include "base/process_reaper.h"
+
+#include "gtest/gtest.h"
+
+#include "test/test_util.h"
+
+using std::map;
+using std::mutex;
+using std::lock_guard;
+
+struct exit_collector {
+	mutex m;
+	map<pid_t, process_exit_info> exits;
+	process_reaper::exit_callback callback() {
+		return [this](process_exit_info const & info) {
+			lock_guard<mutex> lock(m);
+			exits[info.pid] = info;
+		};
+	}
+};
+
+TEST(process_reaper_test, exit_status) {
+	exit_collector ec;
+	pid_t ok, failed, shell;
+	{
+		process_reaper reaper;
+		ok = reaper.spawn("true", ec.callback());
+		failed = reaper.spawn("false", ec.callback());
+		// Needs a shell to interpret the quotes and the exit builtin.
+		shell = reaper.spawn("exit 3 ; echo 'never'", ec.callback());
+		// Leaving scope waits for all three.
+	}
+	ASSERT_EQ(3u, ec.exits.size());
+	EXPECT_TRUE(WIFEXITED(ec.exits[ok].status));
+	EXPECT_EQ(0, WEXITSTATUS(ec.exits[ok].status));
+	EXPECT_EQ(1, WEXITSTATUS(ec.exits[failed].status));
+	EXPECT_EQ(3, WEXITSTATUS(ec.exits[shell].status));
+}
+
+TEST(process_reaper_test, wall_time_and_rusage) {
+	exit_collector ec;
+	pid_t pid;
+	{
+		process_reaper reaper;
+		pid = reaper.spawn("sleep 0.2", ec.callback());
+		EXPECT_EQ(1u, reaper.get_running_count());
+	}
+	auto & info = ec.exits[pid];
+	EXPECT_EQ(pid, info.pid);
+	EXPECT_LE(0.2, info.wall_seconds);
+	EXPECT_GT(5.0, info.wall_seconds);
+	EXPECT_LT(0, info.usage.ru_maxrss);
+}
+
+TEST(process_reaper_test, missing_program) {
+	process_reaper reaper;
+	EXPECT_THROW_WITH_CODE(reaper.spawn("/no/such/program", nullptr), ENOENT);
+	EXPECT_EQ(0u, reaper.get_running_count());
+}
+
+TEST(process_reaper_test, signal) {
+	exit_collector ec;
+	pid_t pid;
+	{
+		process_reaper reaper;
+		pid = reaper.spawn("sleep 30", ec.callback());
+		EXPECT_TRUE(reaper.signal(pid));
+		EXPECT_FALSE(reaper.signal(pid + 100000));
+	}
+	auto & info = ec.exits[pid];
+	EXPECT_TRUE(WIFSIGNALED(info.status));
+	EXPECT_EQ(SIGTERM, WTERMSIG(info.status));
+	EXPECT_GT(5.0, info.wall_seconds);
+}
+
+/**
+ * Is @param pid gone, or a zombie nobody has reaped?
+ */
+static bool is_dead(pid_t pid) {
+	std::ifstream stat(("/proc/" + std::to_string(pid) + "/stat").c_str());
+	std::string line;
+	if (!std::getline(stat, line)) {
+		return true;
+	}
+	auto paren = line.rfind(')');
+	return paren != std::string::npos && line.size() > paren + 2
+			&& line[paren + 2] == 'Z';
+}
+
+TEST(process_reaper_test, signal_reaches_grandchildren) {
+	auto pid_file = make_temp_file();
+	FileCleanup fc(pid_file.c_str());
+	auto cmdline = "sleep 30 & echo $! > " + pid_file + "; wait";
+	exit_collector ec;
+	pid_t pid, grandchild = 0;
+	{
+		process_reaper reaper;
+		pid = reaper.spawn(cmdline.c_str(), ec.callback());
+		// Wait for the shell to start its child.
+		for (int i = 0; i < 500 && !grandchild; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			std::ifstream in(pid_file.c_str());
+			in >> grandchild;
+		}
+		ASSERT_LT(0, grandchild);
+		EXPECT_TRUE(reaper.signal(pid));
+	}
+	auto & info = ec.exits[pid];
+	EXPECT_TRUE(WIFSIGNALED(info.status));
+	bool dead = false;
+	for (int i = 0; i < 200 && !dead; ++i) {
+		dead = is_dead(grandchild);
+		if (!dead) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	EXPECT_TRUE(dead);
+}
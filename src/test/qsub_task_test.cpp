@@ -1,3 +1,5 @@
+#include <string.h>
+
 #define _PROPERLY_INCLUDED
 #include "domain/qsub_task.h"
 
@@ -13,3 +15,82 @@ TEST(qsub_task_test, walltime_to_seconds) {
 	EXPECT_EQ(5103.0, walltime_to_seconds("1:25:3"));
 	EXPECT_EQ(93784.0, walltime_to_seconds("1:2:3:4"));
 }
+
+TEST(qsub_task_test, find_walltime) {
+	auto find = [](char const * cmdline) {
+		return find_walltime(cmdline, strchr(cmdline, 0));
+	};
+	EXPECT_EQ(3600.0, find("qsub -l walltime=1:00:00 job.sh"));
+	EXPECT_EQ(1800.0, find("qsub -l nodes=1:ppn=4,walltime=30:00 job.sh"));
+	EXPECT_EQ(90.0, find("qsub -l mem=2gb -l walltime=90,nodes=2 job.sh"));
+	EXPECT_EQ(DEFAULT_WALLTIME_SECONDS, find("qsub job.sh"));
+	EXPECT_EQ(DEFAULT_WALLTIME_SECONDS, find("qsub -l walltime= job.sh"));
+	EXPECT_EQ(DEFAULT_WALLTIME_SECONDS, find("qsub -l walltime=1:xx job.sh"));
+	EXPECT_EQ(DEFAULT_WALLTIME_SECONDS, find("qsub -l walltime=-5 job.sh"));
+	EXPECT_EQ(DEFAULT_WALLTIME_SECONDS, find("qsub job.sh -lwalltime=5"));
+
+	// The cmdline needn't be null-terminated.
+	char const * line = "qsub -l walltime=25 job.sh\nqsub -l walltime=99";
+	EXPECT_EQ(25.0, find_walltime(line, strchr(line, '\n')));
+	EXPECT_EQ(DEFAULT_WALLTIME_SECONDS, find_walltime(line, line + 4));
+}
+
+TEST(qsub_task_test, get_walltime_seconds) {
+	auto t = task::make("qsub -l walltime=2:00 job.sh", nullptr, 1);
+	ASSERT_TRUE(t.get() != nullptr);
+	EXPECT_EQ(120.0, t->get_walltime_seconds());
+	EXPECT_EQ(120.0, t->get_walltime_seconds());
+}
+
+TEST(qsub_task_test, find_priority) {
+	auto find = [](char const * cmdline) {
+		return find_priority(cmdline, strchr(cmdline, 0));
+	};
+	EXPECT_EQ(5, find("qsub -p 5 job.sh"));
+	EXPECT_EQ(-20, find("qsub -N x -p  -20 job.sh"));
+	EXPECT_EQ(1023, find("qsub -p +1023 job.sh"));
+	EXPECT_EQ(DEFAULT_PRIORITY, find("qsub -p 1024 job.sh"));
+	EXPECT_EQ(DEFAULT_PRIORITY, find("qsub -p 99999999999999999999 job.sh"));
+	EXPECT_EQ(DEFAULT_PRIORITY, find("qsub -p high job.sh"));
+	EXPECT_EQ(DEFAULT_PRIORITY, find("qsub -pe 5 job.sh"));
+	EXPECT_EQ(DEFAULT_PRIORITY, find("qsub job.sh"));
+	// The cmdline needn't be null-terminated.
+	char const * line = "qsub -p 12\nqsub -p 3";
+	EXPECT_EQ(12, find_priority(line, strchr(line, '\n')));
+	EXPECT_EQ(1, find_priority(line, line + 9));
+
+	auto t = task::make("qsub -p -7 job.sh", nullptr, 1);
+	EXPECT_EQ(-7, t->get_priority());
+	EXPECT_EQ(-7, t->get_priority());
+}
+
+TEST(qsub_task_test, estimate) {
+	int priority;
+	double walltime;
+	char const * line = "  qsub -p 3 -l walltime=2:00 job.sh";
+	EXPECT_TRUE(task::estimate(line, strchr(line, 0), priority, walltime));
+	EXPECT_EQ(3, priority);
+	EXPECT_EQ(120.0, walltime);
+	EXPECT_TRUE(task::is_task(line, strchr(line, 0)));
+	line = "echo -p 3 -l walltime=2:00";
+	EXPECT_FALSE(task::estimate(line, strchr(line, 0), priority, walltime));
+	EXPECT_FALSE(task::is_task(line, strchr(line, 0)));
+	EXPECT_FALSE(task::is_task(line, line));
+	EXPECT_EQ(DEFAULT_PRIORITY, priority);
+	EXPECT_EQ(DEFAULT_WALLTIME_SECONDS, walltime);
+}
+
+TEST(qsub_task_test, get_validation_errors) {
+	std::string errors;
+	task::make("qsub -l walltime=1:00 -N name job.sh", nullptr, 1)
+			->get_validation_errors(errors);
+	EXPECT_EQ("", errors);
+	task::make("qsub -I -x job.sh -", nullptr, 1)
+			->get_validation_errors(errors);
+	EXPECT_EQ("The -I flag is not supported. The -x flag is not supported. ",
+			errors);
+	errors.clear();
+	task::make("qsub -l walltime=soon job.sh", nullptr, 1)
+			->get_validation_errors(errors);
+	EXPECT_NE(std::string::npos, errors.find("soon"));
+}
@@ -0,0 +1,140 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "json/json.h"
+
+using std::string;
+
+namespace {
+
+/**
+ * Record events as text, so a test can compare a whole parse at once.
+ */
+struct event_recorder : public Json::SaxHandler {
+	string events;
+	int stop_after;
+
+	event_recorder() : stop_after(-1) {
+	}
+
+	bool note(string const & e) {
+		if (!events.empty()) {
+			events += ' ';
+		}
+		events += e;
+		return stop_after < 0 || --stop_after > 0;
+	}
+
+	static string text(char const * begin, char const * end, bool escaped) {
+		string s;
+		if (escaped) {
+			Json::SaxReader::decodeString(begin, end, s);
+		} else {
+			s.assign(begin, end);
+		}
+		return s;
+	}
+
+	virtual bool startObject() { return note("{"); }
+	virtual bool endObject() { return note("}"); }
+	virtual bool startArray() { return note("["); }
+	virtual bool endArray() { return note("]"); }
+	virtual bool key(char const * begin, char const * end, bool escaped) {
+		return note(text(begin, end, escaped) + ":");
+	}
+	virtual bool stringValue(char const * begin, char const * end,
+			bool escaped) {
+		return note("'" + text(begin, end, escaped) + "'");
+	}
+	virtual bool numberValue(char const * begin, char const * end) {
+		return note(string(begin, end));
+	}
+	virtual bool boolValue(bool value) {
+		return note(value ? "true" : "false");
+	}
+	virtual bool nullValue() {
+		return note("null");
+	}
+};
+
+bool parse(string const & doc, event_recorder & rec) {
+	Json::SaxReader reader;
+	return reader.parse(doc.data(), doc.data() + doc.size(), rec);
+}
+
+} // end anonymous namespace
+
+TEST(sax_reader_test, events_in_order) {
+	event_recorder rec;
+	ASSERT_TRUE(parse("{ \"a\" : [1, -2.5e3, true, false, null],\n"
+			" \"b\": {}, \"c\": [], \"d\": \"x\" }", rec));
+	EXPECT_EQ("{ a: [ 1 -2.5e3 true false null ] b: { } c: [ ] d: 'x' }",
+			rec.events);
+}
+
+TEST(sax_reader_test, strings_are_views_until_decoded) {
+	string doc = "[\"plain\", \"tab\\there \\\"q\\\" \\u00e9 \\ud83d\\ude00\"]";
+	event_recorder rec;
+	ASSERT_TRUE(parse(doc, rec));
+	EXPECT_EQ("[ 'plain' 'tab\there \"q\" \xc3\xa9 \xf0\x9f\x98\x80' ]",
+			rec.events);
+
+	string bad;
+	EXPECT_FALSE(Json::SaxReader::decodeString("\\x", "\\x" + 2, bad));
+	EXPECT_FALSE(Json::SaxReader::decodeString("\\u12", "\\u12" + 4, bad));
+}
+
+TEST(sax_reader_test, comments_are_skipped) {
+	event_recorder rec;
+	ASSERT_TRUE(parse("// leading\n{ /* inline */ \"a\": 1 // trailing\n}",
+			rec));
+	EXPECT_EQ("{ a: 1 }", rec.events);
+}
+
+TEST(sax_reader_test, malformed) {
+	char const * docs[] = {
+		"", "{", "{\"a\" 1}", "{\"a\": 1,}", "[1 2]", "[1,", "\"abc",
+		"tru", "{} x", "/* open", "-", "{a: 1}"
+	};
+	for (auto doc : docs) {
+		event_recorder rec;
+		EXPECT_FALSE(parse(doc, rec)) << doc;
+	}
+	// Nesting beyond maxDepth.
+	event_recorder rec;
+	EXPECT_FALSE(parse(string(Json::SaxReader::maxDepth + 1, '[')
+			+ string(Json::SaxReader::maxDepth + 1, ']'), rec));
+}
+
+TEST(sax_reader_test, handler_can_stop) {
+	event_recorder rec;
+	rec.stop_after = 3;
+	EXPECT_FALSE(parse("[1, 2, 3, 4]", rec));
+	EXPECT_EQ("[ 1 2", rec.events);
+}
+
+TEST(sax_reader_test, accepts_what_reader_writes) {
+	Json::Value root;
+	root["s"] = "line1\nline2 \"quoted\" \\ /";
+	root["n"] = -12;
+	root["d"] = 0.25;
+	root["a"].append(true);
+	root["a"].append(Json::Value());
+	root["o"]["nested"] = "x";
+	// Members are written sorted, or in the order they were added.
+#ifdef JSON_VALUE_USE_HASH_MAP
+	string expected = "{ s: 'line1\nline2 \"quoted\" \\ /' n: -12 d: 0.250 "
+			"a: [ true null ] o: { nested: 'x' } }";
+#else
+	string expected = "{ a: [ true null ] d: 0.250 n: -12 o: { nested: 'x' } "
+			"s: 'line1\nline2 \"quoted\" \\ /' }";
+#endif
+	for (int styled = 0; styled < 2; ++styled) {
+		string doc = styled ? Json::StyledWriter().write(root)
+				: Json::FastWriter().write(root);
+		event_recorder rec;
+		ASSERT_TRUE(parse(doc, rec)) << doc;
+		EXPECT_EQ(expected, rec.events);
+	}
+}
@@ -23,6 +23,8 @@ struct FileCleanup {
 	FileCleanup(char const * fname) : fname(fname) {}
 	~FileCleanup() {
 		unlink(fname.c_str());
+		// ...and any line index that was saved beside it.
+		unlink((fname + ".idx").c_str());
 	}
 };
 
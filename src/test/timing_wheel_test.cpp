@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "base/timing_wheel.h"
+
+#include "gtest/gtest.h"
+
+using std::chrono::milliseconds;
+using std::string;
+using std::vector;
+
+typedef timing_wheel<string> wheel_t;
+
+TEST(timing_wheel_test, expires_after_deadline) {
+	auto t0 = wheel_t::clock::now();
+	wheel_t wheel(milliseconds(10), 8, t0);
+	wheel.schedule("a", t0 + milliseconds(25));
+	wheel.schedule("b", t0 + milliseconds(55));
+	EXPECT_EQ(2u, wheel.size());
+
+	vector<string> expired;
+	wheel.advance(t0 + milliseconds(24), expired);
+	EXPECT_TRUE(expired.empty());
+	wheel.advance(t0 + milliseconds(30), expired);
+	ASSERT_EQ(1u, expired.size());
+	EXPECT_EQ("a", expired[0]);
+	EXPECT_FALSE(wheel.contains("a"));
+	EXPECT_TRUE(wheel.contains("b"));
+
+	expired.clear();
+	wheel.advance(t0 + milliseconds(60), expired);
+	ASSERT_EQ(1u, expired.size());
+	EXPECT_EQ("b", expired[0]);
+	EXPECT_EQ(0u, wheel.size());
+}
+
+TEST(timing_wheel_test, renewal_postpones_expiry) {
+	auto t0 = wheel_t::clock::now();
+	wheel_t wheel(milliseconds(10), 4, t0);
+	vector<string> expired;
+	// Keep renewing well past a full trip around the wheel.
+	for (int ms = 0; ms <= 200; ms += 10) {
+		wheel.schedule("alive", t0 + milliseconds(ms + 30));
+		if (ms == 0) {
+			wheel.schedule("silent", t0 + milliseconds(30));
+		}
+		wheel.advance(t0 + milliseconds(ms), expired);
+	}
+	ASSERT_EQ(1u, expired.size());
+	EXPECT_EQ("silent", expired[0]);
+	EXPECT_TRUE(wheel.contains("alive"));
+
+	// An earlier deadline is honored too.
+	wheel.schedule("alive", t0 + milliseconds(205));
+	wheel.advance(t0 + milliseconds(215), expired);
+	EXPECT_EQ(2u, expired.size());
+	EXPECT_FALSE(wheel.contains("alive"));
+}
+
+TEST(timing_wheel_test, far_deadlines_and_late_turns) {
+	auto t0 = wheel_t::clock::now();
+	wheel_t wheel(milliseconds(10), 4, t0);
+	// Several trips around the wheel away.
+	wheel.schedule("far", t0 + milliseconds(135));
+	wheel.schedule("near", t0 + milliseconds(15));
+	wheel.schedule("gone", t0 + milliseconds(15));
+	wheel.cancel("gone");
+
+	vector<string> expired;
+	for (int ms = 0; ms < 130; ms += 10) {
+		wheel.advance(t0 + milliseconds(ms), expired);
+	}
+	vector<string> expected = { "near" };
+	EXPECT_EQ(expected, expired);
+
+	// Turning the wheel a long time late still finds everything that's due.
+	wheel.schedule("later", t0 + milliseconds(300));
+	wheel.advance(t0 + milliseconds(1000), expired);
+	std::sort(expired.begin(), expired.end());
+	expected = { "far", "later", "near" };
+	EXPECT_EQ(expected, expired);
+	EXPECT_EQ(0u, wheel.size());
+}
@@ -0,0 +1,205 @@
+#include <functional>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "json/json.h"
+#include "json/hash_map.h"
+
+using std::string;
+
+namespace {
+
+Json::Value make_doc() {
+	Json::Value root;
+	root["messageId"] = "2f9c6f0e-2b3c-4b7e-9a51-5d0b7f3c1a42";
+	root["body"]["code"] = "0x0600C064";
+	Json::Value tasks(Json::arrayValue);
+	for (int i = 0; i < 50; ++i) {
+		Json::Value item;
+		item["id"] = std::to_string(i);
+		item["cmdline"] = "echo " + std::to_string(i) + " && sleep 1";
+		tasks.append(item);
+	}
+	root["body"]["tasks"] = tasks;
+	return root;
+}
+
+typedef std::pair<const string, int> entry;
+typedef Json::OrderedHashMap<string, int, std::hash<string>,
+		Json::ValueArenaAllocator<entry> > ordered_map;
+
+} // end anonymous namespace
+
+TEST(value_arena_test, same_output_as_heap) {
+	string expected = Json::FastWriter().write(make_doc());
+	Json::ValueArena arena;
+	Json::ValueArenaScope scope(arena);
+	Json::Value doc = make_doc();
+	EXPECT_EQ(expected, Json::FastWriter().write(doc));
+	EXPECT_GT(arena.bytesReserved(), 0u);
+}
+
+TEST(value_arena_test, small_doc_stays_inline) {
+	Json::ValueArena arena;
+	Json::ValueArenaScope scope(arena);
+	Json::Value root;
+	root["body"]["code"] = "0x0600C064";
+	EXPECT_EQ(0u, arena.bytesReserved());
+}
+
+TEST(value_arena_test, copy_outlives_arena) {
+	Json::Value copy;
+	string expected;
+	{
+		Json::ValueArena arena;
+		Json::Value * doc;
+		{
+			Json::ValueArenaScope scope(arena);
+			doc = new Json::Value(make_doc());
+		}
+		// Copied with no arena in scope, so the copy is on the heap.
+		copy = *doc;
+		expected = Json::FastWriter().write(*doc);
+		delete doc;
+	}
+	EXPECT_EQ(expected, Json::FastWriter().write(copy));
+	copy["body"]["tasks"][60u]["id"] = "60";
+	EXPECT_EQ(61u, copy["body"]["tasks"].size());
+}
+
+TEST(value_arena_test, scopes_nest) {
+	EXPECT_TRUE(Json::ValueArena::current() == 0);
+	Json::ValueArena outer;
+	{
+		Json::ValueArenaScope a(outer);
+		EXPECT_EQ(&outer, Json::ValueArena::current());
+		Json::ValueArena inner;
+		{
+			Json::ValueArenaScope b(inner);
+			EXPECT_EQ(&inner, Json::ValueArena::current());
+		}
+		EXPECT_EQ(&outer, Json::ValueArena::current());
+	}
+	EXPECT_TRUE(Json::ValueArena::current() == 0);
+}
+
+TEST(value_arena_test, ordered_hash_map) {
+	ordered_map m;
+	const char * names[] = {"zeta", "alpha", "mu", "beta", "omega"};
+	for (int i = 0; i < 100; ++i) {
+		string key = names[i % 5] + std::to_string(i);
+		EXPECT_TRUE(m.insert(entry(key, i)).second);
+	}
+	EXPECT_FALSE(m.insert(entry("zeta0", 7)).second);
+	EXPECT_EQ(100u, m.size());
+	// Insertion order, not key order.
+	int expected = 0;
+	for (ordered_map::const_iterator it = m.begin(); it != m.end(); ++it) {
+		EXPECT_EQ(expected++, it->second);
+	}
+	EXPECT_EQ(43, m.find("beta43")->second);
+	EXPECT_TRUE(m.find("nope") == m.end());
+
+	EXPECT_EQ(1u, m.erase("mu2"));
+	EXPECT_EQ(0u, m.erase("mu2"));
+	EXPECT_TRUE(m.find("mu2") == m.end());
+	EXPECT_EQ(99u, m.size());
+	EXPECT_EQ(3, m.find("beta3")->second);
+
+	ordered_map copy(m);
+	EXPECT_TRUE(copy == m);
+	copy.erase("beta3");
+	EXPECT_FALSE(copy == m);
+	EXPECT_TRUE(copy < m || m < copy);
+
+	m.clear();
+	EXPECT_TRUE(m.empty());
+	EXPECT_TRUE(m.begin() == m.end());
+}
+
+// The tests below run against whichever storage value.h picked, and the
+// scons test target runs them once with each (see src/test/sconscript).
+
+TEST(value_arena_test, object_members) {
+	Json::ValueArena arena;
+	Json::ValueArenaScope scope(arena);
+	Json::Value obj;
+	obj["zeta"] = 1;
+	obj["alpha"] = "two";
+	obj["mu"] = 3.5;
+	EXPECT_EQ(3u, obj.size());
+	EXPECT_TRUE(obj.isMember("alpha"));
+	EXPECT_FALSE(obj.isMember("beta"));
+	EXPECT_EQ("two", obj["alpha"].asString());
+	EXPECT_EQ(3u, obj.size());
+
+	Json::Value::Members names = obj.getMemberNames();
+#ifdef JSON_VALUE_USE_HASH_MAP
+	Json::Value::Members expected = { "zeta", "alpha", "mu" };
+	EXPECT_EQ("{\"zeta\":1,\"alpha\":\"two\",\"mu\":3.50}\n",
+			Json::FastWriter().write(obj));
+#else
+	Json::Value::Members expected = { "alpha", "mu", "zeta" };
+	EXPECT_EQ("{\"alpha\":\"two\",\"mu\":3.50,\"zeta\":1}\n",
+			Json::FastWriter().write(obj));
+#endif
+	EXPECT_EQ(expected, names);
+
+	EXPECT_EQ(1, obj.removeMember("zeta").asInt());
+	EXPECT_TRUE(obj.removeMember("zeta").isNull());
+	EXPECT_FALSE(obj.isMember("zeta"));
+	EXPECT_EQ(2u, obj.size());
+	obj["zeta"] = 4;
+	EXPECT_EQ(4, obj["zeta"].asInt());
+}
+
+TEST(value_arena_test, array_elements) {
+	Json::ValueArena arena;
+	Json::ValueArenaScope scope(arena);
+	Json::Value arr;
+	arr[3u] = "d";
+	EXPECT_EQ(4u, arr.size());
+	EXPECT_TRUE(arr[0u].isNull());
+	arr[1u] = "b";
+	arr.append("e");
+	EXPECT_EQ("[null,\"b\",null,\"d\",\"e\"]\n", Json::FastWriter().write(arr));
+	// std::map skips the gaps, and the hash map fills them; either way,
+	// elements go in index order.
+	int last = -1;
+	for (Json::Value::iterator it = arr.begin(); it != arr.end(); ++it) {
+		EXPECT_LT(last, int(it.index()));
+		last = it.index();
+	}
+	EXPECT_EQ(4, last);
+
+	arr.resize(2);
+	EXPECT_EQ(2u, arr.size());
+	EXPECT_EQ("b", arr[1u].asString());
+	arr.resize(4);
+	EXPECT_EQ(4u, arr.size());
+	EXPECT_TRUE(arr[3u].isNull());
+	EXPECT_TRUE(arr.isValidIndex(3));
+	EXPECT_FALSE(arr.isValidIndex(4));
+}
+
+TEST(value_arena_test, parse_compare_and_copy) {
+	string text = "{\"tasks\":[{\"id\":\"1\"},{\"id\":\"2\"}],\"code\":7}";
+	Json::Value heap;
+	ASSERT_TRUE(Json::Reader().parse(text, heap));
+
+	Json::ValueArena arena;
+	Json::ValueArenaScope scope(arena);
+	Json::Value doc;
+	ASSERT_TRUE(Json::Reader().parse(text, doc));
+	EXPECT_TRUE(doc == heap);
+	EXPECT_FALSE(doc < heap || heap < doc);
+	EXPECT_EQ("2", doc["tasks"][1u]["id"].asString());
+	EXPECT_EQ(7, doc["code"].asInt());
+
+	Json::Value copy(doc);
+	copy["tasks"][1u]["id"] = "3";
+	EXPECT_FALSE(copy == doc);
+	EXPECT_TRUE(doc < copy);
+	EXPECT_EQ(Json::FastWriter().write(heap), Json::FastWriter().write(doc));
+}
@@ -0,0 +1,115 @@
+#include <string>
+
+#include "domain/assignment.h"
+#include "domain/completion_record.h"
+#include "domain/event_codes.h"
+#include "domain/msg.h"
+#include "domain/wire.h"
+
+#include "gtest/gtest.h"
+
+using std::string;
+using namespace nitro;
+using namespace nitro::event_codes;
+
+TEST(wire_test, round_trip) {
+	wire_writer writer(NITRO_1ASSIGNMENT_COMPLETE, "worker-1");
+	writer.add_string(wfld_message, "abc");
+	auto msg = writer.finish();
+	EXPECT_TRUE(is_wire_msg(msg));
+	EXPECT_FALSE(is_completion_batch(msg));
+
+	wire_reader reader;
+	ASSERT_TRUE(reader.parse(msg));
+	EXPECT_EQ(NITRO_1ASSIGNMENT_COMPLETE, reader.get_code());
+	EXPECT_EQ("worker-1", reader.get_sender_id());
+	string txt;
+	EXPECT_TRUE(reader.get_string(wfld_message, txt));
+	EXPECT_EQ("abc", txt);
+	EXPECT_FALSE(reader.get_string(wfld_assignment_id, txt));
+	EXPECT_EQ(0u, reader.get_task_count());
+	// Message ids are version 4 guids, unique per frame.
+	EXPECT_EQ(0x40, reader.get_msg_id().bytes[6] & 0xf0);
+	wire_reader other;
+	ASSERT_TRUE(other.parse(wire_writer(NITRO_1ASSIGNMENT_COMPLETE,
+			"worker-1").finish()));
+	EXPECT_TRUE(reader.get_msg_id() != other.get_msg_id());
+}
+
+TEST(wire_test, serialize_msg_in_either_format) {
+	auto json = serialize_msg(wf_json, "w", NITRO_NEED_ASSIGNMENT, "8");
+	EXPECT_FALSE(is_wire_msg(json));
+	EXPECT_EQ(serialize_msg(NITRO_NEED_ASSIGNMENT, "8").size(), json.size());
+
+	auto binary = serialize_msg(wf_binary, "w", NITRO_NEED_ASSIGNMENT, "8");
+	wire_reader reader;
+	ASSERT_TRUE(reader.parse(binary));
+	string txt;
+	EXPECT_TRUE(reader.get_string(wfld_message, txt));
+	EXPECT_EQ("8", txt);
+	// Most of the point.
+	EXPECT_LT(binary.size() * 3, json.size());
+}
+
+TEST(wire_test, assignment_tasks) {
+	assignment a("a1");
+	a.ready_task(1, "qsub task 1");
+	a.ready_task(7, "qsub -l walltime=5 task 7");
+	auto msg = a.get_request_msg(wf_binary, "coord");
+
+	wire_reader reader;
+	ASSERT_TRUE(reader.parse(msg));
+	EXPECT_EQ(NITRO_HERE_IS_ASSIGNMENT, reader.get_code());
+	string aid;
+	EXPECT_TRUE(reader.get_string(wfld_assignment_id, aid));
+	EXPECT_EQ("a1", aid);
+	size_t bytes;
+	EXPECT_EQ(2u, reader.get_task_count(&bytes));
+	EXPECT_EQ(strlen("qsub task 1") + strlen("qsub -l walltime=5 task 7"),
+			bytes);
+
+	char const * cursor = nullptr;
+	uint64_t id;
+	char const * cmdline;
+	size_t len;
+	ASSERT_TRUE(reader.next_task(cursor, id, cmdline, len));
+	EXPECT_EQ(1u, id);
+	EXPECT_EQ("qsub task 1", string(cmdline, len));
+	ASSERT_TRUE(reader.next_task(cursor, id, cmdline, len));
+	EXPECT_EQ(7u, id);
+	EXPECT_EQ("qsub -l walltime=5 task 7", string(cmdline, len));
+	EXPECT_FALSE(reader.next_task(cursor, id, cmdline, len));
+}
+
+TEST(wire_test, fields_after_tasks) {
+	wire_writer writer(NITRO_HERE_IS_ASSIGNMENT, "");
+	writer.begin_tasks();
+	writer.add_task(3, "x", 1);
+	writer.add_string(wfld_assignment_id, "a2");
+	auto msg = writer.finish();
+
+	wire_reader reader;
+	ASSERT_TRUE(reader.parse(msg));
+	EXPECT_EQ(1u, reader.get_task_count());
+	string aid;
+	EXPECT_TRUE(reader.get_string(wfld_assignment_id, aid));
+	EXPECT_EQ("a2", aid);
+}
+
+TEST(wire_test, malformed) {
+	wire_reader reader;
+	EXPECT_FALSE(reader.parse(""));
+	EXPECT_FALSE(reader.parse("{ \"body\" : {} }"));
+
+	assignment a("a1");
+	a.ready_task(1, "qsub task 1");
+	auto msg = a.get_request_msg(wf_binary, "coord");
+	// Every truncation must be caught.
+	for (size_t n = 0; n < msg.size(); ++n) {
+		EXPECT_FALSE(reader.parse(msg.substr(0, n))) << n;
+	}
+	// So must a version we don't know.
+	auto future = msg;
+	future[3] = static_cast<char>(WIRE_VERSION + 1);
+	EXPECT_FALSE(reader.parse(future));
+}
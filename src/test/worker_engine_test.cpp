@@ -5,6 +5,7 @@
 #include <thread>
 
 #include "base/countof.h"
+#include "base/file_lines.h"
 #include "base/xlog.h"
 
 #include "domain/assignment.h"
@@ -16,6 +17,10 @@
 
 #include "gtest/gtest.h"
 
+#include "json/json.h"
+
+#include "test/test_util.h"
+
 #include "zeromq/include/zmq.h"
 
 using std::thread;
@@ -142,6 +147,182 @@ TEST_P(worker_engine_test, assignment_mgmt) {
 	xlog("should be finishing now");
 }
 
+atomic<int> fast_task_count(0);
+atomic<bool> slow_task_overlapped(false);
+
+void overlap_thread_main(worker_engine & we, char const * cmdline) {
+	worker_engine::notifier notifier(we);
+	if (strstr(cmdline, "slow")) {
+		// Keep running until the tasks from the next assignment are done, or
+		// until it's obvious they won't start while we're busy.
+		for (int i = 0; i < 200; ++i) {
+			if (fast_task_count.load() == 3) {
+				slow_task_overlapped.store(true);
+				break;
+			}
+			std::this_thread::sleep_for(milliseconds(10));
+		}
+	} else {
+		++fast_task_count;
+	}
+}
+
+thread * overlap_launch_func(worker_engine & we, char const * cmdline) {
+	return new thread(overlap_thread_main, std::ref(we), cmdline);
+}
+
+TEST(worker_engine_test, starts_tasks_from_next_assignment) {
+
+	fast_task_count.store(0);
+	slow_task_overlapped.store(false);
+
+	char const * wargs[] = { "nitro", "--rrport", "36125", "--inflight", "3" };
+	worker_engine we(cmdline(countof(wargs), wargs));
+	EXPECT_EQ(3u, we.get_max_assignments_in_flight());
+	we.set_desired_busy_threads(4);
+	we.set_launch_func(overlap_launch_func);
+
+	// The first assignment can only keep one slot busy; the other three
+	// should go to the assignment queued behind it.
+	we.accept_assignment(new assignment("a1", "qsub slow\n"));
+	we.accept_assignment(new assignment("a2", "qsub fast\nqsub fast\nqsub fast\n"));
+	EXPECT_EQ(4u, we.get_ready_count());
+
+	we.run();
+	EXPECT_EQ(3, fast_task_count.load());
+	EXPECT_TRUE(slow_task_overlapped.load());
+	EXPECT_EQ(0u, we.get_ready_count());
+}
+
+atomic<bool> progress_heard(false);
+
+void progress_thread_main(worker_engine & we, char const * cmdline) {
+	worker_engine::notifier notifier(we);
+	if (strstr(cmdline, "slow")) {
+		// Stay active until a report says the fast tasks are done. Reports
+		// go out when the engine starts, and every 5 seconds after that.
+		for (int i = 0; i < 2000 && !progress_heard.load(); ++i) {
+			std::this_thread::sleep_for(milliseconds(10));
+		}
+	}
+}
+
+thread * progress_launch_func(worker_engine & we, char const * cmdline) {
+	return new thread(progress_thread_main, std::ref(we), cmdline);
+}
+
+/**
+ * Follow the progress reports a worker publishes, the way a listener should:
+ * start over on a full report, apply the ready, active and complete ids in
+ * that order, and ignore deltas until a full report if one goes missing.
+ * Stop once task 2 is the only one not complete.
+ */
+void progress_listener_main(void * subscriber, map<task::id_type,
+		string> & states) {
+	map<task::id_type, string> expected = {
+		{ 1, "complete" }, { 2, "active" }, { 3, "complete" },
+		{ 4, "complete" },
+	};
+	unsigned last_seq = 0;
+	auto deadline = high_resolution_clock::now() + std::chrono::seconds(20);
+	while (states != expected && high_resolution_clock::now() < deadline) {
+		zmq_pollitem_t items[] = {
+			{ subscriber, 0, ZMQ_POLLIN, 0},
+		};
+		if (zmq_poll(items, 1, 25) != 1) {
+			continue;
+		}
+		Json::Value root;
+		Json::Reader reader;
+		if (!reader.parse(receive_full_msg(subscriber), root)) {
+			continue;
+		}
+		auto & status = root["body"]["status"];
+		if (!status.isMember("seq")) {
+			continue;
+		}
+		auto seq = status["seq"].asUInt();
+		if (status["full"].asBool()) {
+			states.clear();
+		} else if (seq != last_seq + 1) {
+			last_seq = 0;
+			continue;
+		}
+		last_seq = seq;
+		for (auto name : { "ready", "active", "complete" }) {
+			std::vector<task::id_type> ids;
+			EXPECT_TRUE(decode_id_ranges(status[name].asCString(), ids));
+			for (auto id : ids) {
+				states[id] = name;
+			}
+		}
+	}
+	progress_heard.store(true);
+}
+
+TEST(worker_engine_test, publishes_progress_that_decodes) {
+
+	progress_heard.store(false);
+
+	char const * wargs[] = { "nitro", "--rrport", "36127" };
+	worker_engine we(cmdline(countof(wargs), wargs));
+	we.set_desired_busy_threads(4);
+	we.set_launch_func(progress_launch_func);
+	we.accept_assignment(new assignment("a1",
+			"qsub fast\nqsub slow\nqsub fast\nqsub fast\n"));
+
+	// The first report goes out as soon as the engine runs, so subscribe
+	// before that, and give the subscription a moment to reach the
+	// publisher.
+	void * subscriber = zmq_socket(we.ctx, ZMQ_SUB);
+	zsocket_cleaner zclean(subscriber);
+	zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+	zmq_connect_and_log(subscriber, we.get_endpoint(ep_pubsub, et_inproc));
+	std::this_thread::sleep_for(milliseconds(100));
+
+	map<task::id_type, string> states;
+	thread listener(progress_listener_main, subscriber, std::ref(states));
+	we.run();
+	listener.join();
+
+	std::vector<task::id_type> complete;
+	for (auto & s : states) {
+		if (s.second == "complete") {
+			complete.push_back(s.first);
+		}
+	}
+	EXPECT_EQ(std::vector<task::id_type>({ 1, 3, 4 }), complete);
+	EXPECT_EQ("active", states[2]);
+}
+
+TEST(worker_engine_test, runs_real_processes) {
+
+	auto temp_file = make_temp_file();
+	FileCleanup fc(temp_file.c_str());
+
+	char const * wargs[] = { "nitro", "--rrport", "36126" };
+	worker_engine we(cmdline(countof(wargs), wargs));
+	we.set_desired_busy_threads(3);
+	EXPECT_EQ(nullptr, we.get_launch_func());
+
+	// Our tasks are qsub lines, so define a shell function to stand in for
+	// qsub. Each task appends a line to the temp file.
+	string lines;
+	for (int i = 0; i < 10; ++i) {
+		lines += interp("qsub() { echo $1 >> %1; }; qsub %2\n", temp_file, i);
+	}
+	we.accept_assignment(new assignment("a1", lines.c_str()));
+	we.run();
+
+	EXPECT_EQ(0u, we.get_ready_count());
+	file_lines fl(temp_file.c_str());
+	int count = 0;
+	while (fl.next()) {
+		++count;
+	}
+	EXPECT_EQ(10, count);
+}
+
 // Run the engine test with multiple transports, to guarantee that it works for
 // all of them.
 INSTANTIATE_TEST_CASE_P(variant, worker_engine_test,
@@ -1,3 +1,10 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <unistd.h>
+
 #include "zmq.hpp"
 #include "gtest/gtest.h"
 
@@ -20,3 +27,111 @@ TEST(zmq_test, use_sockets_then_close_ctx_doesnt_hang) {
 		// down.
 	}
 }
+
+TEST(zmq_test, poller_reports_sockets_and_fds) {
+	zmq::context_t ctx;
+	zmq::socket_t pull(ctx, ZMQ_PULL);
+	pull.bind("inproc://poller_reports_sockets_and_fds");
+	zmq::socket_t push(ctx, ZMQ_PUSH);
+	push.connect("inproc://poller_reports_sockets_and_fds");
+	int fds[2];
+	ASSERT_EQ(0, pipe(fds));
+
+	void * poller = zmq_poller_new();
+	ASSERT_TRUE(poller != nullptr);
+	int socket_tag, fd_tag;
+	EXPECT_EQ(0, zmq_poller_add(poller, pull, &socket_tag, ZMQ_POLLIN));
+	EXPECT_EQ(0, zmq_poller_add_fd(poller, fds[0], &fd_tag, ZMQ_POLLIN));
+	EXPECT_EQ(-1, zmq_poller_add(poller, pull, nullptr, ZMQ_POLLIN));
+	EXPECT_EQ(EINVAL, zmq_errno());
+
+	zmq_poller_event_t events[2];
+	EXPECT_EQ(-1, zmq_poller_wait_all(poller, events, 2, 10));
+	EXPECT_EQ(EAGAIN, zmq_errno());
+
+	push.send("x", 1);
+	ASSERT_EQ(1, zmq_poller_wait_all(poller, events, 2, 1000));
+	EXPECT_EQ(static_cast<void *>(pull), events[0].socket);
+	EXPECT_EQ(&socket_tag, events[0].user_data);
+	EXPECT_EQ(ZMQ_POLLIN, events[0].events);
+
+	ASSERT_EQ(1, write(fds[1], "y", 1));
+	ASSERT_EQ(2, zmq_poller_wait_all(poller, events, 2, 0));
+	// Raw fds come first.
+	EXPECT_EQ(fds[0], events[0].fd);
+	EXPECT_EQ(&fd_tag, events[0].user_data);
+
+	EXPECT_EQ(0, zmq_poller_remove_fd(poller, fds[0]));
+	EXPECT_EQ(0, zmq_poller_modify(poller, pull, 0));
+	EXPECT_EQ(-1, zmq_poller_wait(poller, events, 0));
+	EXPECT_EQ(0, zmq_poller_remove(poller, pull));
+	EXPECT_EQ(-1, zmq_poller_remove(poller, pull));
+
+	EXPECT_EQ(0, zmq_poller_destroy(&poller));
+	EXPECT_TRUE(poller == nullptr);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(zmq_test, poller_sees_input_whose_signal_was_consumed) {
+	zmq::context_t ctx;
+	zmq::socket_t pull(ctx, ZMQ_PULL);
+	pull.bind("inproc://poller_sees_input_whose_signal_was_consumed");
+	zmq::socket_t push(ctx, ZMQ_PUSH);
+	push.connect("inproc://poller_sees_input_whose_signal_was_consumed");
+
+	void * poller = zmq_poller_new();
+	ASSERT_EQ(0, zmq_poller_add(poller, pull, nullptr, ZMQ_POLLIN));
+	push.send("a", 1);
+	push.send("b", 1);
+	// Reading one message processes the socket's commands, and with them the
+	// ZMQ_FD signal for the other; epoll alone would never wake for it.
+	zmq::message_t msg;
+	while (!pull.recv(&msg, ZMQ_DONTWAIT)) {
+	}
+	zmq_poller_event_t event;
+	EXPECT_EQ(1, zmq_poller_wait(poller, &event, 1000));
+	EXPECT_TRUE(pull.recv(&msg, ZMQ_DONTWAIT));
+	EXPECT_EQ(-1, zmq_poller_wait(poller, &event, 0));
+	zmq_poller_destroy(&poller);
+}
+
+TEST(zmq_test, poller_multiplexes_many_sockets) {
+	const int SOCKET_COUNT = 200;
+	zmq::context_t ctx;
+	std::vector<std::unique_ptr<zmq::socket_t>> pulls, pushes;
+	void * poller = zmq_poller_new();
+	for (int i = 0; i < SOCKET_COUNT; ++i) {
+		auto endpoint = "inproc://poller_multiplexes_many_sockets_"
+				+ std::to_string(i);
+		pulls.emplace_back(new zmq::socket_t(ctx, ZMQ_PULL));
+		pulls.back()->bind(endpoint.c_str());
+		pushes.emplace_back(new zmq::socket_t(ctx, ZMQ_PUSH));
+		pushes.back()->connect(endpoint.c_str());
+		ASSERT_EQ(0, zmq_poller_add(poller, *pulls.back(),
+				reinterpret_cast<void *>(i), ZMQ_POLLIN));
+	}
+	for (int i = 0; i < SOCKET_COUNT; i += 7) {
+		pushes[i]->send("x", 1);
+	}
+	std::vector<zmq_poller_event_t> events(SOCKET_COUNT);
+	std::vector<bool> seen(SOCKET_COUNT);
+	int expected = (SOCKET_COUNT + 6) / 7;
+	for (int total = 0; total < expected;) {
+		int n = zmq_poller_wait_all(poller, &events[0], SOCKET_COUNT, 1000);
+		ASSERT_LT(0, n);
+		for (int j = 0; j < n; ++j) {
+			auto i = reinterpret_cast<intptr_t>(events[j].user_data);
+			ASSERT_EQ(0, i % 7);
+			zmq::message_t msg;
+			ASSERT_TRUE(pulls[i]->recv(&msg, ZMQ_DONTWAIT));
+			if (!seen[i]) {
+				seen[i] = true;
+				++total;
+			}
+		}
+	}
+	zmq_poller_event_t event;
+	EXPECT_EQ(-1, zmq_poller_wait(poller, &event, 0));
+	zmq_poller_destroy(&poller);
+}
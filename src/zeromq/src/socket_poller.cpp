@@ -0,0 +1,323 @@
+/*
+    Copyright (c) 2007-2012 iMatix Corporation
+    Copyright (c) 2009-2011 250bpm s.r.o.
+    Copyright (c) 2007-2012 Other contributors as noted in the AUTHORS file
+
+    This file is part of 0MQ.
+
+    0MQ is free software; you can redistribute it and/or modify it under
+    the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    0MQ is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "socket_poller.hpp"
+#if defined ZMQ_USE_EPOLL
+
+#include <sys/epoll.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+
+#include "socket_base.hpp"
+#include "clock.hpp"
+#include "err.hpp"
+#include "likely.hpp"
+
+zmq::socket_poller_t::socket_poller_t () :
+    tag (0xdecafbad),
+    ready (1)
+{
+    epoll_fd = epoll_create (1);
+    errno_assert (epoll_fd != -1);
+}
+
+zmq::socket_poller_t::~socket_poller_t ()
+{
+    //  Mark the poller as dead.
+    tag = 0xdeadbeef;
+
+    close (epoll_fd);
+    for (items_t::iterator it = items.begin (); it != items.end (); ++it)
+        delete *it;
+}
+
+bool zmq::socket_poller_t::check_tag ()
+{
+    return tag == 0xdecafbad;
+}
+
+int zmq::socket_poller_t::add (socket_base_t *socket_, void *user_data_,
+    short events_)
+{
+    if (find (socket_) != items.end ()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    //  The socket's fd doesn't change, so look it up once, here.
+    fd_t fd;
+    size_t fd_size = sizeof fd;
+    int rc = socket_->getsockopt (ZMQ_FD, &fd, &fd_size);
+    if (rc != 0)
+        return -1;
+
+    item_t *item = new (std::nothrow) item_t;
+    alloc_assert (item);
+    item->socket = socket_;
+    item->fd = fd;
+    item->user_data = user_data_;
+    item->events = events_;
+
+    if (watch (item, EPOLL_CTL_ADD) != 0) {
+        delete item;
+        return -1;
+    }
+    items.push_back (item);
+    ready.resize (items.size ());
+    return 0;
+}
+
+int zmq::socket_poller_t::modify (socket_base_t *socket_, short events_)
+{
+    items_t::iterator it = find (socket_);
+    if (it == items.end ()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    //  A socket's fd is watched for input whatever the events; it signals
+    //  changes to writability too.
+    (*it)->events = events_;
+    return 0;
+}
+
+int zmq::socket_poller_t::remove (socket_base_t *socket_)
+{
+    items_t::iterator it = find (socket_);
+    if (it == items.end ()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    //  The socket may already have been closed, taking its fd with it, so
+    //  there's no point complaining if epoll doesn't know the fd any more.
+    epoll_ctl (epoll_fd, EPOLL_CTL_DEL, (*it)->fd, NULL);
+    delete *it;
+    items.erase (it);
+    return 0;
+}
+
+int zmq::socket_poller_t::add_fd (fd_t fd_, void *user_data_, short events_)
+{
+    if (find_fd (fd_) != items.end ()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    item_t *item = new (std::nothrow) item_t;
+    alloc_assert (item);
+    item->socket = NULL;
+    item->fd = fd_;
+    item->user_data = user_data_;
+    item->events = events_;
+
+    if (watch (item, EPOLL_CTL_ADD) != 0) {
+        delete item;
+        return -1;
+    }
+    items.push_back (item);
+    ready.resize (items.size ());
+    return 0;
+}
+
+int zmq::socket_poller_t::modify_fd (fd_t fd_, short events_)
+{
+    items_t::iterator it = find_fd (fd_);
+    if (it == items.end ()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    short old_events = (*it)->events;
+    (*it)->events = events_;
+    if (watch (*it, EPOLL_CTL_MOD) != 0) {
+        (*it)->events = old_events;
+        return -1;
+    }
+    return 0;
+}
+
+int zmq::socket_poller_t::remove_fd (fd_t fd_)
+{
+    items_t::iterator it = find_fd (fd_);
+    if (it == items.end ()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    epoll_ctl (epoll_fd, EPOLL_CTL_DEL, fd_, NULL);
+    delete *it;
+    items.erase (it);
+    return 0;
+}
+
+int zmq::socket_poller_t::wait (event_t *events_, int n_events_,
+    long timeout_)
+{
+    if (unlikely (n_events_ <= 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!events_) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    zmq::clock_t clock;
+    uint64_t end = 0;
+    bool first_pass = true;
+
+    while (true) {
+
+        //  The first pass never blocks: a socket may have events pending
+        //  whose signal was swallowed by an earlier operation on it.
+        int timeout;
+        if (first_pass)
+            timeout = 0;
+        else
+        if (timeout_ < 0)
+            timeout = -1;
+        else {
+            uint64_t now = clock.now_ms ();
+            timeout = now < end ? (int) (end - now) : 0;
+        }
+
+        int rc = epoll_wait (epoll_fd, &ready [0], (int) ready.size (),
+            timeout);
+        if (rc == -1 && errno == EINTR)
+            return -1;
+        errno_assert (rc >= 0);
+
+        //  Raw file descriptors are reported as epoll saw them. For sockets,
+        //  a wakeup just means it's worth asking ZMQ_EVENTS again.
+        int found = 0;
+        for (int i = 0; i != rc && found != n_events_; i++) {
+            item_t *item = (item_t*) ready [i].data.ptr;
+            if (item->socket)
+                continue;
+            short revents = 0;
+            if ((item->events & ZMQ_POLLIN) && (ready [i].events & EPOLLIN))
+                revents |= ZMQ_POLLIN;
+            if ((item->events & ZMQ_POLLOUT) && (ready [i].events & EPOLLOUT))
+                revents |= ZMQ_POLLOUT;
+            if (ready [i].events & ~(EPOLLIN | EPOLLOUT))
+                revents |= ZMQ_POLLERR;
+            if (revents) {
+                events_ [found].socket = NULL;
+                events_ [found].fd = item->fd;
+                events_ [found].user_data = item->user_data;
+                events_ [found].events = revents;
+                found++;
+            }
+        }
+        found = check_sockets (events_, n_events_, found);
+        if (found != 0)
+            return found;
+
+        //  If timeout is zero, exit immediately whether there are events
+        //  or not.
+        if (timeout_ == 0)
+            break;
+
+        if (first_pass) {
+            if (timeout_ > 0)
+                end = clock.now_ms () + timeout_;
+            first_pass = false;
+            continue;
+        }
+
+        //  Woken up without anything to report (e.g. by a command that
+        //  changed no socket's events); carry on until the deadline.
+        if (timeout_ > 0 && clock.now_ms () >= end)
+            break;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+zmq::socket_poller_t::items_t::iterator zmq::socket_poller_t::find (
+    socket_base_t *socket_)
+{
+    items_t::iterator it = items.begin ();
+    while (it != items.end () && (*it)->socket != socket_)
+        ++it;
+    return it;
+}
+
+zmq::socket_poller_t::items_t::iterator zmq::socket_poller_t::find_fd (
+    fd_t fd_)
+{
+    items_t::iterator it = items.begin ();
+    while (it != items.end () && ((*it)->socket || (*it)->fd != fd_))
+        ++it;
+    return it;
+}
+
+int zmq::socket_poller_t::watch (item_t *item_, int op_)
+{
+    epoll_event ev;
+
+    //  The memset is not actually needed. It's here to prevent debugging
+    //  tools to complain about using uninitialised memory.
+    memset (&ev, 0, sizeof ev);
+
+    if (item_->socket)
+        ev.events = EPOLLIN;
+    else
+        ev.events = (item_->events & ZMQ_POLLIN ? EPOLLIN : 0) |
+            (item_->events & ZMQ_POLLOUT ? EPOLLOUT : 0);
+    ev.data.ptr = item_;
+    return epoll_ctl (epoll_fd, op_, item_->fd, &ev);
+}
+
+int zmq::socket_poller_t::check_sockets (event_t *events_, int n_events_,
+    int found_)
+{
+    for (items_t::iterator it = items.begin ();
+          it != items.end () && found_ != n_events_; ++it) {
+        item_t *item = *it;
+        if (!item->socket)
+            continue;
+
+        //  Asking for ZMQ_EVENTS also processes the socket's pending
+        //  commands, which drains its fd.
+        uint32_t zmq_events;
+        size_t zmq_events_size = sizeof zmq_events;
+        if (item->socket->getsockopt (ZMQ_EVENTS, &zmq_events,
+              &zmq_events_size) != 0)
+            continue;
+
+        short revents = item->events & (short) zmq_events &
+            (ZMQ_POLLIN | ZMQ_POLLOUT);
+        if (revents) {
+            events_ [found_].socket = item->socket;
+            events_ [found_].fd = 0;
+            events_ [found_].user_data = item->user_data;
+            events_ [found_].events = revents;
+            found_++;
+        }
+    }
+    return found_;
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+    Copyright (c) 2007-2012 iMatix Corporation
+    Copyright (c) 2009-2011 250bpm s.r.o.
+    Copyright (c) 2007-2012 Other contributors as noted in the AUTHORS file
+
+    This file is part of 0MQ.
+
+    0MQ is free software; you can redistribute it and/or modify it under
+    the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    0MQ is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ZMQ_SOCKET_POLLER_HPP_INCLUDED__
+#define __ZMQ_SOCKET_POLLER_HPP_INCLUDED__
+
+//  poller.hpp decides which polling mechanism to use.
+#include "poller.hpp"
+#if defined ZMQ_USE_EPOLL
+
+#include <vector>
+#include <sys/epoll.h>
+
+#include "../include/zmq.h"
+#include "fd.hpp"
+#include "stdint.hpp"
+
+namespace zmq
+{
+
+    class socket_base_t;
+
+    //  A poll set that lives across calls, unlike the one zmq_poll builds
+    //  and tears down every time. Sockets are watched through the ZMQ_FD
+    //  they're registered with, in an epoll set owned by the poller.
+    //
+    //  ZMQ_FD is edge-triggered, and any operation on a socket may swallow
+    //  its signal, so an epoll wakeup is only a hint. Socket readiness is
+    //  always taken from ZMQ_EVENTS, which wait checks before blocking as
+    //  well as after waking up. Raw file descriptors are level-triggered
+    //  and reported exactly as epoll sees them.
+    //
+    //  Not thread safe; use a poller only from the thread that owns the
+    //  sockets in it.
+
+    class socket_poller_t
+    {
+    public:
+
+        socket_poller_t ();
+        ~socket_poller_t ();
+
+        typedef zmq_poller_event_t event_t;
+
+        bool check_tag ();
+
+        int add (socket_base_t *socket_, void *user_data_, short events_);
+        int modify (socket_base_t *socket_, short events_);
+        int remove (socket_base_t *socket_);
+
+        int add_fd (fd_t fd_, void *user_data_, short events_);
+        int modify_fd (fd_t fd_, short events_);
+        int remove_fd (fd_t fd_);
+
+        //  Fills in up to n_events_ events and returns how many there were,
+        //  or -1 with errno set to EAGAIN if timeout_ (in milliseconds)
+        //  expired first.
+        int wait (event_t *events_, int n_events_, long timeout_);
+
+    private:
+
+        struct item_t
+        {
+            socket_base_t *socket;
+            fd_t fd;
+            void *user_data;
+            short events;
+        };
+
+        typedef std::vector <item_t*> items_t;
+
+        items_t::iterator find (socket_base_t *socket_);
+        items_t::iterator find_fd (fd_t fd_);
+        int watch (item_t *item_, int op_);
+
+        //  Adds socket items with pending events to events_, starting at
+        //  index found_; returns the new count.
+        int check_sockets (event_t *events_, int n_events_, int found_);
+
+        //  Used to check whether the object is a poller.
+        uint32_t tag;
+
+        fd_t epoll_fd;
+        items_t items;
+
+        //  Buffer for epoll_wait, kept as large as the poll set.
+        std::vector <epoll_event> ready;
+
+        socket_poller_t (const socket_poller_t&);
+        const socket_poller_t &operator = (const socket_poller_t&);
+    };
+
+}
+
+#endif
+
+#endif
@@ -80,6 +80,7 @@ struct iovec {
 #include "err.hpp"
 #include "msg.hpp"
 #include "fd.hpp"
+#include "socket_poller.hpp"
 
 #if !defined ZMQ_HAVE_WINDOWS
 #include <unistd.h>
@@ -964,6 +965,181 @@ int zmq_poll (zmq_pollitem_t *items_, int nitems_, long timeout_)
 #undef ZMQ_POLL_BASED_ON_POLL
 #endif
 
+//  Persistent polling.
+
+#if defined ZMQ_USE_EPOLL
+
+static zmq::socket_poller_t *as_poller (void *poller_)
+{
+    if (!poller_ || !((zmq::socket_poller_t*) poller_)->check_tag ()) {
+        errno = EFAULT;
+        return NULL;
+    }
+    return (zmq::socket_poller_t*) poller_;
+}
+
+static zmq::socket_base_t *as_socket (void *s_)
+{
+    if (!s_ || !((zmq::socket_base_t*) s_)->check_tag ()) {
+        errno = ENOTSOCK;
+        return NULL;
+    }
+    return (zmq::socket_base_t*) s_;
+}
+
+void *zmq_poller_new (void)
+{
+    zmq::socket_poller_t *poller = new (std::nothrow) zmq::socket_poller_t;
+    alloc_assert (poller);
+    return poller;
+}
+
+int zmq_poller_destroy (void **poller_p_)
+{
+    if (!poller_p_) {
+        errno = EFAULT;
+        return -1;
+    }
+    zmq::socket_poller_t *poller = as_poller (*poller_p_);
+    if (!poller)
+        return -1;
+    delete poller;
+    *poller_p_ = NULL;
+    return 0;
+}
+
+int zmq_poller_add (void *poller_, void *s_, void *user_data_, short events_)
+{
+    zmq::socket_poller_t *poller = as_poller (poller_);
+    zmq::socket_base_t *s = poller ? as_socket (s_) : NULL;
+    if (!s)
+        return -1;
+    return poller->add (s, user_data_, events_);
+}
+
+int zmq_poller_modify (void *poller_, void *s_, short events_)
+{
+    zmq::socket_poller_t *poller = as_poller (poller_);
+    zmq::socket_base_t *s = poller ? as_socket (s_) : NULL;
+    if (!s)
+        return -1;
+    return poller->modify (s, events_);
+}
+
+int zmq_poller_remove (void *poller_, void *s_)
+{
+    //  The socket may have been closed already; all we need is its address.
+    zmq::socket_poller_t *poller = as_poller (poller_);
+    if (!poller)
+        return -1;
+    return poller->remove ((zmq::socket_base_t*) s_);
+}
+
+int zmq_poller_add_fd (void *poller_, int fd_, void *user_data_,
+    short events_)
+{
+    zmq::socket_poller_t *poller = as_poller (poller_);
+    if (!poller)
+        return -1;
+    return poller->add_fd (fd_, user_data_, events_);
+}
+
+int zmq_poller_modify_fd (void *poller_, int fd_, short events_)
+{
+    zmq::socket_poller_t *poller = as_poller (poller_);
+    if (!poller)
+        return -1;
+    return poller->modify_fd (fd_, events_);
+}
+
+int zmq_poller_remove_fd (void *poller_, int fd_)
+{
+    zmq::socket_poller_t *poller = as_poller (poller_);
+    if (!poller)
+        return -1;
+    return poller->remove_fd (fd_);
+}
+
+int zmq_poller_wait (void *poller_, zmq_poller_event_t *event_, long timeout_)
+{
+    return zmq_poller_wait_all (poller_, event_, 1, timeout_);
+}
+
+int zmq_poller_wait_all (void *poller_, zmq_poller_event_t *events_,
+    int n_events_, long timeout_)
+{
+    zmq::socket_poller_t *poller = as_poller (poller_);
+    if (!poller)
+        return -1;
+    return poller->wait (events_, n_events_, timeout_);
+}
+
+#else
+
+//  Exotic platforms get zmq_poll only.
+
+void *zmq_poller_new (void)
+{
+    errno = ENOTSUP;
+    return NULL;
+}
+
+int zmq_poller_destroy (void **)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_add (void *, void *, void *, short)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_modify (void *, void *, short)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_remove (void *, void *)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_add_fd (void *, zmq::fd_t, void *, short)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_modify_fd (void *, zmq::fd_t, short)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_remove_fd (void *, zmq::fd_t)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_wait (void *, zmq_poller_event_t *, long)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int zmq_poller_wait_all (void *, zmq_poller_event_t *, int, long)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
+
 //  The proxy functionality
 
 int zmq_proxy (void *frontend_, void *backend_, void *control_)